@@ -78,8 +78,10 @@ public class LibMbPatcher {
         static native /* ErrorCode */ int mbpatcher_config_error(CPatcherConfig pc);
         static native Pointer mbpatcher_config_data_directory(CPatcherConfig pc);
         static native Pointer mbpatcher_config_temp_directory(CPatcherConfig pc);
+        static native Pointer mbpatcher_config_cache_directory(CPatcherConfig pc);
         static native void mbpatcher_config_set_data_directory(CPatcherConfig pc, String path);
         static native void mbpatcher_config_set_temp_directory(CPatcherConfig pc, String path);
+        static native void mbpatcher_config_set_cache_directory(CPatcherConfig pc, String path);
         static native Pointer mbpatcher_config_patchers(CPatcherConfig pc);
         static native Pointer mbpatcher_config_autopatchers(CPatcherConfig pc);
         static native CPatcher mbpatcher_config_create_patcher(CPatcherConfig pc, String id);
@@ -437,6 +439,12 @@ public class LibMbPatcher {
             return LibC.getStringAndFree(p);
         }
 
+        public String getCacheDirectory() {
+            validate(mCPatcherConfig, PatcherConfig.class, "getCacheDirectory");
+            Pointer p = CWrapper.mbpatcher_config_cache_directory(mCPatcherConfig);
+            return LibC.getStringAndFree(p);
+        }
+
         public void setDataDirectory(String path) {
             validate(mCPatcherConfig, PatcherConfig.class, "setDataDirectory", path);
             ensureNotNull(path);
@@ -451,6 +459,13 @@ public class LibMbPatcher {
             CWrapper.mbpatcher_config_set_temp_directory(mCPatcherConfig, path);
         }
 
+        public void setCacheDirectory(String path) {
+            validate(mCPatcherConfig, PatcherConfig.class, "setCacheDirectory", path);
+            ensureNotNull(path);
+
+            CWrapper.mbpatcher_config_set_cache_directory(mCPatcherConfig, path);
+        }
+
         public String[] getPatchers() {
             validate(mCPatcherConfig, PatcherConfig.class, "getPatchers");
             Pointer p = CWrapper.mbpatcher_config_patchers(mCPatcherConfig);
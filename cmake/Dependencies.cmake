@@ -56,7 +56,9 @@ elseif(${MBP_BUILD_TARGET} STREQUAL android-system)
     set(CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_FIND_LIBRARY_SUFFIXES_OLD})
     unset(CMAKE_FIND_LIBRARY_SUFFIXES_OLD)
 elseif(${MBP_BUILD_TARGET} STREQUAL hosttools)
+    include(cmake/dependencies/libpng.cmake)
     include(cmake/dependencies/yaml-cpp.cmake)
+    include(cmake/dependencies/zlib.cmake)
 endif()
 
 # Needed for every target
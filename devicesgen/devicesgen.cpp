@@ -25,9 +25,11 @@
 
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 #include <yaml-cpp/yaml.h>
 
+#include "mbdevice/database.h"
 #include "mbdevice/json.h"
 #include "mbdevice/schema.h"
 
@@ -165,6 +167,53 @@ static bool validate_and_write(Document &d, const SchemaDocument &sd,
     return true;
 }
 
+static bool write_database(const Document &d, const char *path)
+{
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+
+    if (!d.Accept(writer)) {
+        fprintf(stderr, "Failed to write JSON\n");
+        return false;
+    }
+
+    std::vector<Device> devices;
+    JsonError error;
+
+    if (!device_list_from_json(sb.GetString(), devices, error)) {
+        fprintf(stderr, "Failed to load devices from generated JSON\n");
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+
+    if (!device_list_to_database(devices, data)) {
+        fprintf(stderr, "Failed to build device database\n");
+        return false;
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    bool ret = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to write file: %s\n",
+                path, strerror(errno));
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                path, strerror(errno));
+        ret = false;
+    }
+
+    return ret;
+}
+
 static void usage(FILE *stream)
 {
     fprintf(stream,
@@ -173,6 +222,8 @@ static void usage(FILE *stream)
             "Options:\n"
             "  -o, --output <file>\n"
             "                   Output file (outputs to stdout if omitted)\n"
+            "  -b, --database <file>\n"
+            "                   Also write binary device database to file\n"
             "  -h, --help       Display this help message\n"
             "  --styled         Output in human-readable format\n");
 }
@@ -185,11 +236,12 @@ int main(int argc, char *argv[])
         OPT_STYLED             = 1000,
     };
 
-    static const char short_options[] = "o:h";
+    static const char short_options[] = "o:b:h";
 
     static struct option long_options[] = {
         {"styled", no_argument, 0, OPT_STYLED},
         {"output", required_argument, 0, 'o'},
+        {"database", required_argument, 0, 'b'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -197,6 +249,7 @@ int main(int argc, char *argv[])
     int long_index = 0;
 
     const char *output_file = nullptr;
+    const char *database_file = nullptr;
     bool styled = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
@@ -210,6 +263,10 @@ int main(int argc, char *argv[])
             output_file = optarg;
             break;
 
+        case 'b':
+            database_file = optarg;
+            break;
+
         case 'h':
             usage(stdout);
             return EXIT_SUCCESS;
@@ -265,5 +322,9 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (ret && database_file) {
+        ret = write_database(d, database_file);
+    }
+
     return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
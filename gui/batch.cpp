@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batch.h"
+#include "patchutils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <mbpatcher/patchqueue.h>
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+
+
+struct BatchContext
+{
+    mb::patcher::PatchQueue *queue;
+    QStringList inputs;
+    QStringList outputs;
+};
+
+static void batchJobUpdatedCb(size_t index, mb::patcher::PatchJobState state,
+                              void *userData)
+{
+    auto *ctx = static_cast<BatchContext *>(userData);
+    QByteArray input = ctx->inputs[index].toUtf8();
+    int total = ctx->inputs.size();
+
+    switch (state) {
+    case mb::patcher::PatchJobState::Running:
+        printf("[%zu/%d] Patching %s\n", index + 1, total, input.constData());
+        break;
+    case mb::patcher::PatchJobState::Succeeded:
+        printf("[%zu/%d] Created %s\n", index + 1, total,
+               ctx->outputs[index].toUtf8().constData());
+        break;
+    case mb::patcher::PatchJobState::Failed:
+        fprintf(stderr, "[%zu/%d] %s: %s\n", index + 1, total,
+                input.constData(), errorToString(
+                        ctx->queue->job_error(index)).toUtf8().constData());
+        break;
+    case mb::patcher::PatchJobState::Cancelled:
+        fprintf(stderr, "[%zu/%d] %s: Cancelled\n", index + 1, total,
+                input.constData());
+        break;
+    default:
+        break;
+    }
+
+    fflush(stdout);
+}
+
+bool isBatchMode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Patches files without showing any windows. Example:
+ *
+ *   DualBootPatcher --batch --device hammerhead --rom-id dual --jobs 4 *.zip
+ *
+ * The exit status is 0 only if every file was patched successfully.
+ */
+int runBatch(mb::patcher::PatcherConfig *pc)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate(
+            "batch", "Patch multiple files without showing the GUI"));
+    parser.addHelpOption();
+
+    QCommandLineOption batchOption(QStringLiteral("batch"),
+            QCoreApplication::translate("batch", "Run in batch mode"));
+    QCommandLineOption deviceOption(QStringLiteral("device"),
+            QCoreApplication::translate("batch", "Target device ID"),
+            QStringLiteral("id"));
+    QCommandLineOption romIdOption(QStringLiteral("rom-id"),
+            QCoreApplication::translate("batch", "Installation location ID"),
+            QStringLiteral("id"));
+    QCommandLineOption patcherOption(QStringLiteral("patcher"),
+            QCoreApplication::translate("batch", "Patcher ID"),
+            QStringLiteral("id"), QStringLiteral("ZipPatcher"));
+    QCommandLineOption jobsOption(QStringLiteral("jobs"),
+            QCoreApplication::translate(
+                    "batch", "Number of files to patch in parallel"),
+            QStringLiteral("n"), QStringLiteral("0"));
+    QCommandLineOption diskJobsOption(QStringLiteral("jobs-per-disk"),
+            QCoreApplication::translate(
+                    "batch", "Number of jobs writing to the same disk"),
+            QStringLiteral("n"), QStringLiteral("2"));
+    QCommandLineOption cacheDirOption(QStringLiteral("cache-dir"),
+            QCoreApplication::translate(
+                    "batch", "Reuse outputs of previous runs stored in <dir>"),
+            QStringLiteral("dir"));
+
+    parser.addOption(batchOption);
+    parser.addOption(deviceOption);
+    parser.addOption(romIdOption);
+    parser.addOption(patcherOption);
+    parser.addOption(jobsOption);
+    parser.addOption(diskJobsOption);
+    parser.addOption(cacheDirOption);
+    parser.addPositionalArgument(QStringLiteral("files"),
+            QCoreApplication::translate("batch", "Files to patch"),
+            QStringLiteral("<file>..."));
+
+    parser.process(*QCoreApplication::instance());
+
+    const QStringList files = parser.positionalArguments();
+    QString deviceId = parser.value(deviceOption);
+    QString romId = parser.value(romIdOption);
+
+    if (files.isEmpty() || deviceId.isEmpty() || romId.isEmpty()) {
+        fprintf(stderr, "%s\n", parser.helpText().toUtf8().constData());
+        return EXIT_FAILURE;
+    }
+
+    bool ok;
+    unsigned int jobs = parser.value(jobsOption).toUInt(&ok);
+    if (!ok) {
+        fprintf(stderr, "Invalid number of jobs: %s\n",
+                parser.value(jobsOption).toUtf8().constData());
+        return EXIT_FAILURE;
+    }
+    unsigned int diskJobs = parser.value(diskJobsOption).toUInt(&ok);
+    if (!ok) {
+        fprintf(stderr, "Invalid number of jobs per disk: %s\n",
+                parser.value(diskJobsOption).toUtf8().constData());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<mb::device::Device> devices;
+    if (!loadDevices(QString::fromStdString(pc->data_directory()), devices)) {
+        return EXIT_FAILURE;
+    }
+
+    const mb::device::Device *device = nullptr;
+    for (auto const &d : devices) {
+        if (d.id() == deviceId.toStdString()) {
+            device = &d;
+            break;
+        }
+    }
+    if (!device) {
+        fprintf(stderr, "Unknown device: %s\n", deviceId.toUtf8().constData());
+        return EXIT_FAILURE;
+    }
+
+    if (parser.isSet(cacheDirOption)) {
+        pc->set_cache_directory(QDir::toNativeSeparators(QFileInfo(
+                parser.value(cacheDirOption)).absoluteFilePath())
+                        .toUtf8().constData());
+    }
+
+    mb::patcher::PatchQueue queue(pc);
+    queue.set_max_jobs(jobs);
+    queue.set_max_jobs_per_disk(diskJobs);
+
+    BatchContext ctx;
+    ctx.queue = &queue;
+
+    for (const QString &file : files) {
+        QString inputPath(QDir::toNativeSeparators(
+                QFileInfo(file).absoluteFilePath()));
+        QString outputPath(outputPathForInput(inputPath, romId));
+
+        mb::patcher::FileInfo fileInfo;
+        fileInfo.set_input_path(inputPath.toUtf8().constData());
+        fileInfo.set_output_path(outputPath.toUtf8().constData());
+        fileInfo.set_device(*device);
+        fileInfo.set_rom_id(romId.toUtf8().constData());
+
+        queue.add_job(parser.value(patcherOption).toStdString(), fileInfo);
+
+        ctx.inputs << inputPath;
+        ctx.outputs << outputPath;
+    }
+
+    bool ret = queue.run(&batchJobUpdatedCb, nullptr, nullptr, &ctx);
+
+    int succeeded = 0;
+    for (size_t i = 0; i < queue.job_count(); ++i) {
+        if (queue.job_state(i) == mb::patcher::PatchJobState::Succeeded) {
+            ++succeeded;
+        }
+    }
+
+    printf("Patched %d of %d files\n", succeeded, files.size());
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -17,8 +17,10 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "batch.h"
 #include "mainwindow.h"
 
+#include <QtCore/QCoreApplication>
 #include <QtCore/QStringBuilder>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QMessageBox>
@@ -32,6 +34,18 @@
 
 int main(int argc, char *argv[])
 {
+    // Batch mode does not need a display
+    if (isBatchMode(argc, argv)) {
+        QCoreApplication a(argc, argv);
+
+        a.setApplicationName(QObject::tr("Dual Boot Patcher"));
+
+        mb::patcher::PatcherConfig pc;
+        pc.set_data_directory(a.applicationDirPath().toStdString() + "/" + DATA_DIR);
+
+        return runBatch(&pc);
+    }
+
     QApplication a(argc, argv);
 
     a.setApplicationName(QObject::tr("Dual Boot Patcher"));
@@ -19,10 +19,8 @@
 
 #include "mainwindow.h"
 #include "mainwindow_p.h"
+#include "patchutils.h"
 
-#include <cassert>
-
-#include <mbdevice/json.h>
 #include <mbpatcher/errors.h>
 
 #include <QtCore/QStringBuilder>
@@ -31,12 +29,18 @@
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QGridLayout>
 #include <QtWidgets/QGroupBox>
+#include <QtWidgets/QHeaderView>
 
 
-const int patcherPtrTypeId = qRegisterMetaType<PatcherPtr>("PatcherPtr");
-const int fileInfoPtrTypeId = qRegisterMetaType<FileInfoPtr>("FileInfoPtr");
+const int patchQueuePtrTypeId = qRegisterMetaType<PatchQueuePtr>("PatchQueuePtr");
 const int uint64TypeId = qRegisterMetaType<uint64_t>("uint64_t");
 
+// Columns of the queue view
+enum QueueColumn {
+    QueueColumnFile = 0,
+    QueueColumnStatus = 1,
+};
+
 MainWindowPrivate::MainWindowPrivate()
     : settings(qApp->applicationDirPath() % QStringLiteral("/settings.ini"),
                QSettings::IniFormat)
@@ -54,10 +58,10 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
     // If we're passed an argument, switch to automatic mode
     if (qApp->arguments().size() > 2) {
         d->autoMode = true;
-        d->fileName = qApp->arguments().at(1);
+        d->fileNames = QStringList(qApp->arguments().at(1));
     } else {
         d->autoMode = false;
-        d->fileName.clear();
+        d->fileNames.clear();
     }
 
     d->pc = pc;
@@ -88,10 +92,10 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
             d->task, &PatcherTask::patch);
     connect(d->task, &PatcherTask::finished,
             this, &MainWindow::onPatchingFinished);
+    connect(d->task, &PatcherTask::jobUpdated,
+            this, &MainWindow::onJobUpdated);
     connect(d->task, &PatcherTask::progressUpdated,
             this, &MainWindow::onProgressUpdated);
-    connect(d->task, &PatcherTask::filesUpdated,
-            this, &MainWindow::onFilesUpdated);
     connect(d->task, &PatcherTask::detailsUpdated,
             this, &MainWindow::onDetailsUpdated);
 
@@ -102,16 +106,16 @@ MainWindow::~MainWindow()
 {
     Q_D(MainWindow);
 
-    if (d->patcher) {
-        d->patcher->cancel_patching();
-        d->pc->destroy_patcher(d->patcher);
-        d->patcher = nullptr;
+    if (d->queue) {
+        d->queue->cancel();
     }
 
     if (d->thread != nullptr) {
         d->thread->quit();
         d->thread->wait();
     }
+
+    delete d->queue;
 }
 
 void MainWindow::onDeviceSelected(int index)
@@ -204,13 +208,51 @@ void MainWindow::onChooseFileItemClicked(QAction *action)
 
     if (action == d->chooseFlashableZip) {
         d->patcherId = QStringLiteral("ZipPatcher");
-        chooseFile(tr("Flashable zips (*.zip)"));
+        chooseFiles(tr("Flashable zips (*.zip)"));
     } else if (action == d->chooseOdinImage) {
         d->patcherId = QStringLiteral("OdinPatcher");
-        chooseFile(tr("Odin images (*.zip *.tar.md5 *.tar.md5.gz *.tar.md5.xz)"));
+        chooseFiles(tr("Odin images (*.zip *.tar.md5 *.tar.md5.gz *.tar.md5.xz)"));
     }
 }
 
+void MainWindow::onJobUpdated(int index, int state)
+{
+    Q_D(MainWindow);
+
+    QTreeWidgetItem *item = d->queueView->topLevelItem(index);
+    if (!item) {
+        return;
+    }
+
+    QString status;
+
+    switch (static_cast<mb::patcher::PatchJobState>(state)) {
+    case mb::patcher::PatchJobState::Pending:
+        status = tr("Waiting");
+        break;
+    case mb::patcher::PatchJobState::Running:
+        status = tr("Patching");
+        d->queueView->scrollToItem(item);
+        break;
+    case mb::patcher::PatchJobState::Succeeded:
+        status = tr("Done");
+        ++d->files;
+        break;
+    case mb::patcher::PatchJobState::Failed:
+        status = errorToString(d->queue->job_error(index));
+        ++d->files;
+        break;
+    case mb::patcher::PatchJobState::Cancelled:
+        status = tr("Cancelled");
+        ++d->files;
+        break;
+    }
+
+    item->setText(QueueColumnStatus, status);
+
+    updateProgressText();
+}
+
 void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
 {
     Q_D(MainWindow);
@@ -236,34 +278,22 @@ void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
     updateProgressText();
 }
 
-void MainWindow::onFilesUpdated(uint64_t files, uint64_t maxFiles)
+void MainWindow::onDetailsUpdated(int index, const QString &text)
 {
     Q_D(MainWindow);
 
-    d->files = files;
-    d->maxFiles = maxFiles;
-
-    updateProgressText();
-}
-
-void MainWindow::onDetailsUpdated(const QString &text)
-{
-    Q_D(MainWindow);
-
-    d->detailsLbl->setText(text);
+    QTreeWidgetItem *item = d->queueView->topLevelItem(index);
+    if (item) {
+        d->detailsLbl->setText(QStringLiteral("%1: %2")
+                .arg(item->text(QueueColumnFile)).arg(text));
+    }
 }
 
-void MainWindow::onPatchingFinished(const QString &newFile, bool failed,
-                                    const QString &errorMessage)
+void MainWindow::onPatchingFinished(bool failed)
 {
     Q_D(MainWindow);
 
-    d->pc->destroy_patcher(d->patcher);
-    d->patcher = nullptr;
-
-    d->patcherNewFile = newFile;
     d->patcherFailed = failed;
-    d->patcherError = errorMessage;
 
     d->state = MainWindowPrivate::FinishedPatching;
     updateWidgetsVisibility();
@@ -298,6 +328,14 @@ void MainWindow::addWidgets()
     // Labels
     d->deviceLbl = new QLabel(tr("Device:"), d->mainContainer);
     d->instLocLbl = new QLabel(tr("Install to:"), d->mainContainer);
+    d->jobsLbl = new QLabel(tr("Parallel jobs:"), d->mainContainer);
+
+    // Number of files to patch at the same time (0 = number of CPUs)
+    d->jobsSpin = new QSpinBox(d->mainContainer);
+    d->jobsSpin->setRange(0, 64);
+    d->jobsSpin->setSpecialValueText(tr("Automatic"));
+    d->jobsSpin->setValue(d->settings.value(
+            QStringLiteral("max_jobs"), 0).toInt());
 
     // Text boxes
     d->instLocLe = new QLineEdit(d->mainContainer);
@@ -314,6 +352,8 @@ void MainWindow::addWidgets()
     layout->addWidget(d->instLocSel, i, 1, 1, -1);
     layout->addWidget(d->instLocLe, ++i, 1, 1, -1);
     layout->addWidget(d->instLocDesc, ++i, 1, 1, -1);
+    layout->addWidget(d->jobsLbl, ++i, 0);
+    layout->addWidget(d->jobsSpin, i, 1);
 
     d->messageLbl = new QLabel(d->mainContainer);
     // Don't allow the window to grow too big
@@ -324,9 +364,9 @@ void MainWindow::addWidgets()
     d->chooseFlashableZip = d->chooseFileMenu->addAction(tr("Flashable zip"));
     d->chooseOdinImage = d->chooseFileMenu->addAction(tr("Odin image"));
 
-    d->chooseFileBtn = new QPushButton(tr("Choose file"), d->mainContainer);
+    d->chooseFileBtn = new QPushButton(tr("Choose files"), d->mainContainer);
     d->chooseFileBtn->setMenu(d->chooseFileMenu);
-    d->chooseAnotherFileBtn = new QPushButton(tr("Choose another file"), d->mainContainer);
+    d->chooseAnotherFileBtn = new QPushButton(tr("Choose other files"), d->mainContainer);
     d->chooseAnotherFileBtn->setMenu(d->chooseFileMenu);
     d->startPatchingBtn = new QPushButton(tr("Start patching"), d->mainContainer);
 
@@ -361,6 +401,18 @@ void MainWindow::addWidgets()
     QBoxLayout *progressLayout = new QVBoxLayout(d->progressContainer);
     progressLayout->setContentsMargins(0, 0, 0, 0);
 
+    d->queueView = new QTreeWidget(d->progressContainer);
+    d->queueView->setRootIsDecorated(false);
+    d->queueView->setSelectionMode(QAbstractItemView::NoSelection);
+    d->queueView->setHeaderLabels(QStringList()
+            << tr("File") << tr("Status"));
+    d->queueView->header()->setStretchLastSection(false);
+    d->queueView->header()->setSectionResizeMode(
+            QueueColumnFile, QHeaderView::Stretch);
+    d->queueView->header()->setSectionResizeMode(
+            QueueColumnStatus, QHeaderView::ResizeToContents);
+    d->queueView->setFixedWidth(500);
+
     QGroupBox *detailsBox = new QGroupBox(d->progressContainer);
     detailsBox->setTitle(tr("Details"));
 
@@ -379,6 +431,7 @@ void MainWindow::addWidgets()
     d->progressBar->setMinimum(0);
     d->progressBar->setValue(0);
 
+    progressLayout->addWidget(d->queueView);
     progressLayout->addWidget(detailsBox);
     //progressLayout->addStretch(1);
     progressLayout->addWidget(newHorizLine(d->progressContainer));
@@ -424,35 +477,12 @@ void MainWindow::populateDevices()
     Q_D(MainWindow);
 
     // TODO: This shouldn't be done in the GUI thread
-    QString path(QString::fromStdString(d->pc->data_directory())
-            % QStringLiteral("/devices.json"));
-    QFile file(path);
-
-    if (file.open(QIODevice::ReadOnly)) {
-        QByteArray contents = file.readAll();
-        file.close();
-        contents.push_back('\0');
-
-        std::vector<mb::device::Device> devices;
-        mb::device::JsonError error;
-
-        if (mb::device::device_list_from_json(contents.data(), devices, error)) {
-            for (auto &device : devices) {
-                if (device.validate() == 0) {
-                    d->deviceSel->addItem(QStringLiteral("%1 - %2")
-                            .arg(QString::fromStdString(device.id()))
-                            .arg(QString::fromStdString(device.name())));
-                    d->devices.push_back(std::move(device));
-                } else {
-                    qWarning("Failed validation on a device");
-                }
-            }
-        } else {
-            qWarning("Failed to load devices");
-        }
-    } else {
-        qWarning("%s: Failed to open file: %s",
-                 path.toUtf8().data(), file.errorString().toUtf8().data());
+    loadDevices(QString::fromStdString(d->pc->data_directory()), d->devices);
+
+    for (auto const &device : d->devices) {
+        d->deviceSel->addItem(QStringLiteral("%1 - %2")
+                .arg(QString::fromStdString(device.id()))
+                .arg(QString::fromStdString(device.name())));
     }
 }
 
@@ -494,23 +524,23 @@ void MainWindow::populateInstallationLocations()
     d->instLocSel->addItem(tr("Extsd-slot"));
 }
 
-void MainWindow::chooseFile(const QString &patterns)
+void MainWindow::chooseFiles(const QString &patterns)
 {
     Q_D(MainWindow);
 
-    QString fileName = QFileDialog::getOpenFileName(this, QString(),
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, QString(),
             d->settings.value(QStringLiteral("last_dir")).toString(),
             patterns);
-    if (fileName.isNull()) {
+    if (fileNames.isEmpty()) {
         return;
     }
 
     d->settings.setValue(QStringLiteral("last_dir"),
-                         QFileInfo(fileName).dir().absolutePath());
+                         QFileInfo(fileNames.first()).dir().absolutePath());
 
     d->state = MainWindowPrivate::ChoseFile;
 
-    d->fileName = fileName;
+    d->fileNames = fileNames;
 
     updateWidgetsVisibility();
 }
@@ -537,16 +567,42 @@ void MainWindow::updateWidgetsVisibility()
     }
 
     if (d->state == MainWindowPrivate::ChoseFile) {
-        d->messageLbl->setText(tr("File: %1").arg(d->fileName));
+        if (d->fileNames.size() == 1) {
+            d->messageLbl->setText(tr("File: %1").arg(d->fileNames.first()));
+        } else {
+            d->messageLbl->setText(tr("Files: %1")
+                    .arg(d->fileNames.join(QStringLiteral("\n"))));
+        }
     } else if (d->state == MainWindowPrivate::FinishedPatching) {
         QString message;
+        int succeeded = 0;
+
+        for (size_t i = 0; i < d->queue->job_count(); ++i) {
+            QTreeWidgetItem *item = d->queueView->topLevelItem(i);
+
+            switch (d->queue->job_state(i)) {
+            case mb::patcher::PatchJobState::Succeeded:
+                message.append(tr("New file: %1\n")
+                        .arg(item->toolTip(QueueColumnFile)));
+                ++succeeded;
+                break;
+            default:
+                message.append(tr("Failed to patch file: %1 (%2)\n")
+                        .arg(item->text(QueueColumnFile))
+                        .arg(item->text(QueueColumnStatus)));
+                break;
+            }
+        }
+
+        message.append(QStringLiteral("\n"));
 
         if (d->patcherFailed) {
-            message.append(tr("Failed to patch file: %1\n\n").arg(d->fileName));
-            message.append(d->patcherError);
-        } else {
-            message.append(tr("New file: %1\n\n").arg(d->patcherNewFile));
+            message.append(tr("Patched %1 of %2 files")
+                    .arg(succeeded).arg(d->queue->job_count()));
+        } else if (succeeded == 1) {
             message.append(tr("Successfully patched file"));
+        } else {
+            message.append(tr("Successfully patched %1 files").arg(succeeded));
         }
 
         d->messageLbl->setText(message);
@@ -560,11 +616,14 @@ void MainWindow::startPatching()
     d->bytes = 0;
     d->maxBytes = 0;
     d->files = 0;
-    d->maxFiles = 0;
+    d->maxFiles = d->fileNames.size();
 
     d->progressBar->setMaximum(0);
     d->progressBar->setValue(0);
     d->detailsLbl->clear();
+    d->queueView->clear();
+
+    d->settings.setValue(QStringLiteral("max_jobs"), d->jobsSpin->value());
 
     d->state = MainWindowPrivate::Patching;
     updateWidgetsVisibility();
@@ -578,49 +637,31 @@ void MainWindow::startPatching()
         romId = d->instLocs[d->instLocSel->currentIndex()].id;
     }
 
+    delete d->queue;
+    d->queue = new mb::patcher::PatchQueue(d->pc);
+    d->queue->set_max_jobs(d->jobsSpin->value());
 
-    QStringList suffixes;
-    suffixes << QStringLiteral(".tar.md5");
-    suffixes << QStringLiteral(".tar.md5.gz");
-    suffixes << QStringLiteral(".tar.md5.xz");
-    suffixes << QStringLiteral(".zip");
-
-    QFileInfo qFileInfo(d->fileName);
-    QString suffix;
-    QString outputName;
-
-    for (const QString &suffix : suffixes) {
-        if (d->fileName.endsWith(suffix)) {
-            // Input name: <parent path>/<base name>.<suffix>
-            // Output name: <parent path>/<base name>_<rom id>.zip
-            outputName = d->fileName.left(d->fileName.size() - suffix.size())
-                    % QStringLiteral("_")
-                    % romId
-                    % QStringLiteral(".zip");
-            break;
-        }
-    }
-    if (outputName.isEmpty()) {
-        outputName = qFileInfo.completeBaseName()
-                % QStringLiteral("_")
-                % romId
-                % QStringLiteral(".")
-                % qFileInfo.suffix();
-    }
+    for (const QString &fileName : d->fileNames) {
+        QString inputPath(QDir::toNativeSeparators(fileName));
+        QString outputPath(outputPathForInput(fileName, romId));
+
+        mb::patcher::FileInfo fileInfo;
+        fileInfo.set_input_path(inputPath.toUtf8().constData());
+        fileInfo.set_output_path(outputPath.toUtf8().constData());
+        fileInfo.set_device(*d->device);
+        fileInfo.set_rom_id(romId.toUtf8().constData());
 
-    QString inputPath(QDir::toNativeSeparators(qFileInfo.filePath()));
-    QString outputPath(QDir::toNativeSeparators(
-            qFileInfo.dir().filePath(outputName)));
+        d->queue->add_job(d->patcherId.toStdString(), fileInfo);
 
-    FileInfoPtr fileInfo = new mb::patcher::FileInfo();
-    fileInfo->set_input_path(inputPath.toUtf8().constData());
-    fileInfo->set_output_path(outputPath.toUtf8().constData());
-    fileInfo->set_device(*d->device);
-    fileInfo->set_rom_id(romId.toUtf8().constData());
+        QTreeWidgetItem *item = new QTreeWidgetItem(d->queueView);
+        item->setText(QueueColumnFile, QFileInfo(fileName).fileName());
+        item->setText(QueueColumnStatus, tr("Waiting"));
+        item->setToolTip(QueueColumnFile, outputPath);
+    }
 
-    d->patcher = d->pc->create_patcher(d->patcherId.toStdString());
+    updateProgressText();
 
-    emit runThread(d->patcher, fileInfo);
+    emit runThread(d->queue);
 }
 
 QWidget * MainWindow::newHorizLine(QWidget *parent)
@@ -633,111 +674,54 @@ QWidget * MainWindow::newHorizLine(QWidget *parent)
 }
 
 
-static QString errorToString(const mb::patcher::ErrorCode &error) {
-    switch (error) {
-    case mb::patcher::ErrorCode::NoError:
-        return QObject::tr("No error has occurred");
-    case mb::patcher::ErrorCode::MemoryAllocationError:
-        return QObject::tr("Failed to allocate memory");
-    case mb::patcher::ErrorCode::PatcherCreateError:
-        return QObject::tr("Failed to create patcher");
-    case mb::patcher::ErrorCode::AutoPatcherCreateError:
-        return QObject::tr("Failed to create autopatcher");
-    case mb::patcher::ErrorCode::FileOpenError:
-        return QObject::tr("Failed to open file");
-    case mb::patcher::ErrorCode::FileCloseError:
-        return QObject::tr("Failed to close file");
-    case mb::patcher::ErrorCode::FileReadError:
-        return QObject::tr("Failed to read from file");
-    case mb::patcher::ErrorCode::FileWriteError:
-        return QObject::tr("Failed to write to file");
-    case mb::patcher::ErrorCode::FileSeekError:
-        return QObject::tr("Failed to seek file");
-    case mb::patcher::ErrorCode::FileTellError:
-        return QObject::tr("Failed to get file position");
-    case mb::patcher::ErrorCode::ArchiveReadOpenError:
-        return QObject::tr("Failed to open archive for reading");
-    case mb::patcher::ErrorCode::ArchiveReadDataError:
-        return QObject::tr("Failed to read archive data for file");
-    case mb::patcher::ErrorCode::ArchiveReadHeaderError:
-        return QObject::tr("Failed to read archive entry header");
-    case mb::patcher::ErrorCode::ArchiveWriteOpenError:
-        return QObject::tr("Failed to open archive for writing");
-    case mb::patcher::ErrorCode::ArchiveWriteDataError:
-        return QObject::tr("Failed to write archive data for file");
-    case mb::patcher::ErrorCode::ArchiveWriteHeaderError:
-        return QObject::tr("Failed to write archive header for file");
-    case mb::patcher::ErrorCode::ArchiveCloseError:
-        return QObject::tr("Failed to close archive");
-    case mb::patcher::ErrorCode::ArchiveFreeError:
-        return QObject::tr("Failed to free archive header memory");
-    case mb::patcher::ErrorCode::PatchingCancelled:
-        return QObject::tr("Patching was cancelled");
-    default:
-        assert(false);
-    }
-
-    return QString();
-}
-
-
 PatcherTask::PatcherTask(QWidget *parent)
     : QObject(parent)
 {
 }
 
-static void progressUpdatedCbWrapper(uint64_t bytes, uint64_t maxBytes,
-                                     void *userData)
+static void jobUpdatedCbWrapper(size_t index,
+                                mb::patcher::PatchJobState state,
+                                void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->progressUpdatedCb(bytes, maxBytes);
+    task->jobUpdatedCb(index, state);
 }
 
-static void filesUpdatedCbWrapper(uint64_t files, uint64_t maxFiles,
-                                  void *userData)
+static void progressUpdatedCbWrapper(uint64_t bytes, uint64_t maxBytes,
+                                     void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->filesUpdatedCb(files, maxFiles);
+    task->progressUpdatedCb(bytes, maxBytes);
 }
 
-static void detailsUpdatedCbWrapper(const std::string &text, void *userData)
+static void detailsUpdatedCbWrapper(size_t index, const std::string &text,
+                                    void *userData)
 {
     PatcherTask *task = static_cast<PatcherTask *>(userData);
-    task->detailsUpdatedCb(text);
+    task->detailsUpdatedCb(index, text);
 }
 
-void PatcherTask::patch(PatcherPtr patcher, FileInfoPtr info)
+void PatcherTask::patch(PatchQueuePtr queue)
 {
-    patcher->set_file_info(info);
-
-    bool ret = patcher->patch_file(&progressUpdatedCbWrapper,
-                                   &filesUpdatedCbWrapper,
-                                   &detailsUpdatedCbWrapper,
-                                   this);
+    bool ret = queue->run(&jobUpdatedCbWrapper,
+                          &progressUpdatedCbWrapper,
+                          &detailsUpdatedCbWrapper,
+                          this);
 
-    QString newFile(QString::fromStdString(info->output_path()));
-
-    patcher->set_file_info(nullptr);
-    delete info;
-
-    if (!ret) {
-        emit finished(QString(), true, errorToString(patcher->error()));
-    } else {
-        emit finished(newFile, false, QString());
-    }
+    emit finished(!ret);
 }
 
-void PatcherTask::progressUpdatedCb(uint64_t bytes, uint64_t maxBytes)
+void PatcherTask::jobUpdatedCb(size_t index, mb::patcher::PatchJobState state)
 {
-    emit progressUpdated(bytes, maxBytes);
+    emit jobUpdated(static_cast<int>(index), static_cast<int>(state));
 }
 
-void PatcherTask::filesUpdatedCb(uint64_t files, uint64_t maxFiles)
+void PatcherTask::progressUpdatedCb(uint64_t bytes, uint64_t maxBytes)
 {
-    emit filesUpdated(files, maxFiles);
+    emit progressUpdated(bytes, maxBytes);
 }
 
-void PatcherTask::detailsUpdatedCb(const std::string &text)
+void PatcherTask::detailsUpdatedCb(size_t index, const std::string &text)
 {
-    emit detailsUpdated(QString::fromStdString(text));
+    emit detailsUpdated(static_cast<int>(index), QString::fromStdString(text));
 }
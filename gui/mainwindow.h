@@ -22,17 +22,15 @@
 
 #include <mbpatcher/fileinfo.h>
 #include <mbpatcher/patcherconfig.h>
-#include <mbpatcher/patcherinterface.h>
+#include <mbpatcher/patchqueue.h>
 
 #include <QtCore/QMetaType>
 #include <QtWidgets/QAbstractButton>
 #include <QtWidgets/QWidget>
 
 
-typedef mb::patcher::Patcher * PatcherPtr;
-Q_DECLARE_METATYPE(PatcherPtr)
-typedef mb::patcher::FileInfo * FileInfoPtr;
-Q_DECLARE_METATYPE(FileInfoPtr)
+typedef mb::patcher::PatchQueue * PatchQueuePtr;
+Q_DECLARE_METATYPE(PatchQueuePtr)
 
 class MainWindowPrivate;
 
@@ -45,7 +43,7 @@ public:
     ~MainWindow();
 
 signals:
-    void runThread(PatcherPtr patcher, FileInfoPtr info);
+    void runThread(PatchQueuePtr queue);
 
 private slots:
     void onDeviceSelected(int index);
@@ -55,12 +53,11 @@ private slots:
     void onChooseFileItemClicked(QAction *action);
 
     // Progress
+    void onJobUpdated(int index, int state);
     void onProgressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void onFilesUpdated(uint64_t files, uint64_t maxFiles);
-    void onDetailsUpdated(const QString &text);
+    void onDetailsUpdated(int index, const QString &text);
 
-    void onPatchingFinished(const QString &newFile, bool failed,
-                            const QString &errorMessage);
+    void onPatchingFinished(bool failed);
 
 private:
     virtual void closeEvent(QCloseEvent *event) override;
@@ -73,7 +70,7 @@ private:
     void populateDevices();
     void populateInstallationLocations();
 
-    void chooseFile(const QString &patterns);
+    void chooseFiles(const QString &patterns);
     void startPatching();
 
     void updateWidgetsVisibility();
@@ -93,18 +90,17 @@ class PatcherTask : public QObject
 public:
     PatcherTask(QWidget *parent = 0);
 
-    void patch(PatcherPtr patcher, FileInfoPtr info);
+    void patch(PatchQueuePtr queue);
 
+    void jobUpdatedCb(size_t index, mb::patcher::PatchJobState state);
     void progressUpdatedCb(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdatedCb(uint64_t files, uint64_t maxFiles);
-    void detailsUpdatedCb(const std::string &text);
+    void detailsUpdatedCb(size_t index, const std::string &text);
 
 signals:
-    void finished(const QString &newFile, bool failed,
-                  const QString &errorMessage);
+    void finished(bool failed);
+    void jobUpdated(int index, int state);
     void progressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdated(uint64_t files, uint64_t maxFiles);
-    void detailsUpdated(const QString &text);
+    void detailsUpdated(int index, const QString &text);
 };
 
 #endif // MAINWINDOW_H
@@ -24,12 +24,13 @@
 
 #include <mbdevice/device.h>
 #include <mbpatcher/patcherconfig.h>
-#include <mbpatcher/patcherinterface.h>
+#include <mbpatcher/patchqueue.h>
 
 #include <memory>
 #include <vector>
 
 #include <QtCore/QSettings>
+#include <QtCore/QStringList>
 #include <QtCore/QThread>
 #include <QtWidgets/QCheckBox>
 #include <QtWidgets/QComboBox>
@@ -40,6 +41,8 @@
 #include <QtWidgets/QProgressBar>
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QRadioButton>
+#include <QtWidgets/QSpinBox>
+#include <QtWidgets/QTreeWidget>
 
 
 class InstallLocation
@@ -72,21 +75,19 @@ public:
     // Current state of the patcher
     State state = FirstRun;
 
-    // Selected file
+    // Selected files
     QString patcherId;
-    QString fileName;
+    QStringList fileNames;
     bool autoMode;
 
     mb::patcher::PatcherConfig *pc = nullptr;
     std::vector<mb::device::Device> devices;
 
-    // Selected patcher
-    mb::patcher::Patcher *patcher = nullptr;
+    // Queue of files being patched
+    mb::patcher::PatchQueue *queue = nullptr;
 
-    // Patcher finish status and error message
-    QString patcherNewFile;
+    // Patcher finish status
     bool patcherFailed;
-    QString patcherError;
 
     // Threads
     QThread *thread;
@@ -110,10 +111,13 @@ public:
     QComboBox *instLocSel;
     QLabel *instLocDesc;
     QLineEdit *instLocLe;
+    QLabel *jobsLbl;
+    QSpinBox *jobsSpin;
 
     QLabel *messageLbl;
 
     // Progress
+    QTreeWidget *queueView;
     QLabel *detailsLbl;
     QProgressBar *progressBar;
 
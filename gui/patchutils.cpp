@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2014-2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "patchutils.h"
+
+#include <cassert>
+
+#include <mbdevice/json.h>
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QObject>
+#include <QtCore/QStringBuilder>
+#include <QtCore/QStringList>
+
+
+QString outputPathForInput(const QString &inputPath, const QString &romId)
+{
+    QStringList suffixes;
+    suffixes << QStringLiteral(".tar.md5");
+    suffixes << QStringLiteral(".tar.md5.gz");
+    suffixes << QStringLiteral(".tar.md5.xz");
+    suffixes << QStringLiteral(".zip");
+
+    QFileInfo qFileInfo(inputPath);
+    QString outputName;
+
+    for (const QString &suffix : suffixes) {
+        if (inputPath.endsWith(suffix)) {
+            // Input name: <parent path>/<base name>.<suffix>
+            // Output name: <parent path>/<base name>_<rom id>.zip
+            outputName = inputPath.left(inputPath.size() - suffix.size())
+                    % QStringLiteral("_")
+                    % romId
+                    % QStringLiteral(".zip");
+            break;
+        }
+    }
+    if (outputName.isEmpty()) {
+        outputName = qFileInfo.completeBaseName()
+                % QStringLiteral("_")
+                % romId
+                % QStringLiteral(".")
+                % qFileInfo.suffix();
+    }
+
+    return QDir::toNativeSeparators(qFileInfo.dir().filePath(outputName));
+}
+
+QString errorToString(const mb::patcher::ErrorCode &error) {
+    switch (error) {
+    case mb::patcher::ErrorCode::NoError:
+        return QObject::tr("No error has occurred");
+    case mb::patcher::ErrorCode::MemoryAllocationError:
+        return QObject::tr("Failed to allocate memory");
+    case mb::patcher::ErrorCode::PatcherCreateError:
+        return QObject::tr("Failed to create patcher");
+    case mb::patcher::ErrorCode::AutoPatcherCreateError:
+        return QObject::tr("Failed to create autopatcher");
+    case mb::patcher::ErrorCode::FileOpenError:
+        return QObject::tr("Failed to open file");
+    case mb::patcher::ErrorCode::FileCloseError:
+        return QObject::tr("Failed to close file");
+    case mb::patcher::ErrorCode::FileReadError:
+        return QObject::tr("Failed to read from file");
+    case mb::patcher::ErrorCode::FileWriteError:
+        return QObject::tr("Failed to write to file");
+    case mb::patcher::ErrorCode::FileSeekError:
+        return QObject::tr("Failed to seek file");
+    case mb::patcher::ErrorCode::FileTellError:
+        return QObject::tr("Failed to get file position");
+    case mb::patcher::ErrorCode::ArchiveReadOpenError:
+        return QObject::tr("Failed to open archive for reading");
+    case mb::patcher::ErrorCode::ArchiveReadDataError:
+        return QObject::tr("Failed to read archive data for file");
+    case mb::patcher::ErrorCode::ArchiveReadHeaderError:
+        return QObject::tr("Failed to read archive entry header");
+    case mb::patcher::ErrorCode::ArchiveWriteOpenError:
+        return QObject::tr("Failed to open archive for writing");
+    case mb::patcher::ErrorCode::ArchiveWriteDataError:
+        return QObject::tr("Failed to write archive data for file");
+    case mb::patcher::ErrorCode::ArchiveWriteHeaderError:
+        return QObject::tr("Failed to write archive header for file");
+    case mb::patcher::ErrorCode::ArchiveCloseError:
+        return QObject::tr("Failed to close archive");
+    case mb::patcher::ErrorCode::ArchiveFreeError:
+        return QObject::tr("Failed to free archive header memory");
+    case mb::patcher::ErrorCode::PatchingCancelled:
+        return QObject::tr("Patching was cancelled");
+    default:
+        assert(false);
+    }
+
+    return QString();
+}
+
+bool loadDevices(const QString &dataDir,
+                 std::vector<mb::device::Device> &devices)
+{
+    QString path(dataDir % QStringLiteral("/devices.json"));
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("%s: Failed to open file: %s",
+                 path.toUtf8().data(), file.errorString().toUtf8().data());
+        return false;
+    }
+
+    QByteArray contents = file.readAll();
+    file.close();
+    contents.push_back('\0');
+
+    std::vector<mb::device::Device> allDevices;
+    mb::device::JsonError error;
+
+    if (!mb::device::device_list_from_json(
+            contents.data(), allDevices, error)) {
+        qWarning("Failed to load devices");
+        return false;
+    }
+
+    for (auto &device : allDevices) {
+        if (device.validate() == 0) {
+            devices.push_back(std::move(device));
+        } else {
+            qWarning("Failed validation on a device");
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbdevice/device.h"
+
+/*
+ * The binary device database is only used for detecting the current device by
+ * codename (mbtool's utilities, when given a database instead of
+ * devices.json). The patcher GUI and the Android app still load the full
+ * device list from devices.json, and init and the boot UI read the single
+ * device.json added to each patched zip.
+ */
+
+namespace mb
+{
+namespace device
+{
+
+MB_EXPORT bool device_list_to_database(const std::vector<Device> &devices,
+                                       std::vector<unsigned char> &data);
+
+MB_EXPORT bool device_database_is_valid(const void *data, size_t size);
+
+MB_EXPORT bool device_from_database(const void *data, size_t size,
+                                    const std::string &codename,
+                                    Device &device);
+MB_EXPORT bool device_from_database_any(const void *data, size_t size,
+                                        const std::vector<std::string> &codenames,
+                                        Device &device);
+
+MB_EXPORT bool device_list_from_database(const void *data, size_t size,
+                                         std::vector<Device> &devices);
+
+}
+}
@@ -0,0 +1,746 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/database.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+
+/*
+ * Binary device database format
+ *
+ * The database is generated by devicesgen from the same device definitions as
+ * devices.json and allows looking up a device by codename without parsing or
+ * validating any JSON. All integers are little-endian uint32_t values.
+ *
+ * - Header: magic followed by the HEADER_* words
+ * - Devices: device_count records of FIELD_COUNT words each. String fields are
+ *   offsets into the string pool. List fields are an (offset, count) pair
+ *   referring to the list area.
+ * - Lists: string pool offsets
+ * - Buckets: displacement seed for each hash bucket
+ * - Slots: (codename offset, device index) pairs. Empty slots have a device
+ *   index of NO_DEVICE. Only codenames of valid devices are indexed.
+ * - Strings: interned, NULL-terminated strings. Offset 0 is the empty string.
+ *
+ * Codenames are looked up using a perfect hash (hash and displace): the bucket
+ * is determined by hashing the codename with seed 0 and the slot is determined
+ * by hashing it with the bucket's displacement seed. Exactly one slot needs to
+ * be checked for each lookup.
+ */
+
+#define DATABASE_MAGIC          "MBDEVDB1"
+#define DATABASE_MAGIC_SIZE     8
+
+#define NO_DEVICE               0xffffffffu
+
+// Average number of keys per bucket
+#define KEYS_PER_BUCKET         4
+// Maximum number of displacement seeds to try per bucket
+#define MAX_DISPLACEMENT        (1u << 20)
+
+namespace mb
+{
+namespace device
+{
+
+enum HeaderField : uint32_t
+{
+    HEADER_FIELD_COUNT,
+    HEADER_DEVICE_COUNT,
+    HEADER_DEVICES_OFFSET,
+    HEADER_LISTS_OFFSET,
+    HEADER_LISTS_COUNT,
+    HEADER_BUCKET_COUNT,
+    HEADER_BUCKETS_OFFSET,
+    HEADER_SLOT_COUNT,
+    HEADER_SLOTS_OFFSET,
+    HEADER_STRINGS_OFFSET,
+    HEADER_STRINGS_SIZE,
+    HEADER_COUNT,
+};
+
+enum DeviceField : uint32_t
+{
+    FIELD_ID,
+    FIELD_CODENAMES,
+    FIELD_CODENAMES_COUNT,
+    FIELD_NAME,
+    FIELD_ARCHITECTURE,
+    FIELD_FLAGS,
+    FIELD_BASE_DIRS,
+    FIELD_BASE_DIRS_COUNT,
+    FIELD_SYSTEM_DEVS,
+    FIELD_SYSTEM_DEVS_COUNT,
+    FIELD_CACHE_DEVS,
+    FIELD_CACHE_DEVS_COUNT,
+    FIELD_DATA_DEVS,
+    FIELD_DATA_DEVS_COUNT,
+    FIELD_BOOT_DEVS,
+    FIELD_BOOT_DEVS_COUNT,
+    FIELD_RECOVERY_DEVS,
+    FIELD_RECOVERY_DEVS_COUNT,
+    FIELD_EXTRA_DEVS,
+    FIELD_EXTRA_DEVS_COUNT,
+    FIELD_TW_SUPPORTED,
+    FIELD_TW_FLAGS,
+    FIELD_TW_PIXEL_FORMAT,
+    FIELD_TW_FORCE_PIXEL_FORMAT,
+    FIELD_TW_OVERSCAN_PERCENT,
+    FIELD_TW_DEFAULT_X_OFFSET,
+    FIELD_TW_DEFAULT_Y_OFFSET,
+    FIELD_TW_BRIGHTNESS_PATH,
+    FIELD_TW_SECONDARY_BRIGHTNESS_PATH,
+    FIELD_TW_MAX_BRIGHTNESS,
+    FIELD_TW_DEFAULT_BRIGHTNESS,
+    FIELD_TW_BATTERY_PATH,
+    FIELD_TW_CPU_TEMP_PATH,
+    FIELD_TW_INPUT_BLACKLIST,
+    FIELD_TW_INPUT_WHITELIST,
+    FIELD_TW_GRAPHICS_BACKENDS,
+    FIELD_TW_GRAPHICS_BACKENDS_COUNT,
+    FIELD_TW_THEME,
+    FIELD_COUNT,
+};
+
+static uint32_t codename_hash(const char *str, size_t len, uint32_t seed)
+{
+    // FNV-1a with the seed mixed into the offset basis
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<unsigned char>(str[i]);
+        h *= 16777619u;
+    }
+
+    // MurmurHash3 finalizer to spread the bits for small tables
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static inline uint32_t read_u32(const unsigned char *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static inline void append_u32(std::vector<unsigned char> &data, uint32_t value)
+{
+    value = mb_htole32(value);
+    auto ptr = reinterpret_cast<const unsigned char *>(&value);
+    data.insert(data.end(), ptr, ptr + sizeof(value));
+}
+
+// Writer
+
+class DatabaseBuilder
+{
+public:
+    DatabaseBuilder()
+    {
+        // Offset 0 is always the empty string
+        _strings.push_back('\0');
+        _string_offsets[std::string()] = 0;
+    }
+
+    uint32_t add_string(const std::string &str)
+    {
+        auto it = _string_offsets.find(str);
+        if (it != _string_offsets.end()) {
+            return it->second;
+        }
+
+        uint32_t offset = static_cast<uint32_t>(_strings.size());
+        _strings.insert(_strings.end(), str.begin(), str.end());
+        _strings.push_back('\0');
+        _string_offsets[str] = offset;
+        return offset;
+    }
+
+    void add_list(const std::vector<std::string> &list,
+                  uint32_t *offset_out, uint32_t *count_out)
+    {
+        std::vector<uint32_t> offsets;
+        offsets.reserve(list.size());
+
+        for (auto const &item : list) {
+            offsets.push_back(add_string(item));
+        }
+
+        auto it = _list_offsets.find(offsets);
+        if (it != _list_offsets.end()) {
+            *offset_out = it->second;
+        } else {
+            *offset_out = static_cast<uint32_t>(_lists.size());
+            _lists.insert(_lists.end(), offsets.begin(), offsets.end());
+            _list_offsets[offsets] = *offset_out;
+        }
+
+        *count_out = static_cast<uint32_t>(offsets.size());
+    }
+
+    void add_device(const Device &device)
+    {
+        std::vector<uint32_t> r(FIELD_COUNT);
+
+        r[FIELD_ID] = add_string(device.id());
+        add_list(device.codenames(),
+                 &r[FIELD_CODENAMES], &r[FIELD_CODENAMES_COUNT]);
+        r[FIELD_NAME] = add_string(device.name());
+        r[FIELD_ARCHITECTURE] = add_string(device.architecture());
+        r[FIELD_FLAGS] = device.flags();
+        add_list(device.block_dev_base_dirs(),
+                 &r[FIELD_BASE_DIRS], &r[FIELD_BASE_DIRS_COUNT]);
+        add_list(device.system_block_devs(),
+                 &r[FIELD_SYSTEM_DEVS], &r[FIELD_SYSTEM_DEVS_COUNT]);
+        add_list(device.cache_block_devs(),
+                 &r[FIELD_CACHE_DEVS], &r[FIELD_CACHE_DEVS_COUNT]);
+        add_list(device.data_block_devs(),
+                 &r[FIELD_DATA_DEVS], &r[FIELD_DATA_DEVS_COUNT]);
+        add_list(device.boot_block_devs(),
+                 &r[FIELD_BOOT_DEVS], &r[FIELD_BOOT_DEVS_COUNT]);
+        add_list(device.recovery_block_devs(),
+                 &r[FIELD_RECOVERY_DEVS], &r[FIELD_RECOVERY_DEVS_COUNT]);
+        add_list(device.extra_block_devs(),
+                 &r[FIELD_EXTRA_DEVS], &r[FIELD_EXTRA_DEVS_COUNT]);
+        r[FIELD_TW_SUPPORTED] = device.tw_supported();
+        r[FIELD_TW_FLAGS] = device.tw_flags();
+        r[FIELD_TW_PIXEL_FORMAT] =
+                static_cast<uint32_t>(device.tw_pixel_format());
+        r[FIELD_TW_FORCE_PIXEL_FORMAT] =
+                static_cast<uint32_t>(device.tw_force_pixel_format());
+        r[FIELD_TW_OVERSCAN_PERCENT] =
+                static_cast<uint32_t>(device.tw_overscan_percent());
+        r[FIELD_TW_DEFAULT_X_OFFSET] =
+                static_cast<uint32_t>(device.tw_default_x_offset());
+        r[FIELD_TW_DEFAULT_Y_OFFSET] =
+                static_cast<uint32_t>(device.tw_default_y_offset());
+        r[FIELD_TW_BRIGHTNESS_PATH] = add_string(device.tw_brightness_path());
+        r[FIELD_TW_SECONDARY_BRIGHTNESS_PATH] =
+                add_string(device.tw_secondary_brightness_path());
+        r[FIELD_TW_MAX_BRIGHTNESS] =
+                static_cast<uint32_t>(device.tw_max_brightness());
+        r[FIELD_TW_DEFAULT_BRIGHTNESS] =
+                static_cast<uint32_t>(device.tw_default_brightness());
+        r[FIELD_TW_BATTERY_PATH] = add_string(device.tw_battery_path());
+        r[FIELD_TW_CPU_TEMP_PATH] = add_string(device.tw_cpu_temp_path());
+        r[FIELD_TW_INPUT_BLACKLIST] = add_string(device.tw_input_blacklist());
+        r[FIELD_TW_INPUT_WHITELIST] = add_string(device.tw_input_whitelist());
+        add_list(device.tw_graphics_backends(),
+                 &r[FIELD_TW_GRAPHICS_BACKENDS],
+                 &r[FIELD_TW_GRAPHICS_BACKENDS_COUNT]);
+        r[FIELD_TW_THEME] = add_string(device.tw_theme());
+
+        uint32_t index = static_cast<uint32_t>(_devices.size() / FIELD_COUNT);
+        _devices.insert(_devices.end(), r.begin(), r.end());
+
+        // A linear search skips invalid devices, so they are stored, but
+        // never returned by a lookup
+        if (device.validate()) {
+            return;
+        }
+
+        // If multiple devices share a codename, the first one wins, which
+        // matches the behavior of a linear search
+        for (auto const &codename : device.codenames()) {
+            if (_codenames.find(codename) == _codenames.end()) {
+                _codenames[codename] = index;
+            }
+        }
+    }
+
+    bool build_index()
+    {
+        struct Key
+        {
+            const std::string *codename;
+            uint32_t device;
+        };
+
+        uint32_t n = static_cast<uint32_t>(_codenames.size());
+        uint32_t bucket_count = std::max<uint32_t>(
+                1, (n + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET);
+        // Keep the load factor at ~0.8 to make finding seeds quick
+        uint32_t slot_count = std::max<uint32_t>(1, n + n / 4);
+
+        std::vector<std::vector<Key>> buckets(bucket_count);
+
+        for (auto const &item : _codenames) {
+            uint32_t h = codename_hash(item.first.data(), item.first.size(), 0);
+            buckets[h % bucket_count].push_back({ &item.first, item.second });
+        }
+
+        // Place the largest buckets first while most slots are still free
+        std::vector<uint32_t> order(bucket_count);
+        for (uint32_t i = 0; i < bucket_count; ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [&](uint32_t a, uint32_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        _buckets.assign(bucket_count, 0);
+        _slots.assign(slot_count * 2, 0);
+        for (uint32_t i = 0; i < slot_count; ++i) {
+            _slots[i * 2 + 1] = NO_DEVICE;
+        }
+
+        std::vector<uint32_t> positions;
+
+        for (uint32_t b : order) {
+            auto const &keys = buckets[b];
+            if (keys.empty()) {
+                break;
+            }
+
+            bool found = false;
+
+            for (uint32_t seed = 1; seed < MAX_DISPLACEMENT && !found;
+                    ++seed) {
+                positions.clear();
+                found = true;
+
+                for (auto const &key : keys) {
+                    uint32_t pos = codename_hash(
+                            key.codename->data(), key.codename->size(), seed)
+                            % slot_count;
+
+                    if (_slots[pos * 2 + 1] != NO_DEVICE
+                            || std::find(positions.begin(), positions.end(),
+                                         pos) != positions.end()) {
+                        found = false;
+                        break;
+                    }
+
+                    positions.push_back(pos);
+                }
+
+                if (found) {
+                    _buckets[b] = seed;
+
+                    for (size_t i = 0; i < keys.size(); ++i) {
+                        _slots[positions[i] * 2] = add_string(*keys[i].codename);
+                        _slots[positions[i] * 2 + 1] = keys[i].device;
+                    }
+                }
+            }
+
+            if (!found) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void write(std::vector<unsigned char> &data) const
+    {
+        uint32_t devices_offset = DATABASE_MAGIC_SIZE + HEADER_COUNT * 4;
+        uint32_t lists_offset = devices_offset + _devices.size() * 4;
+        uint32_t buckets_offset = lists_offset + _lists.size() * 4;
+        uint32_t slots_offset = buckets_offset + _buckets.size() * 4;
+        uint32_t strings_offset = slots_offset + _slots.size() * 4;
+
+        data.clear();
+        data.reserve(strings_offset + _strings.size());
+
+        data.insert(data.end(), DATABASE_MAGIC,
+                    DATABASE_MAGIC + DATABASE_MAGIC_SIZE);
+
+        uint32_t header[HEADER_COUNT];
+        header[HEADER_FIELD_COUNT] = FIELD_COUNT;
+        header[HEADER_DEVICE_COUNT] = _devices.size() / FIELD_COUNT;
+        header[HEADER_DEVICES_OFFSET] = devices_offset;
+        header[HEADER_LISTS_OFFSET] = lists_offset;
+        header[HEADER_LISTS_COUNT] = _lists.size();
+        header[HEADER_BUCKET_COUNT] = _buckets.size();
+        header[HEADER_BUCKETS_OFFSET] = buckets_offset;
+        header[HEADER_SLOT_COUNT] = _slots.size() / 2;
+        header[HEADER_SLOTS_OFFSET] = slots_offset;
+        header[HEADER_STRINGS_OFFSET] = strings_offset;
+        header[HEADER_STRINGS_SIZE] = _strings.size();
+
+        for (uint32_t value : header) {
+            append_u32(data, value);
+        }
+        for (uint32_t value : _devices) {
+            append_u32(data, value);
+        }
+        for (uint32_t value : _lists) {
+            append_u32(data, value);
+        }
+        for (uint32_t value : _buckets) {
+            append_u32(data, value);
+        }
+        for (uint32_t value : _slots) {
+            append_u32(data, value);
+        }
+
+        data.insert(data.end(), _strings.begin(), _strings.end());
+    }
+
+private:
+    std::vector<char> _strings;
+    std::unordered_map<std::string, uint32_t> _string_offsets;
+    std::vector<uint32_t> _lists;
+    std::map<std::vector<uint32_t>, uint32_t> _list_offsets;
+    std::vector<uint32_t> _devices;
+    std::map<std::string, uint32_t> _codenames;
+    std::vector<uint32_t> _buckets;
+    std::vector<uint32_t> _slots;
+};
+
+/*!
+ * \brief Create binary device database from list of devices
+ *
+ * \param[in] devices List of devices
+ * \param[out] data Output database
+ *
+ * \return Whether the database was successfully created
+ */
+bool device_list_to_database(const std::vector<Device> &devices,
+                             std::vector<unsigned char> &data)
+{
+    DatabaseBuilder builder;
+
+    for (auto const &device : devices) {
+        builder.add_device(device);
+    }
+
+    if (!builder.build_index()) {
+        return false;
+    }
+
+    builder.write(data);
+
+    return true;
+}
+
+// Reader
+
+struct DatabaseView
+{
+    const unsigned char *data;
+    uint32_t device_count;
+    const unsigned char *devices;
+    uint32_t lists_count;
+    const unsigned char *lists;
+    uint32_t bucket_count;
+    const unsigned char *buckets;
+    uint32_t slot_count;
+    const unsigned char *slots;
+    uint32_t strings_size;
+    const char *strings;
+};
+
+static bool check_region(size_t size, uint32_t offset, uint64_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+static bool open_view(const void *data, size_t size, DatabaseView &view)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    if (!data || size < DATABASE_MAGIC_SIZE + HEADER_COUNT * 4
+            || memcmp(ptr, DATABASE_MAGIC, DATABASE_MAGIC_SIZE) != 0) {
+        return false;
+    }
+
+    uint32_t header[HEADER_COUNT];
+    for (uint32_t i = 0; i < HEADER_COUNT; ++i) {
+        header[i] = read_u32(ptr + DATABASE_MAGIC_SIZE + i * 4);
+    }
+
+    if (header[HEADER_FIELD_COUNT] != FIELD_COUNT
+            || header[HEADER_BUCKET_COUNT] == 0
+            || header[HEADER_SLOT_COUNT] == 0
+            || header[HEADER_STRINGS_SIZE] == 0
+            || !check_region(size, header[HEADER_DEVICES_OFFSET],
+                             uint64_t(header[HEADER_DEVICE_COUNT])
+                                     * FIELD_COUNT * 4)
+            || !check_region(size, header[HEADER_LISTS_OFFSET],
+                             uint64_t(header[HEADER_LISTS_COUNT]) * 4)
+            || !check_region(size, header[HEADER_BUCKETS_OFFSET],
+                             uint64_t(header[HEADER_BUCKET_COUNT]) * 4)
+            || !check_region(size, header[HEADER_SLOTS_OFFSET],
+                             uint64_t(header[HEADER_SLOT_COUNT]) * 8)
+            || !check_region(size, header[HEADER_STRINGS_OFFSET],
+                             header[HEADER_STRINGS_SIZE])) {
+        return false;
+    }
+
+    view.data = ptr;
+    view.device_count = header[HEADER_DEVICE_COUNT];
+    view.devices = ptr + header[HEADER_DEVICES_OFFSET];
+    view.lists_count = header[HEADER_LISTS_COUNT];
+    view.lists = ptr + header[HEADER_LISTS_OFFSET];
+    view.bucket_count = header[HEADER_BUCKET_COUNT];
+    view.buckets = ptr + header[HEADER_BUCKETS_OFFSET];
+    view.slot_count = header[HEADER_SLOT_COUNT];
+    view.slots = ptr + header[HEADER_SLOTS_OFFSET];
+    view.strings_size = header[HEADER_STRINGS_SIZE];
+    view.strings = reinterpret_cast<const char *>(
+            ptr + header[HEADER_STRINGS_OFFSET]);
+
+    // Ensures that every offset into the string pool is NULL-terminated
+    return view.strings[view.strings_size - 1] == '\0';
+}
+
+static bool read_string(const DatabaseView &view, uint32_t offset,
+                        std::string &out)
+{
+    if (offset >= view.strings_size) {
+        return false;
+    }
+
+    out = view.strings + offset;
+    return true;
+}
+
+static bool read_list(const DatabaseView &view, uint32_t offset,
+                      uint32_t count, std::vector<std::string> &out)
+{
+    if (offset > view.lists_count || count > view.lists_count - offset) {
+        return false;
+    }
+
+    std::vector<std::string> list(count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!read_string(view, read_u32(view.lists + (offset + i) * 4),
+                         list[i])) {
+            return false;
+        }
+    }
+
+    out.swap(list);
+    return true;
+}
+
+static bool read_device(const DatabaseView &view, uint32_t index,
+                        Device &device)
+{
+    if (index >= view.device_count) {
+        return false;
+    }
+
+    const unsigned char *record = view.devices + index * FIELD_COUNT * 4;
+    uint32_t r[FIELD_COUNT];
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        r[i] = read_u32(record + i * 4);
+    }
+
+    std::string str;
+    std::vector<std::string> list;
+    Device d;
+
+#define STRING_FIELD(FIELD, SETTER) \
+    do { \
+        if (!read_string(view, r[FIELD], str)) return false; \
+        d.SETTER(std::move(str)); \
+    } while (0)
+#define LIST_FIELD(FIELD, SETTER) \
+    do { \
+        if (!read_list(view, r[FIELD], r[FIELD##_COUNT], list)) return false; \
+        d.SETTER(std::move(list)); \
+    } while (0)
+
+    STRING_FIELD(FIELD_ID, set_id);
+    LIST_FIELD(FIELD_CODENAMES, set_codenames);
+    STRING_FIELD(FIELD_NAME, set_name);
+    STRING_FIELD(FIELD_ARCHITECTURE, set_architecture);
+    d.set_flags(static_cast<DeviceFlag>(r[FIELD_FLAGS] & DEVICE_FLAG_MASK));
+    LIST_FIELD(FIELD_BASE_DIRS, set_block_dev_base_dirs);
+    LIST_FIELD(FIELD_SYSTEM_DEVS, set_system_block_devs);
+    LIST_FIELD(FIELD_CACHE_DEVS, set_cache_block_devs);
+    LIST_FIELD(FIELD_DATA_DEVS, set_data_block_devs);
+    LIST_FIELD(FIELD_BOOT_DEVS, set_boot_block_devs);
+    LIST_FIELD(FIELD_RECOVERY_DEVS, set_recovery_block_devs);
+    LIST_FIELD(FIELD_EXTRA_DEVS, set_extra_block_devs);
+    d.set_tw_supported(r[FIELD_TW_SUPPORTED] != 0);
+    d.set_tw_flags(static_cast<TwFlag>(r[FIELD_TW_FLAGS] & TW_FLAG_MASK));
+    d.set_tw_pixel_format(
+            static_cast<TwPixelFormat>(r[FIELD_TW_PIXEL_FORMAT]));
+    d.set_tw_force_pixel_format(
+            static_cast<TwForcePixelFormat>(r[FIELD_TW_FORCE_PIXEL_FORMAT]));
+    d.set_tw_overscan_percent(
+            static_cast<int32_t>(r[FIELD_TW_OVERSCAN_PERCENT]));
+    d.set_tw_default_x_offset(
+            static_cast<int32_t>(r[FIELD_TW_DEFAULT_X_OFFSET]));
+    d.set_tw_default_y_offset(
+            static_cast<int32_t>(r[FIELD_TW_DEFAULT_Y_OFFSET]));
+    STRING_FIELD(FIELD_TW_BRIGHTNESS_PATH, set_tw_brightness_path);
+    STRING_FIELD(FIELD_TW_SECONDARY_BRIGHTNESS_PATH,
+                 set_tw_secondary_brightness_path);
+    d.set_tw_max_brightness(
+            static_cast<int32_t>(r[FIELD_TW_MAX_BRIGHTNESS]));
+    d.set_tw_default_brightness(
+            static_cast<int32_t>(r[FIELD_TW_DEFAULT_BRIGHTNESS]));
+    STRING_FIELD(FIELD_TW_BATTERY_PATH, set_tw_battery_path);
+    STRING_FIELD(FIELD_TW_CPU_TEMP_PATH, set_tw_cpu_temp_path);
+    STRING_FIELD(FIELD_TW_INPUT_BLACKLIST, set_tw_input_blacklist);
+    STRING_FIELD(FIELD_TW_INPUT_WHITELIST, set_tw_input_whitelist);
+    LIST_FIELD(FIELD_TW_GRAPHICS_BACKENDS, set_tw_graphics_backends);
+    STRING_FIELD(FIELD_TW_THEME, set_tw_theme);
+
+#undef STRING_FIELD
+#undef LIST_FIELD
+
+    device = std::move(d);
+    return true;
+}
+
+/*!
+ * \brief Check if data is a binary device database
+ *
+ * \param data Database data
+ * \param size Size of \p data
+ *
+ * \return Whether the database header is valid
+ */
+bool device_database_is_valid(const void *data, size_t size)
+{
+    DatabaseView view;
+    return open_view(data, size, view);
+}
+
+// Find the index of the first valid device with the specified codename
+static bool find_device(const DatabaseView &view, const std::string &codename,
+                        uint32_t &index)
+{
+    uint32_t h = codename_hash(codename.data(), codename.size(), 0);
+    uint32_t seed = read_u32(view.buckets + (h % view.bucket_count) * 4);
+    uint32_t slot = codename_hash(codename.data(), codename.size(), seed)
+            % view.slot_count;
+
+    uint32_t name_offset = read_u32(view.slots + slot * 8);
+    index = read_u32(view.slots + slot * 8 + 4);
+
+    return index != NO_DEVICE && name_offset < view.strings_size
+            && codename == view.strings + name_offset;
+}
+
+/*!
+ * \brief Look up device by codename in binary device database
+ *
+ * Only the matching device is deserialized. The lookup does not depend on the
+ * number of devices in the database.
+ *
+ * \param[in] data Database data
+ * \param[in] size Size of \p data
+ * \param[in] codename Device codename
+ * \param[out] device Device object to store the result
+ *
+ * \return Whether a valid device with the specified codename was found
+ */
+bool device_from_database(const void *data, size_t size,
+                          const std::string &codename, Device &device)
+{
+    return device_from_database_any(data, size, { codename }, device);
+}
+
+/*!
+ * \brief Look up device matching any of several codenames
+ *
+ * The result is the same as searching through the device list in order and
+ * returning the first valid device that has any of the codenames. The order of
+ * \p codenames does not matter.
+ *
+ * \param[in] data Database data
+ * \param[in] size Size of \p data
+ * \param[in] codenames Device codenames (empty strings are ignored)
+ * \param[out] device Device object to store the result
+ *
+ * \return Whether a valid device with any of the codenames was found
+ */
+bool device_from_database_any(const void *data, size_t size,
+                              const std::vector<std::string> &codenames,
+                              Device &device)
+{
+    DatabaseView view;
+    if (!open_view(data, size, view)) {
+        return false;
+    }
+
+    uint32_t first = NO_DEVICE;
+
+    for (auto const &codename : codenames) {
+        uint32_t index;
+
+        if (!codename.empty() && find_device(view, codename, index)
+                && index < first) {
+            first = index;
+        }
+    }
+
+    if (first == NO_DEVICE) {
+        return false;
+    }
+
+    return read_device(view, first, device);
+}
+
+/*!
+ * \brief Load all devices from binary device database
+ *
+ * \param[in] data Database data
+ * \param[in] size Size of \p data
+ * \param[out] devices Vector to store the devices
+ *
+ * \return Whether the devices were successfully loaded
+ */
+bool device_list_from_database(const void *data, size_t size,
+                               std::vector<Device> &devices)
+{
+    DatabaseView view;
+    if (!open_view(data, size, view)) {
+        return false;
+    }
+
+    std::vector<Device> array(view.device_count);
+
+    for (uint32_t i = 0; i < view.device_count; ++i) {
+        if (!read_device(view, i, array[i])) {
+            return false;
+        }
+    }
+
+    devices.swap(array);
+    return true;
+}
+
+}
+}
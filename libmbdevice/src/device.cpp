@@ -69,7 +69,7 @@ void Device::operator=(Device &&device)
  *
  * \return Device ID
  */
-std::string Device::id() const
+const std::string &Device::id() const
 {
     MB_PRIVATE(const Device);
     return priv->base.id;
@@ -91,7 +91,7 @@ void Device::set_id(std::string id)
  *
  * \return List of device names
  */
-std::vector<std::string> Device::codenames() const
+const std::vector<std::string> &Device::codenames() const
 {
     MB_PRIVATE(const Device);
     return priv->base.codenames;
@@ -113,7 +113,7 @@ void Device::set_codenames(std::vector<std::string> codenames)
  *
  * \return Device name
  */
-std::string Device::name() const
+const std::string &Device::name() const
 {
     MB_PRIVATE(const Device);
     return priv->base.name;
@@ -135,7 +135,7 @@ void Device::set_name(std::string name)
  *
  * \return Device architecture
  */
-std::string Device::architecture() const
+const std::string &Device::architecture() const
 {
     MB_PRIVATE(const Device);
     return priv->base.architecture;
@@ -169,7 +169,7 @@ void Device::set_flags(DeviceFlags flags)
  *
  * \return List of block device base directories
  */
-std::vector<std::string> Device::block_dev_base_dirs() const
+const std::vector<std::string> &Device::block_dev_base_dirs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.base_dirs;
@@ -191,7 +191,7 @@ void Device::set_block_dev_base_dirs(std::vector<std::string> base_dirs)
  *
  * \return List of system block device paths
  */
-std::vector<std::string> Device::system_block_devs() const
+const std::vector<std::string> &Device::system_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.system_devs;
@@ -213,7 +213,7 @@ void Device::set_system_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of cache block device paths
  */
-std::vector<std::string> Device::cache_block_devs() const
+const std::vector<std::string> &Device::cache_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.cache_devs;
@@ -235,7 +235,7 @@ void Device::set_cache_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of data block device paths
  */
-std::vector<std::string> Device::data_block_devs() const
+const std::vector<std::string> &Device::data_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.data_devs;
@@ -257,7 +257,7 @@ void Device::set_data_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of boot block device paths
  */
-std::vector<std::string> Device::boot_block_devs() const
+const std::vector<std::string> &Device::boot_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.boot_devs;
@@ -279,7 +279,7 @@ void Device::set_boot_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of recovery block devices
  */
-std::vector<std::string> Device::recovery_block_devs() const
+const std::vector<std::string> &Device::recovery_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.recovery_devs;
@@ -301,7 +301,7 @@ void Device::set_recovery_block_devs(std::vector<std::string> block_devs)
  *
  * \return List of extra block device paths
  */
-std::vector<std::string> Device::extra_block_devs() const
+const std::vector<std::string> &Device::extra_block_devs() const
 {
     MB_PRIVATE(const Device);
     return priv->base.extra_devs;
@@ -402,7 +402,7 @@ void Device::set_tw_default_y_offset(int offset)
     priv->tw.default_y_offset = offset;
 }
 
-std::string Device::tw_brightness_path() const
+const std::string &Device::tw_brightness_path() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.brightness_path;
@@ -414,7 +414,7 @@ void Device::set_tw_brightness_path(std::string path)
     priv->tw.brightness_path = std::move(path);
 }
 
-std::string Device::tw_secondary_brightness_path() const
+const std::string &Device::tw_secondary_brightness_path() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.secondary_brightness_path;
@@ -450,7 +450,7 @@ void Device::set_tw_default_brightness(int value)
     priv->tw.default_brightness = value;
 }
 
-std::string Device::tw_battery_path() const
+const std::string &Device::tw_battery_path() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.battery_path;
@@ -462,7 +462,7 @@ void Device::set_tw_battery_path(std::string path)
     priv->tw.battery_path = std::move(path);
 }
 
-std::string Device::tw_cpu_temp_path() const
+const std::string &Device::tw_cpu_temp_path() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.cpu_temp_path;
@@ -474,7 +474,7 @@ void Device::set_tw_cpu_temp_path(std::string path)
     priv->tw.cpu_temp_path = std::move(path);
 }
 
-std::string Device::tw_input_blacklist() const
+const std::string &Device::tw_input_blacklist() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.input_blacklist;
@@ -486,7 +486,7 @@ void Device::set_tw_input_blacklist(std::string blacklist)
     priv->tw.input_blacklist = std::move(blacklist);
 }
 
-std::string Device::tw_input_whitelist() const
+const std::string &Device::tw_input_whitelist() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.input_whitelist;
@@ -498,7 +498,7 @@ void Device::set_tw_input_whitelist(std::string whitelist)
     priv->tw.input_whitelist = std::move(whitelist);
 }
 
-std::vector<std::string> Device::tw_graphics_backends() const
+const std::vector<std::string> &Device::tw_graphics_backends() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.graphics_backends;
@@ -510,7 +510,7 @@ void Device::set_tw_graphics_backends(std::vector<std::string> backends)
     priv->tw.graphics_backends = std::move(backends);
 }
 
-std::string Device::tw_theme() const
+const std::string &Device::tw_theme() const
 {
     MB_PRIVATE(const Device);
     return priv->tw.theme;
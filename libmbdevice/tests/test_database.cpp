@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/database.h"
+
+using namespace mb::device;
+
+static Device make_device(const std::string &id,
+                          std::vector<std::string> codenames)
+{
+    Device device;
+    device.set_id(id);
+    device.set_codenames(std::move(codenames));
+    device.set_name(id + " name");
+    device.set_architecture(ARCH_ARM64_V8A);
+    device.set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    device.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    device.set_system_block_devs({"/dev/block/bootdevice/by-name/system"});
+    device.set_cache_block_devs({"/dev/block/bootdevice/by-name/cache"});
+    device.set_data_block_devs({"/dev/block/bootdevice/by-name/userdata"});
+    device.set_boot_block_devs({"/dev/block/bootdevice/by-name/boot"});
+    device.set_recovery_block_devs({"/dev/block/bootdevice/by-name/recovery"});
+    device.set_tw_supported(true);
+    device.set_tw_flags(TwFlag::RoundScreen | TwFlag::NoCpuTemp);
+    device.set_tw_pixel_format(TwPixelFormat::Rgba8888);
+    device.set_tw_force_pixel_format(TwForcePixelFormat::Rgb565);
+    device.set_tw_overscan_percent(-5);
+    device.set_tw_default_x_offset(10);
+    device.set_tw_default_y_offset(20);
+    device.set_tw_brightness_path("/sys/class/backlight/panel/brightness");
+    device.set_tw_max_brightness(255);
+    device.set_tw_default_brightness(162);
+    device.set_tw_graphics_backends({"overlay_msm_old", "fbdev"});
+    device.set_tw_theme("portrait_hdpi");
+    return device;
+}
+
+TEST(DatabaseTest, RoundTripAllDevices)
+{
+    std::vector<Device> devices;
+    devices.push_back(make_device("a", {"a1", "a2"}));
+    devices.push_back(make_device("b", {"b1"}));
+    devices.push_back(make_device("c", {"c1", "c2", "c3"}));
+
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+    ASSERT_TRUE(device_database_is_valid(data.data(), data.size()));
+
+    std::vector<Device> result;
+    ASSERT_TRUE(device_list_from_database(data.data(), data.size(), result));
+    ASSERT_EQ(result, devices);
+}
+
+TEST(DatabaseTest, LookupByCodename)
+{
+    std::vector<Device> devices;
+    for (int i = 0; i < 500; ++i) {
+        std::string id = "device" + std::to_string(i);
+        devices.push_back(make_device(id, {id + "a", id + "b"}));
+    }
+
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+
+    for (int i = 0; i < 500; ++i) {
+        std::string id = "device" + std::to_string(i);
+        Device device;
+
+        ASSERT_TRUE(device_from_database(
+                data.data(), data.size(), id + "a", device));
+        ASSERT_EQ(device, devices[i]);
+        ASSERT_TRUE(device_from_database(
+                data.data(), data.size(), id + "b", device));
+        ASSERT_EQ(device, devices[i]);
+    }
+
+    Device device;
+    ASSERT_FALSE(device_from_database(
+            data.data(), data.size(), "nonexistent", device));
+    ASSERT_FALSE(device_from_database(
+            data.data(), data.size(), "", device));
+}
+
+TEST(DatabaseTest, DuplicateCodenameReturnsFirstDevice)
+{
+    std::vector<Device> devices;
+    devices.push_back(make_device("first", {"shared"}));
+    devices.push_back(make_device("second", {"shared", "other"}));
+
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+
+    Device device;
+    ASSERT_TRUE(device_from_database(
+            data.data(), data.size(), "shared", device));
+    ASSERT_EQ(device.id(), "first");
+    ASSERT_TRUE(device_from_database(
+            data.data(), data.size(), "other", device));
+    ASSERT_EQ(device.id(), "second");
+}
+
+TEST(DatabaseTest, LookupMultipleCodenamesReturnsFirstDevice)
+{
+    std::vector<Device> devices;
+    devices.push_back(make_device("first", {"build_product"}));
+    devices.push_back(make_device("second", {"product_device"}));
+
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+
+    // Same result as a linear search, regardless of the codename order
+    Device device;
+    ASSERT_TRUE(device_from_database_any(
+            data.data(), data.size(),
+            { "product_device", "build_product" }, device));
+    ASSERT_EQ(device.id(), "first");
+    ASSERT_TRUE(device_from_database_any(
+            data.data(), data.size(),
+            { "build_product", "product_device" }, device));
+    ASSERT_EQ(device.id(), "first");
+    ASSERT_TRUE(device_from_database_any(
+            data.data(), data.size(), { "", "product_device" }, device));
+    ASSERT_EQ(device.id(), "second");
+    ASSERT_FALSE(device_from_database_any(
+            data.data(), data.size(), { "", "nonexistent" }, device));
+}
+
+TEST(DatabaseTest, InvalidDevicesAreSkipped)
+{
+    std::vector<Device> devices;
+    devices.push_back(make_device("invalid", {"shared"}));
+    devices.back().set_architecture("invalid");
+    devices.push_back(make_device("valid", {"shared"}));
+
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database(devices, data));
+
+    Device device;
+    ASSERT_TRUE(device_from_database(
+            data.data(), data.size(), "shared", device));
+    ASSERT_EQ(device.id(), "valid");
+
+    // Invalid devices are still part of the full list
+    std::vector<Device> result;
+    ASSERT_TRUE(device_list_from_database(data.data(), data.size(), result));
+    ASSERT_EQ(result, devices);
+}
+
+TEST(DatabaseTest, EmptyDatabase)
+{
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database({}, data));
+
+    std::vector<Device> result;
+    ASSERT_TRUE(device_list_from_database(data.data(), data.size(), result));
+    ASSERT_TRUE(result.empty());
+
+    Device device;
+    ASSERT_FALSE(device_from_database(data.data(), data.size(), "a", device));
+}
+
+TEST(DatabaseTest, RejectInvalidData)
+{
+    std::vector<unsigned char> data;
+    ASSERT_TRUE(device_list_to_database({ make_device("a", {"a"}) }, data));
+
+    // Not a database
+    const char json[] = "[]";
+    ASSERT_FALSE(device_database_is_valid(json, sizeof(json)));
+
+    // Truncated
+    for (size_t size = 0; size < data.size(); ++size) {
+        ASSERT_FALSE(device_database_is_valid(data.data(), size));
+    }
+
+    // Unterminated string pool
+    data.back() = 'x';
+    ASSERT_FALSE(device_database_is_valid(data.data(), data.size()));
+}
@@ -167,3 +167,14 @@ TEST(DeviceTest, CheckGettersSetters)
     device.set_tw_theme("portrait_hdpi");
     ASSERT_EQ(device.tw_theme(), "portrait_hdpi");
 }
+
+TEST(DeviceTest, GettersDoNotCopy)
+{
+    Device device;
+
+    device.set_system_block_devs({"/dev/block/mmcblk0p1"});
+    device.set_tw_theme("portrait_hdpi");
+
+    ASSERT_EQ(&device.system_block_devs(), &device.system_block_devs());
+    ASSERT_EQ(device.tw_theme().data(), device.tw_theme().data());
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "mblog/base_logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define ASYNC_LOG_CAPACITY 256
+#define ASYNC_LOG_MSG_SIZE 512
+
+namespace mb
+{
+namespace log
+{
+
+class MB_EXPORT AsyncLogger : public BaseLogger
+{
+public:
+    AsyncLogger(std::shared_ptr<BaseLogger> logger);
+
+    virtual ~AsyncLogger();
+
+    virtual void log(LogLevel prio, const char *fmt, va_list ap) override;
+
+    virtual void flush() override;
+
+    static void install_crash_handler();
+
+private:
+    struct Record
+    {
+        std::atomic<size_t> seq;
+        LogLevel prio;
+        char msg[ASYNC_LOG_MSG_SIZE];
+    };
+
+    void run();
+    void write_record(LogLevel prio, const char *msg);
+
+    std::shared_ptr<BaseLogger> _logger;
+
+    std::unique_ptr<Record[]> _records;
+    std::atomic<size_t> _write_pos;
+    std::atomic<size_t> _read_pos;
+
+    std::atomic<bool> _stop;
+    std::atomic<bool> _sleeping;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _thread;
+};
+
+}
+}
@@ -32,7 +32,11 @@ namespace log
 class MB_EXPORT BaseLogger
 {
 public:
+    virtual ~BaseLogger() {}
+
     virtual void log(LogLevel prio, const char *fmt, va_list ap) = 0;
+
+    virtual void flush() {}
 };
 
 }
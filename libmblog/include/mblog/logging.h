@@ -27,17 +27,31 @@
 #include "mblog/base_logger.h"
 #include "mblog/log_level.h"
 
-#define LOGE(...) mb::log::log(mb::log::LogLevel::Error, __VA_ARGS__)
-#define LOGW(...) mb::log::log(mb::log::LogLevel::Warning, __VA_ARGS__)
-#define LOGI(...) mb::log::log(mb::log::LogLevel::Info, __VA_ARGS__)
-#define LOGD(...) mb::log::log(mb::log::LogLevel::Debug, __VA_ARGS__)
-#define LOGV(...) mb::log::log(mb::log::LogLevel::Verbose, __VA_ARGS__)
-
-#define VLOGE(...) mb::log::logv(mb::log::LogLevel::Error, __VA_ARGS__)
-#define VLOGW(...) mb::log::logv(mb::log::LogLevel::Warning, __VA_ARGS__)
-#define VLOGI(...) mb::log::logv(mb::log::LogLevel::Info, __VA_ARGS__)
-#define VLOGD(...) mb::log::logv(mb::log::LogLevel::Debug, __VA_ARGS__)
-#define VLOGV(...) mb::log::logv(mb::log::LogLevel::Verbose, __VA_ARGS__)
+// Log messages less severe than this level are compiled out. The value is the
+// ordinal of mb::log::LogLevel (0 = Error, ..., 4 = Verbose).
+#ifndef MB_LOG_COMPILE_LEVEL
+#  define MB_LOG_COMPILE_LEVEL 4
+#endif
+
+#define MB_LOG_ENABLED(PRIO) \
+    (static_cast<int>(PRIO) <= MB_LOG_COMPILE_LEVEL \
+            && mb::log::log_level_enabled(PRIO))
+
+// Arguments are not evaluated when the level is disabled
+#define MB_LOG_IF_ENABLED(FUNC, PRIO, ...) \
+    (MB_LOG_ENABLED(PRIO) ? mb::log::FUNC(PRIO, __VA_ARGS__) : (void) 0)
+
+#define LOGE(...) MB_LOG_IF_ENABLED(log, mb::log::LogLevel::Error, __VA_ARGS__)
+#define LOGW(...) MB_LOG_IF_ENABLED(log, mb::log::LogLevel::Warning, __VA_ARGS__)
+#define LOGI(...) MB_LOG_IF_ENABLED(log, mb::log::LogLevel::Info, __VA_ARGS__)
+#define LOGD(...) MB_LOG_IF_ENABLED(log, mb::log::LogLevel::Debug, __VA_ARGS__)
+#define LOGV(...) MB_LOG_IF_ENABLED(log, mb::log::LogLevel::Verbose, __VA_ARGS__)
+
+#define VLOGE(...) MB_LOG_IF_ENABLED(logv, mb::log::LogLevel::Error, __VA_ARGS__)
+#define VLOGW(...) MB_LOG_IF_ENABLED(logv, mb::log::LogLevel::Warning, __VA_ARGS__)
+#define VLOGI(...) MB_LOG_IF_ENABLED(logv, mb::log::LogLevel::Info, __VA_ARGS__)
+#define VLOGD(...) MB_LOG_IF_ENABLED(logv, mb::log::LogLevel::Debug, __VA_ARGS__)
+#define VLOGV(...) MB_LOG_IF_ENABLED(logv, mb::log::LogLevel::Verbose, __VA_ARGS__)
 
 namespace mb
 {
@@ -47,6 +61,10 @@ namespace log
 MB_EXPORT const char * get_log_tag();
 MB_EXPORT void set_log_tag(const char *tag);
 MB_EXPORT void log_set_logger(std::shared_ptr<BaseLogger> logger);
+MB_EXPORT void log_flush();
+MB_EXPORT LogLevel log_get_min_level();
+MB_EXPORT void log_set_min_level(LogLevel level);
+MB_EXPORT bool log_level_enabled(LogLevel prio);
 MB_PRINTF(2, 3)
 MB_EXPORT void log(LogLevel prio, const char *fmt, ...);
 MB_EXPORT void logv(LogLevel prio, const char *fmt, va_list ap);
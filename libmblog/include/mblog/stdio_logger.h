@@ -35,6 +35,8 @@ public:
 
     virtual void log(LogLevel prio, const char *fmt, va_list ap) override;
 
+    virtual void flush() override;
+
 private:
     std::FILE *_stream;
     bool _show_timestamps;
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+// Define MB_TRACE_ENABLED to 1 to compile in the MB_TRACE_* macros. When it is
+// not defined, they expand to nothing and their arguments are not evaluated.
+#ifndef MB_TRACE_ENABLED
+#  define MB_TRACE_ENABLED 0
+#endif
+
+#define MB_TRACE_CONCAT_INNER(A, B) A ## B
+#define MB_TRACE_CONCAT(A, B) MB_TRACE_CONCAT_INNER(A, B)
+
+#if MB_TRACE_ENABLED
+#  define MB_TRACE_SPAN(VAR, NAME) mb::log::TraceSpan VAR(NAME)
+#  define MB_TRACE_SCOPE(NAME) \
+    MB_TRACE_SPAN(MB_TRACE_CONCAT(_mb_trace_span_, __LINE__), NAME)
+#  define MB_TRACE_COUNTER(VAR, NAME, VALUE) (VAR).set_counter(NAME, VALUE)
+#else
+#  define MB_TRACE_SPAN(VAR, NAME)
+#  define MB_TRACE_SCOPE(NAME)
+#  define MB_TRACE_COUNTER(VAR, NAME, VALUE) ((void) 0)
+#endif
+
+#define MB_TRACE_MAX_COUNTERS 2
+
+namespace mb
+{
+namespace log
+{
+
+class MB_EXPORT TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name);
+    ~TraceSpan();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TraceSpan)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TraceSpan)
+
+    void set_counter(const char *name, uint64_t value);
+
+private:
+    const char *_name;
+    uint64_t _start_us;
+    const char *_counter_names[MB_TRACE_MAX_COUNTERS];
+    uint64_t _counter_values[MB_TRACE_MAX_COUNTERS];
+    size_t _counters;
+    bool _active;
+};
+
+MB_EXPORT bool trace_is_enabled();
+MB_EXPORT void trace_set_enabled(bool enabled);
+MB_EXPORT bool trace_write_json(const char *path);
+MB_EXPORT void trace_clear();
+
+}
+}
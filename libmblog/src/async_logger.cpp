@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mblog/async_logger.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#endif
+
+#include "mblog/logging.h"
+
+// Longest time the consumer sleeps without being woken up by a producer
+#define ASYNC_LOG_WAIT_MS 50
+// Longest time flush() waits for the queue to drain
+#define ASYNC_LOG_FLUSH_TIMEOUT_MS 1000
+
+static_assert((ASYNC_LOG_CAPACITY & (ASYNC_LOG_CAPACITY - 1)) == 0,
+              "ASYNC_LOG_CAPACITY must be a power of 2");
+
+namespace mb
+{
+namespace log
+{
+
+// The consumer thread does not exist in forked children, so they log
+// synchronously
+static std::atomic<bool> in_forked_child(false);
+static std::once_flag atfork_once;
+
+#ifndef _WIN32
+static void atfork_child()
+{
+    in_forked_child.store(true, std::memory_order_relaxed);
+}
+#endif
+
+MB_PRINTF(3, 4)
+static void dispatch(BaseLogger &logger, LogLevel prio, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    logger.log(prio, fmt, ap);
+    va_end(ap);
+}
+
+/*!
+ * \brief Logger that writes messages to another logger on a background thread
+ *
+ * Messages are formatted by the calling thread into a fixed size lock-free
+ * ring buffer (multiple producers, single consumer). The background thread
+ * drains the buffer and passes each message to \p logger, so \p logger does
+ * not need to be thread-safe. If the buffer is full, the caller waits for the
+ * background thread to catch up rather than dropping the message.
+ *
+ * \param logger Logger to write messages to
+ */
+AsyncLogger::AsyncLogger(std::shared_ptr<BaseLogger> logger)
+    : _logger(std::move(logger))
+    , _records(new Record[ASYNC_LOG_CAPACITY])
+    , _write_pos(0)
+    , _read_pos(0)
+    , _stop(false)
+    , _sleeping(false)
+{
+    for (size_t i = 0; i < ASYNC_LOG_CAPACITY; ++i) {
+        _records[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+#ifndef _WIN32
+    std::call_once(atfork_once, []{
+        pthread_atfork(nullptr, nullptr, &atfork_child);
+    });
+#endif
+
+    _thread = std::thread(&AsyncLogger::run, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop.store(true, std::memory_order_release);
+    }
+    _cv.notify_one();
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void AsyncLogger::log(LogLevel prio, const char *fmt, va_list ap)
+{
+    if (in_forked_child.load(std::memory_order_relaxed)) {
+        _logger->log(prio, fmt, ap);
+        return;
+    }
+
+    size_t pos = _write_pos.load(std::memory_order_relaxed);
+    Record *record;
+
+    while (true) {
+        record = &_records[pos & (ASYNC_LOG_CAPACITY - 1)];
+        size_t seq = record->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (_write_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Buffer is full. The consumer can't wait for itself, so messages
+            // logged by the underlying logger are dropped in that case.
+            if (std::this_thread::get_id() == _thread.get_id()) {
+                return;
+            }
+            std::this_thread::yield();
+            pos = _write_pos.load(std::memory_order_relaxed);
+        } else {
+            pos = _write_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    int len = vsnprintf(record->msg, sizeof(record->msg), fmt, ap);
+
+    // Make user aware of any truncation
+    if (len >= static_cast<int>(sizeof(record->msg))) {
+        static const char trunc[] = " [trunc...]";
+        memcpy(record->msg + sizeof(record->msg) - sizeof(trunc),
+               trunc, sizeof(trunc));
+    } else if (len < 0) {
+        record->msg[0] = '\0';
+    }
+
+    record->prio = prio;
+    record->seq.store(pos + 1, std::memory_order_release);
+
+    if (_sleeping.load(std::memory_order_acquire)) {
+        _cv.notify_one();
+    }
+}
+
+/*!
+ * \brief Wait for all messages logged so far to be written
+ *
+ * This polls instead of blocking on a condition variable so that it can be
+ * called from a fatal signal handler. It gives up after
+ * ASYNC_LOG_FLUSH_TIMEOUT_MS milliseconds.
+ */
+void AsyncLogger::flush()
+{
+    if (in_forked_child.load(std::memory_order_relaxed)
+            || std::this_thread::get_id() == _thread.get_id()) {
+        return;
+    }
+
+    size_t target = _write_pos.load(std::memory_order_acquire);
+
+    for (int i = 0; i < ASYNC_LOG_FLUSH_TIMEOUT_MS
+            && _read_pos.load(std::memory_order_acquire) < target; ++i) {
+#ifdef _WIN32
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#else
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, nullptr);
+#endif
+    }
+}
+
+void AsyncLogger::run()
+{
+    size_t pos = _read_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Record &record = _records[pos & (ASYNC_LOG_CAPACITY - 1)];
+
+        if (record.seq.load(std::memory_order_acquire) == pos + 1) {
+            dispatch(*_logger, record.prio, "%s", record.msg);
+
+            record.seq.store(pos + ASYNC_LOG_CAPACITY,
+                             std::memory_order_release);
+            _read_pos.store(++pos, std::memory_order_release);
+            continue;
+        }
+
+        if (_stop.load(std::memory_order_acquire)
+                && pos == _write_pos.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        _logger->flush();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.store(true, std::memory_order_release);
+
+        // A producer may have published a record after we checked. Its
+        // wakeup can be missed, so bound the wait.
+        if (record.seq.load(std::memory_order_acquire) != pos + 1
+                && !_stop.load(std::memory_order_acquire)) {
+            _cv.wait_for(lock, std::chrono::milliseconds(ASYNC_LOG_WAIT_MS));
+        }
+
+        _sleeping.store(false, std::memory_order_release);
+    }
+
+    _logger->flush();
+}
+
+#ifndef _WIN32
+static const int crash_signals[] = {
+    SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV,
+};
+static struct sigaction old_actions[sizeof(crash_signals)
+                                    / sizeof(crash_signals[0])];
+
+static void crash_handler(int signum)
+{
+    log_flush();
+
+    // Restore the previous handlers (eg. debuggerd's) and let them handle the
+    // signal once we return
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]);
+            ++i) {
+        sigaction(crash_signals[i], &old_actions[i], nullptr);
+    }
+
+    raise(signum);
+}
+#endif
+
+/*!
+ * \brief Flush the current logger when the process receives a fatal signal
+ *
+ * The previously installed handlers are restored and called afterwards.
+ */
+void AsyncLogger::install_crash_handler()
+{
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &crash_handler;
+    sigemptyset(&sa.sa_mask);
+
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]);
+            ++i) {
+        sigaction(crash_signals[i], &sa, &old_actions[i]);
+    }
+#endif
+}
+
+}
+}
@@ -19,6 +19,7 @@
 
 #include "mblog/logging.h"
 
+#include <atomic>
 #include <string>
 
 #include <cerrno>
@@ -32,6 +33,7 @@ namespace log
 
 static std::string log_tag("mblog");
 static std::shared_ptr<BaseLogger> logger;
+static std::atomic<int> min_level(static_cast<int>(LogLevel::Verbose));
 
 const char * get_log_tag()
 {
@@ -48,6 +50,40 @@ void log_set_logger(std::shared_ptr<BaseLogger> logger_local)
     logger = std::move(logger_local);
 }
 
+/*!
+ * \brief Flush messages buffered by the current logger
+ *
+ * This is safe to call from a fatal signal handler as long as the logger's
+ * flush() implementation is.
+ */
+void log_flush()
+{
+    if (logger) {
+        logger->flush();
+    }
+}
+
+LogLevel log_get_min_level()
+{
+    return static_cast<LogLevel>(min_level.load(std::memory_order_relaxed));
+}
+
+/*!
+ * \brief Set the least severe level that will be logged
+ *
+ * Messages less severe than \p level are discarded before they are
+ * formatted. The LOG* macros also skip evaluating their arguments.
+ */
+void log_set_min_level(LogLevel level)
+{
+    min_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+bool log_level_enabled(LogLevel prio)
+{
+    return static_cast<int>(prio) <= min_level.load(std::memory_order_relaxed);
+}
+
 void log(LogLevel prio, const char *fmt, ...)
 {
     va_list ap;
@@ -60,6 +96,10 @@ void log(LogLevel prio, const char *fmt, ...)
 
 void logv(LogLevel prio, const char *fmt, va_list ap)
 {
+    if (!log_level_enabled(prio)) {
+        return;
+    }
+
     int saved_errno = errno;
 
     if (!logger) {
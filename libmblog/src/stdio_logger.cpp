@@ -82,5 +82,12 @@ void StdioLogger::log(LogLevel prio, const char *fmt, va_list ap)
     fflush(_stream);
 }
 
+void StdioLogger::flush()
+{
+    if (_stream) {
+        fflush(_stream);
+    }
+}
+
 }
 }
\ No newline at end of file
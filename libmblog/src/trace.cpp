@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mblog/trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "mbcommon/string.h"
+
+#include "mblog/logging.h"
+
+// Spans beyond this are dropped to bound memory usage
+#define TRACE_MAX_EVENTS_PER_THREAD 16384
+
+namespace mb
+{
+namespace log
+{
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t tid;
+    uint64_t start_us;
+    uint64_t duration_us;
+    const char *counter_names[MB_TRACE_MAX_COUNTERS];
+    uint64_t counter_values[MB_TRACE_MAX_COUNTERS];
+    size_t counters;
+};
+
+struct TraceBuffer
+{
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    size_t dropped = 0;
+};
+
+static std::atomic<bool> trace_enabled(false);
+
+// Buffers are never freed so that threads can keep a plain pointer to theirs
+static std::mutex buffers_mutex;
+static std::vector<TraceBuffer *> buffers;
+
+static thread_local TraceBuffer *thread_buffer = nullptr;
+static thread_local uint64_t thread_id = 0;
+
+static std::once_flag atfork_once;
+
+#ifndef _WIN32
+static void atfork_child()
+{
+    // The forking thread has a new thread ID in the child
+    thread_id = 0;
+}
+#endif
+
+static uint64_t now_us()
+{
+    return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count());
+}
+
+static uint64_t current_tid()
+{
+    if (thread_id == 0) {
+#if defined(_WIN32)
+        thread_id = GetCurrentThreadId();
+#else
+        thread_id = static_cast<uint64_t>(syscall(SYS_gettid));
+#endif
+    }
+    return thread_id;
+}
+
+static TraceBuffer * current_buffer()
+{
+    if (!thread_buffer) {
+        thread_buffer = new TraceBuffer();
+        thread_buffer->events.reserve(64);
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(thread_buffer);
+    }
+    return thread_buffer;
+}
+
+/*!
+ * \brief Start a span that ends when the object is destroyed
+ *
+ * Nothing is recorded if tracing is disabled when the span starts.
+ *
+ * \param name Span name. Must be a string with static storage duration.
+ */
+TraceSpan::TraceSpan(const char *name)
+    : _name(name)
+    , _start_us(0)
+    , _counters(0)
+    , _active(trace_enabled.load(std::memory_order_relaxed))
+{
+    if (_active) {
+        _start_us = now_us();
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!_active) {
+        return;
+    }
+
+    TraceEvent event;
+    event.name = _name;
+    event.tid = current_tid();
+    event.start_us = _start_us;
+    event.duration_us = now_us() - _start_us;
+    event.counters = _counters;
+    for (size_t i = 0; i < _counters; ++i) {
+        event.counter_names[i] = _counter_names[i];
+        event.counter_values[i] = _counter_values[i];
+    }
+
+    TraceBuffer *buffer = current_buffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+
+    if (buffer->events.size() < TRACE_MAX_EVENTS_PER_THREAD) {
+        buffer->events.push_back(event);
+    } else {
+        ++buffer->dropped;
+    }
+}
+
+/*!
+ * \brief Attach a counter (eg. number of bytes processed) to the span
+ *
+ * Setting a counter with the same name again replaces its value. Counters
+ * beyond MB_TRACE_MAX_COUNTERS are ignored.
+ *
+ * \param name Counter name. Must be a string with static storage duration.
+ * \param value Counter value
+ */
+void TraceSpan::set_counter(const char *name, uint64_t value)
+{
+    if (!_active) {
+        return;
+    }
+
+    for (size_t i = 0; i < _counters; ++i) {
+        if (_counter_names[i] == name) {
+            _counter_values[i] = value;
+            return;
+        }
+    }
+
+    if (_counters < MB_TRACE_MAX_COUNTERS) {
+        _counter_names[_counters] = name;
+        _counter_values[_counters] = value;
+        ++_counters;
+    }
+}
+
+bool trace_is_enabled()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+void trace_set_enabled(bool enabled)
+{
+#ifndef _WIN32
+    std::call_once(atfork_once, []{
+        pthread_atfork(nullptr, nullptr, &atfork_child);
+    });
+#endif
+
+    trace_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; ++str) {
+        unsigned char c = static_cast<unsigned char>(*str);
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/*!
+ * \brief Write recorded spans to a file in the Chrome trace event format
+ *
+ * The output can be loaded in chrome://tracing or Perfetto. Timestamps come
+ * from the monotonic clock, so traces from different processes on the same
+ * device line up. Recorded spans are kept; call trace_clear() to discard
+ * them.
+ *
+ * \param path Output file path
+ *
+ * \return Whether the file was successfully written
+ */
+bool trace_write_json(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+    bool first = true;
+    size_t dropped = 0;
+
+    fputs("{\"traceEvents\":[", fp);
+
+    {
+        std::lock_guard<std::mutex> buffers_lock(buffers_mutex);
+
+        for (TraceBuffer *buffer : buffers) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+
+            for (const TraceEvent &event : buffer->events) {
+                fputs(first ? "\n{\"name\":" : ",\n{\"name\":", fp);
+                first = false;
+
+                write_json_string(fp, event.name);
+                fprintf(fp, ",\"ph\":\"X\",\"ts\":%" PRIu64
+                        ",\"dur\":%" PRIu64 ",\"pid\":%lu,\"tid\":%" PRIu64,
+                        event.start_us, event.duration_us, pid, event.tid);
+
+                if (event.counters > 0) {
+                    fputs(",\"args\":{", fp);
+                    for (size_t i = 0; i < event.counters; ++i) {
+                        if (i > 0) {
+                            fputc(',', fp);
+                        }
+                        write_json_string(fp, event.counter_names[i]);
+                        fprintf(fp, ":%" PRIu64, event.counter_values[i]);
+                    }
+                    fputc('}', fp);
+                }
+
+                fputc('}', fp);
+            }
+
+            dropped += buffer->dropped;
+        }
+    }
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+
+    bool ret = !ferror(fp);
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+
+    if (dropped > 0) {
+        int saved_errno = errno;
+        LOGW("%s: %" MB_PRIzu " trace spans were dropped", path, dropped);
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Discard all recorded spans
+ */
+void trace_clear()
+{
+    std::lock_guard<std::mutex> buffers_lock(buffers_mutex);
+
+    for (TraceBuffer *buffer : buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+}
+
+}
+}
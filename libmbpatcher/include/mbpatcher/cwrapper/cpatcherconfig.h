@@ -35,9 +35,11 @@ MB_EXPORT /* enum ErrorCode */ int mbpatcher_config_error(const CPatcherConfig *
 
 MB_EXPORT char * mbpatcher_config_data_directory(const CPatcherConfig *pc);
 MB_EXPORT char * mbpatcher_config_temp_directory(const CPatcherConfig *pc);
+MB_EXPORT char * mbpatcher_config_cache_directory(const CPatcherConfig *pc);
 
 MB_EXPORT void mbpatcher_config_set_data_directory(CPatcherConfig *pc, char *path);
 MB_EXPORT void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path);
+MB_EXPORT void mbpatcher_config_set_cache_directory(CPatcherConfig *pc, char *path);
 
 MB_EXPORT char ** mbpatcher_config_patchers(const CPatcherConfig *pc);
 MB_EXPORT char ** mbpatcher_config_autopatchers(const CPatcherConfig *pc);
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+#include "mbpatcher/cwrapper/cpatcherinterface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*JobUpdatedCallback) (size_t, /* enum PatchJobState */ int, void *);
+typedef void (*JobDetailsUpdatedCallback) (size_t, const char *, void *);
+
+MB_EXPORT CPatchQueue * mbpatcher_patchqueue_create(CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_patchqueue_destroy(CPatchQueue *queue);
+
+MB_EXPORT unsigned int mbpatcher_patchqueue_max_jobs(const CPatchQueue *queue);
+MB_EXPORT void mbpatcher_patchqueue_set_max_jobs(CPatchQueue *queue,
+                                                 unsigned int jobs);
+
+MB_EXPORT unsigned int mbpatcher_patchqueue_max_jobs_per_disk(const CPatchQueue *queue);
+MB_EXPORT void mbpatcher_patchqueue_set_max_jobs_per_disk(CPatchQueue *queue,
+                                                          unsigned int jobs);
+
+MB_EXPORT size_t mbpatcher_patchqueue_add_job(CPatchQueue *queue,
+                                              const char *patcher_id,
+                                              const CFileInfo *info);
+MB_EXPORT void mbpatcher_patchqueue_clear(CPatchQueue *queue);
+
+MB_EXPORT size_t mbpatcher_patchqueue_job_count(const CPatchQueue *queue);
+MB_EXPORT /* enum PatchJobState */ int mbpatcher_patchqueue_job_state(const CPatchQueue *queue,
+                                                                      size_t index);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_patchqueue_job_error(const CPatchQueue *queue,
+                                                                  size_t index);
+MB_EXPORT void mbpatcher_patchqueue_job_progress(const CPatchQueue *queue,
+                                                 size_t index,
+                                                 uint64_t *bytes_out,
+                                                 uint64_t *max_bytes_out);
+
+MB_EXPORT bool mbpatcher_patchqueue_run(CPatchQueue *queue,
+                                        JobUpdatedCallback jobCb,
+                                        ProgressUpdatedCallback progressCb,
+                                        JobDetailsUpdatedCallback detailsCb,
+                                        void *userData);
+MB_EXPORT void mbpatcher_patchqueue_cancel(CPatchQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
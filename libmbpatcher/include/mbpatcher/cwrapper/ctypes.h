@@ -34,6 +34,9 @@ typedef struct CPatcher CPatcher;
 struct CAutoPatcher;
 typedef struct CAutoPatcher CAutoPatcher;
 
+struct CPatchQueue;
+typedef struct CPatchQueue CPatchQueue;
+
 #ifdef __cplusplus
 }
 #endif
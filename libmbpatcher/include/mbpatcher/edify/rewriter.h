@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+namespace patcher
+{
+
+class EdifyRewriter
+{
+public:
+    EdifyRewriter(const char *data, std::size_t size);
+
+    void replace(std::size_t offset, std::size_t size,
+                 const char *text, std::size_t text_size);
+    void replace(std::size_t offset, std::size_t size,
+                 const std::string &text);
+
+    std::size_t replacements() const;
+
+    std::size_t result_size() const;
+    std::string result() const;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EdifyRewriter)
+
+private:
+    struct Replacement
+    {
+        // Replaced range of the original data
+        std::size_t offset;
+        std::size_t size;
+        // Replacement text in m_arena
+        std::size_t text_offset;
+        std::size_t text_size;
+    };
+
+    const char *m_data;
+    std::size_t m_size;
+    std::vector<Replacement> m_replacements;
+    // Storage for the text of all replacements
+    std::string m_arena;
+    // Change in size caused by the replacements
+    std::ptrdiff_t m_delta;
+};
+
+}
+}
@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include <cstddef>
+
 #include "mbcommon/common.h"
 
 namespace mb
@@ -55,236 +57,32 @@ enum class EdifyTokenType
     Unknown
 };
 
-class EdifyToken
-{
-public:
-    virtual ~EdifyToken();
-
-    EdifyTokenType type() const;
-    virtual std::string generate() = 0;
-
-protected:
-    EdifyToken(EdifyTokenType type);
-
-private:
-    EdifyTokenType m_type;
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-// Keyword token base class
-class EdifyKeywordToken : public EdifyToken
+// Tokens do not own any data. They only refer to a range of the buffer that was
+// tokenized, so the buffer must outlive the tokens.
+struct EdifyToken
 {
-public:
-    virtual std::string generate() override;
-
-protected:
-    EdifyKeywordToken(EdifyTokenType type, std::string keyword);
-
-private:
-    std::string m_keyword;
+    EdifyTokenType type;
+    std::size_t offset;
+    std::size_t size;
 };
 
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenIf : public EdifyKeywordToken
-{
-public:
-    EdifyTokenIf();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenThen : public EdifyKeywordToken
-{
-public:
-    EdifyTokenThen();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenElse : public EdifyKeywordToken
-{
-public:
-    EdifyTokenElse();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenEndif : public EdifyKeywordToken
-{
-public:
-    EdifyTokenEndif();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenAnd : public EdifyKeywordToken
-{
-public:
-    EdifyTokenAnd();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenOr : public EdifyKeywordToken
-{
-public:
-    EdifyTokenOr();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenEquals : public EdifyKeywordToken
-{
-public:
-    EdifyTokenEquals();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenNotEquals : public EdifyKeywordToken
-{
-public:
-    EdifyTokenNotEquals();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenNot : public EdifyKeywordToken
-{
-public:
-    EdifyTokenNot();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenLeftParen : public EdifyKeywordToken
-{
-public:
-    EdifyTokenLeftParen();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenRightParen : public EdifyKeywordToken
-{
-public:
-    EdifyTokenRightParen();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenSemicolon : public EdifyKeywordToken
-{
-public:
-    EdifyTokenSemicolon();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenComma : public EdifyKeywordToken
-{
-public:
-    EdifyTokenComma();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenConcat : public EdifyKeywordToken
-{
-public:
-    EdifyTokenConcat();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenNewline : public EdifyKeywordToken
-{
-public:
-    EdifyTokenNewline();
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenWhitespace : public EdifyToken
-{
-public:
-    EdifyTokenWhitespace(std::string str);
-    virtual std::string generate() override;
-
-private:
-    std::string m_str;
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenComment : public EdifyToken
-{
-public:
-    EdifyTokenComment(std::string str);
-    virtual std::string generate() override;
-
-private:
-    std::string m_str;
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenString : public EdifyToken
-{
-public:
-    enum Type {
-        NotQuoted,
-        MakeQuoted,
-        AlreadyQuoted
-    };
-
-    EdifyTokenString(std::string str, Type type);
-    virtual std::string generate() override;
-
-    std::string unescaped_string();
-    std::string string();
-
-protected:
-    std::string m_str;
-    Type m_type;
-    bool m_quoted;
-
-    static void escape(const std::string &str, std::string *out);
-    static bool unescape(const std::string &str, std::string *out);
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-class EdifyTokenUnknown : public EdifyToken
-{
-public:
-    EdifyTokenUnknown(char c);
-    virtual std::string generate() override;
-
-private:
-    char m_char;
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
 class EdifyTokenizer
 {
 public:
     static bool tokenize(const char *data, std::size_t size,
-                         std::vector<EdifyToken *> *tokens);
-    static std::string untokenize(const std::vector<EdifyToken *> &tokens);
-    static std::string untokenize(const std::vector<EdifyToken *>::iterator &begin,
-                                  const std::vector<EdifyToken *>::iterator &end);
+                         std::vector<EdifyToken> *tokens);
+
+    static bool is_quoted(const char *data, const EdifyToken &token);
+    static bool unescape_string(const char *data, const EdifyToken &token,
+                                std::string *out);
 
-    static void dump(const std::vector<EdifyToken *> &tokens);
+    static void dump(const char *data, const std::vector<EdifyToken> &tokens);
 
 private:
     static bool is_valid_unquoted(char c);
 
     static bool next_token(const char *data, std::size_t size, std::size_t *pos,
-                           EdifyToken **token);
+                           EdifyToken *token);
 
     MB_DISABLE_DEFAULT_CONSTRUCTOR(EdifyTokenizer)
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EdifyTokenizer)
@@ -49,9 +49,11 @@ public:
 
     std::string data_directory() const;
     std::string temp_directory() const;
+    std::string cache_directory() const;
 
     void set_data_directory(std::string path);
     void set_temp_directory(std::string path);
+    void set_cache_directory(std::string path);
 
     std::vector<std::string> patchers() const;
     std::vector<std::string> auto_patchers() const;
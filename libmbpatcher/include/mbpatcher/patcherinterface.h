@@ -140,6 +140,19 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patch_files(const std::string &directory) = 0;
+
+    /*!
+     * \brief Patch a file in memory
+     *
+     * This is equivalent to patch_files(), but operates on one file that has
+     * already been read into memory instead of on an extracted directory.
+     *
+     * \param name Path of the file in the zip file (one of existing_files())
+     * \param[in,out] data Contents of the file. It is replaced with the
+     *                     patched contents.
+     */
+    virtual bool patch_data(const std::string &name,
+                            std::vector<unsigned char> *data) = 0;
 };
 
 }
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/fileinfo.h"
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchjobstate.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+class PatchQueuePrivate;
+class MB_EXPORT PatchQueue
+{
+    MB_DECLARE_PRIVATE(PatchQueue)
+
+public:
+    typedef void (*JobUpdatedCallback) (size_t, PatchJobState, void *);
+    typedef void (*ProgressUpdatedCallback) (uint64_t, uint64_t, void *);
+    typedef void (*DetailsUpdatedCallback) (size_t, const std::string &, void *);
+
+    explicit PatchQueue(PatcherConfig * const pc);
+    ~PatchQueue();
+
+    unsigned int max_jobs() const;
+    void set_max_jobs(unsigned int jobs);
+
+    unsigned int max_jobs_per_disk() const;
+    void set_max_jobs_per_disk(unsigned int jobs);
+
+    size_t add_job(const std::string &patcher_id, const FileInfo &info);
+    void clear();
+
+    size_t job_count() const;
+    PatchJobState job_state(size_t index) const;
+    ErrorCode job_error(size_t index) const;
+    void job_progress(size_t index, uint64_t *bytes_out,
+                      uint64_t *max_bytes_out) const;
+
+    bool run(JobUpdatedCallback job_cb,
+             ProgressUpdatedCallback progress_cb,
+             DetailsUpdatedCallback details_cb,
+             void *userdata);
+
+    void cancel();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchQueue)
+
+private:
+    std::unique_ptr<PatchQueuePrivate> _priv_ptr;
+};
+
+}
+}
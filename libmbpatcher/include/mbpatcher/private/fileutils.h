@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -51,6 +52,15 @@ public:
     static std::string system_temporary_dir();
 
     static std::string create_temporary_dir(const std::string &directory);
+
+    static bool file_size(const std::string &path, uint64_t *size_out);
+    static std::string volume_id(const std::string &path);
+
+    static bool clone_file(const std::string &source,
+                           const std::string &target);
+    static bool move_file(const std::string &source,
+                          const std::string &target);
+    static bool remove_file(const std::string &path);
 };
 
 }
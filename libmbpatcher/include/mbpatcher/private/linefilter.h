@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/file.h"
+
+#include "mbpatcher/errors.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+enum class LineFilterAction
+{
+    // Write the line unmodified
+    Keep,
+    // Omit the line from the output
+    Remove,
+    // Write the replacement instead of the line
+    Replace,
+};
+
+class LineFilter
+{
+public:
+    // The line does not include the newline character and is not
+    // NULL-terminated. For LineFilterAction::Replace, the callback must store
+    // the new line (without a newline character) in replacement.
+    typedef LineFilterAction (*LineCallback)(const char *line, size_t size,
+                                             std::string *replacement,
+                                             void *userdata);
+
+    static ErrorCode filter(File &input, File &output,
+                            LineCallback cb, void *userdata);
+
+    static ErrorCode filter_file(const std::string &path,
+                                 LineCallback cb, void *userdata);
+
+    static ErrorCode filter_data(std::vector<unsigned char> *data,
+                                 LineCallback cb, void *userdata);
+};
+
+}
+}
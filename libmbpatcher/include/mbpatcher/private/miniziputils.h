@@ -26,6 +26,7 @@
 #include "minizip/zip.h"
 
 #include "mbpatcher/errors.h"
+#include "mbpatcher/private/zipdirectory.h"
 
 
 namespace mb
@@ -39,6 +40,8 @@ public:
     struct ArchiveStats {
         uint64_t files;
         uint64_t total_size;
+        // All entries in central directory order, including ignored ones
+        std::vector<ZipDirectoryEntry> entries;
     };
 
     static std::string unz_error_string(int ret);
@@ -86,6 +89,11 @@ public:
                               const std::string &name,
                               const std::vector<unsigned char> &contents);
 
+    static ErrorCode add_file(zipFile zf,
+                              const std::string &name,
+                              const std::vector<unsigned char> &contents,
+                              const unz_file_info64 &fi);
+
     static ErrorCode add_file(zipFile zf,
                               const std::string &name,
                               const std::string &path);
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <openssl/sha.h>
+
+
+namespace mb
+{
+namespace patcher
+{
+
+class PatchCacheKey
+{
+public:
+    PatchCacheKey();
+
+    void add(const void *data, size_t size);
+    void add(const std::string &str);
+    void add(uint64_t value);
+    bool add_file(const std::string &path);
+    bool add_zip_central_directory(const std::string &path);
+
+    std::string digest();
+
+private:
+    SHA256_CTX m_ctx;
+};
+
+class PatchCache
+{
+public:
+    explicit PatchCache(std::string directory);
+
+    bool is_enabled() const;
+
+    std::string path(const std::string &type, const std::string &key) const;
+
+    bool contains(const std::string &type, const std::string &key) const;
+    bool get(const std::string &type, const std::string &key,
+             const std::string &target) const;
+    bool put(const std::string &type, const std::string &key,
+             const std::string &source) const;
+
+private:
+    std::string m_directory;
+};
+
+}
+}
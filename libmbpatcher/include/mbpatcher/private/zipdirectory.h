@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+#include "mbpatcher/errors.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+struct ZipDirectoryLocation
+{
+    // Number of entries
+    uint64_t entries;
+    // Offset of the central directory from the beginning of the file
+    uint64_t offset;
+    // Size of the central directory
+    uint64_t size;
+    // Number of bytes before the zip data (eg. a prepended stub)
+    uint64_t bytes_before;
+};
+
+struct ZipDirectoryEntry
+{
+    std::string name;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    // Offset of the local file header from the beginning of the file
+    uint64_t offset;
+    uint32_t crc;
+    uint32_t dos_date;
+    uint16_t method;
+};
+
+class ZipDirectory
+{
+public:
+    static bool locate(File &file, ZipDirectoryLocation *location);
+
+    static ErrorCode read(const std::string &path,
+                          std::vector<ZipDirectoryEntry> *entries);
+};
+
+}
+}
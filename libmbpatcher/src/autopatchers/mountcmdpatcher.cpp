@@ -21,8 +21,7 @@
 
 #include <cstring>
 
-#include "mbpatcher/private/fileutils.h"
-#include "mbpatcher/private/stringutils.h"
+#include "mbpatcher/private/linefilter.h"
 
 
 namespace mb
@@ -83,38 +82,39 @@ std::vector<std::string> MountCmdPatcher::existing_files() const
     return { FlashScript, InstallerScript };
 }
 
-static bool space_or_end(const char *ptr)
+static bool is_word(const char *ptr, const char *end,
+                    const char *word, size_t size)
 {
-    return !*ptr || isspace(*ptr);
+    return static_cast<size_t>(end - ptr) >= size
+            && std::memcmp(ptr, word, size) == 0
+            && (ptr + size == end || isspace(ptr[size]));
 }
 
-static bool patch_file(const std::string &path)
+static LineFilterAction filter_line(const char *line, size_t size,
+                                    std::string *replacement, void *userdata)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
-    std::vector<std::string> lines = StringUtils::split(contents, '\n');
+    (void) userdata;
 
-    for (std::string &line : lines) {
-        const char *ptr = line.data();
+    const char *end = line + size;
+    const char *ptr = line;
 
-        // Skip whitespace
-        for (; *ptr && isspace(*ptr); ++ptr);
+    // Skip whitespace
+    for (; ptr != end && isspace(*ptr); ++ptr);
 
-        if ((strncmp(ptr, "mount", 5) == 0 && space_or_end(ptr + 5))
-                || (strncmp(ptr, "umount", 6) == 0 && space_or_end(ptr + 6))) {
-            line.insert(ptr - line.data(), "/sbin/");
-        }
+    if (is_word(ptr, end, "mount", 5) || is_word(ptr, end, "umount", 6)) {
+        replacement->assign(line, ptr);
+        replacement->append("/sbin/");
+        replacement->append(ptr, end);
+        return LineFilterAction::Replace;
     }
 
-    contents = StringUtils::join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
+    return LineFilterAction::Keep;
+}
 
-    return true;
+static bool patch_file(const std::string &path)
+{
+    return LineFilter::filter_file(path, &filter_line, nullptr)
+            == ErrorCode::NoError;
 }
 
 bool MountCmdPatcher::patch_files(const std::string &directory)
@@ -126,5 +126,16 @@ bool MountCmdPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool MountCmdPatcher::patch_data(const std::string &name,
+                                 std::vector<unsigned char> *data)
+{
+    if (name == FlashScript || name == InstallerScript) {
+        LineFilter::filter_data(data, &filter_line, nullptr);
+    }
+
+    // Don't fail if an error occurs
+    return true;
+}
+
 }
 }
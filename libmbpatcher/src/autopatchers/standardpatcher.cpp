@@ -19,14 +19,17 @@
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
+#include <cstdint>
 #include <cstring>
 
+#include "mbcommon/libc/string.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 
+#include "mbpatcher/edify/rewriter.h"
 #include "mbpatcher/edify/tokenizer.h"
 #include "mbpatcher/private/fileutils.h"
-#include "mbpatcher/private/stringutils.h"
+#include "mbpatcher/private/linefilter.h"
 
 #define DUMP_DEBUG 0
 
@@ -96,273 +99,191 @@ std::vector<std::string> StandardPatcher::existing_files() const
     return { UpdaterScript, SystemTransferList };
 }
 
-static bool find_items_in_string(const std::string &haystack,
-                                 const std::vector<std::string> &needles)
+/*! \cond INTERNAL */
+enum class Partition
 {
-    for (auto const &needle : needles) {
-        if (haystack.find(needle) != std::string::npos) {
-            return true;
-        }
-    }
-
-    return false;
-}
+    None,
+    System,
+    Cache,
+    Data,
+};
 
-static bool find_function(const std::vector<EdifyToken *>::iterator begin,
-                          const std::vector<EdifyToken *>::iterator end,
-                          std::vector<EdifyToken *>::iterator *out_func_name,
-                          std::vector<EdifyToken *>::iterator *out_left_paren,
-                          std::vector<EdifyToken *>::iterator *out_right_paren)
+enum Replacement
 {
-    std::vector<EdifyToken *>::iterator func_name;
-    std::vector<EdifyToken *>::iterator left_paren;
-    std::vector<EdifyToken *>::iterator right_paren;
-
-    for (auto it = begin; it != end; ++it) {
-        // Find string representing the function name
-        if ((*it)->type() != EdifyTokenType::String) {
-            continue;
-        }
-
-        func_name = it;
+    MountSystem,
+    MountCache,
+    MountData,
+    UnmountSystem,
+    UnmountCache,
+    UnmountData,
+    FormatSystem,
+    FormatCache,
+    FormatData,
+    RemovedReboot,
+    ReplacementCount
+};
 
-        bool found_left_paren = false;
-        bool found_right_paren = false;
+// State shared by all rules while patching a script
+struct RewriteContext
+{
+    const char *data;
+    const std::vector<EdifyToken> &tokens;
+    const std::vector<std::string> &system_devs;
+    const std::vector<std::string> &cache_devs;
+    const std::vector<std::string> &data_devs;
+    // Replacement functions are formatted once and copied into the rewriter
+    std::string replacements[ReplacementCount];
+    // Reused buffer for unescaped strings
+    std::string buf;
+};
 
-        // Barring any whitespace, newlines, or comments, the function name
-        // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::Whitespace
-                    || (*it2)->type() == EdifyTokenType::Newline
-                    || (*it2)->type() == EdifyTokenType::Comment) {
-                continue;
-            } else if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                found_left_paren = true;
-                left_paren = it2;
-            }
-            break;
-        }
+// Returns the replacement for the function call or nullptr to keep it as is
+typedef const std::string * (*RewriteRule)(RewriteContext &ctx,
+                                           std::size_t left_paren,
+                                           std::size_t right_paren);
+/*! \endcond */
 
-        // If a left parenthesis was not found, then the string token was not
-        // a function name
-        if (!found_left_paren) {
-            continue;
-        }
+static bool contains(const char *haystack, std::size_t haystack_size,
+                     const char *needle, std::size_t needle_size)
+{
+    return mb_memmem(haystack, haystack_size, needle, needle_size) != nullptr;
+}
 
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = left_paren; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                ++depth;
-            } else if ((*it2)->type() == EdifyTokenType::RightParen) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                right_paren = it2;
-                break;
-            }
-        }
+static bool contains(const char *haystack, std::size_t haystack_size,
+                     const char *needle)
+{
+    return contains(haystack, haystack_size, needle, std::strlen(needle));
+}
 
-        // If a right parenthesis was not found, but the function name and left
-        // parenthesis were found, then assume there's a syntax error and bail
-        // out
-        if (!found_right_paren) {
-            return false;
+static bool find_items_in_string(const char *haystack,
+                                 std::size_t haystack_size,
+                                 const std::vector<std::string> &needles)
+{
+    for (auto const &needle : needles) {
+        if (contains(haystack, haystack_size, needle.data(), needle.size())) {
+            return true;
         }
-
-        *out_func_name = func_name;
-        *out_left_paren = left_paren;
-        *out_right_paren = right_paren;
-
-        return true;
     }
 
     return false;
 }
 
 /*!
- * \brief Replace edify function
- *
- * \param tokens List of edify tokens
- * \param func_name Function name token of the replaced function
- * \param left_paren Left parenthesis token of the replaced function
- * \param right_paren Right parenthesis token of the replaced function
- * \param replacement Replacement edify function (in string form)
+ * \brief Determine which partition a string refers to
  *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens->end() if the replacement
- *         string could not be tokenized.
+ * The string is checked for mount points and for the device's block devices.
+ * If it refers to multiple partitions, system takes precedence over cache and
+ * cache takes precedence over data.
  */
-static std::vector<EdifyToken *>::iterator
-replace_function(std::vector<EdifyToken *> *tokens,
-                 std::vector<EdifyToken *>::iterator func_name,
-                 std::vector<EdifyToken *>::iterator left_paren,
-                 std::vector<EdifyToken *>::iterator right_paren,
-                 const std::string &replacement)
-{
-    // Included for completeness' sake
-    (void) left_paren;
-
-    std::vector<EdifyToken *> replacement_tokens;
-    bool result = EdifyTokenizer::tokenize(
-            replacement.data(), replacement.size(), &replacement_tokens);
-    if (!result) {
-        LOGE("Failed to tokenize replacement function string: %s",
-             replacement.c_str());
-        return tokens->end();
+static Partition find_partition(const RewriteContext &ctx,
+                                const char *str, std::size_t size)
+{
+    if (contains(str, size, "/system")
+            || find_items_in_string(str, size, ctx.system_devs)) {
+        return Partition::System;
+    } else if (contains(str, size, "/cache")
+            || find_items_in_string(str, size, ctx.cache_devs)) {
+        return Partition::Cache;
+    } else if (contains(str, size, "/data")
+            || contains(str, size, "/userdata")
+            || find_items_in_string(str, size, ctx.data_devs)) {
+        return Partition::Data;
+    } else {
+        return Partition::None;
     }
+}
 
-    // Deallocate replaced tokens
-    for (auto it = func_name; it != right_paren; ++it) {
-        delete *it;
+static const std::string * partition_replacement(RewriteContext &ctx,
+                                                 Partition partition,
+                                                 Replacement system,
+                                                 Replacement cache,
+                                                 Replacement data)
+{
+    switch (partition) {
+    case Partition::System:
+        return &ctx.replacements[system];
+    case Partition::Cache:
+        return &ctx.replacements[cache];
+    case Partition::Data:
+        return &ctx.replacements[data];
+    default:
+        return nullptr;
     }
-    delete *right_paren;
-
-    // Remove replaced tokens
-    auto it = tokens->erase(func_name, right_paren);
-    it = tokens->erase(it);
-
-    // Add replacement tokens
-    it = tokens->insert(it, replacement_tokens.begin(),
-                        replacement_tokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += replacement_tokens.size();
-
-    return it;
 }
 
 /*!
- * \brief Replace edify mount() command
- *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \brief Find partition referenced by the first string argument that refers to
+ *        one
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * The raw (possibly quoted) string is checked.
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_mount(std::vector<EdifyToken *> *tokens,
-                    const std::vector<EdifyToken *>::iterator func_name,
-                    const std::vector<EdifyToken *>::iterator left_paren,
-                    const std::vector<EdifyToken *>::iterator right_paren,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
-{
-    // For the mount() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+static Partition find_partition_in_args(const RewriteContext &ctx,
+                                        std::size_t left_paren,
+                                        std::size_t right_paren)
+{
+    for (std::size_t i = left_paren + 1; i < right_paren; ++i) {
+        const EdifyToken &t = ctx.tokens[i];
+        if (t.type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/data"));
+        Partition partition = find_partition(ctx, ctx.data + t.offset, t.size);
+        if (partition != Partition::None) {
+            return partition;
         }
     }
-    return right_paren + 1;
+
+    return Partition::None;
 }
 
 /*!
- * \brief Replace edify unmount() command
- *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
- *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \brief Replace edify mount() command with the corresponding
+ *        update-binary-tool command
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_unmount(std::vector<EdifyToken *> *tokens,
-                      const std::vector<EdifyToken *>::iterator func_name,
-                      const std::vector<EdifyToken *>::iterator left_paren,
-                      const std::vector<EdifyToken *>::iterator right_paren,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
-{
-    // For the unmount() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
-            continue;
-        }
+static const std::string * rewrite_mount(RewriteContext &ctx,
+                                         std::size_t left_paren,
+                                         std::size_t right_paren)
+{
+    return partition_replacement(
+            ctx, find_partition_in_args(ctx, left_paren, right_paren),
+            MountSystem, MountCache, MountData);
+}
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/data"));
-        }
-    }
-    return right_paren + 1;
+/*!
+ * \brief Replace edify unmount() command with the corresponding
+ *        update-binary-tool command
+ */
+static const std::string * rewrite_unmount(RewriteContext &ctx,
+                                           std::size_t left_paren,
+                                           std::size_t right_paren)
+{
+    return partition_replacement(
+            ctx, find_partition_in_args(ctx, left_paren, right_paren),
+            UnmountSystem, UnmountCache, UnmountData);
+}
+
+/*!
+ * \brief Replace edify format() command with the corresponding
+ *        update-binary-tool command
+ */
+static const std::string * rewrite_format(RewriteContext &ctx,
+                                          std::size_t left_paren,
+                                          std::size_t right_paren)
+{
+    return partition_replacement(
+            ctx, find_partition_in_args(ctx, left_paren, right_paren),
+            FormatSystem, FormatCache, FormatData);
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
- *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * Reboot commands are removed and mount, umount, format.sh, and mke2fs commands
+ * are replaced with the corresponding update-binary-tool command.
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_run_program(std::vector<EdifyToken *> *tokens,
-                          const std::vector<EdifyToken *>::iterator func_name,
-                          const std::vector<EdifyToken *>::iterator left_paren,
-                          const std::vector<EdifyToken *>::iterator right_paren,
-                          const std::vector<std::string> &system_devs,
-                          const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+static const std::string * rewrite_run_program(RewriteContext &ctx,
+                                               std::size_t left_paren,
+                                               std::size_t right_paren)
 {
     bool found_reboot = false;
     bool found_mount = false;
@@ -373,13 +294,14 @@ replace_edify_run_program(std::vector<EdifyToken *> *tokens,
     bool is_cache = false;
     bool is_data = false;
 
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (std::size_t i = left_paren + 1; i < right_paren; ++i) {
+        const EdifyToken &t = ctx.tokens[i];
+        if (t.type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string unescaped = token->unescaped_string();
+        const std::string &unescaped = ctx.buf;
+        EdifyTokenizer::unescape_string(ctx.data, t, &ctx.buf);
 
         if (ends_with(unescaped, "reboot")) {
             found_reboot = true;
@@ -397,152 +319,286 @@ replace_edify_run_program(std::vector<EdifyToken *> *tokens,
             found_mke2fs = true;
         }
 
-        if (unescaped.find("/system") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), system_devs)) {
+        const char *str = unescaped.data();
+        std::size_t size = unescaped.size();
+
+        if (contains(str, size, "/system")
+                || find_items_in_string(str, size, ctx.system_devs)) {
             is_system = true;
         }
-        if (unescaped.find("/cache") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), cache_devs)) {
+        if (contains(str, size, "/cache")
+                || find_items_in_string(str, size, ctx.cache_devs)) {
             is_cache = true;
         }
-        if (unescaped.find("/data") != std::string::npos
-                || unescaped.find("/userdata") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), data_devs)) {
+        if (contains(str, size, "/data")
+                || contains(str, size, "/userdata")
+                || find_items_in_string(str, size, ctx.data_devs)) {
             is_data = true;
         }
     }
 
+    Partition partition = is_system ? Partition::System
+            : is_cache ? Partition::Cache
+            : is_data ? Partition::Data
+            : Partition::None;
+
     if (found_reboot) {
-        return replace_function(tokens, func_name, left_paren, right_paren,
-                                "(ui_print(\"Removed reboot command\") == 0)");
+        return &ctx.replacements[RemovedReboot];
     } else if (found_umount) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/data"));
-        }
+        return partition_replacement(ctx, partition,
+                                     UnmountSystem, UnmountCache, UnmountData);
     } else if (found_mount) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/data"));
-        }
+        return partition_replacement(ctx, partition,
+                                     MountSystem, MountCache, MountData);
     } else if (found_format_sh) {
-        return replace_function(tokens, func_name, left_paren, right_paren,
-                                format(FORMAT_FMT, "/system"));
+        return &ctx.replacements[FormatSystem];
     } else if (found_mke2fs) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/data"));
-        }
+        return partition_replacement(ctx, partition,
+                                     FormatSystem, FormatCache, FormatData);
     }
 
-    return right_paren + 1;
+    return nullptr;
 }
 
 /*!
- * \brief Replace edify delete_recursive() command
- *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
- *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \brief Replace edify delete_recursive() command for /system or /cache with
+ *        the corresponding update-binary-tool format command
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_delete_recursive(std::vector<EdifyToken *> *tokens,
-                               const std::vector<EdifyToken *>::iterator func_name,
-                               const std::vector<EdifyToken *>::iterator left_paren,
-                               const std::vector<EdifyToken *>::iterator right_paren)
-{
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+static const std::string * rewrite_delete_recursive(RewriteContext &ctx,
+                                                    std::size_t left_paren,
+                                                    std::size_t right_paren)
+{
+    for (std::size_t i = left_paren + 1; i < right_paren; ++i) {
+        const EdifyToken &t = ctx.tokens[i];
+        if (t.type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string unescaped = token->unescaped_string();
+        const std::string &unescaped = ctx.buf;
+        EdifyTokenizer::unescape_string(ctx.data, t, &ctx.buf);
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
+            return &ctx.replacements[FormatSystem];
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
+            return &ctx.replacements[FormatCache];
+        }
+    }
+
+    return nullptr;
+}
+
+/*! \cond INTERNAL */
+struct RewriteRuleEntry
+{
+    const char *name;
+    std::size_t name_size;
+    RewriteRule rule;
+};
+/*! \endcond */
+
+#define RULE(NAME, FUNC) { NAME, sizeof(NAME) - 1, FUNC }
+
+static const RewriteRuleEntry rewrite_rules[] = {
+    RULE("mount",            &rewrite_mount),
+    RULE("unmount",          &rewrite_unmount),
+    RULE("run_program",      &rewrite_run_program),
+    RULE("delete_recursive", &rewrite_delete_recursive),
+    RULE("format",           &rewrite_format),
+};
+
+#undef RULE
+
+static RewriteRule find_rule(const char *name, std::size_t size)
+{
+    for (auto const &entry : rewrite_rules) {
+        if (entry.name_size == size
+                && std::memcmp(entry.name, name, size) == 0) {
+            return entry.rule;
         }
     }
-    return right_paren + 1;
+
+    return nullptr;
 }
 
 /*!
- * \brief Replace edify format() command
+ * \brief Find the matching right parenthesis of every left parenthesis
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \return List where the element for each left parenthesis token is the index
+ *         of the matching right parenthesis token or SIZE_MAX if it is not
+ *         matched. Elements for other tokens are unspecified.
+ */
+static std::vector<std::size_t>
+match_parens(const std::vector<EdifyToken> &tokens)
+{
+    std::vector<std::size_t> matches(tokens.size(), SIZE_MAX);
+    std::vector<std::size_t> stack;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == EdifyTokenType::LeftParen) {
+            stack.push_back(i);
+        } else if (tokens[i].type == EdifyTokenType::RightParen
+                && !stack.empty()) {
+            matches[stack.back()] = i;
+            stack.pop_back();
+        }
+    }
+
+    return matches;
+}
+
+static bool is_trivia(EdifyTokenType type)
+{
+    return type == EdifyTokenType::Whitespace
+            || type == EdifyTokenType::Newline
+            || type == EdifyTokenType::Comment;
+}
+
+/*!
+ * \brief Apply all rewrite rules to a tokenized script
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * The tokens are scanned once. For every function call, the rule for the
+ * function name (if any) decides whether the whole call is replaced. The
+ * arguments of calls handled by a rule are not scanned further.
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_format(std::vector<EdifyToken *> *tokens,
-                     const std::vector<EdifyToken *>::iterator func_name,
-                     const std::vector<EdifyToken *>::iterator left_paren,
-                     const std::vector<EdifyToken *>::iterator right_paren,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
-{
-    // For the format() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+static void rewrite_functions(RewriteContext &ctx, EdifyRewriter &rewriter)
+{
+    auto const &tokens = ctx.tokens;
+    std::vector<std::size_t> matches = match_parens(tokens);
+
+    for (std::size_t i = 0; i < tokens.size();) {
+        const EdifyToken &func_name = tokens[i];
+
+        // Find string representing the function name
+        if (func_name.type != EdifyTokenType::String) {
+            ++i;
+            continue;
+        }
+
+        // Barring any whitespace, newlines, or comments, the function name
+        // should be followed by a left parenthesis
+        std::size_t left_paren = i + 1;
+        while (left_paren < tokens.size()
+                && is_trivia(tokens[left_paren].type)) {
+            ++left_paren;
+        }
+
+        // If a left parenthesis was not found, then the string token was not
+        // a function name
+        if (left_paren == tokens.size()
+                || tokens[left_paren].type != EdifyTokenType::LeftParen) {
+            ++i;
+            continue;
+        }
+
+        // If a right parenthesis was not found, but the function name and left
+        // parenthesis were found, then assume there's a syntax error and bail
+        // out
+        std::size_t right_paren = matches[left_paren];
+        if (right_paren == SIZE_MAX) {
+            break;
+        }
+
+        RewriteRule rule;
+
+        if (EdifyTokenizer::is_quoted(ctx.data, func_name)) {
+            EdifyTokenizer::unescape_string(ctx.data, func_name, &ctx.buf);
+            rule = find_rule(ctx.buf.data(), ctx.buf.size());
+        } else {
+            rule = find_rule(ctx.data + func_name.offset, func_name.size);
+        }
+
+        if (!rule) {
+            ++i;
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/data"));
+        const std::string *replacement = rule(ctx, left_paren, right_paren);
+        if (replacement) {
+            const EdifyToken &end = tokens[right_paren];
+            rewriter.replace(func_name.offset,
+                             end.offset + end.size - func_name.offset,
+                             *replacement);
         }
+
+        i = right_paren + 1;
+    }
+}
+
+/*!
+ * \brief Rewrite the mount, unmount, and format commands in an updater-script
+ *
+ * \param device Target device
+ * \param data Contents of the updater-script
+ * \param size Size of \p data
+ * \param[out] output Rewritten script or empty string if nothing was changed
+ *
+ * \return Whether the script was successfully parsed
+ */
+static bool rewrite_updater(const device::Device &device,
+                            const char *data, size_t size,
+                            std::string *output)
+{
+    output->clear();
+
+    if (size >= 2 && std::memcmp(data, "#!", 2) == 0) {
+        // Ignore any script with a shebang line
+        return true;
+    }
+
+    std::vector<EdifyToken> tokens;
+    bool result = EdifyTokenizer::tokenize(data, size, &tokens);
+    if (!result) {
+        LOGE("Failed to tokenize updater-script");
+        return false;
+    }
+
+#if DUMP_DEBUG
+    EdifyTokenizer::dump(data, tokens);
+#endif
+
+    RewriteContext ctx{
+        data,
+        tokens,
+        device.system_block_devs(),
+        device.cache_block_devs(),
+        device.data_block_devs(),
+        {
+            format(MOUNT_FMT, "/system"),
+            format(MOUNT_FMT, "/cache"),
+            format(MOUNT_FMT, "/data"),
+            format(UNMOUNT_FMT, "/system"),
+            format(UNMOUNT_FMT, "/cache"),
+            format(UNMOUNT_FMT, "/data"),
+            format(FORMAT_FMT, "/system"),
+            format(FORMAT_FMT, "/cache"),
+            format(FORMAT_FMT, "/data"),
+            "(ui_print(\"Removed reboot command\") == 0)",
+        },
+        {}
+    };
+
+    EdifyRewriter rewriter(data, size);
+    rewrite_functions(ctx, rewriter);
+
+    if (rewriter.replacements() > 0) {
+        *output = rewriter.result();
+    }
+
+    return true;
+}
+
+static LineFilterAction filter_transfer_list(const char *line, size_t size,
+                                             std::string *replacement,
+                                             void *userdata)
+{
+    (void) replacement;
+    (void) userdata;
+
+    if (size >= 6 && std::memcmp(line, "erase ", 6) == 0) {
+        return LineFilterAction::Remove;
     }
-    return right_paren + 1;
+
+    return LineFilterAction::Keep;
 }
 
 bool StandardPatcher::patch_files(const std::string &directory)
@@ -558,11 +614,40 @@ bool StandardPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool StandardPatcher::patch_data(const std::string &name,
+                                 std::vector<unsigned char> *data)
+{
+    MB_PRIVATE(StandardPatcher);
+
+    if (name == UpdaterScript) {
+        std::string output;
+
+        if (!rewrite_updater(priv->info->device(),
+                             reinterpret_cast<const char *>(data->data()),
+                             data->size(), &output)) {
+            return false;
+        }
+
+        if (!output.empty()) {
+            data->assign(output.begin(), output.end());
+        }
+    } else if (name == SystemTransferList) {
+        auto ret = LineFilter::filter_data(data, &filter_transfer_list,
+                                           nullptr);
+        if (ret != ErrorCode::NoError) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool StandardPatcher::patch_updater(const std::string &directory)
 {
     MB_PRIVATE(StandardPatcher);
 
     std::string contents;
+    std::string output;
     std::string path;
 
     path += directory;
@@ -571,77 +656,13 @@ bool StandardPatcher::patch_updater(const std::string &directory)
 
     FileUtils::read_to_string(path, &contents);
 
-    if (contents.size() >= 2 && std::memcmp(contents.data(), "#!", 2) == 0) {
-        // Ignore any script with a shebang line
-        return true;
-    }
-
-    std::vector<EdifyToken *> tokens;
-    bool result = EdifyTokenizer::tokenize(
-            contents.data(), contents.size(), &tokens);
-    if (!result) {
-        LOGE("Failed to tokenize updater-script");
+    if (!rewrite_updater(priv->info->device(), contents.data(),
+                         contents.size(), &output)) {
         return false;
     }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
-
-    auto &&device = priv->info->device();
-    auto system_devs = device.system_block_devs();
-    auto cache_devs = device.cache_block_devs();
-    auto data_devs = device.data_block_devs();
-
-    std::vector<EdifyToken *>::iterator begin = tokens.begin();
-    std::vector<EdifyToken *>::iterator end;
-
-    // TODO: Catch errors
-    while (true) {
-        end = tokens.end();
-
-        // Need to find:
-        // 1. String containing function name
-        // 2. Left parenthesis for the function
-        // 3. Right parenthesis for the function
-        std::vector<EdifyToken *>::iterator func_name;
-        std::vector<EdifyToken *>::iterator left_paren;
-        std::vector<EdifyToken *>::iterator right_paren;
-
-        if (!find_function(begin, end, &func_name, &left_paren, &right_paren)) {
-            break;
-        }
-
-        // Tokens (types are checked by findFunction())
-        EdifyTokenString *t_func_name = (EdifyTokenString *)(*func_name);
-
-        if (t_func_name->unescaped_string() == "mount") {
-            begin = replace_edify_mount(&tokens, func_name, left_paren, right_paren,
-                                        system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "unmount") {
-            begin = replace_edify_unmount(&tokens, func_name, left_paren, right_paren,
-                                          system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "run_program") {
-            begin = replace_edify_run_program(&tokens, func_name, left_paren, right_paren,
-                                              system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(&tokens, func_name, left_paren, right_paren);
-        } else if (t_func_name->unescaped_string() == "format") {
-            begin = replace_edify_format(&tokens, func_name, left_paren, right_paren,
-                                         system_devs, cache_devs, data_devs);
-        } else {
-            begin = func_name + 1;
-        }
-    }
-
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
-
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
-
-    for (EdifyToken *t : tokens) {
-        delete t;
+    if (!output.empty()) {
+        FileUtils::write_from_string(path, output);
     }
 
     return true;
@@ -649,32 +670,17 @@ bool StandardPatcher::patch_updater(const std::string &directory)
 
 bool StandardPatcher::patch_transfer_list(const std::string &directory)
 {
-    std::string contents;
     std::string path;
-    std::vector<std::string> lines;
 
     path += directory;
     path += "/";
     path += SystemTransferList;
 
-    auto ret = FileUtils::read_to_string(path, &contents);
+    auto ret = LineFilter::filter_file(path, &filter_transfer_list, nullptr);
     if (ret != ErrorCode::NoError) {
         return ret == ErrorCode::FileOpenError;
     }
 
-    lines = StringUtils::split(contents, '\n');
-
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (starts_with(*it, "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
-        }
-    }
-
-    contents = StringUtils::join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
-
     return true;
 }
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/cwrapper/cpatchqueue.h"
+
+#include <cassert>
+
+#include "mbpatcher/patchqueue.h"
+
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *q = reinterpret_cast<mb::patcher::PatchQueue *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *q = reinterpret_cast<const mb::patcher::PatchQueue *>(x);
+
+
+/*!
+ * \file cpatchqueue.h
+ * \brief C Wrapper for PatchQueue
+ *
+ * Please see the documentation for PatchQueue from the C++ API for more
+ * details. The C functions directly correspond to the PatchQueue member
+ * functions.
+ *
+ * \sa PatchQueue
+ */
+
+extern "C" {
+
+struct QueueCallbackWrapper
+{
+    JobUpdatedCallback job_cb;
+    ProgressUpdatedCallback progress_cb;
+    JobDetailsUpdatedCallback details_cb;
+    void *userdata;
+};
+
+static void job_cb_wrapper(size_t index, mb::patcher::PatchJobState state,
+                           void *userdata)
+{
+    auto *wrapper = reinterpret_cast<QueueCallbackWrapper *>(userdata);
+    if (wrapper->job_cb) {
+        wrapper->job_cb(index, static_cast<int>(state), wrapper->userdata);
+    }
+}
+
+static void queue_progress_cb_wrapper(uint64_t bytes, uint64_t max_bytes,
+                                      void *userdata)
+{
+    auto *wrapper = reinterpret_cast<QueueCallbackWrapper *>(userdata);
+    if (wrapper->progress_cb) {
+        wrapper->progress_cb(bytes, max_bytes, wrapper->userdata);
+    }
+}
+
+static void queue_details_cb_wrapper(size_t index, const std::string &text,
+                                     void *userdata)
+{
+    auto *wrapper = reinterpret_cast<QueueCallbackWrapper *>(userdata);
+    if (wrapper->details_cb) {
+        wrapper->details_cb(index, text.c_str(), wrapper->userdata);
+    }
+}
+
+/*!
+ * \brief Create a new CPatchQueue object.
+ *
+ * \note The returned object must be freed with mbpatcher_patchqueue_destroy().
+ *
+ * \param pc CPatcherConfig used for creating the patchers
+ * \return New CPatchQueue
+ */
+CPatchQueue * mbpatcher_patchqueue_create(CPatcherConfig *pc)
+{
+    assert(pc != nullptr);
+    return reinterpret_cast<CPatchQueue *>(new mb::patcher::PatchQueue(
+            reinterpret_cast<mb::patcher::PatcherConfig *>(pc)));
+}
+
+/*!
+ * \brief Destroys a CPatchQueue object.
+ *
+ * \param queue CPatchQueue to destroy
+ */
+void mbpatcher_patchqueue_destroy(CPatchQueue *queue)
+{
+    CAST(queue);
+    delete q;
+}
+
+/*!
+ * \brief Maximum number of jobs that run at the same time
+ *
+ * \param queue CPatchQueue object
+ * \return Number of jobs or 0 to use the number of CPUs
+ *
+ * \sa PatchQueue::max_jobs()
+ */
+unsigned int mbpatcher_patchqueue_max_jobs(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return q->max_jobs();
+}
+
+/*!
+ * \brief Set the maximum number of jobs that run at the same time
+ *
+ * \param queue CPatchQueue object
+ * \param jobs Number of jobs or 0 to use the number of CPUs
+ *
+ * \sa PatchQueue::set_max_jobs()
+ */
+void mbpatcher_patchqueue_set_max_jobs(CPatchQueue *queue, unsigned int jobs)
+{
+    CAST(queue);
+    q->set_max_jobs(jobs);
+}
+
+/*!
+ * \brief Maximum number of running jobs writing to the same volume
+ *
+ * \param queue CPatchQueue object
+ * \return Number of jobs or 0 for no limit
+ *
+ * \sa PatchQueue::max_jobs_per_disk()
+ */
+unsigned int mbpatcher_patchqueue_max_jobs_per_disk(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return q->max_jobs_per_disk();
+}
+
+/*!
+ * \brief Set the maximum number of running jobs writing to the same volume
+ *
+ * \param queue CPatchQueue object
+ * \param jobs Number of jobs or 0 for no limit
+ *
+ * \sa PatchQueue::set_max_jobs_per_disk()
+ */
+void mbpatcher_patchqueue_set_max_jobs_per_disk(CPatchQueue *queue,
+                                                unsigned int jobs)
+{
+    CAST(queue);
+    q->set_max_jobs_per_disk(jobs);
+}
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * \param queue CPatchQueue object
+ * \param patcher_id ID of the patcher to use
+ * \param info CFileInfo describing the file to patch. It is copied.
+ * \return Index of the new job
+ *
+ * \sa PatchQueue::add_job()
+ */
+size_t mbpatcher_patchqueue_add_job(CPatchQueue *queue,
+                                    const char *patcher_id,
+                                    const CFileInfo *info)
+{
+    CAST(queue);
+    assert(patcher_id != nullptr);
+    assert(info != nullptr);
+    return q->add_job(patcher_id,
+                      *reinterpret_cast<const mb::patcher::FileInfo *>(info));
+}
+
+/*!
+ * \brief Remove all jobs from the queue
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::clear()
+ */
+void mbpatcher_patchqueue_clear(CPatchQueue *queue)
+{
+    CAST(queue);
+    q->clear();
+}
+
+/*!
+ * \brief Number of jobs in the queue
+ *
+ * \param queue CPatchQueue object
+ * \return Number of jobs
+ *
+ * \sa PatchQueue::job_count()
+ */
+size_t mbpatcher_patchqueue_job_count(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return q->job_count();
+}
+
+/*!
+ * \brief Get the state of a job
+ *
+ * \param queue CPatchQueue object
+ * \param index Job index
+ * \return PatchJobState
+ *
+ * \sa PatchQueue::job_state()
+ */
+/* enum PatchJobState */ int mbpatcher_patchqueue_job_state(const CPatchQueue *queue,
+                                                            size_t index)
+{
+    CCAST(queue);
+    return static_cast<int>(q->job_state(index));
+}
+
+/*!
+ * \brief Get the error of a job
+ *
+ * \param queue CPatchQueue object
+ * \param index Job index
+ * \return ErrorCode
+ *
+ * \sa PatchQueue::job_error()
+ */
+/* enum ErrorCode */ int mbpatcher_patchqueue_job_error(const CPatchQueue *queue,
+                                                        size_t index)
+{
+    CCAST(queue);
+    return static_cast<int>(q->job_error(index));
+}
+
+/*!
+ * \brief Get the last progress reported by a job
+ *
+ * \param queue CPatchQueue object
+ * \param index Job index
+ * \param bytes_out Pointer to store current bytes
+ * \param max_bytes_out Pointer to store maximum bytes
+ *
+ * \sa PatchQueue::job_progress()
+ */
+void mbpatcher_patchqueue_job_progress(const CPatchQueue *queue,
+                                       size_t index,
+                                       uint64_t *bytes_out,
+                                       uint64_t *max_bytes_out)
+{
+    CCAST(queue);
+    q->job_progress(index, bytes_out, max_bytes_out);
+}
+
+/*!
+ * \brief Run all pending jobs
+ *
+ * \param queue CPatchQueue object
+ * \param jobCb Callback for receiving job state changes
+ * \param progressCb Callback for receiving the overall progress
+ * \param detailsCb Callback for receiving a job's detailed progress text
+ * \param userData Pointer to pass to callback functions
+ * \return true if all jobs succeeded, otherwise false
+ *
+ * \sa PatchQueue::run()
+ */
+bool mbpatcher_patchqueue_run(CPatchQueue *queue,
+                              JobUpdatedCallback jobCb,
+                              ProgressUpdatedCallback progressCb,
+                              JobDetailsUpdatedCallback detailsCb,
+                              void *userData)
+{
+    CAST(queue);
+
+    QueueCallbackWrapper wrapper;
+    wrapper.job_cb = jobCb;
+    wrapper.progress_cb = progressCb;
+    wrapper.details_cb = detailsCb;
+    wrapper.userdata = userData;
+
+    return q->run(&job_cb_wrapper, &queue_progress_cb_wrapper,
+                  &queue_details_cb_wrapper, &wrapper);
+}
+
+/*!
+ * \brief Cancel all running and pending jobs
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::cancel()
+ */
+void mbpatcher_patchqueue_cancel(CPatchQueue *queue)
+{
+    CAST(queue);
+    q->cancel();
+}
+
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/edify/rewriter.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace mb
+{
+namespace patcher
+{
+
+/*!
+ * \class EdifyRewriter
+ *
+ * \brief Applies replacements to an edify script in a single pass
+ *
+ * Instead of modifying the token list, callers record which byte ranges of the
+ * original script should be replaced (usually the range spanned by a set of
+ * tokens). The replacement text is copied into a single buffer owned by the
+ * rewriter. result() then builds the new script with one allocation by
+ * copying the unmodified ranges and the replacement text in order.
+ */
+
+/*!
+ * \brief Construct rewriter for script
+ *
+ * \param data Original script data (must outlive the rewriter)
+ * \param size Size of original script data
+ */
+EdifyRewriter::EdifyRewriter(const char *data, std::size_t size)
+    : m_data(data)
+    , m_size(size)
+    , m_delta(0)
+{
+}
+
+/*!
+ * \brief Replace a range of the original script
+ *
+ * \note Replacements must be added in order and must not overlap.
+ *
+ * \param offset Offset of the range in the original script
+ * \param size Size of the range
+ * \param text Replacement text (copied)
+ * \param text_size Size of replacement text
+ */
+void EdifyRewriter::replace(std::size_t offset, std::size_t size,
+                            const char *text, std::size_t text_size)
+{
+    assert(offset <= m_size && size <= m_size - offset);
+    assert(m_replacements.empty()
+            || m_replacements.back().offset + m_replacements.back().size
+                    <= offset);
+
+    m_replacements.push_back({offset, size, m_arena.size(), text_size});
+    m_arena.append(text, text_size);
+    m_delta += static_cast<std::ptrdiff_t>(text_size)
+            - static_cast<std::ptrdiff_t>(size);
+}
+
+void EdifyRewriter::replace(std::size_t offset, std::size_t size,
+                            const std::string &text)
+{
+    replace(offset, size, text.data(), text.size());
+}
+
+/*!
+ * \brief Get number of replacements
+ */
+std::size_t EdifyRewriter::replacements() const
+{
+    return m_replacements.size();
+}
+
+/*!
+ * \brief Get size of the rewritten script
+ */
+std::size_t EdifyRewriter::result_size() const
+{
+    return static_cast<std::size_t>(static_cast<std::ptrdiff_t>(m_size)
+            + m_delta);
+}
+
+/*!
+ * \brief Build the rewritten script
+ */
+std::string EdifyRewriter::result() const
+{
+    std::string out(result_size(), '\0');
+    char *ptr = &out[0];
+    std::size_t pos = 0;
+
+    for (auto const &r : m_replacements) {
+        std::memcpy(ptr, m_data + pos, r.offset - pos);
+        ptr += r.offset - pos;
+        std::memcpy(ptr, m_arena.data() + r.text_offset, r.text_size);
+        ptr += r.text_size;
+        pos = r.offset + r.size;
+    }
+
+    std::memcpy(ptr, m_data + pos, m_size - pos);
+    ptr += m_size - pos;
+
+    assert(ptr == out.data() + out.size());
+
+    return out;
+}
+
+}
+}
@@ -20,536 +20,302 @@
 #include "mbpatcher/edify/tokenizer.h"
 
 #include <cassert>
+#include <cctype>
 #include <cstring>
 
 #include "mbcommon/common.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 
-#include "mbpatcher/private/stringutils.h"
-
 namespace mb
 {
 namespace patcher
 {
 
-EdifyToken::~EdifyToken()
-{
-}
-
-EdifyToken::EdifyToken(EdifyTokenType type) : m_type(type)
-{
-}
-
-EdifyTokenType EdifyToken::type() const
-{
-    return m_type;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyKeywordToken::EdifyKeywordToken(EdifyTokenType type, std::string keyword)
-    : EdifyToken(type), m_keyword(std::move(keyword))
-{
-}
-
-std::string EdifyKeywordToken::generate()
-{
-    return m_keyword;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenIf::EdifyTokenIf()
-    : EdifyKeywordToken(EdifyTokenType::If, "if")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenThen::EdifyTokenThen()
-    : EdifyKeywordToken(EdifyTokenType::Then, "then")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenElse::EdifyTokenElse()
-    : EdifyKeywordToken(EdifyTokenType::Else, "else")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenEndif::EdifyTokenEndif()
-    : EdifyKeywordToken(EdifyTokenType::Endif, "endif")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenAnd::EdifyTokenAnd()
-    : EdifyKeywordToken(EdifyTokenType::And, "&&")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenOr::EdifyTokenOr()
-    : EdifyKeywordToken(EdifyTokenType::Or, "||")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenEquals::EdifyTokenEquals()
-    : EdifyKeywordToken(EdifyTokenType::Equals, "==")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenNotEquals::EdifyTokenNotEquals()
-    : EdifyKeywordToken(EdifyTokenType::NotEquals, "!=")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenNot::EdifyTokenNot()
-    : EdifyKeywordToken(EdifyTokenType::Not, "!")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenLeftParen::EdifyTokenLeftParen()
-    : EdifyKeywordToken(EdifyTokenType::LeftParen, "(")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenRightParen::EdifyTokenRightParen()
-    : EdifyKeywordToken(EdifyTokenType::RightParen, ")")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenSemicolon::EdifyTokenSemicolon()
-    : EdifyKeywordToken(EdifyTokenType::Semicolon, ";")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenComma::EdifyTokenComma()
-    : EdifyKeywordToken(EdifyTokenType::Comma, ",")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenConcat::EdifyTokenConcat()
-    : EdifyKeywordToken(EdifyTokenType::Concat, "+")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenNewline::EdifyTokenNewline()
-    : EdifyKeywordToken(EdifyTokenType::Newline, "\n")
-{
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenWhitespace::EdifyTokenWhitespace(std::string str)
-    : EdifyToken(EdifyTokenType::Whitespace)
-{
-    assert(!str.empty());
-
-    for (char c MB_UNUSED : str) {
-        // Should never fail
-        assert(std::isspace(c));
-    }
-
-    m_str = std::move(str);
-}
-
-std::string EdifyTokenWhitespace::generate()
-{
-    return m_str;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenComment::EdifyTokenComment(std::string str)
-    : EdifyToken(EdifyTokenType::Comment), m_str(std::move(str))
-{
-}
-
-std::string EdifyTokenComment::generate()
-{
-    return '#' + m_str;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenString::EdifyTokenString(std::string str, Type type)
-    : EdifyToken(EdifyTokenType::String), m_type(type)
-{
-    switch (type) {
-    case AlreadyQuoted:
-        m_quoted = true;
-        assert(str.size() >= 2);
-        assert(str.front() == '"');
-        assert(str.back() == '"');
-        m_str = std::move(str);
-        break;
-    case NotQuoted:
-        m_quoted = false;
-        m_str = std::move(str);
-        break;
-    case MakeQuoted:
-        m_quoted = true;
-        std::string temp;
-        escape(str, &temp);
-        temp.insert(temp.begin(), '"');
-        temp.push_back('"');
-        m_str = std::move(temp);
-        break;
-    }
-}
-
-std::string EdifyTokenString::generate()
-{
-    return m_str;
-}
-
-std::string EdifyTokenString::unescaped_string()
-{
-    std::string out;
-    // TODO: Check return value
-    unescape(m_str, &out);
-    if (m_quoted && out.size() >= 2) {
-        out.pop_back();
-        out.erase(out.begin());
-    }
-    return out;
-}
-
-std::string EdifyTokenString::string()
-{
-    return m_str;
-}
-
-void EdifyTokenString::escape(const std::string &str, std::string *out)
-{
-    static const char digits[] = "0123456789abcdef";
-
-    std::string output;
-
-    for (char c : str) {
-        if (c == '\a') {
-            output += "\\a";
-        } else if (c == '\b') {
-            output += "\\b";
-        } else if (c == '\f') {
-            output += "\\f";
-        } else if (c == '\n') {
-            output += "\\n";
-        } else if (c == '\r') {
-            output += "\\r";
-        } else if (c == '\t') {
-            output += "\\t";
-        } else if (c == '\v') {
-            output += "\\v";
-        } else if (std::isprint(c)) {
-            output += c;
-        } else {
-            output += "\\x";
-            output += digits[(c >> 4) & 0xf];
-            output += digits[c & 0xf];
-        }
-    }
-
-    out->swap(output);
-}
-
 static int hex_char_to_int(char c)
 {
     if (c >= '0' && c <= '9') {
         return c - '0';
     } else if (c >= 'a' && c <= 'f') {
-        return c - 'a';
+        return c - 'a' + 10;
     } else if (c >= 'A' && c <= 'F') {
-        return c - 'A';
+        return c - 'A' + 10;
     } else {
         return -1;
     }
 }
 
-bool EdifyTokenString::unescape(const std::string &str, std::string *out)
+static bool is_space(char c)
 {
-    std::string output;
-
-    for (std::size_t i = 0; i < str.size();) {
-        char c = str[i];
-
-        if (c == '\\') {
-            if (i == str.size() - 1) {
-                // Escape character is last character
-                return false;
-            }
-
-            std::size_t new_i = i + 2;
-
-            if (str[i + 1] == 'a') {
-                output += '\a';
-            } else if (str[i + 1] == 'b') {
-                output += '\b';
-            } else if (str[i + 1] == 'f') {
-                output += '\f';
-            } else if (str[i + 1] == 'n') {
-                output += '\n';
-            } else if (str[i + 1] == 'r') {
-                output += '\r';
-            } else if (str[i + 1] == 't') {
-                output += '\t';
-            } else if (str[i + 1] == 'v') {
-                output += '\v';
-            } else if (str[i + 1] == '\\') {
-                output += '\\';
-            } else if (str[i + 1] == 'x') {
-                if (str.size() - i < 4) {
-                    // Need 4 chars: \xYY
-                    return false;
-                }
-                int digit1 = hex_char_to_int(str[i + 2]);
-                int digit2 = hex_char_to_int(str[i + 3]);
-                if (digit1 < 0 || digit2 < 0) {
-                    // One of the chars is not a valid hex character
-                    return false;
-                }
-
-                char val = (digit1 << 4) & digit2;
-                output += val;
-
-                new_i += 2;
-            } else {
-                // Invalid escape char
-                return false;
-            }
-
-            i = new_i;
-        } else {
-            output += c;
-            i += 1;
-        }
-    }
-
-    out->swap(output);
-
-    return true;
+    return std::isspace(static_cast<unsigned char>(c));
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-EdifyTokenUnknown::EdifyTokenUnknown(char c) : EdifyToken(EdifyTokenType::Unknown), m_char(c)
-{
-}
-
-std::string EdifyTokenUnknown::generate()
-{
-    return std::string(1, m_char);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
 bool EdifyTokenizer::is_valid_unquoted(char c)
 {
-    return std::isalnum(c)
+    return std::isalnum(static_cast<unsigned char>(c))
             || c == '_'
             || c == ':'
             || c == '/'
             || c == '.';
 }
 
+static bool starts_with_keyword(const char *data, std::size_t size,
+                                std::size_t pos, const char *keyword,
+                                std::size_t keyword_size)
+{
+    return size - pos >= keyword_size
+            && std::memcmp(data + pos, keyword, keyword_size) == 0;
+}
+
 bool EdifyTokenizer::next_token(const char *data, std::size_t size,
-                                std::size_t *pos, EdifyToken **token)
+                                std::size_t *pos, EdifyToken *token)
 {
     std::size_t p = *pos;
     assert(p < size);
 
-    if (size - p >= 2 && std::memcmp(data + p, "if", 2) == 0) {
-        *token = new EdifyTokenIf();
+    EdifyTokenType type;
+
+    if (starts_with_keyword(data, size, p, "if", 2)) {
+        type = EdifyTokenType::If;
         p += 2;
-    } else if (size - p >= 4 && std::memcmp(data + p, "then", 4) == 0) {
-        *token = new EdifyTokenThen();
+    } else if (starts_with_keyword(data, size, p, "then", 4)) {
+        type = EdifyTokenType::Then;
         p += 4;
-    } else if (size - p >= 4 && std::memcmp(data + p, "else", 4) == 0) {
-        *token = new EdifyTokenElse();
+    } else if (starts_with_keyword(data, size, p, "else", 4)) {
+        type = EdifyTokenType::Else;
         p += 4;
-    } else if (size - p >= 5 && std::memcmp(data + p, "endif", 5) == 0) {
-        *token = new EdifyTokenEndif();
+    } else if (starts_with_keyword(data, size, p, "endif", 5)) {
+        type = EdifyTokenType::Endif;
         p += 5;
-    } else if (size - p >= 2 && std::memcmp(data + p, "&&", 2) == 0) {
-        *token = new EdifyTokenAnd();
+    } else if (starts_with_keyword(data, size, p, "&&", 2)) {
+        type = EdifyTokenType::And;
         p += 2;
-    } else if (size - p >= 2 && std::memcmp(data + p, "||", 2) == 0) {
-        *token = new EdifyTokenOr();
+    } else if (starts_with_keyword(data, size, p, "||", 2)) {
+        type = EdifyTokenType::Or;
         p += 2;
-    } else if (size - p >= 2 && std::memcmp(data + p, "==", 2) == 0) {
-        *token = new EdifyTokenEquals();
+    } else if (starts_with_keyword(data, size, p, "==", 2)) {
+        type = EdifyTokenType::Equals;
         p += 2;
-    } else if (size - p >= 2 && std::memcmp(data + p, "!=", 2) == 0) {
-        *token = new EdifyTokenNotEquals();
+    } else if (starts_with_keyword(data, size, p, "!=", 2)) {
+        type = EdifyTokenType::NotEquals;
         p += 2;
     } else if (data[p] == '!') {
-        *token = new EdifyTokenNot();
+        type = EdifyTokenType::Not;
         p += 1;
     } else if (data[p] == '(') {
-        *token = new EdifyTokenLeftParen();
+        type = EdifyTokenType::LeftParen;
         p += 1;
     } else if (data[p] == ')') {
-        *token = new EdifyTokenRightParen();
+        type = EdifyTokenType::RightParen;
         p += 1;
     } else if (data[p] == ';') {
-        *token = new EdifyTokenSemicolon();
+        type = EdifyTokenType::Semicolon;
         p += 1;
     } else if (data[p] == ',') {
-        *token = new EdifyTokenComma();
+        type = EdifyTokenType::Comma;
         p += 1;
     } else if (data[p] == '+') {
-        *token = new EdifyTokenConcat();
+        type = EdifyTokenType::Concat;
         p += 1;
     } else if (data[p] == '\n') {
-        *token = new EdifyTokenNewline();
+        type = EdifyTokenType::Newline;
         p += 1;
-    } else if (data[p] != '\n' && std::isspace(data[p])) {
-        std::string buf;
-        buf += data[p];
+    } else if (is_space(data[p])) {
+        type = EdifyTokenType::Whitespace;
         p += 1;
-        while (size - p >= 1 && data[p] != '\n' && std::isspace(data[p])) {
-            buf += data[p];
+        while (p < size && data[p] != '\n' && is_space(data[p])) {
             p += 1;
         }
-        *token = new EdifyTokenWhitespace(std::move(buf));
     } else if (data[p] == '#') {
-        std::string buf;
-        // Omit '#' character
+        type = EdifyTokenType::Comment;
         p += 1;
-        while (size - p >= 1 && data[p] != '\n') {
-            buf += data[p];
+        while (p < size && data[p] != '\n') {
             p += 1;
         }
-        *token = new EdifyTokenComment(std::move(buf));
     } else if (is_valid_unquoted(data[p])) {
-        std::string buf;
-        buf += data[p];
+        type = EdifyTokenType::String;
         p += 1;
-        while (size - p >= 1 && is_valid_unquoted(data[p])) {
-            buf += data[p];
+        while (p < size && is_valid_unquoted(data[p])) {
             p += 1;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::NotQuoted);
     } else if (data[p] == '"') {
-        std::size_t curPos = p;
-        std::string buf;
-        buf += data[p];
+        type = EdifyTokenType::String;
         p += 1;
         bool escaped = false;
         bool terminated = false;
-        while (size - p >= 1) {
+        while (p < size) {
             if (data[p] == '\\' || escaped) {
                 escaped = !escaped;
-            } else if (!escaped && data[p] == '"') {
-                buf += data[p];
+            } else if (data[p] == '"') {
                 p += 1;
                 terminated = true;
                 break;
             }
-            buf += data[p];
             p += 1;
         }
         if (!terminated) {
-            LOGE("Unterminated quote at position %" MB_PRIzu, curPos);
+            LOGE("Unterminated quote at position %" MB_PRIzu, *pos);
             return false;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::AlreadyQuoted);
     } else {
-        *token = new EdifyTokenUnknown(data[p]);
+        type = EdifyTokenType::Unknown;
         p += 1;
     }
 
+    token->type = type;
+    token->offset = *pos;
+    token->size = p - *pos;
+
     *pos = p;
 
     return true;
 }
 
+/*!
+ * \brief Split edify script into tokens
+ *
+ * \param data Script data
+ * \param size Size of script data
+ * \param tokens Output list of tokens (not modified unless tokenizing
+ *               succeeds). The tokens refer to \p data, which must remain
+ *               valid for as long as the tokens are used.
+ *
+ * \return Whether the script was successfully tokenized
+ */
 bool EdifyTokenizer::tokenize(const char *data, std::size_t size,
-                              std::vector<EdifyToken *> *tokens)
+                              std::vector<EdifyToken> *tokens)
 {
-    std::vector<EdifyToken *> temp;
-    EdifyToken *token;
+    std::vector<EdifyToken> temp;
+    EdifyToken token;
     std::size_t pos = 0;
-    bool fail = false;
-
-    while (true) {
-        if (pos > size) {
-            LOGE("Tokenizer position exceeded data size!");
-            fail = true;
-            break;
-        } else if (pos == size) {
-            break;
-        } else if (!next_token(data, size, &pos, &token)) {
-            fail = true;
-            break;
-        }
-        temp.push_back(token);
-    }
 
-    if (fail) {
-        for (EdifyToken *t : temp) {
-            delete t;
+    // Most tokens in real scripts are a few characters long. This avoids most
+    // of the reallocations without significantly overallocating.
+    temp.reserve(size / 4);
+
+    while (pos < size) {
+        if (!next_token(data, size, &pos, &token)) {
+            return false;
         }
-        temp.clear();
-        return false;
+        temp.push_back(token);
     }
 
     tokens->swap(temp);
     return true;
 }
 
-std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken *> &tokens)
+/*!
+ * \brief Check if a string token is surrounded by quotes
+ */
+bool EdifyTokenizer::is_quoted(const char *data, const EdifyToken &token)
 {
-    std::string output;
-    for (EdifyToken *token : tokens) {
-        output += token->generate();
-    }
-    return output;
+    return token.type == EdifyTokenType::String
+            && token.size >= 2
+            && data[token.offset] == '"';
 }
 
-std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken *>::iterator &begin,
-                                       const std::vector<EdifyToken *>::iterator &end)
+/*!
+ * \brief Get the value of a string token
+ *
+ * Escape sequences are unescaped and the surrounding quotes (if any) are
+ * removed.
+ *
+ * \param data Data that was tokenized
+ * \param token String token
+ * \param out Output string (contents are replaced)
+ *
+ * \return False if the string contains an invalid escape sequence, in which
+ *         case \p out is empty. Otherwise, true.
+ */
+bool EdifyTokenizer::unescape_string(const char *data,
+                                     const EdifyToken &token,
+                                     std::string *out)
 {
-    std::string output;
-    for (auto it = begin; it != end; ++it) {
-        output += (*it)->generate();
+    const char *str = data + token.offset;
+    std::size_t size = token.size;
+
+    if (is_quoted(data, token)) {
+        str += 1;
+        size -= 2;
     }
-    return output;
+
+    out->clear();
+
+    for (std::size_t i = 0; i < size;) {
+        char c = str[i];
+
+        if (c != '\\') {
+            // Copy everything up to the next escape character at once
+            const char *end = static_cast<const char *>(
+                    std::memchr(str + i, '\\', size - i));
+            std::size_t n = end ? end - (str + i) : size - i;
+            out->append(str + i, n);
+            i += n;
+            continue;
+        }
+
+        if (i == size - 1) {
+            // Escape character is last character
+            out->clear();
+            return false;
+        }
+
+        std::size_t new_i = i + 2;
+
+        if (str[i + 1] == 'a') {
+            *out += '\a';
+        } else if (str[i + 1] == 'b') {
+            *out += '\b';
+        } else if (str[i + 1] == 'f') {
+            *out += '\f';
+        } else if (str[i + 1] == 'n') {
+            *out += '\n';
+        } else if (str[i + 1] == 'r') {
+            *out += '\r';
+        } else if (str[i + 1] == 't') {
+            *out += '\t';
+        } else if (str[i + 1] == 'v') {
+            *out += '\v';
+        } else if (str[i + 1] == '\\') {
+            *out += '\\';
+        } else if (str[i + 1] == 'x') {
+            if (size - i < 4) {
+                // Need 4 chars: \xYY
+                out->clear();
+                return false;
+            }
+            int digit1 = hex_char_to_int(str[i + 2]);
+            int digit2 = hex_char_to_int(str[i + 3]);
+            if (digit1 < 0 || digit2 < 0) {
+                // One of the chars is not a valid hex character
+                out->clear();
+                return false;
+            }
+
+            *out += static_cast<char>((digit1 << 4) | digit2);
+
+            new_i += 2;
+        } else {
+            // Invalid escape char
+            out->clear();
+            return false;
+        }
+
+        i = new_i;
+    }
+
+    return true;
 }
 
-void EdifyTokenizer::dump(const std::vector<EdifyToken *> &tokens)
+void EdifyTokenizer::dump(const char *data,
+                          const std::vector<EdifyToken> &tokens)
 {
     const char *token_name = nullptr;
 
     for (std::size_t i = 0; i < tokens.size(); ++i) {
-        EdifyToken *t = tokens[i];
+        const EdifyToken &t = tokens[i];
 
-        switch (t->type()) {
+        switch (t.type) {
         case EdifyTokenType::If:         token_name = "If";         break;
         case EdifyTokenType::Then:       token_name = "Then";       break;
         case EdifyTokenType::Else:       token_name = "Else";       break;
@@ -571,7 +337,8 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken *> &tokens)
         case EdifyTokenType::Unknown:    token_name = "Unknown";    break;
         }
 
-        LOGD("%" MB_PRIzu ": %-20s: %s", i, token_name, t->generate().c_str());
+        LOGD("%" MB_PRIzu ": %-20s: %.*s", i, token_name,
+             static_cast<int>(t.size), data + t.offset);
     }
 }
 
@@ -20,6 +20,7 @@
 #include "mbpatcher/patcherconfig.h"
 
 #include <algorithm>
+#include <mutex>
 
 #include <cassert>
 
@@ -46,11 +47,14 @@ public:
     // Directories
     std::string data_dir;
     std::string temp_dir;
+    std::string cache_dir;
 
     // Errors
     ErrorCode error;
 
-    // Created patchers
+    // Created patchers. Patchers may be created and destroyed from multiple
+    // threads when using a PatchQueue.
+    std::mutex alloc_mutex;
     std::vector<Patcher *> alloc_patchers;
     std::vector<AutoPatcher *> alloc_auto_patchers;
 };
@@ -72,12 +76,12 @@ PatcherConfig::~PatcherConfig()
     MB_PRIVATE(PatcherConfig);
 
     for (Patcher *patcher : priv->alloc_patchers) {
-        destroy_patcher(patcher);
+        delete patcher;
     }
     priv->alloc_patchers.clear();
 
     for (AutoPatcher *patcher : priv->alloc_auto_patchers) {
-        destroy_auto_patcher(patcher);
+        delete patcher;
     }
     priv->alloc_auto_patchers.clear();
 }
@@ -125,6 +129,21 @@ std::string PatcherConfig::temp_directory() const
     }
 }
 
+/*!
+ * \brief Get the cache directory
+ *
+ * Patchers that support caching store their outputs here so that patching the
+ * same file again with the same parameters is nearly free. Caching is disabled
+ * if the cache directory is empty, which is the default.
+ *
+ * \return Cache directory or empty string if caching is disabled
+ */
+std::string PatcherConfig::cache_directory() const
+{
+    MB_PRIVATE(const PatcherConfig);
+    return priv->cache_dir;
+}
+
 /*!
  * \brief Set top-level data directory
  *
@@ -150,6 +169,21 @@ void PatcherConfig::set_temp_directory(std::string path)
     priv->temp_dir = std::move(path);
 }
 
+/*!
+ * \brief Set the cache directory
+ *
+ * The directory is created when something is first added to the cache. It can
+ * be shared by multiple PatcherConfig instances and processes. Nothing is ever
+ * removed from the cache, so it is up to the caller to clean it up.
+ *
+ * \param path Path to cache directory or empty string to disable caching
+ */
+void PatcherConfig::set_cache_directory(std::string path)
+{
+    MB_PRIVATE(PatcherConfig);
+    priv->cache_dir = std::move(path);
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -199,6 +233,7 @@ Patcher * PatcherConfig::create_patcher(const std::string &id)
     }
 
     if (p != nullptr) {
+        std::lock_guard<std::mutex> lock(priv->alloc_mutex);
         priv->alloc_patchers.push_back(p);
     }
 
@@ -227,6 +262,7 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
     }
 
     if (ap != nullptr) {
+        std::lock_guard<std::mutex> lock(priv->alloc_mutex);
         priv->alloc_auto_patchers.push_back(ap);
     }
 
@@ -242,6 +278,8 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
 {
     MB_PRIVATE(PatcherConfig);
 
+    std::unique_lock<std::mutex> lock(priv->alloc_mutex);
+
     auto it = std::find(priv->alloc_patchers.begin(),
                         priv->alloc_patchers.end(),
                         patcher);
@@ -249,6 +287,8 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
     assert(it != priv->alloc_patchers.end());
 
     priv->alloc_patchers.erase(it);
+    lock.unlock();
+
     delete patcher;
 }
 
@@ -261,6 +301,8 @@ void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
 {
     MB_PRIVATE(PatcherConfig);
 
+    std::unique_lock<std::mutex> lock(priv->alloc_mutex);
+
     auto it = std::find(priv->alloc_auto_patchers.begin(),
                         priv->alloc_auto_patchers.end(),
                         patcher);
@@ -268,6 +310,8 @@ void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
     assert(it != priv->alloc_auto_patchers.end());
 
     priv->alloc_auto_patchers.erase(it);
+    lock.unlock();
+
     delete patcher;
 }
 
@@ -20,6 +20,7 @@
 #include "mbpatcher/patchers/zippatcher.h"
 
 #include <algorithm>
+#include <map>
 #include <unordered_set>
 
 #include <cassert>
@@ -34,12 +35,17 @@
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/patchcache.h"
 #include "mbpatcher/private/stringutils.h"
 
 // minizip
 #include "minizip/unzip.h"
 #include "minizip/zip.h"
 
+// Cache entry types
+#define CACHE_TYPE_OUTPUT           "zip-outputs"
+#define CACHE_TYPE_ENTRIES          "zip-entries"
+
 
 namespace mb
 {
@@ -47,6 +53,21 @@ namespace patcher
 {
 
 /*! \cond INTERNAL */
+struct CopySpec
+{
+    std::string source;
+    std::string target;
+};
+
+// File to be patched by the AutoPatchers
+struct PatchEntry
+{
+    unz_file_info64 fi;
+    std::vector<unsigned char> data;
+};
+
+typedef std::map<std::string, PatchEntry> PatchEntries;
+
 class ZipPatcherPrivate
 {
 public:
@@ -72,13 +93,28 @@ public:
     MinizipUtils::UnzCtx *z_input = nullptr;
     MinizipUtils::ZipCtx *z_output = nullptr;
     std::vector<AutoPatcher *> auto_patchers;
+    std::string device_json;
+
+    // Caching
+    std::string output_cache_key;
 
     bool patch_zip();
 
-    bool pass1(const std::string &temporary_dir,
+    bool pass1(const std::vector<ZipDirectoryEntry> &dir_entries,
+               PatchEntries &entries,
                const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
+    bool pass2(PatchEntries &entries,
                const std::unordered_set<std::string> &files);
+    bool add_patched_files(const PatchEntries &entries, zipFile zf);
+    bool add_cached_entries(const std::string &path);
+
+    std::string compute_output_cache_key(const std::vector<CopySpec> &to_copy);
+    std::string compute_entries_cache_key(
+            const PatchEntries &entries,
+            const std::unordered_set<std::string> &files);
+    bool cache_entries(const PatchCache &cache, const std::string &key,
+                       const PatchEntries &entries);
+
     bool open_input_archive();
     void close_input_archive();
     bool open_output_archive();
@@ -149,6 +185,7 @@ bool ZipPatcher::patch_file(ProgressUpdatedCallback progress_cb,
     priv->max_bytes = 0;
     priv->files = 0;
     priv->max_files = 0;
+    priv->output_cache_key.clear();
 
     bool ret = priv->patch_zip();
 
@@ -174,15 +211,20 @@ bool ZipPatcher::patch_file(ProgressUpdatedCallback progress_cb,
         return false;
     }
 
+    // The output is only cached once it is complete. Failing to add it to the
+    // cache is not an error.
+    if (ret && !priv->output_cache_key.empty()) {
+        PatchCache cache(priv->pc->cache_directory());
+        if (!cache.put(CACHE_TYPE_OUTPUT, priv->output_cache_key,
+                       priv->info->output_path())) {
+            LOGW("%s: Failed to add to cache",
+                 priv->info->output_path().c_str());
+        }
+    }
+
     return ret;
 }
 
-struct CopySpec
-{
-    std::string source;
-    std::string target;
-};
-
 bool ZipPatcherPrivate::patch_zip()
 {
     std::unordered_set<std::string> exclude_from_pass1;
@@ -209,27 +251,6 @@ bool ZipPatcherPrivate::patch_zip()
         }
     }
 
-    // Unlike the old patcher, we'll write directly to the new file
-    if (!open_output_archive()) {
-        return false;
-    }
-
-    zipFile zf = MinizipUtils::ctx_get_zip_file(z_output);
-
-    if (cancelled) return false;
-
-    MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archive_stats(info->input_path(), &stats,
-                                              std::vector<std::string>());
-    if (result != ErrorCode::NoError) {
-        error = result;
-        return false;
-    }
-
-    max_bytes = stats.total_size;
-
-    if (cancelled) return false;
-
     std::string arch_dir(pc->data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += info->device().architecture();
@@ -266,6 +287,62 @@ bool ZipPatcherPrivate::patch_zip()
                           "multiboot/binaries/" + binary});
     }
 
+    if (!device::device_to_json(info->device(), device_json)) {
+        error = ErrorCode::MemoryAllocationError;
+        return false;
+    }
+
+    // If this exact file was patched before, just use the previous output
+    PatchCache cache(pc->cache_directory());
+
+    if (cache.is_enabled()) {
+        output_cache_key = compute_output_cache_key(to_copy);
+
+        if (!output_cache_key.empty()
+                && cache.get(CACHE_TYPE_OUTPUT, output_cache_key,
+                             info->output_path())) {
+            LOGD("%s: Using cached output %s", info->input_path().c_str(),
+                 output_cache_key.c_str());
+            output_cache_key.clear();
+
+            uint64_t size = 0;
+            FileUtils::file_size(info->output_path(), &size);
+            update_details(info->output_path());
+            update_progress(size, size);
+            return true;
+        }
+    }
+
+    if (cancelled) return false;
+
+    // Older versions could leave the output as a hard link to a cached file,
+    // so it must be replaced instead of being overwritten in place
+    if (!FileUtils::remove_file(info->output_path())) {
+        error = ErrorCode::ArchiveWriteOpenError;
+        return false;
+    }
+
+    // Unlike the old patcher, we'll write directly to the new file
+    if (!open_output_archive()) {
+        return false;
+    }
+
+    zipFile zf = MinizipUtils::ctx_get_zip_file(z_output);
+
+    if (cancelled) return false;
+
+    MinizipUtils::ArchiveStats stats;
+    auto result = MinizipUtils::archive_stats(info->input_path(), &stats,
+                                              std::vector<std::string>());
+    if (result != ErrorCode::NoError) {
+        error = result;
+        return false;
+    }
+
+    max_bytes = stats.total_size;
+
+    if (cancelled) return false;
+
     // +1 for info.prop
     // +1 for device.json
     max_files = stats.files + to_copy.size() + 2;
@@ -275,12 +352,10 @@ bool ZipPatcherPrivate::patch_zip()
         return false;
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(pc->temp_directory());
+    // Files for the autopatchers are kept in memory between the passes
+    PatchEntries entries;
 
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        io::deleteRecursively(temp_dir);
+    if (!pass1(stats.entries, entries, exclude_from_pass1)) {
         return false;
     }
 
@@ -288,13 +363,10 @@ bool ZipPatcherPrivate::patch_zip()
 
     // On the second pass, run the autopatchers on the rest of the files
 
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        io::deleteRecursively(temp_dir);
+    if (!pass2(entries, exclude_from_pass1)) {
         return false;
     }
 
-    io::deleteRecursively(temp_dir);
-
     for (const CopySpec &spec : to_copy) {
         if (cancelled) return false;
 
@@ -328,15 +400,9 @@ bool ZipPatcherPrivate::patch_zip()
     update_files(++files, max_files);
     update_details("multiboot/device.json");
 
-    std::string json;
-    if (!device::device_to_json(info->device(), json)) {
-        error = ErrorCode::MemoryAllocationError;
-        return false;
-    }
-
     result = MinizipUtils::add_file(
             zf, "multiboot/device.json",
-            std::vector<unsigned char>(json.begin(), json.end()));
+            std::vector<unsigned char>(device_json.begin(), device_json.end()));
     if (result != ErrorCode::NoError) {
         error = result;
         return false;
@@ -352,24 +418,31 @@ bool ZipPatcherPrivate::patch_zip()
  *
  * This performs the following operations:
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
+ * - Files needed by an AutoPatcher are decompressed into memory.
  * - Otherwise, the file is copied directly to the output zip.
+ *
+ * The sizes come from the entries that were already read from the central
+ * directory. minizip iterates through the entries in the same order, but the
+ * name of minizip's current entry is still compared against the array so that
+ * the two can never silently go out of sync.
  */
-bool ZipPatcherPrivate::pass1(const std::string &temporary_dir,
+bool ZipPatcherPrivate::pass1(const std::vector<ZipDirectoryEntry> &dir_entries,
+                              PatchEntries &entries,
                               const std::unordered_set<std::string> &exclude)
 {
     unzFile uf = MinizipUtils::ctx_get_unz_file(z_input);
     zipFile zf = MinizipUtils::ctx_get_zip_file(z_output);
 
     int ret = unzGoToFirstFile(uf);
-    if (ret != UNZ_OK) {
-        error = ErrorCode::ArchiveReadHeaderError;
-        return false;
-    }
 
-    do {
+    for (auto const &dir_entry : dir_entries) {
         if (cancelled) return false;
 
+        if (ret != UNZ_OK) {
+            error = ErrorCode::ArchiveReadHeaderError;
+            return false;
+        }
+
         unz_file_info64 fi;
         std::string cur_file;
 
@@ -378,31 +451,45 @@ bool ZipPatcherPrivate::pass1(const std::string &temporary_dir,
             return false;
         }
 
+        if (cur_file != dir_entry.name) {
+            LOGE("%s: Expected entry %s, but minizip is at %s",
+                 info->input_path().c_str(), dir_entry.name.c_str(),
+                 cur_file.c_str());
+            error = ErrorCode::ArchiveReadHeaderError;
+            return false;
+        }
+
         update_files(++files, max_files);
         update_details(cur_file);
 
         // Skip files that should be patched and added in pass 2
         if (exclude.find(cur_file) != exclude.end()) {
-            if (!MinizipUtils::extract_file(uf, temporary_dir)) {
+            PatchEntry &entry = entries[cur_file];
+            entry.fi = fi;
+
+            if (!MinizipUtils::read_to_memory(uf, &entry.data,
+                                              &la_progress_cb, this)) {
                 error = ErrorCode::ArchiveReadDataError;
                 return false;
             }
-            continue;
-        }
+        } else {
+            // Rename the installer for mbtool
+            if (cur_file == "META-INF/com/google/android/update-binary") {
+                cur_file = "META-INF/com/google/android/update-binary.orig";
+            }
 
-        // Rename the installer for mbtool
-        if (cur_file == "META-INF/com/google/android/update-binary") {
-            cur_file = "META-INF/com/google/android/update-binary.orig";
+            if (!MinizipUtils::copy_file_raw(uf, zf, cur_file,
+                                             &la_progress_cb, this)) {
+                LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
+                error = ErrorCode::ArchiveWriteDataError;
+                return false;
+            }
         }
 
-        if (!MinizipUtils::copy_file_raw(uf, zf, cur_file, &la_progress_cb, this)) {
-            LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
-            error = ErrorCode::ArchiveWriteDataError;
-            return false;
-        }
+        bytes += dir_entry.uncompressed_size;
 
-        bytes += fi.uncompressed_size;
-    } while ((ret = unzGoToNextFile(uf)) == UNZ_OK);
+        ret = unzGoToNextFile(uf);
+    }
 
     if (ret != UNZ_END_OF_LIST_OF_FILE) {
         error = ErrorCode::ArchiveReadHeaderError;
@@ -419,44 +506,80 @@ bool ZipPatcherPrivate::pass1(const std::string &temporary_dir,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * - Patch the files in memory using the AutoPatchers and add the resulting
+ *   files to the output zip
+ *
+ * If caching is enabled, the patched files are stored in the cache as a small
+ * zip. When the same files are patched again with the same parameters, the
+ * AutoPatchers are skipped and the already compressed files are copied from
+ * the cache instead.
  */
-bool ZipPatcherPrivate::pass2(const std::string &temporary_dir,
+bool ZipPatcherPrivate::pass2(PatchEntries &entries,
                               const std::unordered_set<std::string> &files)
 {
-    zipFile zf = MinizipUtils::ctx_get_zip_file(z_output);
+    PatchCache cache(pc->cache_directory());
+    std::string key;
+
+    if (cache.is_enabled()) {
+        key = compute_entries_cache_key(entries, files);
+
+        if (!key.empty() && cache.contains(CACHE_TYPE_ENTRIES, key)) {
+            LOGD("%s: Using cached patched files %s",
+                 info->input_path().c_str(), key.c_str());
+            return add_cached_entries(cache.path(CACHE_TYPE_ENTRIES, key));
+        }
+    }
 
     for (auto *ap : auto_patchers) {
-        if (cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
-            error = ap->error();
-            return false;
+        for (auto const &file : ap->existing_files()) {
+            if (cancelled) return false;
+
+            auto it = entries.find(file);
+            if (it == entries.end()) {
+                continue;
+            }
+
+            if (!ap->patch_data(file, &it->second.data)) {
+                error = ap->error();
+                return false;
+            }
         }
     }
 
-    // TODO Headers are being discarded
+    if (cancelled) return false;
 
-    for (auto const &file : files) {
+    if (!key.empty() && cache_entries(cache, key, entries)) {
+        return add_cached_entries(cache.path(CACHE_TYPE_ENTRIES, key));
+    }
+
+    return add_patched_files(entries, MinizipUtils::ctx_get_zip_file(z_output));
+}
+
+/*!
+ * \brief Add patched files to a zip
+ *
+ * The files are added in sorted order so that the cached zips are
+ * reproducible.
+ */
+bool ZipPatcherPrivate::add_patched_files(const PatchEntries &entries,
+                                          zipFile zf)
+{
+    for (auto const &item : entries) {
         if (cancelled) return false;
 
         ErrorCode ret;
 
-        if (file == "META-INF/com/google/android/update-binary") {
+        if (item.first == "META-INF/com/google/android/update-binary") {
             ret = MinizipUtils::add_file(
                     zf,
                     "META-INF/com/google/android/update-binary.orig",
-                      temporary_dir + "/" + file);
+                    item.second.data, item.second.fi);
         } else {
             ret = MinizipUtils::add_file(
-                    zf,
-                    file,
-                      temporary_dir + "/" + file);
+                    zf, item.first, item.second.data, item.second.fi);
         }
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+        if (ret != ErrorCode::NoError) {
             error = ret;
             return false;
         }
@@ -467,6 +590,190 @@ bool ZipPatcherPrivate::pass2(const std::string &temporary_dir,
     return true;
 }
 
+/*!
+ * \brief Copy all entries of a cached zip to the output zip
+ *
+ * The entries are copied without recompressing them.
+ */
+bool ZipPatcherPrivate::add_cached_entries(const std::string &path)
+{
+    zipFile zf = MinizipUtils::ctx_get_zip_file(z_output);
+
+    MinizipUtils::UnzCtx *ctx = MinizipUtils::open_input_file(path);
+    if (!ctx) {
+        LOGE("minizip: Failed to open for reading: %s", path.c_str());
+        error = ErrorCode::ArchiveReadOpenError;
+        return false;
+    }
+
+    unzFile uf = MinizipUtils::ctx_get_unz_file(ctx);
+    bool result = true;
+
+    int ret = unzGoToFirstFile(uf);
+    while (ret == UNZ_OK) {
+        if (cancelled) {
+            result = false;
+            break;
+        }
+
+        unz_file_info64 fi;
+        std::string cur_file;
+
+        if (!MinizipUtils::get_info(uf, &fi, &cur_file)) {
+            error = ErrorCode::ArchiveReadHeaderError;
+            result = false;
+            break;
+        }
+
+        if (!MinizipUtils::copy_file_raw(uf, zf, cur_file, nullptr, nullptr)) {
+            LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
+            error = ErrorCode::ArchiveWriteDataError;
+            result = false;
+            break;
+        }
+
+        ret = unzGoToNextFile(uf);
+    }
+
+    if (result && ret != UNZ_END_OF_LIST_OF_FILE) {
+        error = ErrorCode::ArchiveReadHeaderError;
+        result = false;
+    }
+
+    MinizipUtils::close_input_file(ctx);
+
+    return result;
+}
+
+/*!
+ * \brief Compute cache key for the entire output file
+ *
+ * The key covers everything that ends up in the output: the input zip's
+ * central directory, the patcher parameters, and the files copied from the
+ * data directory.
+ *
+ * \return Cache key or empty string if it could not be computed
+ */
+std::string ZipPatcherPrivate::compute_output_cache_key(
+        const std::vector<CopySpec> &to_copy)
+{
+    PatchCacheKey key;
+
+    key.add(std::string(CACHE_TYPE_OUTPUT));
+    key.add(ZipPatcher::Id);
+    key.add(std::string(version()));
+    key.add(info->rom_id());
+    key.add(device_json);
+
+    for (auto *ap : auto_patchers) {
+        key.add(ap->id());
+    }
+
+    if (!key.add_zip_central_directory(info->input_path())) {
+        return {};
+    }
+
+    for (const CopySpec &spec : to_copy) {
+        key.add(spec.target);
+        if (!key.add_file(spec.source)) {
+            return {};
+        }
+    }
+
+    return key.digest();
+}
+
+/*!
+ * \brief Compute cache key for the files patched by the AutoPatchers
+ *
+ * Unlike the key for the entire output, this only covers the original
+ * contents of the files to be patched, so it stays the same when only the
+ * other files in the zip change.
+ *
+ * \return Cache key or empty string if it could not be computed
+ */
+std::string ZipPatcherPrivate::compute_entries_cache_key(
+        const PatchEntries &entries,
+        const std::unordered_set<std::string> &files)
+{
+    PatchCacheKey key;
+
+    key.add(std::string(CACHE_TYPE_ENTRIES));
+    key.add(ZipPatcher::Id);
+    key.add(std::string(version()));
+    key.add(info->rom_id());
+    key.add(device_json);
+
+    for (auto *ap : auto_patchers) {
+        key.add(ap->id());
+    }
+
+    std::vector<std::string> sorted(files.begin(), files.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    for (auto const &file : sorted) {
+        auto it = entries.find(file);
+        bool exists = it != entries.end();
+
+        key.add(file);
+        key.add(static_cast<uint64_t>(exists));
+
+        // Same as PatchCacheKey::add_file() so that the keys match the ones
+        // for files that were extracted to disk
+        if (exists) {
+            auto const &data = it->second.data;
+            key.add(data.data(), data.size());
+            key.add(static_cast<uint64_t>(data.size()));
+        }
+    }
+
+    return key.digest();
+}
+
+/*!
+ * \brief Store patched files in the cache
+ */
+bool ZipPatcherPrivate::cache_entries(
+        const PatchCache &cache, const std::string &key,
+        const PatchEntries &entries)
+{
+    std::string temp_dir =
+            FileUtils::create_temporary_dir(pc->temp_directory());
+    if (temp_dir.empty()) {
+        LOGW("%s: Failed to create temporary directory",
+             pc->temp_directory().c_str());
+        return false;
+    }
+
+    std::string path(temp_dir);
+    path += "/entries.zip";
+
+    MinizipUtils::ZipCtx *ctx = MinizipUtils::open_output_file(path);
+    if (!ctx) {
+        LOGW("minizip: Failed to open for writing: %s", path.c_str());
+        io::deleteRecursively(temp_dir);
+        return false;
+    }
+
+    // Errors are not fatal here since the files can still be added directly
+    ErrorCode saved_error = error;
+    bool ret = add_patched_files(entries, MinizipUtils::ctx_get_zip_file(ctx));
+    error = saved_error;
+
+    if (MinizipUtils::close_output_file(ctx) != ZIP_OK) {
+        ret = false;
+    }
+
+    if (ret && !cache.put(CACHE_TYPE_ENTRIES, key, path)) {
+        LOGW("%s: Failed to add to cache", path.c_str());
+        ret = false;
+    }
+
+    io::deleteRecursively(temp_dir);
+
+    return ret;
+}
+
 bool ZipPatcherPrivate::open_input_archive()
 {
     assert(z_input == nullptr);
@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/patchqueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cassert>
+
+#include "mblog/logging.h"
+
+#include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/fileutils.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+/*! \cond INTERNAL */
+struct PatchJob
+{
+    std::string patcher_id;
+    FileInfo info;
+
+    // Volume containing the output file
+    std::string volume;
+    // Size of the input file. Used for weighting the overall progress.
+    uint64_t weight;
+
+    PatchJobState state;
+    ErrorCode error;
+    uint64_t bytes;
+    uint64_t max_bytes;
+
+    Patcher *patcher;
+};
+
+struct PatchJobContext
+{
+    PatchQueuePrivate *priv;
+    size_t index;
+};
+
+class PatchQueuePrivate
+{
+public:
+    PatcherConfig *pc;
+
+    unsigned int max_jobs;
+    unsigned int max_jobs_per_disk;
+
+    // Job objects never move, so pointers to them remain valid while jobs
+    // are being added
+    std::vector<std::unique_ptr<PatchJob>> jobs;
+
+    // Protects everything below as well as the state of all jobs
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::unordered_map<std::string, unsigned int> volume_jobs;
+    bool running = false;
+    std::atomic_bool cancelled{false};
+
+    // Callbacks are serialized so that the caller does not need to handle
+    // concurrent invocations
+    std::mutex cb_mutex;
+    uint64_t last_progress;
+    PatchQueue::JobUpdatedCallback job_cb;
+    PatchQueue::ProgressUpdatedCallback progress_cb;
+    PatchQueue::DetailsUpdatedCallback details_cb;
+    void *userdata;
+
+    void worker();
+    void run_job(std::unique_lock<std::mutex> &lock, size_t index);
+
+    void send_job_updated(size_t index, PatchJobState state);
+    void send_progress();
+    void send_details(size_t index, const std::string &text);
+
+    static void progress_cb_wrapper(uint64_t bytes, uint64_t max_bytes,
+                                    void *userdata);
+    static void details_cb_wrapper(const std::string &text, void *userdata);
+};
+/*! \endcond */
+
+
+/*!
+ * \class PatchQueue
+ * \brief Patches multiple files in parallel
+ *
+ * Jobs are run on a bounded pool of worker threads. Since patching is mostly
+ * I/O-bound, the number of jobs writing to the same output volume can be
+ * limited separately.
+ *
+ * All callbacks are invoked from worker threads, but never concurrently.
+ */
+
+PatchQueue::PatchQueue(PatcherConfig * const pc)
+    : _priv_ptr(new PatchQueuePrivate())
+{
+    MB_PRIVATE(PatchQueue);
+    priv->pc = pc;
+    priv->max_jobs = 0;
+    priv->max_jobs_per_disk = 2;
+}
+
+PatchQueue::~PatchQueue()
+{
+    MB_PRIVATE(PatchQueue);
+    assert(!priv->running);
+}
+
+/*!
+ * \brief Maximum number of jobs that run at the same time
+ *
+ * \return Number of jobs or 0 to use the number of CPUs
+ */
+unsigned int PatchQueue::max_jobs() const
+{
+    MB_PRIVATE(const PatchQueue);
+    return priv->max_jobs;
+}
+
+/*!
+ * \brief Set the maximum number of jobs that run at the same time
+ *
+ * \param jobs Number of jobs or 0 to use the number of CPUs
+ */
+void PatchQueue::set_max_jobs(unsigned int jobs)
+{
+    MB_PRIVATE(PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    priv->max_jobs = jobs;
+}
+
+/*!
+ * \brief Maximum number of running jobs writing to the same volume
+ *
+ * \return Number of jobs or 0 for no limit
+ */
+unsigned int PatchQueue::max_jobs_per_disk() const
+{
+    MB_PRIVATE(const PatchQueue);
+    return priv->max_jobs_per_disk;
+}
+
+/*!
+ * \brief Set the maximum number of running jobs writing to the same volume
+ *
+ * The default is 2.
+ *
+ * \param jobs Number of jobs or 0 for no limit
+ */
+void PatchQueue::set_max_jobs_per_disk(unsigned int jobs)
+{
+    MB_PRIVATE(PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    priv->max_jobs_per_disk = jobs;
+}
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * Jobs may be added while the queue is running. They will be picked up by the
+ * worker threads if any are still active. Otherwise, they will remain pending
+ * until run() is called again.
+ *
+ * \param patcher_id ID of the Patcher to use
+ * \param info FileInfo describing the file to patch. It is copied.
+ *
+ * \return Index of the new job
+ */
+size_t PatchQueue::add_job(const std::string &patcher_id, const FileInfo &info)
+{
+    MB_PRIVATE(PatchQueue);
+
+    std::unique_ptr<PatchJob> job(new PatchJob());
+    job->patcher_id = patcher_id;
+    job->info.set_input_path(info.input_path());
+    job->info.set_output_path(info.output_path());
+    job->info.set_device(info.device());
+    job->info.set_rom_id(info.rom_id());
+    job->volume = FileUtils::volume_id(info.output_path());
+    if (!FileUtils::file_size(info.input_path(), &job->weight)
+            || job->weight == 0) {
+        job->weight = 1;
+    }
+    job->state = PatchJobState::Pending;
+    job->error = ErrorCode::NoError;
+    job->bytes = 0;
+    job->max_bytes = 0;
+    job->patcher = nullptr;
+
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    priv->jobs.push_back(std::move(job));
+    priv->cond.notify_one();
+
+    return priv->jobs.size() - 1;
+}
+
+/*!
+ * \brief Remove all jobs from the queue
+ *
+ * \pre The queue must not be running
+ */
+void PatchQueue::clear()
+{
+    MB_PRIVATE(PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    assert(!priv->running);
+    priv->jobs.clear();
+}
+
+/*!
+ * \brief Number of jobs in the queue
+ */
+size_t PatchQueue::job_count() const
+{
+    MB_PRIVATE(const PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    return priv->jobs.size();
+}
+
+/*!
+ * \brief Get the state of a job
+ */
+PatchJobState PatchQueue::job_state(size_t index) const
+{
+    MB_PRIVATE(const PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    assert(index < priv->jobs.size());
+    return priv->jobs[index]->state;
+}
+
+/*!
+ * \brief Get the error of a job
+ *
+ * \note The returned ErrorCode is only valid if the job has failed.
+ */
+ErrorCode PatchQueue::job_error(size_t index) const
+{
+    MB_PRIVATE(const PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    assert(index < priv->jobs.size());
+    return priv->jobs[index]->error;
+}
+
+/*!
+ * \brief Get the last progress reported by a job's patcher
+ */
+void PatchQueue::job_progress(size_t index, uint64_t *bytes_out,
+                              uint64_t *max_bytes_out) const
+{
+    MB_PRIVATE(const PatchQueue);
+    std::lock_guard<std::mutex> lock(priv->mutex);
+    assert(index < priv->jobs.size());
+    *bytes_out = priv->jobs[index]->bytes;
+    *max_bytes_out = priv->jobs[index]->max_bytes;
+}
+
+/*!
+ * \brief Run all pending jobs
+ *
+ * This method blocks until all pending jobs have finished or the queue is
+ * cancelled. The calling thread is used as one of the workers.
+ *
+ * The overall progress is reported in units of input bytes. A job's share is
+ * its input file size and it counts fully once the job is no longer running,
+ * regardless of whether it succeeded.
+ *
+ * \param job_cb Callback for receiving job state changes
+ * \param progress_cb Callback for receiving the overall progress
+ * \param details_cb Callback for receiving a job's detailed progress text
+ * \param userdata Pointer to pass to callback functions
+ *
+ * \return Whether all jobs in the queue succeeded
+ */
+bool PatchQueue::run(JobUpdatedCallback job_cb,
+                     ProgressUpdatedCallback progress_cb,
+                     DetailsUpdatedCallback details_cb,
+                     void *userdata)
+{
+    MB_PRIVATE(PatchQueue);
+
+    unsigned int n_workers;
+
+    {
+        std::lock_guard<std::mutex> lock(priv->mutex);
+        assert(!priv->running);
+
+        priv->running = true;
+        priv->cancelled = false;
+        priv->volume_jobs.clear();
+
+        priv->last_progress = 0;
+        priv->job_cb = job_cb;
+        priv->progress_cb = progress_cb;
+        priv->details_cb = details_cb;
+        priv->userdata = userdata;
+
+        n_workers = priv->max_jobs;
+        if (n_workers == 0) {
+            n_workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        size_t pending = std::count_if(
+                priv->jobs.begin(), priv->jobs.end(),
+                [](const std::unique_ptr<PatchJob> &job) {
+                    return job->state == PatchJobState::Pending;
+                });
+        n_workers = std::max<size_t>(1, std::min<size_t>(n_workers, pending));
+    }
+
+    LOGD("Running patch queue with %u workers", n_workers);
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < n_workers; ++i) {
+        threads.emplace_back(&PatchQueuePrivate::worker, priv);
+    }
+    priv->worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Anything left over was not started because the queue was cancelled
+    std::vector<size_t> cancelled_jobs;
+    bool ret = true;
+
+    {
+        std::lock_guard<std::mutex> lock(priv->mutex);
+
+        for (size_t i = 0; i < priv->jobs.size(); ++i) {
+            auto &job = priv->jobs[i];
+
+            if (job->state == PatchJobState::Pending && priv->cancelled) {
+                job->state = PatchJobState::Cancelled;
+                job->error = ErrorCode::PatchingCancelled;
+                cancelled_jobs.push_back(i);
+            }
+            if (job->state != PatchJobState::Succeeded) {
+                ret = false;
+            }
+        }
+    }
+
+    for (size_t index : cancelled_jobs) {
+        priv->send_job_updated(index, PatchJobState::Cancelled);
+    }
+    if (!cancelled_jobs.empty()) {
+        priv->send_progress();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(priv->mutex);
+        priv->running = false;
+        priv->job_cb = nullptr;
+        priv->progress_cb = nullptr;
+        priv->details_cb = nullptr;
+        priv->userdata = nullptr;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Cancel all running and pending jobs
+ *
+ * This method is thread-safe. run() will return once the running jobs have
+ * stopped.
+ */
+void PatchQueue::cancel()
+{
+    MB_PRIVATE(PatchQueue);
+
+    std::lock_guard<std::mutex> lock(priv->mutex);
+
+    priv->cancelled = true;
+
+    for (auto &job : priv->jobs) {
+        if (job->patcher) {
+            job->patcher->cancel_patching();
+        }
+    }
+
+    priv->cond.notify_all();
+}
+
+void PatchQueuePrivate::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!cancelled) {
+        bool have_pending = false;
+        size_t index = 0;
+
+        for (; index < jobs.size(); ++index) {
+            auto &job = jobs[index];
+
+            if (job->state != PatchJobState::Pending) {
+                continue;
+            }
+
+            have_pending = true;
+
+            if (max_jobs_per_disk == 0
+                    || volume_jobs[job->volume] < max_jobs_per_disk) {
+                break;
+            }
+        }
+
+        if (!have_pending) {
+            break;
+        } else if (index == jobs.size()) {
+            // Every pending job writes to a busy volume. One of the running
+            // jobs will wake us up once it is done.
+            cond.wait(lock);
+            continue;
+        }
+
+        run_job(lock, index);
+    }
+}
+
+// Must be called with the lock held. The lock is released while patching.
+void PatchQueuePrivate::run_job(std::unique_lock<std::mutex> &lock,
+                                size_t index)
+{
+    PatchJob *job = jobs[index].get();
+
+    job->state = PatchJobState::Running;
+    ++volume_jobs[job->volume];
+
+    lock.unlock();
+
+    send_job_updated(index, PatchJobState::Running);
+
+    Patcher *patcher = pc->create_patcher(job->patcher_id);
+    bool started = false;
+    bool ret = false;
+    ErrorCode error = ErrorCode::PatcherCreateError;
+
+    if (patcher) {
+        lock.lock();
+        job->patcher = patcher;
+        lock.unlock();
+
+        PatchJobContext ctx{this, index};
+
+        patcher->set_file_info(&job->info);
+
+        // The patcher resets its cancellation state when patching begins, so
+        // cancel() may be missed if it was called just before. The progress
+        // callback takes care of that.
+        if (!cancelled) {
+            started = true;
+            ret = patcher->patch_file(&progress_cb_wrapper, nullptr,
+                                      &details_cb_wrapper, &ctx);
+            error = ret ? ErrorCode::NoError : patcher->error();
+        } else {
+            error = ErrorCode::PatchingCancelled;
+        }
+
+        patcher->set_file_info(nullptr);
+    } else {
+        LOGE("%s: Invalid patcher ID: %s",
+             job->info.input_path().c_str(), job->patcher_id.c_str());
+    }
+
+    // Don't leave a partially written output behind since it would look like
+    // a successfully patched file
+    if (started && !ret) {
+        FileUtils::remove_file(job->info.output_path());
+    }
+
+    PatchJobState state;
+    if (ret) {
+        state = PatchJobState::Succeeded;
+    } else if (error == ErrorCode::PatchingCancelled) {
+        state = PatchJobState::Cancelled;
+    } else {
+        state = PatchJobState::Failed;
+    }
+
+    lock.lock();
+    job->patcher = nullptr;
+    job->state = state;
+    job->error = error;
+    --volume_jobs[job->volume];
+    cond.notify_all();
+    lock.unlock();
+
+    if (patcher) {
+        pc->destroy_patcher(patcher);
+    }
+
+    send_job_updated(index, state);
+    send_progress();
+
+    lock.lock();
+}
+
+void PatchQueuePrivate::send_job_updated(size_t index, PatchJobState state)
+{
+    std::lock_guard<std::mutex> lock(cb_mutex);
+
+    if (job_cb) {
+        job_cb(index, state, userdata);
+    }
+}
+
+void PatchQueuePrivate::send_progress()
+{
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto const &job : jobs) {
+            max_bytes += job->weight;
+
+            switch (job->state) {
+            case PatchJobState::Pending:
+                break;
+            case PatchJobState::Running:
+                if (job->max_bytes > 0) {
+                    bytes += static_cast<uint64_t>(
+                            static_cast<double>(job->weight)
+                            * job->bytes / job->max_bytes);
+                }
+                break;
+            default:
+                bytes += job->weight;
+                break;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(cb_mutex);
+
+    // Jobs report progress very often, so only pass on changes of at least
+    // 0.1% (or the final value). Workers may race to get here, so make sure
+    // the reported value never goes backwards.
+    if (bytes <= last_progress
+            || (bytes != max_bytes && bytes - last_progress < max_bytes / 1000)) {
+        return;
+    }
+    last_progress = bytes;
+
+    if (progress_cb) {
+        progress_cb(bytes, max_bytes, userdata);
+    }
+}
+
+void PatchQueuePrivate::send_details(size_t index, const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(cb_mutex);
+
+    if (details_cb) {
+        details_cb(index, text, userdata);
+    }
+}
+
+void PatchQueuePrivate::progress_cb_wrapper(uint64_t bytes, uint64_t max_bytes,
+                                            void *userdata)
+{
+    auto *ctx = static_cast<PatchJobContext *>(userdata);
+    auto *priv = ctx->priv;
+
+    {
+        std::lock_guard<std::mutex> lock(priv->mutex);
+        PatchJob *job = priv->jobs[ctx->index].get();
+        job->bytes = bytes;
+        job->max_bytes = max_bytes;
+
+        if (priv->cancelled && job->patcher) {
+            job->patcher->cancel_patching();
+        }
+    }
+
+    priv->send_progress();
+}
+
+void PatchQueuePrivate::details_cb_wrapper(const std::string &text,
+                                           void *userdata)
+{
+    auto *ctx = static_cast<PatchJobContext *>(userdata);
+    ctx->priv->send_details(ctx->index, text);
+}
+
+}
+}
@@ -32,7 +32,13 @@
 #include "mbpatcher/private/win32.h"
 #include <windows.h>
 #else
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#  ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#  endif
 #endif
 
 
@@ -356,5 +362,249 @@ std::string FileUtils::create_temporary_dir(const std::string &directory)
 #endif
 }
 
+bool FileUtils::file_size(const std::string &path, uint64_t *size_out)
+{
+#ifdef _WIN32
+    std::wstring w_path;
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!utf8_to_wcs(w_path, path)
+            || !GetFileAttributesExW(w_path.c_str(), GetFileExInfoStandard,
+                                     &data)) {
+        return false;
+    }
+
+    *size_out = (static_cast<uint64_t>(data.nFileSizeHigh) << 32)
+            | data.nFileSizeLow;
+    return true;
+#else
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    *size_out = sb.st_size;
+    return true;
+#endif
+}
+
+// Returns an identifier that is the same for all paths on the same volume. The
+// path does not need to exist (the closest existing parent is used instead).
+// An empty string is returned if the volume cannot be determined.
+std::string FileUtils::volume_id(const std::string &path)
+{
+#ifdef _WIN32
+    std::wstring w_path;
+    wchar_t volume[MAX_PATH + 1];
+
+    if (!utf8_to_wcs(w_path, path)
+            || !GetVolumePathNameW(w_path.c_str(), volume,
+                                   sizeof(volume) / sizeof(volume[0]))) {
+        return {};
+    }
+
+    return wcs_to_utf8(volume);
+#else
+    std::string current(path.empty() ? "." : path);
+    struct stat sb;
+
+    while (stat(current.c_str(), &sb) < 0) {
+        auto pos = current.find_last_of('/');
+        if (pos == std::string::npos) {
+            current = ".";
+        } else if (pos == 0) {
+            current = "/";
+        } else {
+            current.resize(pos);
+        }
+
+        if ((current == "." || current == "/")
+                && stat(current.c_str(), &sb) < 0) {
+            return {};
+        }
+    }
+
+    return std::to_string(sb.st_dev);
+#endif
+}
+
+#ifndef _WIN32
+static bool copy_fd(int fd_source, int fd_target)
+{
+    char buf[10240];
+    ssize_t n;
+
+    while ((n = read(fd_source, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        for (char *ptr = buf; n > 0; ) {
+            ssize_t written = write(fd_target, ptr, n);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            ptr += written;
+            n -= written;
+        }
+    }
+
+    return true;
+}
+#endif
+
+/*!
+ * \brief Create a file with the same contents as another file
+ *
+ * On Linux, the file is reflinked if the filesystem supports it. Otherwise,
+ * the contents are copied. Hard links are never used, so either file can be
+ * modified afterwards without affecting the other.
+ *
+ * \param source Path to existing file
+ * \param target Path to new file (must not exist)
+ *
+ * \return Whether the file was successfully created
+ */
+bool FileUtils::clone_file(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+    std::wstring w_source;
+    std::wstring w_target;
+
+    if (!utf8_to_wcs(w_source, source) || !utf8_to_wcs(w_target, target)) {
+        LOGE("Failed to convert UTF-8 to WCS");
+        return false;
+    }
+
+    if (!CopyFileW(w_source.c_str(), w_target.c_str(), TRUE)) {
+        LOGE("%s: Failed to copy to %s: %s", source.c_str(), target.c_str(),
+             win32_error_to_string(GetLastError()).c_str());
+        return false;
+    }
+
+    return true;
+#else
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        LOGE("%s: Failed to open: %s", source.c_str(), strerror(errno));
+        return false;
+    }
+
+    int fd_target = open(target.c_str(),
+                         O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_target < 0) {
+        LOGE("%s: Failed to open: %s", target.c_str(), strerror(errno));
+        close(fd_source);
+        return false;
+    }
+
+#ifdef FICLONE
+    if (ioctl(fd_target, FICLONE, fd_source) == 0) {
+        close(fd_target);
+        close(fd_source);
+        return true;
+    }
+#endif
+
+    bool ret = copy_fd(fd_source, fd_target);
+    if (!ret) {
+        LOGE("%s: Failed to copy to %s: %s",
+             source.c_str(), target.c_str(), strerror(errno));
+    }
+
+    if (close(fd_target) < 0 && ret) {
+        LOGE("%s: Failed to close: %s", target.c_str(), strerror(errno));
+        ret = false;
+    }
+    close(fd_source);
+
+    if (!ret) {
+        unlink(target.c_str());
+    }
+
+    return ret;
+#endif
+}
+
+/*!
+ * \brief Atomically move a file, replacing the target if it exists
+ *
+ * \param source Path to existing file
+ * \param target New path (must be on the same volume as \p source)
+ *
+ * \return Whether the file was successfully moved
+ */
+bool FileUtils::move_file(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+    std::wstring w_source;
+    std::wstring w_target;
+
+    if (!utf8_to_wcs(w_source, source) || !utf8_to_wcs(w_target, target)) {
+        LOGE("Failed to convert UTF-8 to WCS");
+        return false;
+    }
+
+    if (!MoveFileExW(w_source.c_str(), w_target.c_str(),
+                     MOVEFILE_REPLACE_EXISTING)) {
+        LOGE("%s: Failed to move to %s: %s", source.c_str(), target.c_str(),
+             win32_error_to_string(GetLastError()).c_str());
+        return false;
+    }
+
+    return true;
+#else
+    if (rename(source.c_str(), target.c_str()) < 0) {
+        LOGE("%s: Failed to move to %s: %s", source.c_str(), target.c_str(),
+             strerror(errno));
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+/*!
+ * \brief Remove a file
+ *
+ * \param path Path to file
+ *
+ * \return True if the file was removed or did not exist. Otherwise, false.
+ */
+bool FileUtils::remove_file(const std::string &path)
+{
+#ifdef _WIN32
+    std::wstring w_path;
+
+    if (!utf8_to_wcs(w_path, path)) {
+        LOGE("%s: Failed to convert UTF-8 to WCS", path.c_str());
+        return false;
+    }
+
+    if (!DeleteFileW(w_path.c_str())
+            && GetLastError() != ERROR_FILE_NOT_FOUND) {
+        LOGE("%s: Failed to remove: %s", path.c_str(),
+             win32_error_to_string(GetLastError()).c_str());
+        return false;
+    }
+
+    return true;
+#else
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to remove: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+#endif
+}
+
 }
 }
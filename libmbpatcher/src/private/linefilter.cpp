@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/linefilter.h"
+
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mblog/logging.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+#define BUFFER_SIZE     65536
+
+
+namespace mb
+{
+namespace patcher
+{
+
+/*! \cond INTERNAL */
+class BufferedWriter
+{
+public:
+    BufferedWriter(File &file)
+        : m_file(file), m_buf(BUFFER_SIZE), m_used(0)
+    {
+    }
+
+    bool write(const char *data, size_t size)
+    {
+        if (size > m_buf.size() - m_used) {
+            if (!flush()) {
+                return false;
+            }
+
+            // Don't bother copying anything that won't fit anyway
+            if (size > m_buf.size()) {
+                return write_fully(data, size);
+            }
+        }
+
+        std::memcpy(m_buf.data() + m_used, data, size);
+        m_used += size;
+        return true;
+    }
+
+    bool flush()
+    {
+        bool ret = write_fully(m_buf.data(), m_used);
+        m_used = 0;
+        return ret;
+    }
+
+private:
+    File &m_file;
+    std::vector<char> m_buf;
+    size_t m_used;
+
+    bool write_fully(const char *data, size_t size)
+    {
+        size_t n;
+        return file_write_fully(m_file, data, size, n) && n == size;
+    }
+};
+
+struct FilterState
+{
+    BufferedWriter writer;
+    LineFilter::LineCallback cb;
+    void *userdata;
+    std::string replacement;
+    bool first;
+};
+/*! \endcond */
+
+static bool process_line(FilterState &state, const char *line, size_t size)
+{
+    switch (state.cb(line, size, &state.replacement, state.userdata)) {
+    case LineFilterAction::Remove:
+        return true;
+    case LineFilterAction::Replace:
+        line = state.replacement.data();
+        size = state.replacement.size();
+        break;
+    case LineFilterAction::Keep:
+        break;
+    }
+
+    if (!state.first && !state.writer.write("\n", 1)) {
+        return false;
+    }
+    state.first = false;
+
+    return state.writer.write(line, size);
+}
+
+/*!
+ * \brief Filter lines of a file
+ *
+ * The input is read in fixed-size chunks and the output is written as the
+ * lines are processed, so the memory usage only depends on the length of the
+ * longest line and not on the size of the file.
+ *
+ * The input is split at every newline character and the lines that are kept
+ * are joined with newline characters, the same as splitting with
+ * StringUtils::split() and joining with StringUtils::join(). If the input
+ * ends with a newline character, the callback is called with an empty last
+ * line.
+ *
+ * \param input File to read from
+ * \param output File to write to
+ * \param cb Callback to call for every line
+ * \param userdata User data pointer to pass to \p cb
+ *
+ * \return ErrorCode::NoError if successful. ErrorCode::FileReadError or
+ *         ErrorCode::FileWriteError if reading or writing fails.
+ */
+ErrorCode LineFilter::filter(File &input, File &output,
+                             LineCallback cb, void *userdata)
+{
+    FilterState state{BufferedWriter(output), cb, userdata, {}, true};
+    std::vector<char> buf(BUFFER_SIZE);
+    // Incomplete line at the end of the previous chunk
+    std::string partial;
+    size_t n;
+
+    while (true) {
+        if (!input.read(buf.data(), buf.size(), n)) {
+            LOGE("Failed to read data: %s", input.error_string().c_str());
+            return ErrorCode::FileReadError;
+        } else if (n == 0) {
+            break;
+        }
+
+        const char *ptr = buf.data();
+        const char *end = buf.data() + n;
+        const char *newline;
+
+        while ((newline = static_cast<const char *>(
+                std::memchr(ptr, '\n', end - ptr)))) {
+            bool ret;
+
+            if (partial.empty()) {
+                ret = process_line(state, ptr, newline - ptr);
+            } else {
+                partial.append(ptr, newline - ptr);
+                ret = process_line(state, partial.data(), partial.size());
+                partial.clear();
+            }
+
+            if (!ret) {
+                LOGE("Failed to write data: %s",
+                     output.error_string().c_str());
+                return ErrorCode::FileWriteError;
+            }
+
+            ptr = newline + 1;
+        }
+
+        partial.append(ptr, end - ptr);
+    }
+
+    if (!process_line(state, partial.data(), partial.size())
+            || !state.writer.flush()) {
+        LOGE("Failed to write data: %s", output.error_string().c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Filter lines of a file in place
+ *
+ * The output is written to a temporary file next to \p path, which then
+ * replaces the original file.
+ *
+ * \param path Path to file
+ * \param cb Callback to call for every line
+ * \param userdata User data pointer to pass to \p cb
+ *
+ * \return ErrorCode::NoError if successful. ErrorCode::FileOpenError if the
+ *         file cannot be opened. Otherwise, some other error code.
+ */
+ErrorCode LineFilter::filter_file(const std::string &path,
+                                  LineCallback cb, void *userdata)
+{
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    StandardFile input;
+    StandardFile output;
+
+    auto ret = FileUtils::open_file(input, path, FileOpenMode::READ_ONLY);
+    if (ret != ErrorCode::NoError) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), input.error_string().c_str());
+        return ret;
+    }
+
+    ret = FileUtils::open_file(output, temp_path, FileOpenMode::WRITE_ONLY);
+    if (ret != ErrorCode::NoError) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), output.error_string().c_str());
+        return ret;
+    }
+
+    ret = filter(input, output, cb, userdata);
+
+    input.close();
+
+    if (!output.close() && ret == ErrorCode::NoError) {
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), output.error_string().c_str());
+        ret = ErrorCode::FileCloseError;
+    }
+
+    if (ret == ErrorCode::NoError && !FileUtils::move_file(temp_path, path)) {
+        ret = ErrorCode::FileWriteError;
+    }
+
+    if (ret != ErrorCode::NoError) {
+        FileUtils::remove_file(temp_path);
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Filter lines of a buffer in place
+ *
+ * \param[in,out] data Buffer containing the lines to filter. It is replaced
+ *                     with the filtered data if filtering succeeds.
+ * \param cb Callback to call for every line
+ * \param userdata User data pointer to pass to \p cb
+ *
+ * \return ErrorCode::NoError if successful. Otherwise, some other error code.
+ */
+ErrorCode LineFilter::filter_data(std::vector<unsigned char> *data,
+                                  LineCallback cb, void *userdata)
+{
+    void *out_buf = nullptr;
+    size_t out_size = 0;
+
+    MemoryFile input(data->data(), data->size());
+    MemoryFile output(&out_buf, &out_size);
+
+    auto ret = filter(input, output, cb, userdata);
+
+    input.close();
+    output.close();
+
+    if (ret == ErrorCode::NoError) {
+        auto *begin = static_cast<unsigned char *>(out_buf);
+        data->assign(begin, begin + out_size);
+    }
+
+    free(out_buf);
+
+    return ret;
+}
+
+}
+}
@@ -238,56 +238,47 @@ int MinizipUtils::close_output_file(ZipCtx *ctx)
     return ret;
 }
 
+/*!
+ * \brief Get number of files and total uncompressed size of a zip
+ *
+ * The central directory is parsed directly with ZipDirectory::read(), so this
+ * only requires reading the end of the file once. The entries are also
+ * returned so that they do not have to be read again while iterating through
+ * the zip.
+ *
+ * \param path Path to zip file
+ * \param[out] stats Output statistics
+ * \param ignore Files to exclude from the file count and total size
+ *
+ * \return ErrorCode::NoError if successful. Otherwise, the error code.
+ */
 ErrorCode MinizipUtils::archive_stats(const std::string &path,
                                       MinizipUtils::ArchiveStats *stats,
                                       std::vector<std::string> ignore)
 {
     assert(stats != nullptr);
 
-    UnzCtx *ctx = open_input_file(path);
+    std::vector<ZipDirectoryEntry> entries;
 
-    if (!ctx) {
-        LOGE("miniunz: Failed to open for reading: %s", path.c_str());
-        return ErrorCode::ArchiveReadOpenError;
+    auto ret = ZipDirectory::read(path, &entries);
+    if (ret != ErrorCode::NoError) {
+        return ret;
     }
 
     uint64_t count = 0;
     uint64_t total_size = 0;
-    std::string name;
-    unz_file_info64 fi;
-    memset(&fi, 0, sizeof(fi));
-
-    int ret = unzGoToFirstFile(ctx->uf);
-    if (ret != UNZ_OK) {
-        LOGE("miniunz: Failed to move to first file: %s",
-             unz_error_string(ret).c_str());
-        close_input_file(ctx);
-        return ErrorCode::ArchiveReadHeaderError;
-    }
-
-    do {
-        if (!get_info(ctx->uf, &fi, &name)) {
-            close_input_file(ctx);
-            return ErrorCode::ArchiveReadHeaderError;
-        }
 
-        if (std::find(ignore.begin(), ignore.end(), name) == ignore.end()) {
+    for (auto const &entry : entries) {
+        if (std::find(ignore.begin(), ignore.end(), entry.name)
+                == ignore.end()) {
             ++count;
-            total_size += fi.uncompressed_size;
+            total_size += entry.uncompressed_size;
         }
-    } while ((ret = unzGoToNextFile(ctx->uf)) == UNZ_OK);
-
-    if (ret != UNZ_END_OF_LIST_OF_FILE) {
-        LOGE("miniunz: Finished before EOF: %s",
-             unz_error_string(ret).c_str());
-        close_input_file(ctx);
-        return ErrorCode::ArchiveReadHeaderError;
     }
 
-    close_input_file(ctx);
-
     stats->files = count;
     stats->total_size = total_size;
+    stats->entries.swap(entries);
 
     return ErrorCode::NoError;
 }
@@ -630,16 +621,14 @@ static bool get_file_time(const std::string &filename, uint32_t *dostime)
     return false;
 }
 
-ErrorCode MinizipUtils::add_file(zipFile zf,
-                                 const std::string &name,
-                                 const std::vector<unsigned char> &contents)
+static ErrorCode add_file_with_info(zipFile zf,
+                                    const std::string &name,
+                                    const std::vector<unsigned char> &contents,
+                                    const zip_fileinfo &zi)
 {
     // Obviously never true, but we'll keep it here just in case
     bool zip64 = (uint64_t) contents.size() >= ((1ull << 32) - 1);
 
-    zip_fileinfo zi;
-    memset(&zi, 0, sizeof(zi));
-
     int ret = zipOpenNewFileInZip2_64(
         zf,                     // file
         name.c_str(),           // filename
@@ -657,7 +646,7 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
 
     if (ret != ZIP_OK) {
         LOGE("minizip: Failed to open inner file: %s",
-             zip_error_string(ret).c_str());
+             MinizipUtils::zip_error_string(ret).c_str());
 
         return ErrorCode::ArchiveWriteDataError;
     }
@@ -666,7 +655,7 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
     ret = zipWriteInFileInZip(zf, contents.data(), contents.size());
     if (ret != ZIP_OK) {
         LOGE("minizip: Failed to write inner file data: %s",
-             zip_error_string(ret).c_str());
+             MinizipUtils::zip_error_string(ret).c_str());
         zipCloseFileInZip(zf);
 
         return ErrorCode::ArchiveWriteDataError;
@@ -675,7 +664,7 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
     ret = zipCloseFileInZip(zf);
     if (ret != ZIP_OK) {
         LOGE("minizip: Failed to close inner file: %s",
-             zip_error_string(ret).c_str());
+             MinizipUtils::zip_error_string(ret).c_str());
 
         return ErrorCode::ArchiveWriteDataError;
     }
@@ -683,6 +672,37 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
     return ErrorCode::NoError;
 }
 
+ErrorCode MinizipUtils::add_file(zipFile zf,
+                                 const std::string &name,
+                                 const std::vector<unsigned char> &contents)
+{
+    zip_fileinfo zi;
+    memset(&zi, 0, sizeof(zi));
+
+    return add_file_with_info(zf, name, contents, zi);
+}
+
+/*!
+ * \brief Add a file to a zip with the attributes of an existing entry
+ *
+ * The modification time and file attributes are copied from \p fi, which is
+ * usually the info for the entry that \p contents was read from.
+ */
+ErrorCode MinizipUtils::add_file(zipFile zf,
+                                 const std::string &name,
+                                 const std::vector<unsigned char> &contents,
+                                 const unz_file_info64 &fi)
+{
+    zip_fileinfo zi;
+    memset(&zi, 0, sizeof(zi));
+
+    zi.dos_date = fi.dos_date;
+    zi.internal_fa = fi.internal_fa;
+    zi.external_fa = fi.external_fa;
+
+    return add_file_with_info(zf, name, contents, zi);
+}
+
 ErrorCode MinizipUtils::add_file(zipFile zf,
                                  const std::string &name,
                                  const std::string &path)
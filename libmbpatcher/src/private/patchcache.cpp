@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/patchcache.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdio>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mblog/logging.h"
+#include "mbpio/delete.h"
+#include "mbpio/directory.h"
+#include "mbpio/path.h"
+
+#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/zipdirectory.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+/*!
+ * \class PatchCacheKey
+ *
+ * \brief Builds the key of a PatchCache entry
+ *
+ * The key is the SHA-256 digest of everything that was added, so everything
+ * that influences the cached data must be added. Strings are length-prefixed
+ * so that adjacent values cannot be confused with each other.
+ */
+
+PatchCacheKey::PatchCacheKey()
+{
+    SHA256_Init(&m_ctx);
+}
+
+void PatchCacheKey::add(const void *data, size_t size)
+{
+    SHA256_Update(&m_ctx, data, size);
+}
+
+void PatchCacheKey::add(const std::string &str)
+{
+    add(static_cast<uint64_t>(str.size()));
+    add(str.data(), str.size());
+}
+
+void PatchCacheKey::add(uint64_t value)
+{
+    unsigned char buf[8];
+
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        buf[i] = static_cast<unsigned char>(value >> (i * 8));
+    }
+
+    add(buf, sizeof(buf));
+}
+
+/*!
+ * \brief Add the size and contents of a file
+ *
+ * \param path Path to file
+ *
+ * \return Whether the file was successfully read
+ */
+bool PatchCacheKey::add_file(const std::string &path)
+{
+    StandardFile file;
+    std::vector<unsigned char> buf(65536);
+    uint64_t total = 0;
+    size_t n;
+
+    if (FileUtils::open_file(file, path, FileOpenMode::READ_ONLY)
+            != ErrorCode::NoError) {
+        LOGW("%s: Failed to open: %s", path.c_str(),
+             file.error_string().c_str());
+        return false;
+    }
+
+    // The size is added last so the file only needs to be read once
+    while (true) {
+        if (!file.read(buf.data(), buf.size(), n)) {
+            LOGW("%s: Failed to read: %s", path.c_str(),
+                 file.error_string().c_str());
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        add(buf.data(), n);
+        total += n;
+    }
+
+    add(total);
+
+    return true;
+}
+
+/*!
+ * \brief Add the central directory of a zip file
+ *
+ * The central directory contains the name, sizes, CRC32 checksum, and offset
+ * of every entry, so it identifies the contents of the zip without having to
+ * read everything. Only the end of the file and the central directory itself
+ * are read.
+ *
+ * \param path Path to zip file
+ *
+ * \return Whether the central directory was found and successfully read
+ */
+bool PatchCacheKey::add_zip_central_directory(const std::string &path)
+{
+    StandardFile file;
+    ZipDirectoryLocation location;
+
+    if (FileUtils::open_file(file, path, FileOpenMode::READ_ONLY)
+            != ErrorCode::NoError) {
+        LOGW("%s: Failed to open: %s", path.c_str(),
+             file.error_string().c_str());
+        return false;
+    }
+
+    if (!ZipDirectory::locate(file, &location)) {
+        LOGW("%s: Failed to find central directory", path.c_str());
+        return false;
+    }
+
+    add(location.entries);
+    add(location.size);
+    add(location.bytes_before);
+
+    std::vector<unsigned char> buf(65536);
+
+    if (!file.seek(static_cast<int64_t>(location.offset), SEEK_SET, nullptr)) {
+        LOGW("%s: Failed to seek: %s", path.c_str(),
+             file.error_string().c_str());
+        return false;
+    }
+
+    for (uint64_t remain = location.size; remain > 0; ) {
+        size_t to_read = static_cast<size_t>(
+                std::min<uint64_t>(remain, buf.size()));
+        size_t n;
+
+        if (!file_read_fully(file, buf.data(), to_read, n) || n != to_read) {
+            LOGW("%s: Failed to read central directory", path.c_str());
+            return false;
+        }
+
+        add(buf.data(), n);
+        remain -= n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get hex-encoded SHA-256 digest of everything that was added
+ *
+ * \note The key cannot be used anymore after calling this function.
+ */
+std::string PatchCacheKey::digest()
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    std::string result;
+
+    SHA256_Final(digest, &m_ctx);
+
+    result.reserve(sizeof(digest) * 2);
+    for (unsigned char c : digest) {
+        result += hex[c >> 4];
+        result += hex[c & 0xf];
+    }
+
+    return result;
+}
+
+/*!
+ * \class PatchCache
+ *
+ * \brief Content-addressed storage for patcher outputs
+ *
+ * Files are stored as `<directory>/<type>/<key>`. Entries are never modified
+ * after they are added. Files are reflinked or copied into and out of the
+ * cache, never hard linked, so neither the caller's files nor the cache
+ * entries are affected if the other side is later modified in place.
+ */
+
+PatchCache::PatchCache(std::string directory)
+    : m_directory(std::move(directory))
+{
+}
+
+bool PatchCache::is_enabled() const
+{
+    return !m_directory.empty();
+}
+
+std::string PatchCache::path(const std::string &type,
+                             const std::string &key) const
+{
+    std::string result(m_directory);
+    result += '/';
+    result += type;
+    result += '/';
+    result += key;
+    return result;
+}
+
+bool PatchCache::contains(const std::string &type,
+                          const std::string &key) const
+{
+    uint64_t size;
+    return is_enabled() && FileUtils::file_size(path(type, key), &size);
+}
+
+// Clone into a temporary directory next to the target and then move the file
+// into place so that readers never see a partially written file
+static bool clone_and_replace(const std::string &source,
+                              const std::string &target)
+{
+    std::string dir = io::dirName(target);
+    if (dir.empty()) {
+        dir = ".";
+    }
+
+    std::string temp_dir = FileUtils::create_temporary_dir(dir);
+    if (temp_dir.empty()) {
+        LOGW("%s: Failed to create temporary directory", dir.c_str());
+        return false;
+    }
+
+    std::string temp_path(temp_dir);
+    temp_path += "/file";
+
+    bool ret = FileUtils::clone_file(source, temp_path)
+            && FileUtils::move_file(temp_path, target);
+
+    io::deleteRecursively(temp_dir);
+
+    return ret;
+}
+
+/*!
+ * \brief Copy a cached file
+ *
+ * \param type Type of entry
+ * \param key Entry key
+ * \param target Path to copy the file to (replaced if it exists)
+ *
+ * \return True if the entry exists and was copied. Otherwise, false.
+ */
+bool PatchCache::get(const std::string &type, const std::string &key,
+                     const std::string &target) const
+{
+    if (!contains(type, key)) {
+        return false;
+    }
+
+    return clone_and_replace(path(type, key), target);
+}
+
+/*!
+ * \brief Add a file to the cache
+ *
+ * \param type Type of entry
+ * \param key Entry key
+ * \param source Path to file (copied, so it may be modified afterwards)
+ *
+ * \return Whether the file was successfully added
+ */
+bool PatchCache::put(const std::string &type, const std::string &key,
+                     const std::string &source) const
+{
+    if (!is_enabled()) {
+        return false;
+    }
+
+    std::string dir(m_directory);
+    dir += '/';
+    dir += type;
+
+    if (!io::createDirectories(dir)) {
+        LOGW("%s: Failed to create directory", dir.c_str());
+        return false;
+    }
+
+    return clone_and_replace(source, path(type, key));
+}
+
+}
+}
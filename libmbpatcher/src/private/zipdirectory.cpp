@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/zipdirectory.h"
+
+#include <algorithm>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mblog/logging.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+#define ZIP_EOCD_MAGIC              0x06054b50
+#define ZIP_EOCD_SIZE               22
+#define ZIP_MAX_COMMENT_SIZE        0xffff
+#define ZIP64_EOCD_LOCATOR_MAGIC    0x07064b50
+#define ZIP64_EOCD_LOCATOR_SIZE     20
+#define ZIP64_EOCD_MAGIC            0x06064b50
+#define ZIP64_EOCD_SIZE             56
+#define ZIP_CD_HEADER_MAGIC         0x02014b50
+#define ZIP_CD_HEADER_SIZE          46
+#define ZIP64_EXTRA_FIELD_ID        0x0001
+
+
+namespace mb
+{
+namespace patcher
+{
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(read_le32(p))
+            | (static_cast<uint64_t>(read_le32(p + 4)) << 32);
+}
+
+static bool read_at(File &file, uint64_t offset, void *buf, size_t size)
+{
+    size_t n;
+
+    return file.seek(static_cast<int64_t>(offset), SEEK_SET, nullptr)
+            && file_read_fully(file, buf, size, n)
+            && n == size;
+}
+
+/*!
+ * \brief Find the central directory of a zip file
+ *
+ * Only the end of central directory record (and the zip64 records, if
+ * needed) at the end of the file are read.
+ *
+ * Like minizip, this handles files with data prepended to the zip (eg. a
+ * self-extracting stub). The offsets stored in the zip are relative to the
+ * start of the zip data, so the number of prepended bytes is computed from
+ * where the central directory ends and the returned offset is relative to
+ * the beginning of the file.
+ *
+ * \param file Zip file
+ * \param[out] location Number of entries and location of central directory
+ *
+ * \return Whether the central directory was found
+ */
+bool ZipDirectory::locate(File &file, ZipDirectoryLocation *location)
+{
+    uint64_t file_size;
+
+    if (!file.seek(0, SEEK_END, &file_size)) {
+        LOGW("Failed to seek: %s", file.error_string().c_str());
+        return false;
+    }
+
+    // The end of central directory record is at the end of the file, followed
+    // by a variable length comment
+    std::vector<unsigned char> tail(static_cast<size_t>(std::min<uint64_t>(
+            file_size, ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE)));
+    uint64_t tail_offset = file_size - tail.size();
+
+    if (tail.size() < ZIP_EOCD_SIZE
+            || !read_at(file, tail_offset, tail.data(), tail.size())) {
+        LOGW("Failed to read end of central directory");
+        return false;
+    }
+
+    const unsigned char *eocd = nullptr;
+
+    for (size_t i = tail.size() - ZIP_EOCD_SIZE + 1; i-- > 0; ) {
+        const unsigned char *p = tail.data() + i;
+        if (read_le32(p) == ZIP_EOCD_MAGIC
+                && i + ZIP_EOCD_SIZE + read_le16(p + 20) <= tail.size()) {
+            eocd = p;
+            break;
+        }
+    }
+
+    if (!eocd) {
+        LOGW("End of central directory not found");
+        return false;
+    }
+
+    // The central directory ends where the (zip64) end of central directory
+    // record begins
+    uint64_t eocd_offset = tail_offset + (eocd - tail.data());
+    uint64_t entries = read_le16(eocd + 10);
+    uint64_t cd_size = read_le32(eocd + 12);
+    uint64_t cd_offset = read_le32(eocd + 16);
+
+    if (entries == 0xffff || cd_size == 0xffffffff
+            || cd_offset == 0xffffffff) {
+        unsigned char locator[ZIP64_EOCD_LOCATOR_SIZE];
+        unsigned char eocd64[ZIP64_EOCD_SIZE];
+
+        if (eocd_offset < ZIP64_EOCD_LOCATOR_SIZE
+                || !read_at(file, eocd_offset - ZIP64_EOCD_LOCATOR_SIZE,
+                            locator, sizeof(locator))
+                || read_le32(locator) != ZIP64_EOCD_LOCATOR_MAGIC
+                || !read_at(file, read_le64(locator + 8),
+                            eocd64, sizeof(eocd64))
+                || read_le32(eocd64) != ZIP64_EOCD_MAGIC) {
+            LOGW("Invalid zip64 end of central directory");
+            return false;
+        }
+
+        eocd_offset = read_le64(locator + 8);
+        entries = read_le64(eocd64 + 32);
+        cd_size = read_le64(eocd64 + 40);
+        cd_offset = read_le64(eocd64 + 48);
+    }
+
+    // Same as minizip's byte_before_the_zipfile
+    if (cd_offset > eocd_offset || cd_size > eocd_offset - cd_offset) {
+        LOGW("Central directory is out of bounds");
+        return false;
+    }
+
+    location->entries = entries;
+    location->bytes_before = eocd_offset - cd_size - cd_offset;
+    location->offset = cd_offset + location->bytes_before;
+    location->size = cd_size;
+
+    return true;
+}
+
+// Replace the fields that were too large for the central directory header
+// with the values from the zip64 extended information extra field
+static bool parse_zip64_extra(const unsigned char *extra, size_t extra_size,
+                              ZipDirectoryEntry *entry)
+{
+    while (extra_size >= 4) {
+        uint16_t id = read_le16(extra);
+        uint16_t size = read_le16(extra + 2);
+
+        extra += 4;
+        extra_size -= 4;
+
+        if (size > extra_size) {
+            return false;
+        }
+
+        if (id == ZIP64_EXTRA_FIELD_ID) {
+            uint64_t *fields[] = {
+                &entry->uncompressed_size,
+                &entry->compressed_size,
+                &entry->offset,
+            };
+            size_t pos = 0;
+
+            for (uint64_t *field : fields) {
+                if (*field != 0xffffffff) {
+                    continue;
+                }
+                if (pos + 8 > size) {
+                    return false;
+                }
+                *field = read_le64(extra + pos);
+                pos += 8;
+            }
+
+            return true;
+        }
+
+        extra += size;
+        extra_size -= size;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read the central directory of a zip file
+ *
+ * The central directory is read with a single bulk read and parsed directly
+ * instead of walking through the entries one at a time with minizip. The
+ * entries are returned in the same order that minizip iterates through them.
+ * The local file header offsets are relative to the beginning of the file,
+ * including any data prepended to the zip.
+ *
+ * \param path Path to zip file
+ * \param[out] entries Entries in the central directory
+ *
+ * \return ErrorCode::NoError if successful. Otherwise, the error code.
+ */
+ErrorCode ZipDirectory::read(const std::string &path,
+                             std::vector<ZipDirectoryEntry> *entries)
+{
+    StandardFile file;
+    ZipDirectoryLocation location;
+
+    auto ret = FileUtils::open_file(file, path, FileOpenMode::READ_ONLY);
+    if (ret != ErrorCode::NoError) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), file.error_string().c_str());
+        return ErrorCode::ArchiveReadOpenError;
+    }
+
+    if (!locate(file, &location)) {
+        LOGE("%s: Failed to find central directory", path.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    // Every entry needs at least a fixed size header
+    if (location.entries > location.size / ZIP_CD_HEADER_SIZE) {
+        LOGE("%s: Too many entries for central directory size: %" PRIu64,
+             path.c_str(), location.entries);
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<unsigned char> buf(static_cast<size_t>(location.size));
+
+    if (!read_at(file, location.offset, buf.data(), buf.size())) {
+        LOGE("%s: Failed to read central directory: %s",
+             path.c_str(), file.error_string().c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<ZipDirectoryEntry> result(
+            static_cast<size_t>(location.entries));
+    const unsigned char *ptr = buf.data();
+    const unsigned char *end = buf.data() + buf.size();
+
+    for (ZipDirectoryEntry &entry : result) {
+        if (static_cast<size_t>(end - ptr) < ZIP_CD_HEADER_SIZE
+                || read_le32(ptr) != ZIP_CD_HEADER_MAGIC) {
+            LOGE("%s: Invalid central directory header", path.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        uint16_t name_size = read_le16(ptr + 28);
+        uint16_t extra_size = read_le16(ptr + 30);
+        uint16_t comment_size = read_le16(ptr + 32);
+        size_t total_size = ZIP_CD_HEADER_SIZE + name_size + extra_size
+                + comment_size;
+
+        if (static_cast<size_t>(end - ptr) < total_size) {
+            LOGE("%s: Truncated central directory header", path.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        // The name is treated as a C string, like minizip does
+        const char *name = reinterpret_cast<const char *>(
+                ptr + ZIP_CD_HEADER_SIZE);
+        const char *name_end = static_cast<const char *>(
+                std::memchr(name, '\0', name_size));
+
+        entry.name.assign(name, name_end ? name_end : name + name_size);
+        entry.method = read_le16(ptr + 10);
+        entry.dos_date = read_le32(ptr + 12);
+        entry.crc = read_le32(ptr + 16);
+        entry.compressed_size = read_le32(ptr + 20);
+        entry.uncompressed_size = read_le32(ptr + 24);
+        entry.offset = read_le32(ptr + 42);
+
+        if (!parse_zip64_extra(ptr + ZIP_CD_HEADER_SIZE + name_size,
+                               extra_size, &entry)) {
+            LOGE("%s: Invalid zip64 extra field: %s",
+                 path.c_str(), entry.name.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        entry.offset += location.bytes_before;
+
+        ptr += total_size;
+    }
+
+    entries->swap(result);
+
+    return ErrorCode::NoError;
+}
+
+}
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+#include <cstring>
+
+#include "mbpio/delete.h"
+#include "mbpio/directory.h"
+
+#include "mbpatcher/fileinfo.h"
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchers/zippatcher.h"
+#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/zipdirectory.h"
+
+using namespace mb;
+using namespace mb::patcher;
+
+#define UPDATE_BINARY   "META-INF/com/google/android/update-binary"
+#define UPDATER_SCRIPT  "META-INF/com/google/android/updater-script"
+
+#define SYSTEM_BLOCK_DEV "/dev/block/platform/msm_sdcc.1/by-name/system"
+
+static const char *input_updater_script =
+    "ui_print(\"Installing\");\n"
+    "mount(\"ext4\", \"EMMC\", \"" SYSTEM_BLOCK_DEV "\", \"/system\");\n"
+    "format(\"ext4\", \"EMMC\", \"" SYSTEM_BLOCK_DEV "\", \"0\", \"/system\");\n"
+    "package_extract_dir(\"system\", \"/system\");\n"
+    "set_perm(0, 0, 0755, \"/system/bin/foo\");\n"
+    "unmount(\"/system\");\n";
+
+// Output of the original ZipPatcher implementation for the script above
+static const char *expected_updater_script =
+    "ui_print(\"Installing\");\n"
+    "(run_program(\"/update-binary-tool\", \"mount\", \"/system\") == 0);\n"
+    "(run_program(\"/update-binary-tool\", \"format\", \"/system\") == 0);\n"
+    "package_extract_dir(\"system\", \"/system\");\n"
+    "set_perm(0, 0, 0755, \"/system/bin/foo\");\n"
+    "(run_program(\"/update-binary-tool\", \"unmount\", \"/system\") == 0);\n";
+
+struct ZipEntry
+{
+    unz_file_info64 fi;
+    // Compressed data, exactly as stored in the zip
+    std::vector<unsigned char> raw;
+    // Uncompressed data
+    std::vector<unsigned char> data;
+};
+
+typedef std::map<std::string, ZipEntry> ZipEntries;
+
+static std::vector<unsigned char> make_data(size_t size, unsigned int seed)
+{
+    std::vector<unsigned char> data(size);
+    for (auto &c : data) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<unsigned char>(seed >> 16);
+    }
+    return data;
+}
+
+static std::vector<unsigned char> to_data(const std::string &str)
+{
+    return {str.begin(), str.end()};
+}
+
+static bool read_raw(unzFile uf, std::vector<unsigned char> *output)
+{
+    int method;
+    int level;
+
+    if (unzOpenCurrentFile2(uf, &method, &level, 1) != UNZ_OK) {
+        return false;
+    }
+
+    char buf[32768];
+    int n;
+
+    while ((n = unzReadCurrentFile(uf, buf, sizeof(buf))) > 0) {
+        output->insert(output->end(), buf, buf + n);
+    }
+
+    return unzCloseCurrentFile(uf) == UNZ_OK && n == 0;
+}
+
+static ::testing::AssertionResult read_zip(const std::string &path,
+                                           ZipEntries *entries)
+{
+    auto *ctx = MinizipUtils::open_input_file(path);
+    if (!ctx) {
+        return ::testing::AssertionFailure()
+                << path << ": Failed to open zip";
+    }
+
+    unzFile uf = MinizipUtils::ctx_get_unz_file(ctx);
+    ::testing::AssertionResult result = ::testing::AssertionSuccess();
+
+    int ret = unzGoToFirstFile(uf);
+    while (ret == UNZ_OK) {
+        std::string name;
+        ZipEntry entry;
+
+        if (!MinizipUtils::get_info(uf, &entry.fi, &name)
+                || !read_raw(uf, &entry.raw)
+                || !MinizipUtils::read_to_memory(
+                        uf, &entry.data, nullptr, nullptr)) {
+            result = ::testing::AssertionFailure()
+                    << path << ": Failed to read entry: " << name;
+            break;
+        }
+
+        if (!entries->emplace(std::move(name), std::move(entry)).second) {
+            result = ::testing::AssertionFailure()
+                    << path << ": Duplicate entry: " << name;
+            break;
+        }
+
+        ret = unzGoToNextFile(uf);
+    }
+
+    if (result && ret != UNZ_END_OF_LIST_OF_FILE) {
+        result = ::testing::AssertionFailure()
+                << path << ": Failed to iterate through zip: "
+                << MinizipUtils::unz_error_string(ret);
+    }
+
+    MinizipUtils::close_input_file(ctx);
+
+    return result;
+}
+
+static std::string to_string(const std::vector<unsigned char> &data)
+{
+    return {data.begin(), data.end()};
+}
+
+struct ZipPatcherTest : testing::Test
+{
+    std::string _temp_dir;
+    std::string _data_dir;
+    std::string _input_path;
+
+    // Entries of the input zip
+    std::map<std::string, std::vector<unsigned char>> _input_files;
+    // Files that are added to the output from the data directory
+    std::map<std::string, std::vector<unsigned char>> _added_files;
+
+    PatcherConfig _pc;
+
+    virtual void SetUp()
+    {
+        _temp_dir = FileUtils::create_temporary_dir(
+                FileUtils::system_temporary_dir());
+        ASSERT_FALSE(_temp_dir.empty());
+
+        _data_dir = _temp_dir + "/data";
+        _input_path = _temp_dir + "/input.zip";
+
+        std::string arch_dir = _data_dir + "/binaries/android/armeabi-v7a";
+        ASSERT_TRUE(io::createDirectories(arch_dir));
+        ASSERT_TRUE(io::createDirectories(_data_dir + "/scripts"));
+        ASSERT_TRUE(io::createDirectories(_temp_dir + "/tmp"));
+
+        unsigned int seed = 0;
+
+        for (auto const &name : {
+            "mbtool_recovery",
+            "file-contexts-tool",
+            "fsck-wrapper",
+            "mbtool",
+            "mount.exfat",
+        }) {
+            std::string target = std::string("multiboot/binaries/") + name;
+            if (strcmp(name, "mbtool_recovery") == 0) {
+                target = UPDATE_BINARY;
+            }
+
+            auto data = make_data(4096, ++seed);
+            auto sig = make_data(256, ++seed);
+
+            add_data_file(arch_dir + "/" + name, target, data);
+            add_data_file(arch_dir + "/" + name + ".sig", target + ".sig",
+                          sig);
+        }
+
+        add_data_file(_data_dir + "/scripts/bb-wrapper.sh",
+                      "multiboot/bb-wrapper.sh",
+                      to_data("#!/sbin/sh\n"));
+        add_data_file(_data_dir + "/scripts/bb-wrapper.sh.sig",
+                      "multiboot/bb-wrapper.sh.sig",
+                      make_data(256, ++seed));
+
+        _input_files[UPDATE_BINARY] = make_data(8192, ++seed);
+        _input_files[UPDATER_SCRIPT] = to_data(input_updater_script);
+        _input_files["boot.img"] = std::vector<unsigned char>(65536, 'B');
+        _input_files["system/app/Test.apk"] = make_data(1 << 20, ++seed);
+        _input_files["system/bin/foo"] = to_data("#!/system/bin/sh\n");
+        _input_files["system/build.prop"] = to_data("ro.test=1\n");
+
+        auto *ctx = MinizipUtils::open_output_file(_input_path);
+        ASSERT_NE(ctx, nullptr);
+
+        zipFile zf = MinizipUtils::ctx_get_zip_file(ctx);
+        for (auto const &item : _input_files) {
+            ASSERT_EQ(MinizipUtils::add_file(zf, item.first, item.second),
+                      ErrorCode::NoError);
+        }
+
+        ASSERT_EQ(MinizipUtils::close_output_file(ctx), ZIP_OK);
+
+        _pc.set_data_directory(_data_dir);
+        _pc.set_temp_directory(_temp_dir + "/tmp");
+    }
+
+    virtual void TearDown()
+    {
+        if (!_temp_dir.empty()) {
+            io::deleteRecursively(_temp_dir);
+        }
+    }
+
+    void add_data_file(const std::string &path, const std::string &target,
+                       const std::vector<unsigned char> &data)
+    {
+        ASSERT_EQ(FileUtils::write_from_memory(path, data),
+                  ErrorCode::NoError);
+        _added_files[target] = data;
+    }
+
+    ::testing::AssertionResult patch(const std::string &output_path)
+    {
+        device::Device device;
+        device.set_id("test");
+        device.set_architecture(device::ARCH_ARMEABI_V7A);
+        device.set_system_block_devs({SYSTEM_BLOCK_DEV});
+
+        FileInfo info;
+        info.set_input_path(_input_path);
+        info.set_output_path(output_path);
+        info.set_device(device);
+        info.set_rom_id("dual");
+
+        ZipPatcher patcher(&_pc);
+        patcher.set_file_info(&info);
+
+        if (!patcher.patch_file(nullptr, nullptr, nullptr, nullptr)) {
+            return ::testing::AssertionFailure()
+                    << "Failed to patch file: error code "
+                    << static_cast<int>(patcher.error());
+        }
+
+        return ::testing::AssertionSuccess();
+    }
+
+    void check_output(const std::string &output_path)
+    {
+        ZipEntries input;
+        ZipEntries output;
+
+        ASSERT_TRUE(read_zip(_input_path, &input));
+        ASSERT_TRUE(read_zip(output_path, &output));
+
+        // Patched updater-script
+        auto it = output.find(UPDATER_SCRIPT);
+        ASSERT_NE(it, output.end());
+        ASSERT_EQ(to_string(it->second.data), expected_updater_script);
+
+        // Renamed update-binary
+        it = output.find(UPDATE_BINARY ".orig");
+        ASSERT_NE(it, output.end());
+        ASSERT_EQ(it->second.data, input[UPDATE_BINARY].data);
+
+        // Untouched entries are copied without recompression
+        for (auto const &item : input) {
+            if (item.first == UPDATE_BINARY || item.first == UPDATER_SCRIPT) {
+                continue;
+            }
+
+            it = output.find(item.first);
+            ASSERT_NE(it, output.end()) << "Missing entry: " << item.first;
+            ASSERT_EQ(it->second.fi.compression_method,
+                      item.second.fi.compression_method) << item.first;
+            ASSERT_EQ(it->second.fi.crc, item.second.fi.crc) << item.first;
+            ASSERT_EQ(it->second.raw, item.second.raw) << item.first;
+            ASSERT_EQ(it->second.data, _input_files[item.first])
+                    << item.first;
+        }
+
+        // Files added from the data directory
+        for (auto const &item : _added_files) {
+            it = output.find(item.first);
+            ASSERT_NE(it, output.end()) << "Missing entry: " << item.first;
+            ASSERT_EQ(it->second.data, item.second) << item.first;
+        }
+
+        it = output.find("multiboot/info.prop");
+        ASSERT_NE(it, output.end());
+        ASSERT_EQ(to_string(it->second.data),
+                  ZipPatcher::create_info_prop(&_pc, "dual", false));
+
+        ASSERT_NE(output.find("multiboot/device.json"), output.end());
+
+        // Input entries (with update-binary renamed), added files,
+        // info.prop, and device.json
+        ASSERT_EQ(output.size(), input.size() + _added_files.size() + 2);
+    }
+
+    void check_same_entries(const std::string &a, const std::string &b)
+    {
+        ZipEntries entries_a;
+        ZipEntries entries_b;
+
+        ASSERT_TRUE(read_zip(a, &entries_a));
+        ASSERT_TRUE(read_zip(b, &entries_b));
+        ASSERT_EQ(entries_a.size(), entries_b.size());
+
+        for (auto const &item : entries_a) {
+            auto it = entries_b.find(item.first);
+            ASSERT_NE(it, entries_b.end()) << "Missing entry: " << item.first;
+            ASSERT_EQ(it->second.raw, item.second.raw) << item.first;
+            ASSERT_EQ(it->second.data, item.second.data) << item.first;
+        }
+    }
+};
+
+TEST_F(ZipPatcherTest, PatchWithoutCache)
+{
+    std::string output = _temp_dir + "/output.zip";
+
+    ASSERT_TRUE(patch(output));
+    check_output(output);
+}
+
+TEST_F(ZipPatcherTest, PatchWithCacheMatchesUncached)
+{
+    std::string uncached = _temp_dir + "/uncached.zip";
+    std::string cold = _temp_dir + "/cold.zip";
+    std::string warm = _temp_dir + "/warm.zip";
+
+    ASSERT_TRUE(patch(uncached));
+
+    _pc.set_cache_directory(_temp_dir + "/cache");
+
+    ASSERT_TRUE(patch(cold));
+    ASSERT_TRUE(patch(warm));
+
+    check_output(cold);
+    check_output(warm);
+    check_same_entries(uncached, cold);
+    check_same_entries(uncached, warm);
+}
+
+TEST_F(ZipPatcherTest, CachedOutputIsNotModifiedWithOutput)
+{
+    std::string first = _temp_dir + "/first.zip";
+    std::string second = _temp_dir + "/second.zip";
+    std::string third = _temp_dir + "/third.zip";
+
+    _pc.set_cache_directory(_temp_dir + "/cache");
+
+    ASSERT_TRUE(patch(first));
+
+    // Clobber the first output, which was copied into the cache. The cached
+    // copy must not change.
+    ASSERT_EQ(FileUtils::write_from_memory(first, to_data("garbage")),
+              ErrorCode::NoError);
+
+    ASSERT_TRUE(patch(second));
+    check_output(second);
+
+    // Clobber the second output in place, which was copied out of the cache.
+    // The cached copy must not change either.
+    ASSERT_EQ(FileUtils::write_from_memory(second, to_data("garbage")),
+              ErrorCode::NoError);
+
+    ASSERT_TRUE(patch(third));
+    check_output(third);
+}
+
+TEST_F(ZipPatcherTest, PatchWithPrependedData)
+{
+    std::string output = _temp_dir + "/output.zip";
+    std::vector<unsigned char> data;
+
+    // Offsets in the zip are relative to the start of the zip data, not the
+    // start of the file
+    ASSERT_EQ(FileUtils::read_to_memory(_input_path, &data),
+              ErrorCode::NoError);
+    data.insert(data.begin(), 1000, 'X');
+    ASSERT_EQ(FileUtils::write_from_memory(_input_path, data),
+              ErrorCode::NoError);
+
+    std::vector<ZipDirectoryEntry> entries;
+    ASSERT_EQ(ZipDirectory::read(_input_path, &entries), ErrorCode::NoError);
+    ASSERT_EQ(entries.size(), _input_files.size());
+
+    for (auto const &entry : entries) {
+        ASSERT_LE(entry.offset + 4, data.size()) << entry.name;
+        ASSERT_EQ(memcmp(data.data() + entry.offset, "PK\x03\x04", 4), 0)
+                << entry.name;
+    }
+
+    _pc.set_cache_directory(_temp_dir + "/cache");
+
+    ASSERT_TRUE(patch(output));
+    check_output(output);
+}
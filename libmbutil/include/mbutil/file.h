@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include <sys/types.h>
+
 namespace mb
 {
 namespace util
@@ -32,6 +34,8 @@ bool file_first_line(const std::string &path,
                      std::string *line_out);
 bool file_write_data(const std::string &path,
                      const char *data, size_t size);
+bool file_replace_data(const std::string &path, const char *data, size_t size,
+                       mode_t mode, uid_t uid, gid_t gid);
 bool file_find_one_of(const std::string &path, std::vector<std::string> items);
 bool file_read_all(const std::string &path,
                    std::vector<unsigned char> *data_out);
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace mb
+{
+namespace util
+{
+
+class LinePatcher {
+public:
+    struct Line {
+        // Line contents, excluding the newline. This is NOT NULL-terminated
+        const char *data;
+        // Size of the line, excluding the newline
+        size_t size;
+        // Zero-based line number
+        size_t number;
+
+        // Text to write before the line
+        std::string prepend;
+        // Text to write after the line (and its newline)
+        std::string append;
+        // Comment out the line by prefixing it with '#'
+        bool comment_out;
+        // Remove the line from the output
+        bool remove;
+
+        bool starts_with(const char *prefix) const;
+        bool contains(const char *needle) const;
+        bool is_whitespace() const;
+        std::string str() const;
+    };
+
+    // Called for every line before any edits are made
+    typedef std::function<void(const Line &)> ScanFn;
+    // Called for every line. Edits see the original line contents
+    typedef std::function<void(Line &)> EditFn;
+
+    void add_scan(ScanFn fn);
+    void add_edit(EditFn fn);
+    void add_trailer(std::string text);
+
+    bool empty() const;
+
+    bool apply(const std::string &path, bool *changed_out = nullptr) const;
+
+private:
+    std::vector<ScanFn> _scans;
+    std::vector<EditFn> _edits;
+    std::string _trailer;
+};
+
+}
+}
@@ -20,6 +20,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include <cstdint>
 
 namespace mb
 {
@@ -30,6 +33,8 @@ std::string loopdev_find_unused(void);
 bool loopdev_set_up_device(const std::string &loopdev, const std::string &file,
                            uint64_t offset, bool ro);
 bool loopdev_remove_device(const std::string &loopdev);
+size_t loopdev_remove_devices(const std::vector<std::string> &loopdevs);
+size_t loopdev_reclaim_leaked(void);
 
 }
 }
\ No newline at end of file
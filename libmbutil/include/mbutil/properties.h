@@ -19,9 +19,14 @@
 
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
 #include "mbutil/integer.h"
 #include "mbutil/external/system_properties.h"
 
@@ -94,6 +99,37 @@ bool property_set_direct(const std::string &key, const std::string &value);
 bool property_list(PropertyListCb prop_fn, void *cookie);
 
 bool property_get_all(std::unordered_map<std::string, std::string> &map);
+size_t property_get_keys(const std::vector<std::string> &keys,
+                         std::unordered_map<std::string, std::string> &map);
+
+class CachedProperty
+{
+public:
+    explicit CachedProperty(std::string key);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CachedProperty)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CachedProperty)
+
+    const std::string & key() const;
+
+    bool get(std::string &value_out);
+    std::string get_string(const std::string &default_value);
+    bool get_bool(bool default_value);
+
+private:
+    bool refresh();
+
+    std::mutex _mutex;
+    std::string _key;
+    const prop_info *_pi;
+    // Area serial at the time of the last failed lookup
+    uint32_t _area_serial;
+    bool _has_area_serial;
+    // Serial of the property at the time _value was read
+    uint32_t _serial;
+    bool _has_value;
+    std::string _value;
+};
 
 // Properties file functions
 
@@ -143,8 +179,112 @@ bool property_file_list(const std::string &path, PropertyListCb prop_fn,
 bool property_file_get_all(const std::string &path,
                            std::unordered_map<std::string, std::string> &map);
 
+bool property_file_get_keys(const std::string &path,
+                            const std::vector<std::string> &keys,
+                            std::unordered_map<std::string, std::string> &map);
+
 bool property_file_write_all(const std::string &path,
                              const std::unordered_map<std::string, std::string> &map);
 
+class PropertyFile
+{
+public:
+    PropertyFile();
+    ~PropertyFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PropertyFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PropertyFile)
+
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const;
+
+    bool get(const std::string &key, std::string &value_out) const;
+    std::string get_string(const std::string &key,
+                           const std::string &default_value) const;
+    bool get_bool(const std::string &key, bool default_value) const;
+
+    template<typename SNumType>
+    inline SNumType get_snum(const std::string &key,
+                             SNumType default_value) const
+    {
+        std::string value;
+        SNumType result;
+
+        if (get(key, value) && str_to_snum(value.c_str(), 10, &result)) {
+            return result;
+        }
+
+        return default_value;
+    }
+
+    template<typename UNumType>
+    inline UNumType get_unum(const std::string &key,
+                             UNumType default_value) const
+    {
+        std::string value;
+        UNumType result;
+
+        if (get(key, value) && str_to_unum(value.c_str(), 10, &result)) {
+            return result;
+        }
+
+        return default_value;
+    }
+
+    size_t get_keys(const std::vector<std::string> &keys,
+                    std::unordered_map<std::string, std::string> &map) const;
+
+    void list(PropertyListCb prop_fn, void *cookie) const;
+
+    void set(const std::string &key, const std::string &value);
+    void remove(const std::string &key);
+    bool commit();
+
+private:
+    // Line containing a property. The key starts at offset and the value
+    // starts right after the '='.
+    struct Entry
+    {
+        size_t offset;
+        size_t key_size;
+        size_t value_size;
+    };
+
+    struct Change
+    {
+        std::string key;
+        std::string value;
+        bool removed;
+    };
+
+    bool scan_entry(const char *&ptr, Entry &entry) const;
+    const Entry * find_entry(const char *key, size_t key_size) const;
+    bool find_entry_unindexed(const char *key, size_t key_size,
+                              Entry &entry) const;
+    const Change * find_change(const std::string &key) const;
+    void ensure_indexed() const;
+
+    std::string _path;
+    const char *_data;
+    size_t _size;
+    mode_t _mode;
+    uid_t _uid;
+    gid_t _gid;
+
+    // The index is built on the second lookup so that reading a single
+    // property only needs to scan up to the first match
+    mutable bool _indexed;
+    mutable bool _scanned_once;
+    // All properties in file order, including duplicate keys
+    mutable std::vector<Entry> _entries;
+    // Open addressing hash table mapping a key to (index + 1) of the first
+    // entry with that key. 0 means that the slot is empty.
+    mutable std::vector<uint32_t> _slots;
+
+    // Uncommitted changes
+    std::vector<Change> _changes;
+};
+
 }
 }
@@ -19,12 +19,18 @@
 
 #include "mbutil/blkid.h"
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
+#include <cstdint>
 #include <cstring>
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbutil/finally.h"
@@ -37,86 +43,114 @@ namespace mb
 namespace util
 {
 
-static inline bool check_magic(const void *data, size_t data_size,
-                               const void *magic, size_t magic_size,
-                               size_t offset)
+struct Magic
 {
-    if (offset + magic_size > data_size) {
-        return false;
-    }
+    const char *type;
+    const char *magic;
+    size_t magic_size;
+    size_t offset;
+};
 
-    return memcmp(static_cast<const unsigned char *>(data) + offset,
-                  magic, magic_size) == 0;
-}
+// Magics are checked in order and the first match wins. The vfat signatures
+// are very weak (eg. a jump instruction at offset 0), so they must come last.
+static constexpr Magic magics[] = {
+    { "btrfs",    "_BHRfS_M",     8, 64 * 1024 + 0x40 },
+    { "exfat",    "EXFAT   ",     8, 3 },
+    // This matches ext2, ext3, ext4, ext4dev, and jbd
+    { "ext",      "\x53\xef",     2, 0x400 + 0x38 },
+    { "f2fs",     "\x10\x20\xF5\xF2", 4, 0x400 },
+    { "ntfs",     "NTFS    ",     8, 3 },
+    { "squashfs", "hsqs",         4, 0 },
+    { "squashfs", "sqsh",         4, 0 },
+    { "vfat",     "MSWIN",        5, 0x52 },
+    { "vfat",     "FAT32   ",     8, 0x52 },
+    { "vfat",     "MSDOS",        5, 0x36 },
+    { "vfat",     "FAT16   ",     8, 0x36 },
+    { "vfat",     "FAT12   ",     8, 0x36 },
+    { "vfat",     "FAT     ",     8, 0x36 },
+    { "vfat",     "\353",         1, 0 },
+    { "vfat",     "\351",         1, 0 },
+    { "vfat",     "\125\252",     2, 0x1fe },
+};
 
-static inline bool is_btrfs(const void *data, size_t size)
-{
-    return check_magic(data, size, "_BHRfS_M", 8, 64 * 1024 + 0x40);
-}
+static constexpr size_t n_magics = sizeof(magics) / sizeof(magics[0]);
 
-static inline bool is_exfat(const void *data, size_t size)
+static constexpr size_t magics_end(size_t i = 0)
 {
-    return check_magic(data, size, "EXFAT   ", 8, 3);
+    return i == n_magics ? 0
+            : magics[i].offset + magics[i].magic_size > magics_end(i + 1)
+            ? magics[i].offset + magics[i].magic_size : magics_end(i + 1);
 }
 
-static inline bool is_ext(const void *data, size_t size)
-{
-    // This matches ext2, ext3, ext4, ext4dev, and jbd
-    return check_magic(data, size, "\x53\xef", 2, 0x400 + 0x38);
-}
+// Smallest 4 KiB-aligned window that covers every magic in the table
+static constexpr size_t probe_window_size = (magics_end() + 4095) / 4096 * 4096;
 
-static inline bool is_f2fs(const void *data, size_t size)
+struct CacheEntry
 {
-    return check_magic(data, size, "\x10\x20\xF5\xF2", 4, 0x400);
-}
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;
+    uint64_t generation;
+    int64_t time_sec;
+    int64_t time_nsec;
+    const char *type;
+};
 
-static inline bool is_ntfs(const void *data, size_t size)
-{
-    return check_magic(data, size, "NTFS    ", 8, 3);
-}
+static std::mutex cache_mutex;
+static std::vector<CacheEntry> cache;
 
-static inline bool is_squashfs(const void *data, size_t size)
+static bool cache_key_matches(const CacheEntry &a, const CacheEntry &b)
 {
-    return     check_magic(data, size, "hsqs", 4, 0)
-            || check_magic(data, size, "sqsh", 4, 0);
+    return a.dev == b.dev && a.ino == b.ino
+            && a.size == b.size && a.generation == b.generation
+            && a.time_sec == b.time_sec && a.time_nsec == b.time_nsec;
 }
 
-static inline bool is_vfat(const void *data, size_t size)
+/*!
+ * \brief Fill in the cache key for an opened file
+ *
+ * The key includes the inode generation number and the mtime so that rewritten
+ * images are probed again. Block devices are never cached. Nothing about the
+ * device node changes when the device is reformatted (eg. with mke2fs during an
+ * installation), so there is no way to tell that a cached result is stale.
+ *
+ * \return Whether the file can be cached
+ */
+static bool get_cache_key(int fd, CacheEntry &key)
 {
-    return     check_magic(data, size, "MSWIN",    5, 0x52)
-            || check_magic(data, size, "FAT32   ", 8, 0x52)
-            || check_magic(data, size, "MSDOS",    5, 0x36)
-            || check_magic(data, size, "FAT16   ", 8, 0x36)
-            || check_magic(data, size, "FAT12   ", 8, 0x36)
-            || check_magic(data, size, "FAT     ", 8, 0x36)
-            || check_magic(data, size, "\353",     1, 0)
-            || check_magic(data, size, "\351",     1, 0)
-            || check_magic(data, size, "\125\252", 2, 0x1fe);
-}
+    struct stat sb;
 
-struct probe_func
-{
-    const char *name;
-    bool (*func)(const void *, size_t);
-};
+    if (fstat(fd, &sb) < 0) {
+        return false;
+    }
 
-static probe_func probe_funcs[] = {
-    { "btrfs",    &is_btrfs },
-    { "exfat",    &is_exfat },
-    { "ext",      &is_ext },
-    { "f2fs",     &is_f2fs },
-    { "ntfs",     &is_ntfs },
-    { "squashfs", &is_squashfs },
-    { "vfat",     &is_vfat },
-    { nullptr,    nullptr },
-};
+    if (!S_ISREG(sb.st_mode)) {
+        return false;
+    }
 
-static ssize_t read_all(int fd, void *buf, size_t size)
+    // Not all filesystems support this, in which case only the mtime is used
+    // to detect changes
+    int version = 0;
+    ioctl(fd, FS_IOC_GETVERSION, &version);
+
+    key.dev = sb.st_dev;
+    key.ino = sb.st_ino;
+    key.size = static_cast<uint64_t>(sb.st_size);
+    key.generation = static_cast<unsigned int>(version);
+    key.time_sec = sb.st_mtim.tv_sec;
+    key.time_nsec = sb.st_mtim.tv_nsec;
+    key.type = nullptr;
+
+    return true;
+}
+
+static ssize_t pread_all(int fd, void *buf, size_t size, off64_t offset)
 {
     size_t total = 0;
 
     while (total < size) {
-        ssize_t n = read(fd, static_cast<char *>(buf) + total, size - total);
+        ssize_t n = pread64(fd, static_cast<char *>(buf) + total,
+                            size - total, offset + total);
         if (n == 0) {
             break;
         } else if (n < 0) {
@@ -133,10 +167,34 @@ static ssize_t read_all(int fd, void *buf, size_t size)
     return total;
 }
 
-bool blkid_get_fs_type(const char *path, const char **type)
+static const char * classify(const unsigned char *data, size_t size)
 {
-    std::vector<unsigned char> buf(1024 * 1024);
+    for (const Magic &m : magics) {
+        if (m.offset + m.magic_size <= size
+                && memcmp(data + m.offset, m.magic, m.magic_size) == 0) {
+            return m.type;
+        }
+    }
+
+    return nullptr;
+}
 
+/*!
+ * \brief Detect the filesystem type of a block device or image
+ *
+ * All superblock magics are checked against a single read of the beginning of
+ * the file. Results for image files are cached for the lifetime of the process
+ * and are keyed by the file's identity, size, and generation (see
+ * get_cache_key()). Block devices are always probed.
+ *
+ * \param[in] path Path to block device or image file
+ * \param[out] type Pointer to store the static filesystem type string or
+ *                  nullptr if the filesystem is unknown
+ *
+ * \return Whether the file could be probed. \a errno is set on failure.
+ */
+bool blkid_get_fs_type(const char *path, const char **type)
+{
     int fd = open(path, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         return false;
@@ -148,19 +206,42 @@ bool blkid_get_fs_type(const char *path, const char **type)
         errno = saved_errno;
     });
 
-    ssize_t n = read_all(fd, buf.data(), buf.size());
+    CacheEntry key;
+    bool have_key = get_cache_key(fd, key);
+
+    if (have_key) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+
+        for (const CacheEntry &entry : cache) {
+            if (cache_key_matches(entry, key)) {
+                *type = entry.type;
+                return true;
+            }
+        }
+    }
+
+    std::vector<unsigned char> buf(probe_window_size);
+
+    ssize_t n = pread_all(fd, buf.data(), buf.size(), 0);
     if (n < 0) {
         return false;
     }
 
-    for (auto it = probe_funcs; it->name; ++it) {
-        if (it->func(buf.data(), n)) {
-            *type = it->name;
-            return true;
+    key.type = classify(buf.data(), static_cast<size_t>(n));
+
+    if (have_key) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+
+        auto it = std::find_if(cache.begin(), cache.end(),
+                               [&](const CacheEntry &entry) {
+            return cache_key_matches(entry, key);
+        });
+        if (it == cache.end()) {
+            cache.push_back(key);
         }
     }
 
-    *type = nullptr;
+    *type = key.type;
     return true;
 }
 
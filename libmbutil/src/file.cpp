@@ -141,6 +141,77 @@ bool file_write_data(const std::string &path,
     return ret;
 }
 
+static bool write_fully(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Atomically replace the contents of a file
+ *
+ * The data is written to `<path>.new`, which is then renamed over \p path.
+ * Readers will see either the old or the new contents, but never a partially
+ * written file.
+ *
+ * \param path Path to file
+ * \param data Data to write
+ * \param size Size of \p data
+ * \param mode Permissions of the new file
+ * \param uid Owner of the new file
+ * \param gid Group of the new file
+ *
+ * \return Whether the file was replaced. If false, errno is set and the
+ *         original file is left untouched.
+ */
+bool file_replace_data(const std::string &path, const char *data, size_t size,
+                       mode_t mode, uid_t uid, gid_t gid)
+{
+    std::string new_path(path);
+    new_path += ".new";
+
+    int fd = open(new_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                  mode & 0777);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ret = write_fully(fd, data, size)
+            && fchown(fd, uid, gid) == 0
+            && fchmod(fd, mode & 0777) == 0;
+
+    int saved_errno = errno;
+
+    if (close(fd) < 0 && ret) {
+        saved_errno = errno;
+        ret = false;
+    }
+
+    if (ret && rename(new_path.c_str(), path.c_str()) < 0) {
+        saved_errno = errno;
+        ret = false;
+    }
+
+    if (!ret) {
+        unlink(new_path.c_str());
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
 bool file_find_one_of(const std::string &path, std::vector<std::string> items)
 {
     struct stat sb;
@@ -83,5 +83,37 @@ bool sha512_hash(const std::string &path,
     return true;
 }
 
+/*!
+ * \brief Compute SHA512 hash of a memory buffer
+ *
+ * \param data Data to hash
+ * \param size Size of \p data
+ * \param digest `unsigned char` array of size `SHA512_DIGEST_LENGTH` to store
+ *               computed hash value
+ *
+ * \return true on success, false on failure
+ */
+bool sha512_hash(const void *data, size_t size,
+                 unsigned char digest[SHA512_DIGEST_LENGTH])
+{
+    SHA512_CTX ctx;
+    if (!SHA512_Init(&ctx)) {
+        LOGE("openssl: SHA512_Init() failed");
+        return false;
+    }
+
+    if (!SHA512_Update(&ctx, data, size)) {
+        LOGE("openssl: SHA512_Update() failed");
+        return false;
+    }
+
+    if (!SHA512_Final(digest, &ctx)) {
+        LOGE("openssl: SHA512_Final() failed");
+        return false;
+    }
+
+    return true;
+}
+
 }
 }
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/line_patcher.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/libc/string.h"
+#include "mblog/logging.h"
+#include "mbutil/file.h"
+#include "mbutil/finally.h"
+
+namespace mb
+{
+namespace util
+{
+
+bool LinePatcher::Line::starts_with(const char *prefix) const
+{
+    size_t len = strlen(prefix);
+    return size >= len && memcmp(data, prefix, len) == 0;
+}
+
+bool LinePatcher::Line::contains(const char *needle) const
+{
+    return mb_memmem(data, size, needle, strlen(needle)) != nullptr;
+}
+
+bool LinePatcher::Line::is_whitespace() const
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (!isspace(static_cast<unsigned char>(data[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string LinePatcher::Line::str() const
+{
+    return std::string(data, size);
+}
+
+/*!
+ * \brief Add function to be called for every line before editing
+ *
+ * Scan functions are useful for gathering information about the whole file
+ * that the edit functions depend on. Since the file is memory mapped, this
+ * does not cause the file to be reread.
+ */
+void LinePatcher::add_scan(ScanFn fn)
+{
+    _scans.push_back(std::move(fn));
+}
+
+/*!
+ * \brief Add function to be called for every line
+ *
+ * Edit functions are called in the order that they were added. All of them
+ * see the original contents of the line and the changes they request via
+ * LinePatcher::Line are combined.
+ */
+void LinePatcher::add_edit(EditFn fn)
+{
+    _edits.push_back(std::move(fn));
+}
+
+/*!
+ * \brief Add text to be appended to the end of the file
+ */
+void LinePatcher::add_trailer(std::string text)
+{
+    _trailer += text;
+}
+
+bool LinePatcher::empty() const
+{
+    return _scans.empty() && _edits.empty() && _trailer.empty();
+}
+
+/*!
+ * \brief Apply edits to a file
+ *
+ * The file is read once (via mmap) and, if any changes were made, the result
+ * is written once to a temporary file that atomically replaces the original.
+ * The ownership and permissions of the original file are preserved.
+ *
+ * \param path Path to file
+ * \param changed_out Pointer to store whether the file was changed
+ *
+ * \return Whether the edits were successfully applied. If the file cannot be
+ *         opened, false is returned with errno set and nothing is logged.
+ */
+bool LinePatcher::apply(const std::string &path, bool *changed_out) const
+{
+    struct stat sb;
+    void *map = nullptr;
+
+    if (changed_out) {
+        *changed_out = false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (sb.st_size > 0) {
+        map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            LOGE("%s: Failed to mmap: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    auto unmap_map = finally([&] {
+        if (map) {
+            munmap(map, sb.st_size);
+        }
+    });
+
+    const char *begin = static_cast<const char *>(map);
+    const char *end = begin + sb.st_size;
+
+    auto for_each_line = [&](const std::function<void(Line &)> &fn) {
+        Line line;
+        line.number = 0;
+
+        for (const char *ptr = begin; ptr < end; ++line.number) {
+            const char *nl = static_cast<const char *>(
+                    memchr(ptr, '\n', end - ptr));
+
+            line.data = ptr;
+            line.size = (nl ? nl : end) - ptr;
+            fn(line);
+
+            ptr += line.size + (nl ? 1 : 0);
+        }
+    };
+
+    for (auto const &scan : _scans) {
+        for_each_line([&](Line &line) {
+            scan(line);
+        });
+    }
+
+    std::string output;
+    output.reserve(sb.st_size + _trailer.size() + 4096);
+    bool changed = false;
+
+    for_each_line([&](Line &line) {
+        line.prepend.clear();
+        line.append.clear();
+        line.comment_out = false;
+        line.remove = false;
+
+        for (auto const &edit : _edits) {
+            edit(line);
+        }
+
+        bool has_newline = line.data + line.size < end;
+
+        output += line.prepend;
+        if (!line.remove) {
+            if (line.comment_out) {
+                output += '#';
+            }
+            output.append(line.data, line.size);
+            if (has_newline || !line.append.empty()) {
+                output += '\n';
+            }
+        }
+        output += line.append;
+
+        changed = changed || !line.prepend.empty() || !line.append.empty()
+                || line.comment_out || line.remove;
+    });
+
+    if (!_trailer.empty()) {
+        if (!output.empty() && output.back() != '\n') {
+            output += '\n';
+        }
+        output += _trailer;
+        changed = true;
+    }
+
+    if (!changed) {
+        return true;
+    }
+
+    if (!file_replace_data(path, output.data(), output.size(),
+                           sb.st_mode, sb.st_uid, sb.st_gid)) {
+        LOGE("%s: Failed to write patched file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (changed_out) {
+        *changed_out = true;
+    }
+
+    return true;
+}
+
+}
+}
@@ -19,12 +19,16 @@
 
 #include "mbutil/loopdev.h"
 
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
@@ -32,7 +36,9 @@
 #include <linux/loop.h>
 
 #include "mbcommon/string.h"
+#include "mbutil/autoclose/file.h"
 #include "mbutil/finally.h"
+#include "mbutil/mount.h"
 #include "mbutil/string.h"
 
 
@@ -44,12 +50,75 @@
 
 #define MAX_LOOPDEVS    1024
 
+// Number of free loop devices to find per scan of /dev/block/loop*
+#define LOOP_POOL_SIZE  8
+
+// Added in Linux 5.8
+#ifndef LOOP_CONFIGURE
+#  define LOOP_CONFIGURE 0x4C0A
+
+struct loop_config
+{
+    __u32 fd;
+    __u32 block_size;
+    struct loop_info64 info;
+    __u64 __reserved[8];
+};
+#endif
+
 
 namespace mb
 {
 namespace util
 {
 
+/*
+ * Loop devices handed out by loopdev_find_unused() are tracked until they are
+ * released with loopdev_remove_device(). This keeps threads in this process
+ * from claiming the same device and lets us find devices that were attached,
+ * but never cleaned up. Devices that were found to be free during a scan are
+ * kept in a pool so that the next allocation does not need to scan again.
+ */
+struct LoopState
+{
+    std::mutex mutex;
+    // Claimed loop device number -> backing file (empty if not yet attached)
+    std::unordered_map<int, std::string> owned;
+    // Loop device numbers that were free when last checked
+    std::vector<int> pool;
+    // Whether LOOP_CONFIGURE is unsupported by the kernel
+    bool no_loop_configure = false;
+};
+
+static LoopState state;
+
+static bool is_loopdev_free(int fd)
+{
+    struct loop_info64 loopinfo;
+    return ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0 && errno == ENXIO;
+}
+
+/*!
+ * \brief Get loop device number from an opened loop device
+ *
+ * \return Loopdev number or -1 if \a fd is not a loop device
+ */
+static int get_loopdev_number(int fd)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0) {
+        return -1;
+    }
+
+    if (!S_ISBLK(sb.st_mode) || major(sb.st_rdev) != 7) {
+        errno = ENOTBLK;
+        return -1;
+    }
+
+    return static_cast<int>(minor(sb.st_rdev));
+}
+
 /*!
  * \brief Find empty loopdev by using the new ioctl for /dev/block/loop-control
  *
@@ -60,7 +129,7 @@ static int find_loopdev_by_loop_control(void)
 {
     int fd = -1;
 
-    if ((fd = open(LOOP_CONTROL, O_RDWR)) < 0) {
+    if ((fd = open(LOOP_CONTROL, O_RDWR | O_CLOEXEC)) < 0) {
         return -1;
     }
 
@@ -84,24 +153,31 @@ static int find_loopdev_by_loop_control(void)
 }
 
 /*!
- * \brief Find empty loopdev by dumb scan through /dev/block/loop*
+ * \brief Find empty loopdevs by dumb scan through /dev/block/loop*
  *
- * \return Loopdev number or -1 if:
- *         - /dev/block/loop# failed to stat where errno != ENOENT
- *         - /dev/block/loop# is not a loop device
- *         - /dev/block/loop# could not be opened
- *         - LOOP_GET_STATUS64 ioctl failed where errno != ENXIO
+ * Devices that are owned by this process are skipped. The free devices found
+ * are appended to \a out until it contains \a max entries.
+ *
+ * \pre state.mutex is locked
+ *
+ * Loopdevs are skipped if:
+ * - /dev/block/loop# failed to stat where errno != ENOENT
+ * - /dev/block/loop# is not a loop device
+ * - /dev/block/loop# could not be opened
+ * - LOOP_GET_STATUS64 ioctl failed where errno != ENXIO
  */
-static int find_loopdev_by_scanning(void)
+static void find_loopdevs_by_scanning(std::vector<int> &out, size_t max)
 {
     int fd;
     char loopdev[64];
 
     // Avoid /dev/block/loop0 since some installers (ahem, SuperSU) are
     // hardcoded to use it
-    for (int n = 1; n < MAX_LOOPDEVS; ++n) {
-        struct loop_info64 loopinfo;
-        struct stat sb;
+    for (int n = 1; n < MAX_LOOPDEVS && out.size() < max; ++n) {
+        if (state.owned.find(n) != state.owned.end()
+                || std::find(out.begin(), out.end(), n) != out.end()) {
+            continue;
+        }
 
         sprintf(loopdev, LOOP_FMT, n);
 
@@ -115,62 +191,149 @@ static int find_loopdev_by_scanning(void)
             // Loopdev does not exist. Great! loopdev_find_unused() will
             // create it
             if (errno == ENOENT) {
-                return n;
-            } else {
-                continue;
+                out.push_back(n);
             }
+            continue;
         }
 
         auto close_fd = finally([&] {
             close(fd);
         });
 
-        if (fstat(fd, &sb) < 0) {
-            // Uhhhhh...
+        if (get_loopdev_number(fd) < 0) {
+            // Device isn't a loop device
             continue;
         }
 
-        if (!S_ISBLK(sb.st_mode) || major(sb.st_rdev) != 7) {
-            // Device isn't a loop device
+        if (is_loopdev_free(fd)) {
+            out.push_back(n);
+        }
+    }
+}
+
+/*!
+ * \brief Take a loop device from the pool if it is still free
+ *
+ * \pre state.mutex is locked
+ *
+ * \return Loopdev number or -1 if the pool is empty
+ */
+static int take_from_pool(void)
+{
+    char loopdev[64];
+
+    while (!state.pool.empty()) {
+        int n = state.pool.back();
+        state.pool.pop_back();
+
+        if (state.owned.find(n) != state.owned.end()) {
             continue;
         }
 
-        if (ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0) {
-            if (errno == ENXIO) {
+        sprintf(loopdev, LOOP_FMT, n);
+
+        int fd = open(loopdev, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT
+                    && mknod(loopdev, S_IFBLK | 0644, makedev(7, n)) == 0) {
                 return n;
-            } else {
-                continue;
             }
+            continue;
+        }
+
+        bool is_free = is_loopdev_free(fd);
+        close(fd);
+
+        if (is_free) {
+            return n;
         }
     }
 
     return -1;
 }
 
+/*!
+ * \brief Find and claim an unused loop device
+ *
+ * The device is reserved for the calling process until it is released with
+ * loopdev_remove_device(), so concurrent callers will never receive the same
+ * device. Another process may still attach it first, in which case
+ * loopdev_set_up_device() fails with EBUSY.
+ *
+ * \return Path to loop device or empty string if no unused loop device could be
+ *         found
+ */
 std::string loopdev_find_unused(void)
 {
+    std::lock_guard<std::mutex> lock(state.mutex);
+
     int n = find_loopdev_by_loop_control();
-    // Also search by scanning if n == 0, since some installers hardcode
-    // /dev/block/loop0
-    if (n <= 0) {
-        n = find_loopdev_by_scanning();
+    // Also search the pool if n == 0, since some installers hardcode
+    // /dev/block/loop0. n may also be a device that we claimed, but have not
+    // attached yet.
+    if (n <= 0 || state.owned.find(n) != state.owned.end()) {
+        n = take_from_pool();
     }
     if (n < 0) {
+        find_loopdevs_by_scanning(state.pool, LOOP_POOL_SIZE);
+        // Pop from the end, so use the lowest numbered device first
+        std::reverse(state.pool.begin(), state.pool.end());
+        n = take_from_pool();
+    }
+    if (n < 0) {
+        errno = ENOENT;
         return {};
     }
 
+    state.owned[n];
+
     return mb::format(LOOP_FMT, n);
 }
 
+/*!
+ * \brief Stop tracking a loop device and return it to the pool
+ *
+ * \pre state.mutex is locked
+ */
+static void release_loopdev(int n)
+{
+    if (state.owned.erase(n) > 0
+            && std::find(state.pool.begin(), state.pool.end(), n)
+                    == state.pool.end()) {
+        state.pool.push_back(n);
+    }
+}
+
+/*!
+ * \brief Attach a file to a loop device
+ *
+ * LOOP_CONFIGURE is used to set the backing file, offset, flags, and direct I/O
+ * in a single ioctl if the kernel supports it. Direct I/O avoids caching the
+ * image's data twice (in the loop device and in the backing file). If the
+ * kernel rejects direct I/O for the backing file, the device is configured
+ * without it. On older kernels, LOOP_SET_FD and LOOP_SET_STATUS64 are used
+ * without direct I/O because enabling it with LOOP_SET_DIRECT_IO costs as much
+ * as the rest of the setup.
+ *
+ * The logical block size is left at the kernel's default because images may
+ * contain filesystems with a block size smaller than the backing device's.
+ *
+ * \param loopdev Path to loop device
+ * \param file Path to backing file
+ * \param offset Offset of the data in \a file
+ * \param ro Whether to attach the file read-only
+ *
+ * \return Whether the file was attached. \a errno is set on failure.
+ */
 bool loopdev_set_up_device(const std::string &loopdev, const std::string &file,
                            uint64_t offset, bool ro)
 {
     int ffd = -1;
     int lfd = -1;
+    int n = -1;
+    bool ret = false;
 
-    struct loop_info64 loopinfo;
-
-    if ((ffd = open(file.c_str(), ro ? O_RDONLY : O_RDWR)) < 0) {
+    if ((ffd = open(file.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC)) < 0) {
         return false;
     }
 
@@ -178,7 +341,8 @@ bool loopdev_set_up_device(const std::string &loopdev, const std::string &file,
         close(ffd);
     });
 
-    if ((lfd = open(loopdev.c_str(), ro ? O_RDONLY : O_RDWR)) < 0) {
+    if ((lfd = open(loopdev.c_str(),
+                    (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC)) < 0) {
         return false;
     }
 
@@ -186,31 +350,208 @@ bool loopdev_set_up_device(const std::string &loopdev, const std::string &file,
         close(lfd);
     });
 
+    auto update_state = finally([&] {
+        if (n < 0) {
+            return;
+        }
+
+        int saved_errno = errno;
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (ret) {
+            state.owned[n] = file;
+        } else {
+            // We either lost a race with another process or the device
+            // is unusable. Either way, it's not ours anymore.
+            state.owned.erase(n);
+        }
+
+        errno = saved_errno;
+    });
+
+    if ((n = get_loopdev_number(lfd)) < 0) {
+        return false;
+    }
+
+    struct loop_info64 loopinfo;
     memset(&loopinfo, 0, sizeof(struct loop_info64));
     strlcpy((char *) loopinfo.lo_file_name, file.c_str(), LO_NAME_SIZE);
     loopinfo.lo_offset = offset;
 
+    bool try_configure;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        try_configure = !state.no_loop_configure;
+    }
+
+    if (try_configure) {
+        struct loop_config config;
+        memset(&config, 0, sizeof(config));
+        config.fd = ffd;
+        config.info = loopinfo;
+        config.info.lo_flags = LO_FLAGS_DIRECT_IO;
+        if (ro) {
+            config.info.lo_flags |= LO_FLAGS_READ_ONLY;
+        }
+
+        if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+            ret = true;
+            return true;
+        } else if (errno == EINVAL) {
+            // Some kernels reject direct I/O if the backing file does not
+            // support it. That says nothing about LOOP_CONFIGURE itself, so
+            // try again without it.
+            config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+
+            if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+                ret = true;
+                return true;
+            }
+        }
+
+        if (errno != EINVAL && errno != ENOTTY) {
+            return false;
+        }
+
+        // The ioctl is not supported
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.no_loop_configure = true;
+    }
+
     if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
         return false;
     }
 
     if (ioctl(lfd, LOOP_SET_STATUS64, &loopinfo) < 0) {
+        int saved_errno = errno;
         ioctl(lfd, LOOP_CLR_FD, 0);
+        errno = saved_errno;
         return false;
     }
 
+    ret = true;
     return true;
 }
 
+/*!
+ * \brief Detach the backing file from a loop device
+ *
+ * If the loop device was claimed by this process, it is returned to the pool of
+ * free loop devices.
+ *
+ * \param loopdev Path to loop device
+ *
+ * \return Whether the LOOP_CLR_FD ioctl succeeded
+ */
 bool loopdev_remove_device(const std::string &loopdev)
 {
-    int lfd;
-    if ((lfd = open(loopdev.c_str(), O_RDONLY)) < 0) {
-        return false;
+    return loopdev_remove_devices({ loopdev }) == 1;
+}
+
+/*!
+ * \brief Detach the backing files from several loop devices
+ *
+ * All of the devices are detached before any are returned to the pool, so the
+ * pool lock is only taken once.
+ *
+ * \param loopdevs Paths to loop devices
+ *
+ * \return Number of loop devices that were detached. If this is less than the
+ *         number of devices, \a errno is set to the error of the last failure.
+ */
+size_t loopdev_remove_devices(const std::vector<std::string> &loopdevs)
+{
+    std::vector<int> released;
+    size_t removed = 0;
+    int last_errno = 0;
+
+    for (const std::string &loopdev : loopdevs) {
+        int lfd = open(loopdev.c_str(), O_RDONLY | O_CLOEXEC);
+        if (lfd < 0) {
+            last_errno = errno;
+            continue;
+        }
+
+        int n = get_loopdev_number(lfd);
+        bool ret = ioctl(lfd, LOOP_CLR_FD, 0) == 0;
+        int saved_errno = errno;
+        close(lfd);
+
+        if (ret) {
+            ++removed;
+        } else {
+            last_errno = saved_errno;
+        }
+
+        // Stop tracking the device if it has no backing file anymore
+        if (n >= 0 && (ret || saved_errno == ENXIO)) {
+            released.push_back(n);
+        }
+    }
+
+    if (!released.empty()) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        for (int n : released) {
+            release_loopdev(n);
+        }
+    }
+
+    if (removed < loopdevs.size()) {
+        errno = last_errno;
+    }
+
+    return removed;
+}
+
+/*!
+ * \brief Detach loop devices that this process attached, but no longer uses
+ *
+ * A loop device is considered leaked if it was attached with
+ * loopdev_set_up_device(), was not released with loopdev_remove_device(), and
+ * is not the source of any mount point in /proc/mounts. This should only be
+ * called once nothing else (eg. a child process) could be using the loop
+ * devices directly.
+ *
+ * \return Number of loop devices that were reclaimed
+ */
+size_t loopdev_reclaim_leaked(void)
+{
+    std::vector<std::string> leaked;
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        for (auto const &item : state.owned) {
+            if (!item.second.empty()) {
+                leaked.push_back(mb::format(LOOP_FMT, item.first));
+            }
+        }
     }
-    int ret = ioctl(lfd, LOOP_CLR_FD, 0);
-    close(lfd);
-    return ret == 0;
+
+    if (leaked.empty()) {
+        return 0;
+    }
+
+    autoclose::file fp(std::fopen(PROC_MOUNTS, "r"), std::fclose);
+    if (!fp) {
+        return 0;
+    }
+
+    for (MountEntry entry; get_mount_entry(fp.get(), entry);) {
+        struct stat sb;
+
+        if (stat(entry.fsname.c_str(), &sb) < 0
+                || !S_ISBLK(sb.st_mode) || major(sb.st_rdev) != 7) {
+            continue;
+        }
+
+        std::string path = mb::format(LOOP_FMT, minor(sb.st_rdev));
+        leaked.erase(std::remove(leaked.begin(), leaked.end(), path),
+                     leaked.end());
+    }
+
+    return loopdev_remove_devices(leaked);
 }
 
 }
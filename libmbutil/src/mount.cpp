@@ -44,6 +44,8 @@
 
 #define MAX_UNMOUNT_TRIES 5
 
+#define LOOPDEV_SETUP_ATTEMPTS 5
+
 #define DELETED_SUFFIX " (deleted)"
 
 namespace mb
@@ -225,19 +227,28 @@ bool mount(const char *source, const char *target, const char *fstype,
     }
 
     if (need_loopdev) {
-        std::string loopdev = util::loopdev_find_unused();
-        if (loopdev.empty()) {
-            LOGE("Failed to find unused loop device: %s", strerror(errno));
-            return false;
-        }
+        std::string loopdev;
+
+        // Another process may attach the unused loop device between the
+        // lookup and the setup, in which case the ioctl fails with EBUSY.
+        // Look up a new device and try again.
+        for (int attempt = 0; ; ++attempt) {
+            loopdev = util::loopdev_find_unused();
+            if (loopdev.empty()) {
+                LOGE("Failed to find unused loop device: %s", strerror(errno));
+                return false;
+            }
 
-        LOGD("Assigning %s to loop device %s", source, loopdev.c_str());
+            LOGD("Assigning %s to loop device %s", source, loopdev.c_str());
 
-        if (!util::loopdev_set_up_device(
-                loopdev, source, 0, mount_flags & MS_RDONLY)) {
-            LOGE("Failed to set up loop device %s: %s",
-                 loopdev.c_str(), strerror(errno));
-            return false;
+            if (util::loopdev_set_up_device(
+                    loopdev, source, 0, mount_flags & MS_RDONLY)) {
+                break;
+            } else if (errno != EBUSY || attempt + 1 >= LOOPDEV_SETUP_ATTEMPTS) {
+                LOGE("Failed to set up loop device %s: %s",
+                     loopdev.c_str(), strerror(errno));
+                return false;
+            }
         }
 
         if (::mount(loopdev.c_str(), target, fstype, mount_flags, data) < 0) {
@@ -23,12 +23,19 @@
 #include <mutex>
 #include <vector>
 
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "mbcommon/common.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 #include "mbutil/finally.h"
 #include "mbutil/string.h"
 
@@ -235,89 +242,195 @@ bool property_get_all(std::unordered_map<std::string, std::string> &map)
     }, &map);
 }
 
-// Properties file functions
+// Above this many keys, a single pass over all properties is faster than
+// looking up each key individually. A pass reads every property, so it only
+// pays off when the batch covers a large part of the property area.
+#define GET_KEYS_FOREACH_THRESHOLD 512
 
-enum class PropIterAction
+/*!
+ * \brief Look up several properties at once
+ *
+ * Batches of up to GET_KEYS_FOREACH_THRESHOLD keys look up each key
+ * individually. Larger batches make a single pass over the property area and
+ * pick out the requested keys.
+ *
+ * \param keys Keys to look up
+ * \param map Map to add found properties to. Existing entries are not
+ *            replaced.
+ *
+ * \return Number of keys that were found
+ */
+size_t property_get_keys(const std::vector<std::string> &keys,
+                         std::unordered_map<std::string, std::string> &map)
 {
-    CONTINUE,
-    STOP,
-};
+    size_t found = 0;
 
-typedef PropIterAction (*PropIterCb)(const std::string &key,
-                                     const std::string &value,
-                                     void *cookie);
+    if (keys.size() <= GET_KEYS_FOREACH_THRESHOLD) {
+        std::string value;
 
-static bool iterate_property_file(const std::string &path, PropIterCb cb,
-                                  void *cookie)
-{
-    ScopedFILE fp(fopen(path.c_str(), "r"), &fclose);
-    if (!fp) {
-        return false;
+        for (auto const &key : keys) {
+            if (property_get(key, value)) {
+                map.emplace(key, value);
+                ++found;
+            }
+        }
+
+        return found;
     }
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+    struct GetKeysCtx
+    {
+        std::unordered_map<std::string, bool> wanted;
+        std::unordered_map<std::string, std::string> *map;
+        size_t found;
+        // Reused to avoid an allocation per property
+        std::string name;
+    };
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+    GetKeysCtx ctx;
+    ctx.map = &map;
+    ctx.found = 0;
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        if (read == 0 || line[0] == '#') {
-            // Skip empty and comment lines
-            continue;
-        }
+    for (auto const &key : keys) {
+        ctx.wanted.emplace(key, false);
+    }
 
-        char *equals = strchr(line, '=');
-        if (!equals) {
-            // No equals in line
-            continue;
-        }
+    libc_system_property_foreach([](const prop_info *pi, void *cookie) {
+        libc_system_property_read_callback(
+                pi, [](void *cookie, const char *name, const char *value,
+                       uint32_t serial) {
+            (void) serial;
+            auto *ctx = static_cast<GetKeysCtx *>(cookie);
+
+            ctx->name = name;
+
+            auto it = ctx->wanted.find(ctx->name);
+            if (it != ctx->wanted.end() && !it->second) {
+                it->second = true;
+                ctx->map->emplace(ctx->name, value);
+                ++ctx->found;
+            }
+        }, cookie);
+    }, &ctx);
 
-        *equals = '\0';
+    return ctx.found;
+}
+
+/*!
+ * \brief Handle for repeatedly reading a system property
+ *
+ * The property is looked up once and the value is only reread when the
+ * property's serial changes. While the property does not exist, the lookup is
+ * only retried after a property has been added or changed. All functions are
+ * thread safe.
+ */
+CachedProperty::CachedProperty(std::string key)
+    : _key(std::move(key))
+    , _pi(nullptr)
+    , _area_serial(0)
+    , _has_area_serial(false)
+    , _serial(0)
+    , _has_value(false)
+{
+}
 
-        if (line[read - 1] == '\n') {
-            line[read - 1] = '\0';
+const std::string & CachedProperty::key() const
+{
+    return _key;
+}
+
+/*!
+ * \brief Update the cached value if the property changed
+ *
+ * \pre _mutex is locked
+ *
+ * \return Whether the property exists
+ */
+bool CachedProperty::refresh()
+{
+    if (!_pi) {
+        initialize_properties();
+
+        // Nothing was added since the last failed lookup
+        uint32_t area_serial = mb__system_property_area_serial();
+        if (_has_area_serial && area_serial == _area_serial) {
+            return false;
         }
 
-        if (cb(line, equals + 1, cookie) == PropIterAction::STOP) {
-            return true;
+        _pi = libc_system_property_find(_key.c_str());
+        if (!_pi) {
+            _area_serial = area_serial;
+            _has_area_serial = true;
+            return false;
         }
     }
 
-    return !ferror(fp.get());
+    if (_has_value && mb__system_property_serial(_pi) == _serial) {
+        return true;
+    }
+
+    libc_system_property_read_callback(
+            _pi, [](void *cookie, const char *name, const char *value,
+                    uint32_t serial) {
+        (void) name;
+        auto *prop = static_cast<CachedProperty *>(cookie);
+        prop->_value = value;
+        prop->_serial = serial;
+    }, this);
+    _has_value = true;
+
+    return true;
 }
 
-bool property_file_get(const std::string &path, const std::string &key,
-                       std::string &value_out)
+bool CachedProperty::get(std::string &value_out)
 {
-    struct Ctx
-    {
-        const std::string *key;
-        std::string *value_out;
-        bool found;
-    };
+    std::lock_guard<std::mutex> lock(_mutex);
 
-    Ctx ctx{&key, &value_out, false};
+    if (!refresh()) {
+        return false;
+    }
 
-    bool ret = iterate_property_file(
-            path, [](const std::string &key, const std::string &value,
-                     void *cookie){
-        auto *ctx = static_cast<Ctx *>(cookie);
-        if (key == *ctx->key) {
-            *ctx->value_out = value;
-            ctx->found = true;
-            return PropIterAction::STOP;
-        }
-        return PropIterAction::CONTINUE;
-    }, &ctx);
+    value_out = _value;
+    return true;
+}
+
+std::string CachedProperty::get_string(const std::string &default_value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (refresh() && !_value.empty()) {
+        return _value;
+    }
 
-    if (!ctx.found) {
+    return default_value;
+}
+
+bool CachedProperty::get_bool(bool default_value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool result;
+
+    if (refresh() && string_to_bool(_value, result)) {
+        return result;
+    }
+
+    return default_value;
+}
+
+// Properties file functions
+
+bool property_file_get(const std::string &path, const std::string &key,
+                       std::string &value_out)
+{
+    PropertyFile file;
+
+    if (!file.open(path)) {
         value_out.clear();
+        return false;
     }
 
-    return ret;
+    file.get(key, value_out);
+    return true;
 }
 
 std::string property_file_get_string(const std::string &path,
@@ -349,21 +462,14 @@ bool property_file_get_bool(const std::string &path, const std::string &key,
 bool property_file_list(const std::string &path, PropertyListCb prop_fn,
                         void *cookie)
 {
-    struct Ctx
-    {
-        PropertyListCb prop_fn;
-        void *cookie;
-    };
+    PropertyFile file;
 
-    Ctx ctx{prop_fn, cookie};
+    if (!file.open(path)) {
+        return false;
+    }
 
-    return iterate_property_file(
-            path, [](const std::string &key, const std::string &value,
-                     void *cookie){
-        auto *ctx = static_cast<Ctx *>(cookie);
-        ctx->prop_fn(key, value, ctx->cookie);
-        return PropIterAction::CONTINUE;
-    }, &ctx);
+    file.list(prop_fn, cookie);
+    return true;
 }
 
 bool property_file_get_all(const std::string &path,
@@ -376,6 +482,32 @@ bool property_file_get_all(const std::string &path,
     }, &map);
 }
 
+/*!
+ * \brief Get the values of several keys from a properties file
+ *
+ * Like property_file_get(), the first occurrence of a key wins. Keys that are
+ * not found are not added to \p map.
+ *
+ * \param path Path to properties file
+ * \param keys Keys to look up
+ * \param map Map to add found properties to
+ *
+ * \return Whether the file was successfully read
+ */
+bool property_file_get_keys(const std::string &path,
+                            const std::vector<std::string> &keys,
+                            std::unordered_map<std::string, std::string> &map)
+{
+    PropertyFile file;
+
+    if (!file.open(path)) {
+        return false;
+    }
+
+    file.get_keys(keys, map);
+    return true;
+}
+
 bool property_file_write_all(const std::string &path,
                              const std::unordered_map<std::string, std::string> &map)
 {
@@ -396,5 +528,487 @@ bool property_file_write_all(const std::string &path,
     return true;
 }
 
+
+// FNV-1a
+static uint32_t hash_key(const char *key, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*!
+ * \class PropertyFile
+ *
+ * \brief Indexed, read-mostly view of a properties file
+ *
+ * The file is memory mapped once. After the first lookup, every `key=value`
+ * line is indexed by key, so any number of lookups can be done without
+ * scanning the file again. The
+ * parsing rules are the same as the `property_file_*()` functions: empty
+ * lines, comment lines (starting with `#`), and lines without `=` are
+ * ignored, and nothing is trimmed.
+ *
+ * Changes made with set() and remove() are visible to lookups immediately,
+ * but are only written to disk by commit().
+ */
+
+PropertyFile::PropertyFile()
+    : _data(nullptr)
+    , _size(0)
+    , _mode(0644)
+    , _uid(0)
+    , _gid(0)
+    , _indexed(false)
+    , _scanned_once(false)
+{
+}
+
+PropertyFile::~PropertyFile()
+{
+    close();
+}
+
+/*!
+ * \brief Open and index a properties file
+ *
+ * \param path Path to properties file
+ *
+ * \return Whether the file was successfully opened. If false, errno is set.
+ */
+bool PropertyFile::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        ::close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return false;
+    }
+
+    if (sb.st_size > 0) {
+        void *map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+
+        _data = static_cast<const char *>(map);
+        _size = sb.st_size;
+    } else {
+        _data = "";
+        _size = 0;
+    }
+
+    _path = path;
+    _mode = sb.st_mode;
+    _uid = sb.st_uid;
+    _gid = sb.st_gid;
+
+    return true;
+}
+
+/*!
+ * \brief Close the file and discard uncommitted changes
+ */
+void PropertyFile::close()
+{
+    if (_size > 0) {
+        munmap(const_cast<char *>(_data), _size);
+    }
+
+    _path.clear();
+    _data = nullptr;
+    _size = 0;
+    _indexed = false;
+    _scanned_once = false;
+    _entries.clear();
+    _slots.clear();
+    _changes.clear();
+}
+
+bool PropertyFile::is_open() const
+{
+    return _data != nullptr;
+}
+
+/*!
+ * \brief Find the next property line at or after \p ptr
+ *
+ * \return Whether a property was found. \p ptr is advanced past its line.
+ */
+bool PropertyFile::scan_entry(const char *&ptr, Entry &entry) const
+{
+    const char *end = _data + _size;
+
+    while (ptr < end) {
+        const char *line = ptr;
+        const char *nl = static_cast<const char *>(
+                memchr(line, '\n', end - line));
+        const char *line_end = nl ? nl : end;
+
+        ptr = nl ? nl + 1 : end;
+
+        if (*line == '#') {
+            continue;
+        }
+
+        const char *equals = static_cast<const char *>(
+                memchr(line, '=', line_end - line));
+        if (equals) {
+            entry.offset = line - _data;
+            entry.key_size = equals - line;
+            entry.value_size = line_end - equals - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PropertyFile::ensure_indexed() const
+{
+    if (_indexed) {
+        return;
+    }
+
+    const char *ptr = _data;
+    Entry entry;
+
+    while (scan_entry(ptr, entry)) {
+        _entries.push_back(entry);
+    }
+
+    size_t capacity = 16;
+    while (capacity < _entries.size() * 2) {
+        capacity *= 2;
+    }
+
+    _slots.assign(capacity, 0);
+
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        const Entry &entry = _entries[i];
+        const char *key = _data + entry.offset;
+        size_t slot = hash_key(key, entry.key_size) & (capacity - 1);
+
+        while (true) {
+            uint32_t index = _slots[slot];
+            if (index == 0) {
+                _slots[slot] = static_cast<uint32_t>(i + 1);
+                break;
+            }
+
+            const Entry &other = _entries[index - 1];
+            if (other.key_size == entry.key_size
+                    && memcmp(_data + other.offset, key, entry.key_size) == 0) {
+                // First occurrence wins
+                break;
+            }
+
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+
+    _indexed = true;
+}
+
+const PropertyFile::Entry * PropertyFile::find_entry(const char *key,
+                                                     size_t key_size) const
+{
+    ensure_indexed();
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash_key(key, key_size) & mask;
+
+    while (uint32_t index = _slots[slot]) {
+        const Entry &entry = _entries[index - 1];
+        if (entry.key_size == key_size
+                && memcmp(_data + entry.offset, key, key_size) == 0) {
+            return &entry;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+bool PropertyFile::find_entry_unindexed(const char *key, size_t key_size,
+                                        Entry &entry) const
+{
+    const char *ptr = _data;
+
+    while (scan_entry(ptr, entry)) {
+        if (entry.key_size == key_size
+                && memcmp(_data + entry.offset, key, key_size) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const PropertyFile::Change * PropertyFile::find_change(
+        const std::string &key) const
+{
+    for (auto const &change : _changes) {
+        if (change.key == key) {
+            return &change;
+        }
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief Get the value of a property
+ *
+ * If the key appears multiple times, the first occurrence wins.
+ *
+ * \param key Property key
+ * \param value_out Reference to store value. Cleared if the key is not found.
+ *
+ * \return Whether the key was found
+ */
+bool PropertyFile::get(const std::string &key, std::string &value_out) const
+{
+    if (const Change *change = find_change(key)) {
+        if (change->removed) {
+            value_out.clear();
+            return false;
+        }
+        value_out = change->value;
+        return true;
+    }
+
+    Entry unindexed;
+    const Entry *entry;
+
+    if (!_indexed && !_scanned_once) {
+        _scanned_once = true;
+        entry = find_entry_unindexed(key.data(), key.size(), unindexed)
+                ? &unindexed : nullptr;
+    } else {
+        entry = find_entry(key.data(), key.size());
+    }
+
+    if (!entry) {
+        value_out.clear();
+        return false;
+    }
+
+    value_out.assign(_data + entry->offset + entry->key_size + 1,
+                     entry->value_size);
+    return true;
+}
+
+std::string PropertyFile::get_string(const std::string &key,
+                                     const std::string &default_value) const
+{
+    std::string value;
+
+    if (get(key, value) && !value.empty()) {
+        return value;
+    }
+
+    return default_value;
+}
+
+bool PropertyFile::get_bool(const std::string &key, bool default_value) const
+{
+    std::string value;
+    bool result;
+
+    if (get(key, value) && string_to_bool(value, result)) {
+        return result;
+    }
+
+    return default_value;
+}
+
+/*!
+ * \brief Look up several properties at once
+ *
+ * \param keys Keys to look up
+ * \param map Map to add found properties to. Existing entries are not
+ *            replaced.
+ *
+ * \return Number of keys that were found
+ */
+size_t PropertyFile::get_keys(
+        const std::vector<std::string> &keys,
+        std::unordered_map<std::string, std::string> &map) const
+{
+    size_t found = 0;
+    std::string value;
+
+    for (auto const &key : keys) {
+        if (get(key, value)) {
+            map.emplace(key, value);
+            ++found;
+        }
+    }
+
+    return found;
+}
+
+/*!
+ * \brief Call a function for every property
+ *
+ * Properties are listed in file order, including duplicate keys. Changed keys
+ * are listed once with their new value and new keys are listed last.
+ */
+void PropertyFile::list(PropertyListCb prop_fn, void *cookie) const
+{
+    std::string key;
+    std::string value;
+
+    ensure_indexed();
+
+    for (auto const &entry : _entries) {
+        key.assign(_data + entry.offset, entry.key_size);
+
+        if (const Change *change = find_change(key)) {
+            if (change->removed
+                    || find_entry(key.data(), key.size()) != &entry) {
+                continue;
+            }
+            prop_fn(key, change->value, cookie);
+        } else {
+            value.assign(_data + entry.offset + entry.key_size + 1,
+                         entry.value_size);
+            prop_fn(key, value, cookie);
+        }
+    }
+
+    for (auto const &change : _changes) {
+        if (!change.removed
+                && !find_entry(change.key.data(), change.key.size())) {
+            prop_fn(change.key, change.value, cookie);
+        }
+    }
+}
+
+/*!
+ * \brief Set a property
+ *
+ * When committed, the first line with \p key is replaced, any later lines with
+ * the same key are removed, and the property is appended to the end of the
+ * file if it didn't exist.
+ */
+void PropertyFile::set(const std::string &key, const std::string &value)
+{
+    for (auto &change : _changes) {
+        if (change.key == key) {
+            change.value = value;
+            change.removed = false;
+            return;
+        }
+    }
+
+    _changes.push_back({ key, value, false });
+}
+
+/*!
+ * \brief Remove all lines with a property
+ */
+void PropertyFile::remove(const std::string &key)
+{
+    for (auto &change : _changes) {
+        if (change.key == key) {
+            change.value.clear();
+            change.removed = true;
+            return;
+        }
+    }
+
+    _changes.push_back({ key, {}, true });
+}
+
+/*!
+ * \brief Write uncommitted changes to the file
+ *
+ * Lines that aren't affected by the changes, including comments, are kept
+ * as-is. The file is atomically replaced and its ownership and permissions
+ * are preserved. Afterwards, the new file is opened.
+ *
+ * \return Whether the changes were written. If false, errno is set and the
+ *         original file is left untouched.
+ */
+bool PropertyFile::commit()
+{
+    if (!is_open()) {
+        errno = EBADF;
+        return false;
+    } else if (_changes.empty()) {
+        return true;
+    }
+
+    ensure_indexed();
+
+    std::string output;
+    output.reserve(_size + 1024);
+
+    const char *begin = _data;
+    const char *end = _data + _size;
+    const char *ptr = begin;
+    std::string key;
+
+    for (auto const &entry : _entries) {
+        const char *line = begin + entry.offset;
+        key.assign(line, entry.key_size);
+
+        const Change *change = find_change(key);
+        if (!change) {
+            continue;
+        }
+
+        // Copy everything up to this line
+        output.append(ptr, line);
+
+        const char *nl = static_cast<const char *>(memchr(line, '\n', end - line));
+        ptr = nl ? nl + 1 : end;
+
+        if (!change->removed && find_entry(key.data(), key.size()) == &entry) {
+            output += key;
+            output += '=';
+            output += change->value;
+            output += '\n';
+        }
+    }
+
+    output.append(ptr, end);
+
+    for (auto const &change : _changes) {
+        if (!change.removed
+                && !find_entry(change.key.data(), change.key.size())) {
+            if (!output.empty() && output.back() != '\n') {
+                output += '\n';
+            }
+            output += change.key;
+            output += '=';
+            output += change.value;
+            output += '\n';
+        }
+    }
+
+    if (!file_replace_data(_path, output.data(), output.size(),
+                           _mode, _uid, _gid)) {
+        return false;
+    }
+
+    std::string path(std::move(_path));
+    return open(path);
+}
+
 }
 }
@@ -78,6 +78,11 @@ int GUIAnimation::Render()
     return 0;
 }
 
+bool GUIAnimation::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
+
 int GUIAnimation::Update()
 {
     if (!isConditionTrue()) {
@@ -57,6 +57,8 @@ extern "C" void __gui_print(const char *color, char *buf)
         gConsole.push_back(start);
         gConsoleColor.push_back(color);
     }
+
+    gui_wake();
 }
 
 extern "C" void gui_print(const char *fmt, ...)
@@ -264,6 +266,12 @@ int GUIConsole::Render()
     return RenderConsole();
 }
 
+bool GUIConsole::GetDamageRect(int& x __unused, int& y __unused,
+                               int& w __unused, int& h __unused)
+{
+    return false;
+}
+
 int GUIConsole::Update()
 {
     if (mSlideout && mSlideoutState != visible) {
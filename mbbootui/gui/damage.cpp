@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/damage.hpp"
+
+#include <algorithm>
+
+#include "minuitwrp/minui.h"
+
+// Beyond this many disjoint rects, redraw their bounding box instead
+#define MAX_DAMAGE_RECTS            8
+// Redraw everything once this percentage of the screen is damaged
+#define MAX_DAMAGE_PERCENT          75
+
+static DamageRect union_rect(const DamageRect &a, const DamageRect &b)
+{
+    int x0 = std::min(a.x, b.x);
+    int y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.w, b.x + b.w);
+    int y1 = std::max(a.y + a.h, b.y + b.h);
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+bool DamageRect::intersects(const DamageRect &other) const
+{
+    return x < other.x + other.w && other.x < x + w
+            && y < other.y + other.h && other.y < y + h;
+}
+
+DamageRegion::DamageRegion() : m_full(false)
+{
+}
+
+void DamageRegion::clear()
+{
+    m_rects.clear();
+    m_full = false;
+}
+
+void DamageRegion::add(int x, int y, int w, int h)
+{
+    if (m_full) {
+        return;
+    }
+
+    int fb_w = gr_fb_width();
+    int fb_h = gr_fb_height();
+
+    int x0 = std::max(x, 0);
+    int y0 = std::max(y, 0);
+    int x1 = std::min(x + w, fb_w);
+    int y1 = std::min(y + h, fb_h);
+
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+
+    add_rect({ x0, y0, x1 - x0, y1 - y0 });
+
+    if (m_full) {
+        return;
+    }
+
+    long area = 0;
+    for (auto const &r : m_rects) {
+        area += static_cast<long>(r.w) * r.h;
+    }
+    if (area * 100 >= static_cast<long>(fb_w) * fb_h * MAX_DAMAGE_PERCENT) {
+        set_full();
+    }
+}
+
+void DamageRegion::add(const DamageRegion &other)
+{
+    if (other.m_full) {
+        set_full();
+        return;
+    }
+
+    for (auto const &r : other.m_rects) {
+        add(r.x, r.y, r.w, r.h);
+    }
+}
+
+void DamageRegion::add_rect(DamageRect rect)
+{
+    // Merge with every rect that overlaps the new one. The merged rect can
+    // overlap rects that were previously disjoint, so repeat until stable.
+    bool merged;
+    do {
+        merged = false;
+        for (auto it = m_rects.begin(); it != m_rects.end(); ++it) {
+            if (it->intersects(rect)) {
+                rect = union_rect(*it, rect);
+                m_rects.erase(it);
+                merged = true;
+                break;
+            }
+        }
+    } while (merged);
+
+    m_rects.push_back(rect);
+
+    if (m_rects.size() > MAX_DAMAGE_RECTS) {
+        DamageRect b = bounds();
+        m_rects.clear();
+        m_rects.push_back(b);
+    }
+}
+
+void DamageRegion::set_full()
+{
+    m_rects.clear();
+    m_full = true;
+}
+
+bool DamageRegion::is_full() const
+{
+    return m_full;
+}
+
+bool DamageRegion::is_empty() const
+{
+    return !m_full && m_rects.empty();
+}
+
+const std::vector<DamageRect> & DamageRegion::rects() const
+{
+    return m_rects;
+}
+
+DamageRect DamageRegion::bounds() const
+{
+    if (m_full) {
+        return { 0, 0, gr_fb_width(), gr_fb_height() };
+    } else if (m_rects.empty()) {
+        return { 0, 0, 0, 0 };
+    }
+
+    DamageRect result = m_rects[0];
+    for (size_t i = 1; i < m_rects.size(); ++i) {
+        result = union_rect(result, m_rects[i]);
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+struct DamageRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+
+    bool intersects(const DamageRect &other) const;
+};
+
+// Set of screen areas that changed since the last frame. Overlapping rects are
+// merged and the region degrades to "full screen" once it gets too fragmented
+// or too large for partial redraws to pay off.
+class DamageRegion
+{
+public:
+    DamageRegion();
+
+    void clear();
+
+    void add(int x, int y, int w, int h);
+    void add(const DamageRegion &other);
+    void set_full();
+
+    bool is_full() const;
+    bool is_empty() const;
+
+    const std::vector<DamageRect> & rects() const;
+    DamageRect bounds() const;
+
+private:
+    void add_rect(DamageRect rect);
+
+    std::vector<DamageRect> m_rects;
+    bool m_full;
+};
@@ -30,3 +30,7 @@ int GUIFill::Render()
     return 0;
 }
 
+bool GUIFill::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
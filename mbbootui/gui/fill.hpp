@@ -31,6 +31,9 @@ public:
     //  Return 0 on success, <0 on error
     virtual int Render();
 
+    // GetDamageRect - Returns the area that Render() draws into
+    virtual bool GetDamageRect(int& x, int& y, int& w, int& h);
+
 protected:
     COLOR mColor;
 };
@@ -20,7 +20,13 @@
 
 #include <atomic>
 
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
 #include <linux/input.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "mblog/logging.h"
@@ -36,6 +42,7 @@
 #include "minuitwrp/minui.h"
 
 #include "gui/blanktimer.hpp"
+#include "gui/damage.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/mousecursor.hpp"
 #include "gui/objects.hpp"
@@ -44,6 +51,20 @@
 // Enable to print render time of each frame to the log file
 //#define PRINT_RENDER_TIME 1
 
+// Interval between frames while something on screen is changing
+#define FRAME_INTERVAL_MS           33
+// Number of unchanged frames after which the frame timer is stopped. Due to
+// possible animation objects, this should not be too small.
+#define IDLE_FRAMES_BEFORE_SLEEP    15
+// Maximum time to sleep while idle. The blank timer and page state are only
+// checked after a frame, so this bounds how late they can be noticed.
+#define IDLE_TIMEOUT_MS             1000
+// Upper bound on input events handled per wakeup
+#define MAX_EVENTS_PER_WAKEUP       256
+// Number of previous frames whose damage is remembered for backends that
+// return buffers older than the last frame
+#define MAX_BUFFER_AGE              3
+
 #ifdef _EVENT_LOGGING
 #define LOGEVENT(...) LOGE(__VA_ARGS__)
 #else
@@ -53,6 +74,8 @@
 // Global values
 static int gGuiInitialized = 0;
 static std::atomic_int gForceRender;
+static int gWakeFd = -1;
+static DamageRegion gDamageHistory[MAX_BUFFER_AGE - 1];
 blanktimer blankTimer;
 static float scale_theme_w = 1;
 static float scale_theme_h = 1;
@@ -67,7 +90,7 @@ static int gRecorder = -1;
 
 void gr_write_frame_to_file(int fd);
 
-void flip()
+void flip(const DamageRect* area = nullptr)
 {
     if (gRecorder != -1) {
         timespec time;
@@ -75,7 +98,11 @@ void flip()
         write(gRecorder, &time, sizeof(timespec));
         gr_write_frame_to_file(gRecorder);
     }
-    gr_flip();
+    if (area) {
+        gr_flip_region(area->x, area->y, area->w, area->h);
+    } else {
+        gr_flip();
+    }
 }
 
 void rapidxml::parse_error_handler(const char *what, void *where)
@@ -111,8 +138,15 @@ public:
         }
     }
 
-    // process input events. returns true if any event was received.
-    bool processInput(int timeout_ms);
+    // process all pending input events. returns true if any event was received.
+    bool processInput();
+
+    // send touch/key hold and repeat notifications that are due
+    void processHoldAndRepeat();
+
+    // returns the number of ms until processHoldAndRepeat() has something to
+    // do, or -1 if no touch or key is held
+    int getHoldAndRepeatTimeout();
 
     void handleDrag();
 
@@ -148,7 +182,6 @@ private:
     int x, y; // x and y coordinates of last touch
     struct timespec touchStart; // used to track time for long press / key repeat
 
-    void processHoldAndRepeat();
     void process_EV_REL(input_event& ev);
     void process_EV_ABS(input_event& ev);
     void process_EV_KEY(input_event& ev);
@@ -159,41 +192,51 @@ private:
 InputHandler input_handler;
 
 
-bool InputHandler::processInput(int timeout_ms)
+bool InputHandler::processInput()
 {
-    input_event ev;
-    int ret = ev_get(&ev, timeout_ms);
+    bool got_event = false;
 
-    if (ret < 0) {
-        // This path means that we did not get any new touch data, but
-        // we do not get new touch data if you press and hold on either
-        // the screen or on a keyboard key or mouse button
-        if (touch_status || key_status) {
-            processHoldAndRepeat();
+    for (int i = 0; i < MAX_EVENTS_PER_WAKEUP; ++i) {
+        input_event ev;
+        int ret = ev_get(&ev, 0);
+
+        if (ret == -2) {
+            break;  // -2 means no more events in the queue
+        } else if (ret < 0) {
+            continue;  // consumed by the virtual key/touch translation
         }
-        return (ret != -2);  // -2 means no more events in the queue
-    }
 
-    switch (ev.type) {
-    case EV_ABS:
-        process_EV_ABS(ev);
-        break;
+        switch (ev.type) {
+        case EV_ABS:
+            process_EV_ABS(ev);
+            break;
 
-    case EV_REL:
-        process_EV_REL(ev);
-        break;
+        case EV_REL:
+            process_EV_REL(ev);
+            break;
+
+        case EV_KEY:
+            process_EV_KEY(ev);
+            break;
+        }
 
-    case EV_KEY:
-        process_EV_KEY(ev);
-        break;
+        got_event = true;
     }
 
-    blankTimer.resetTimerAndUnblank();
-    return true;  // we got an event, so there might be more in the queue
+    if (got_event) {
+        blankTimer.resetTimerAndUnblank();
+    }
+    return got_event;
 }
 
 void InputHandler::processHoldAndRepeat()
 {
+    // We do not get new touch data if you press and hold on either the screen
+    // or on a keyboard key or mouse button
+    if (!touch_status && !key_status) {
+        return;
+    }
+
     HardwareKeyboard *kb = PageManager::GetHardwareKeyboard();
 
     // touch and key repeat section
@@ -224,6 +267,30 @@ void InputHandler::processHoldAndRepeat()
     }
 }
 
+int InputHandler::getHoldAndRepeatTimeout()
+{
+    int interval;
+
+    if (touch_status == TS_TOUCH_AND_HOLD) {
+        interval = touch_hold_ms;
+    } else if (touch_status == TS_TOUCH_REPEAT) {
+        interval = touch_repeat_ms;
+    } else if (key_status == KS_KEY_PRESSED) {
+        interval = key_hold_ms;
+    } else if (key_status == KS_KEY_REPEAT) {
+        interval = key_repeat_ms;
+    } else {
+        return -1;
+    }
+
+    timespec curTime;
+    clock_gettime(CLOCK_MONOTONIC, &curTime);
+    int64_t elapsed = mb::util::timespec_diff_ms(touchStart, curTime);
+
+    // processHoldAndRepeat() fires once strictly more than interval ms passed
+    return elapsed > interval ? 0 : static_cast<int>(interval - elapsed) + 1;
+}
+
 void InputHandler::doTouchStart()
 {
     LOGEVENT("TOUCH_START: %d,%d", x, y);
@@ -359,46 +426,139 @@ void InputHandler::handleDrag()
     }
 }
 
-// Get and dispatch input events until it's time to draw the next frame
-// This special function will return immediately the first time, but then
-// always returns 1/30th of a second (or immediately if called later) from
-// the last time it was called
-static void loopTimer(int input_timeout_ms)
+// Wake up the GUI thread if it is sleeping in waitForEvents(). Called from
+// other threads after changing anything that affects what is on screen.
+void gui_wake()
 {
-    static timespec lastCall;
-    static int initialized = 0;
+    if (gWakeFd >= 0) {
+        uint64_t value = 1;
+        write(gWakeFd, &value, sizeof(value));
+    }
+}
 
-    if (!initialized) {
-        clock_gettime(CLOCK_MONOTONIC, &lastCall);
-        initialized = 1;
-        return;
+// Block until there is input, terminal output, a wakeup request, or until the
+// timeout expires. Everything that is ready is handled before returning.
+// Returns true if anything other than the timeout woke us up.
+static bool waitForEvents(int timeout_ms)
+{
+    struct pollfd fds[2];
+    unsigned int count = 0;
+    int pty_index = -1;
+    int wake_index = -1;
+
+    if (g_pty_fd > 0) {
+        pty_index = count;
+        fds[count].fd = g_pty_fd;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        ++count;
+    }
+    if (gWakeFd >= 0) {
+        wake_index = count;
+        fds[count].fd = gWakeFd;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        ++count;
     }
 
-    do {
-        bool got_event = input_handler.processInput(input_timeout_ms); // get inputs but don't send drag notices
-        timespec curTime, diff;
-        clock_gettime(CLOCK_MONOTONIC, &curTime);
+    int ret = ev_poll(fds, count, timeout_ms);
+    if (ret < 0) {
+        if (errno != EINTR) {
+            LOGE("Failed to poll for events: %s", strerror(errno));
+        }
+        return false;
+    } else if (ret == 0) {
+        return false;
+    }
 
-        mb::util::timespec_diff(lastCall, curTime, &diff);
+    bool woken = false;
 
-        // This is really 2 or 30 times per second
-        // As long as we get events, increase the timeout so we can catch up with input
-        long timeout = got_event ? 500000000 : 33333333;
+    if (wake_index >= 0 && (fds[wake_index].revents & POLLIN)) {
+        uint64_t value;
+        read(gWakeFd, &value, sizeof(value));
+        woken = true;
+    }
+    if (pty_index >= 0 && (fds[pty_index].revents & POLLIN)) {
+        terminal_pty_read();
+        woken = true;
+    }
+    if (input_handler.processInput()) {
+        woken = true;
+    }
 
-        if (diff.tv_sec || diff.tv_nsec > timeout) {
-            // int64_t input_time = mb::util::timespec_diff_ms(lastCall, curTime);
-            // LOGI("loopTimer(): %" PRId64 " ms, count: %u", input_time, count);
+    return woken;
+}
 
-            lastCall = curTime;
-            input_handler.handleDrag(); // send only drag notices if needed
-            return;
+// Remember the damage of a flipped frame for bringing older buffers up to date
+static void pushDamageHistory(const DamageRegion& damage)
+{
+    for (int i = MAX_BUFFER_AGE - 2; i > 0; --i) {
+        gDamageHistory[i] = gDamageHistory[i - 1];
+    }
+    gDamageHistory[0] = damage;
+}
+
+// Draw and display a frame. update_ret is the result of PageManager::Update()
+// and damage holds the areas that changed since the previous frame.
+static void renderFrame(int update_ret, const DamageRegion& damage, bool force)
+{
+    int age = gr_buffer_age();
+    DamageRegion repaint;
+
+    if (force) {
+        repaint.set_full();
+    } else if (age <= 0 || age > MAX_BUFFER_AGE) {
+        // The contents of the buffer are unknown
+        if (update_ret > 1) {
+            repaint.set_full();
+        }
+    } else {
+        if (update_ret > 1) {
+            repaint.add(damage);
+        }
+        // The buffer is also missing whatever changed in the frames that
+        // were drawn into other buffers since it was last displayed
+        for (int i = 0; i < age - 1; ++i) {
+            repaint.add(gDamageHistory[i]);
         }
+    }
+
+    DamageRegion flipped(repaint);
+    flipped.add(damage);
+
+#ifdef PRINT_RENDER_TIME
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+    if (repaint.is_full()) {
+        PageManager::Render();
+    } else if (!repaint.is_empty()) {
+        PageManager::Render(&repaint);
+    }
 
-        // We need to sleep some period time microseconds
-        //unsigned int sleepTime = 33333 -(diff.tv_nsec / 1000);
-        //usleep(sleepTime); // removed so we can scan for input
-        input_timeout_ms = 0;
-    } while (1);
+#ifdef PRINT_RENDER_TIME
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t render_t = mb::util::timespec_diff_ms(start, end);
+#endif
+
+    if (flipped.is_full()) {
+        flip();
+    } else {
+        DamageRect bounds = flipped.bounds();
+        flip(&bounds);
+    }
+
+#ifdef PRINT_RENDER_TIME
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t flip_t = mb::util::timespec_diff_ms(end, start);
+
+    LOGI("Render(): %" PRId64 " ms (%s), flip(): %" PRId64 " ms, total: %" PRId64 " ms",
+         render_t, repaint.is_full() ? "full" : "partial", flip_t,
+         render_t + flip_t);
+#endif
+
+    pushDamageHistory(flipped);
 }
 
 static int runPages(const char *page_name, const int stop_on_page_done)
@@ -415,29 +575,64 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 
     DataManager::SetValue(VAR_TW_LOADED, 1);
 
-    struct timeval timeout;
-    fd_set fdset;
-    int has_data = 0;
-
-    int input_timeout_ms = 0;
     int idle_frames = 0;
+    // Whether something happened that needs a frame to be drawn
+    bool pending = true;
+
+    timespec next_frame;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+
+    DamageRegion damage;
+
+    // Nothing is known about the contents of the buffers yet
+    for (auto &d : gDamageHistory) {
+        d.set_full();
+    }
 
     for (;;) {
-        loopTimer(input_timeout_ms);
-        if (g_pty_fd > 0) {
-            // TODO: this is not nice, we should have one central select for input, pty
-            FD_ZERO(&fdset);
-            FD_SET(g_pty_fd, &fdset);
-            timeout.tv_sec = 0;
-            timeout.tv_usec = 1;
-            has_data = select(g_pty_fd + 1, &fdset, nullptr, nullptr, &timeout);
-            if (has_data > 0) {
-                terminal_pty_read();
-            }
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Sleep until the next frame is due. If nothing is changing on screen,
+        // stop the frame timer and sleep until something happens.
+        int timeout_ms;
+        if (pending || gForceRender || idle_frames <= IDLE_FRAMES_BEFORE_SLEEP) {
+            int64_t remaining = mb::util::timespec_diff_ms(now, next_frame);
+            timeout_ms = remaining > 0 ? static_cast<int>(remaining) : 0;
+        } else {
+            timeout_ms = IDLE_TIMEOUT_MS;
+        }
+
+        int hold_timeout_ms = input_handler.getHoldAndRepeatTimeout();
+        if (hold_timeout_ms >= 0 && hold_timeout_ms < timeout_ms) {
+            timeout_ms = hold_timeout_ms;
+        }
+
+        if (waitForEvents(timeout_ms)) {
+            pending = true;
+        }
+        input_handler.processHoldAndRepeat();
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (mb::util::timespec_diff_ms(next_frame, now) < 0) {
+            // Not time for the next frame yet
+            continue;
         }
 
+        next_frame = now;
+        next_frame.tv_nsec += FRAME_INTERVAL_MS * 1000000L;
+        if (next_frame.tv_nsec >= 1000000000L) {
+            next_frame.tv_nsec -= 1000000000L;
+            ++next_frame.tv_sec;
+        }
+        pending = false;
+
+        input_handler.handleDrag(); // send only drag notices if needed
+
         if (!gForceRender) {
-            int ret = PageManager::Update();
+            damage.clear();
+
+            int ret = PageManager::Update(&damage);
             if (ret == 0) {
                 ++idle_frames;
             } else if (ret == -2) {
@@ -445,41 +640,15 @@ static int runPages(const char *page_name, const int stop_on_page_done)
             } else {
                 idle_frames = 0;
             }
-            // due to possible animation objects, we need to delay activating the input timeout
-            input_timeout_ms = idle_frames > 15 ? 1000 : 0;
-
-#ifndef PRINT_RENDER_TIME
-            if (ret > 1) {
-                PageManager::Render();
-            }
 
             if (ret > 0) {
-                flip();
+                renderFrame(ret, damage, false);
             }
-#else
-            if (ret > 1) {
-                timespec start, end;
-                int64_t render_t, flip_t;
-                clock_gettime(CLOCK_MONOTONIC, &start);
-                PageManager::Render();
-                clock_gettime(CLOCK_MONOTONIC, &end);
-                render_t = mb::util::timespec_diff_ms(start, end);
-
-                flip();
-                clock_gettime(CLOCK_MONOTONIC, &start);
-                flip_t = mb::util::timespec_diff_ms(end, start);
-
-                LOGI("Render(): %" PRId64 " ms, flip(): %" PRId64 " ms, total: %" PRId64 " ms",
-                     render_t, flip_t, render_t + flip_t);
-            } else if (ret > 0) {
-                flip();
-            }
-#endif
         } else {
             gForceRender = 0;
-            PageManager::Render();
-            flip();
-            input_timeout_ms = 0;
+            damage.set_full();
+            renderFrame(2, damage, true);
+            idle_frames = 0;
         }
 
         blankTimer.checkForTimeout();
@@ -498,6 +667,7 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 int gui_forceRender()
 {
     gForceRender = 1;
+    gui_wake();
     return 0;
 }
 
@@ -506,6 +676,7 @@ int gui_changePage(std::string newPage)
     LOGI("Set page: '%s'", newPage.c_str());
     PageManager::ChangePage(newPage);
     gForceRender = 1;
+    gui_wake();
     return 0;
 }
 
@@ -514,6 +685,7 @@ int gui_changeOverlay(std::string overlay)
     LOGI("Set overlay: '%s'", overlay.c_str());
     PageManager::ChangeOverlay(overlay);
     gForceRender = 1;
+    gui_wake();
     return 0;
 }
 
@@ -605,6 +777,11 @@ extern "C" int gui_init()
     }
 
     ev_init();
+
+    gWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (gWakeFd < 0) {
+        LOGW("Failed to create wakeup eventfd: %s", strerror(errno));
+    }
     return 0;
 }
 
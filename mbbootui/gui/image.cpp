@@ -58,6 +58,11 @@ int GUIImage::Render()
     return 0;
 }
 
+bool GUIImage::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
+
 int GUIImage::SetRenderPos(int x, int y, int w, int h)
 {
     if (w || h) {
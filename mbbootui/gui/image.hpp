@@ -31,6 +31,9 @@ public:
     //  Return 0 on success, <0 on error
     virtual int Render();
 
+    // GetDamageRect - Returns the area that Render() draws into
+    virtual bool GetDamageRect(int& x, int& y, int& w, int& h);
+
     // SetRenderPos - Update the position of the object
     //  Return 0 on success, <0 on error
     virtual int SetRenderPos(int x, int y, int w = 0, int h = 0);
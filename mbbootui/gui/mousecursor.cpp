@@ -67,6 +67,11 @@ int MouseCursor::Render()
     return 0;
 }
 
+bool MouseCursor::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
+
 int MouseCursor::Update()
 {
     if (m_present != ev_has_mouse()) {
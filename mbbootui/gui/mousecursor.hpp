@@ -28,6 +28,7 @@ public:
 
     virtual int Render();
     virtual int Update();
+    virtual bool GetDamageRect(int& x, int& y, int& w, int& h);
     virtual int SetRenderPos(int x, int y, int w = 0, int h = 0);
 
     void Move(int deltaX, int deltaY);
@@ -73,6 +73,15 @@ public:
         return 0;
     }
 
+    // GetDamageRect - Returns the area that Render() draws into
+    //  Return false if the object may draw outside of a known area, in which
+    //  case any change to the object causes a full render
+    virtual bool GetDamageRect(int& x __unused, int& y __unused,
+                               int& w __unused, int& h __unused)
+    {
+        return false;
+    }
+
     // GetPlacement - Returns the current placement
     virtual int GetPlacement(Placement& placement)
     {
@@ -94,6 +103,14 @@ public:
         return;
     }
 
+protected:
+    // Damage rect for objects that never draw outside of their render position
+    bool GetRenderPosDamageRect(int& x, int& y, int& w, int& h)
+    {
+        GetRenderPos(x, y, w, h);
+        return w > 0 && h > 0;
+    }
+
 protected:
     int mRenderX, mRenderY, mRenderW, mRenderH;
     Placement mPlacement;
@@ -48,6 +48,7 @@
 #include "gui/button.hpp"
 #include "gui/checkbox.hpp"
 #include "gui/console.hpp"
+#include "gui/damage.hpp"
 #include "gui/fileselector.hpp"
 #include "gui/fill.hpp"
 #include "gui/hardwarekeyboard.hpp"
@@ -64,6 +65,7 @@
 #include "gui/terminal.hpp"
 #include "gui/text.hpp"
 #include "gui/textbox.hpp"
+#include "gui/theme_bundle.hpp"
 
 #define TW_THEME_VERSION 1
 #define TW_THEME_VER_ERR -2
@@ -81,6 +83,7 @@ MouseCursor *PageManager::mMouseCursor = nullptr;
 HardwareKeyboard *PageManager::mHardwareKeyboard = nullptr;
 bool PageManager::mReloadTheme = false;
 std::string PageManager::mStartPage = "main";
+ThemeBundle* PageManager::mThemeBundle = nullptr;
 std::vector<language_struct> Language_List;
 
 int tw_x_offset = 0;
@@ -507,14 +510,52 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
     return true;
 }
 
-int Page::Render()
+// Update an object and record the areas it changed. Both the old and the new
+// area are damaged so that moved or resized objects leave no trail.
+static int UpdateRenderObject(RenderObject* object, DamageRegion* damage)
+{
+    if (!damage || damage->is_full()) {
+        return object->Update();
+    }
+
+    int x, y, w, h;
+    bool known = object->GetDamageRect(x, y, w, h);
+
+    int ret = object->Update();
+    if (ret > 0) {
+        if (known) {
+            damage->add(x, y, w, h);
+        }
+        if (known && object->GetDamageRect(x, y, w, h)) {
+            damage->add(x, y, w, h);
+        } else {
+            damage->set_full();
+        }
+    }
+
+    return ret;
+}
+
+int Page::Render(const DamageRect* area)
 {
     // Render background
     gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
-    gr_fill(0, 0, gr_fb_width(), gr_fb_height());
+    if (area) {
+        gr_fill(area->x, area->y, area->w, area->h);
+    } else {
+        gr_fill(0, 0, gr_fb_width(), gr_fb_height());
+    }
 
     // Render remaining objects
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        if (area) {
+            DamageRect rect;
+            if ((*iter)->GetDamageRect(rect.x, rect.y, rect.w, rect.h)
+                    && !rect.intersects(*area)) {
+                continue;
+            }
+        }
+
         if ((*iter)->Render()) {
             LOGE("A render request has failed.");
         }
@@ -522,12 +563,12 @@ int Page::Render()
     return 0;
 }
 
-int Page::Update()
+int Page::Update(DamageRegion* damage)
 {
     int retCode = 0;
 
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
-        int ret = (*iter)->Update();
+        int ret = UpdateRenderObject(*iter, damage);
         if (ret < 0) {
             LOGE("An update request has failed.");
         } else if (ret > retCode) {
@@ -1071,17 +1112,17 @@ std::string PageSet::GetCurrentPage() const
     return mCurrentPage ? mCurrentPage->GetName() : "";
 }
 
-int PageSet::Render()
+int PageSet::Render(const DamageRect* area)
 {
     int ret;
 
-    ret = (mCurrentPage ? mCurrentPage->Render() : -1);
+    ret = (mCurrentPage ? mCurrentPage->Render(area) : -1);
     if (ret < 0) {
         return ret;
     }
 
     for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-        ret = ((*iter) ? (*iter)->Render() : -1);
+        ret = ((*iter) ? (*iter)->Render(area) : -1);
         if (ret < 0) {
             return ret;
         }
@@ -1089,17 +1130,17 @@ int PageSet::Render()
     return ret;
 }
 
-int PageSet::Update()
+int PageSet::Update(DamageRegion* damage)
 {
     int ret;
 
-    ret = (mCurrentPage ? mCurrentPage->Update() : -1);
+    ret = (mCurrentPage ? mCurrentPage->Update(damage) : -1);
     if (ret < 0 || ret > 1) {
         return ret;
     }
 
     for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-        ret = ((*iter) ? (*iter)->Update() : -1);
+        ret = ((*iter) ? (*iter)->Update(damage) : -1);
         if (ret < 0) {
             return ret;
         }
@@ -1162,6 +1203,25 @@ void PageSet::AddStringResource(std::string resource_source,
                                   std::move(value));
 }
 
+const ThemeBundle* PageManager::GetThemeBundle()
+{
+    // The bundle is opened once and stays mapped in case the theme is
+    // reloaded
+    if (!mThemeBundle) {
+        std::string path = TWFunc::get_resource_path(THEME_BUNDLE_FILENAME);
+
+        mThemeBundle = new ThemeBundle();
+        if (mThemeBundle->open(path)) {
+            LOGI("Using theme bundle %s (%u entries)",
+                 path.c_str(), mThemeBundle->entry_count());
+        } else {
+            LOGI("No theme bundle found, loading images directly");
+        }
+    }
+
+    return mThemeBundle->is_open() ? mThemeBundle : nullptr;
+}
+
 char* PageManager::LoadFileToBuffer(const std::string& filename,
                                     ZipArchive* package)
 {
@@ -1570,16 +1630,35 @@ int PageManager::IsCurrentPage(Page* page)
     return (mCurrentSet ? mCurrentSet->IsCurrentPage(page) : 0);
 }
 
-int PageManager::Render()
+int PageManager::Render(const DamageRegion* damage)
 {
     if (blankTimer.isScreenOff()) {
         return 0;
     }
 
-    int res = (mCurrentSet ? mCurrentSet->Render() : -1);
-    if (mMouseCursor) {
-        mMouseCursor->Render();
+    if (!damage || damage->is_full()) {
+        int res = (mCurrentSet ? mCurrentSet->Render() : -1);
+        if (mMouseCursor) {
+            mMouseCursor->Render();
+        }
+        return res;
+    }
+
+    int res = 0;
+
+    for (auto const &rect : damage->rects()) {
+        gr_clip_base(rect.x, rect.y, rect.w, rect.h);
+
+        res = (mCurrentSet ? mCurrentSet->Render(&rect) : -1);
+        if (mMouseCursor) {
+            mMouseCursor->Render();
+        }
+        if (res < 0) {
+            break;
+        }
     }
+
+    gr_noclip_base();
     return res;
 }
 
@@ -1632,7 +1711,7 @@ void PageManager::LoadCursorData(xml_node<>* node)
     mMouseCursor->LoadData(node);
 }
 
-int PageManager::Update()
+int PageManager::Update(DamageRegion* damage)
 {
     if (blankTimer.isScreenOff()) {
         return 0;
@@ -1642,10 +1721,10 @@ int PageManager::Update()
         return -2;
     }
 
-    int res = (mCurrentSet ? mCurrentSet->Update() : -1);
+    int res = (mCurrentSet ? mCurrentSet->Update(damage) : -1);
 
     if (mMouseCursor) {
-        int c_res = mMouseCursor->Update();
+        int c_res = UpdateRenderObject(mMouseCursor, damage);
         if (c_res > res) {
             res = c_res;
         }
@@ -1692,4 +1771,5 @@ extern "C" void gui_notifyVarChange(const char *name, const char* value)
     }
 
     PageManager::NotifyVarChange(name, value);
+    gui_wake();
 }
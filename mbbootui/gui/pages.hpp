@@ -52,15 +52,19 @@ extern std::vector<language_struct> Language_List;
 // Utility Functions
 int ConvertStrToColor(std::string str, COLOR* color);
 int gui_forceRender();
+void gui_wake();
 int gui_changePage(std::string newPage);
 int gui_changeOverlay(std::string newPage);
 
 class Resource;
 class ResourceManager;
+class DamageRegion;
+struct DamageRect;
 class RenderObject;
 class ActionObject;
 class InputObject;
 class MouseCursor;
+class ThemeBundle;
 class GUIObject;
 class HardwareKeyboard;
 
@@ -76,8 +80,12 @@ public:
     }
 
 public:
-    virtual int Render();
-    virtual int Update();
+    // Render the page. If area is not null, only objects that may draw into it
+    // are rendered and the caller is expected to have clipped to it.
+    virtual int Render(const DamageRect* area = nullptr);
+    // Update the page. If damage is not null, the areas of objects that
+    // changed are added to it.
+    virtual int Update(DamageRegion* damage = nullptr);
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
     virtual int NotifyKey(int key, bool down);
     virtual int NotifyCharInput(int ch);
@@ -123,8 +131,8 @@ public:
     std::string GetCurrentPage() const;
 
     // These are routing routines
-    int Render();
-    int Update();
+    int Render(const DamageRect* area = nullptr);
+    int Update(DamageRegion* damage = nullptr);
     int NotifyTouch(TOUCH_STATE state, int x, int y);
     int NotifyKey(int key, bool down);
     int NotifyCharInput(int ch);
@@ -150,6 +158,7 @@ class PageManager
 public:
     // Used by GUI
     static char* LoadFileToBuffer(const std::string &filename, ZipArchive* package);
+    static const ThemeBundle* GetThemeBundle();
     static void LoadLanguageList(ZipArchive* package);
     static void LoadLanguage(const std::string& filename);
     static int LoadPackage(const std::string& name, const std::string& package,
@@ -172,8 +181,8 @@ public:
     static int IsCurrentPage(Page* page);
 
     // These are routing routines
-    static int Render();
-    static int Update();
+    static int Render(const DamageRegion* damage = nullptr);
+    static int Update(DamageRegion* damage = nullptr);
     static int NotifyTouch(TOUCH_STATE state, int x, int y);
     static int NotifyKey(int key, bool down);
     static int NotifyCharInput(int ch);
@@ -200,6 +209,7 @@ protected:
     static bool mReloadTheme;
     static std::string mStartPage;
     static LoadingContext* currentLoadingContext;
+    static ThemeBundle* mThemeBundle;
 };
 
 #endif  // _PAGES_HEADER_HPP
@@ -54,6 +54,11 @@ int GUIProgressBar::Render()
     return RenderInternal();
 }
 
+bool GUIProgressBar::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
+
 int GUIProgressBar::RenderInternal()
 {
     if (!mEmptyBar || !mEmptyBar->GetResource()) {
@@ -30,6 +30,9 @@ public:
     //  Return 0 on success, <0 on error
     virtual int Render();
 
+    // GetDamageRect - Returns the area that Render() draws into
+    virtual bool GetDamageRect(int& x, int& y, int& w, int& h);
+
     // Update - Update any UI component animations (called <= 30 FPS)
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
@@ -13,6 +13,7 @@
 #include "twrp-functions.hpp"
 
 #include "gui/gui.h"
+#include "gui/theme_bundle.hpp"
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
@@ -55,11 +56,35 @@ int Resource::ExtractResource(ZipArchive* pZip,
     return ret;
 }
 
+// Images from the stock theme are also stored in the theme bundle. If it is
+// missing or invalid, the PNGs in the theme directory are used instead.
+static bool LoadBundleImage(const std::string& file, gr_surface* surface)
+{
+    const ThemeBundle* bundle = PageManager::GetThemeBundle();
+    ThemeBundleImage image;
+
+    if (!bundle || !bundle->find_image("images/" + file + ".png", &image)) {
+        return false;
+    }
+
+    int rc = res_create_surface_zlib(
+            image.data, image.size, image.width, image.height,
+            image.format == ThemeBundlePixelFormat::Rgba8888, surface);
+    if (rc != 0) {
+        LOGI("Failed to load image %s from theme bundle, error %d", file.c_str(), rc);
+        return false;
+    }
+
+    return true;
+}
+
 void Resource::LoadImage(ZipArchive* pZip, const std::string& file,
                          gr_surface* surface)
 {
     int rc = 0;
-    if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0) {
+    if (!pZip && LoadBundleImage(file, surface)) {
+        return;
+    } else if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0) {
         rc = res_create_surface(TMP_RESOURCE_NAME, surface);
         unlink(TMP_RESOURCE_NAME);
     } else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0) {
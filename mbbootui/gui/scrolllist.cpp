@@ -308,6 +308,11 @@ int GUIScrollList::Render()
     return 0;
 }
 
+bool GUIScrollList::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPosDamageRect(x, y, w, h);
+}
+
 void GUIScrollList::RenderItem(size_t itemindex __unused, int yPos, bool selected)
 {
     RenderStdItem(yPos, selected, nullptr, "implement RenderItem!");
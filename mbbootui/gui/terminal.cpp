@@ -41,7 +41,7 @@
 #define debug_printf(...)
 #endif
 
-extern int g_pty_fd; // in gui.cpp where the select is
+extern int g_pty_fd; // in gui.cpp where the poll is
 
 /*
 Pseudoterminal handler.
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/theme_bundle.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+
+ThemeBundle::ThemeBundle()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_entries(nullptr)
+    , m_strings(nullptr)
+{
+}
+
+ThemeBundle::~ThemeBundle()
+{
+    close();
+}
+
+bool ThemeBundle::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            LOGW("%s: Failed to open: %s", path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGW("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    if (static_cast<size_t>(sb.st_size) < sizeof(ThemeBundleHeader)) {
+        LOGW("%s: Theme bundle is truncated", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        LOGW("%s: Failed to mmap: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    m_data = data;
+    m_size = sb.st_size;
+    m_header = static_cast<const ThemeBundleHeader *>(data);
+
+    if (!validate()) {
+        LOGW("%s: Invalid theme bundle", path.c_str());
+        close();
+        return false;
+    }
+
+    m_entries = reinterpret_cast<const ThemeBundleEntry *>(
+            static_cast<const char *>(m_data) + m_header->entries_offset);
+    m_strings = static_cast<const char *>(m_data) + m_header->strings_offset;
+
+    return true;
+}
+
+void ThemeBundle::close()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+    m_entries = nullptr;
+    m_strings = nullptr;
+}
+
+bool ThemeBundle::is_open() const
+{
+    return m_data != nullptr;
+}
+
+uint32_t ThemeBundle::entry_count() const
+{
+    return m_header ? m_header->entry_count : 0;
+}
+
+static bool in_range(uint64_t offset, uint64_t size, uint64_t limit)
+{
+    return offset <= limit && size <= limit - offset;
+}
+
+// Everything is bounds checked once here so that lookups don't need to be
+bool ThemeBundle::validate() const
+{
+    const char *base = static_cast<const char *>(m_data);
+
+    if (memcmp(m_header->magic, THEME_BUNDLE_MAGIC,
+               THEME_BUNDLE_MAGIC_SIZE) != 0) {
+        LOGW("Bad theme bundle magic");
+        return false;
+    }
+
+    if (m_header->version != THEME_BUNDLE_VERSION) {
+        LOGW("Unsupported theme bundle version: %u", m_header->version);
+        return false;
+    }
+
+    if (m_header->entries_offset % alignof(ThemeBundleEntry) != 0
+            || !in_range(m_header->entries_offset,
+                         static_cast<uint64_t>(m_header->entry_count)
+                                 * sizeof(ThemeBundleEntry),
+                         m_size)
+            || !in_range(m_header->strings_offset, m_header->strings_size,
+                         m_size)
+            || m_header->strings_size == 0
+            || base[m_header->strings_offset + m_header->strings_size - 1]
+                    != '\0') {
+        LOGW("Theme bundle tables are out of bounds");
+        return false;
+    }
+
+    auto entries = reinterpret_cast<const ThemeBundleEntry *>(
+            base + m_header->entries_offset);
+    const char *strings = base + m_header->strings_offset;
+    const char *prev_name = nullptr;
+
+    for (uint32_t i = 0; i < m_header->entry_count; ++i) {
+        const ThemeBundleEntry &entry = entries[i];
+
+        if (entry.name_offset >= m_header->strings_size
+                || !in_range(entry.data_offset, entry.data_size, m_size)) {
+            LOGW("Theme bundle entry %u is out of bounds", i);
+            return false;
+        }
+
+        const char *name = strings + entry.name_offset;
+        if (prev_name && strcmp(prev_name, name) >= 0) {
+            LOGW("Theme bundle entries are not sorted");
+            return false;
+        }
+        prev_name = name;
+
+        if ((entry.format != static_cast<uint32_t>(
+                        ThemeBundlePixelFormat::Rgbx8888)
+                && entry.format != static_cast<uint32_t>(
+                        ThemeBundlePixelFormat::Rgba8888))
+                || entry.width == 0 || entry.height == 0
+                || static_cast<uint64_t>(entry.width) * entry.height * 4
+                        > UINT32_MAX) {
+            LOGW("Theme bundle image %s is invalid", name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const ThemeBundleEntry * ThemeBundle::find_entry(const std::string &name) const
+{
+    if (!m_data) {
+        return nullptr;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = m_header->entry_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const ThemeBundleEntry *entry = &m_entries[mid];
+        int cmp = strcmp(m_strings + entry->name_offset, name.c_str());
+
+        if (cmp == 0) {
+            return entry;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return nullptr;
+}
+
+bool ThemeBundle::find_image(const std::string &name,
+                             ThemeBundleImage *image_out) const
+{
+    const ThemeBundleEntry *entry = find_entry(name);
+    if (!entry) {
+        return false;
+    }
+
+    image_out->data = static_cast<const unsigned char *>(m_data)
+            + entry->data_offset;
+    image_out->size = entry->data_size;
+    image_out->width = entry->width;
+    image_out->height = entry->height;
+    image_out->format = static_cast<ThemeBundlePixelFormat>(entry->format);
+    return true;
+}
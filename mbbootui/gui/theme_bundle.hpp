@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A theme bundle is generated from a theme directory at build time by themec.
+// It contains all images of the theme, already converted to 32-bit pixels and
+// compressed with zlib. mbbootui maps the bundle into memory and inflates
+// images straight into their surfaces, which is cheaper than decoding the
+// original PNGs. The PNGs are still shipped and are used if the bundle is
+// missing, invalid or lacks an image. XML files and fonts are not bundled and
+// are loaded from the theme directory as usual.
+//
+// Layout (all integers are little endian):
+//
+//   ThemeBundleHeader
+//   ThemeBundleEntry[entry_count], sorted by name (strcmp order)
+//   String table with the NUL-terminated entry names
+//   Entry data (zlib streams)
+
+#define THEME_BUNDLE_MAGIC          "MBTHEME"
+#define THEME_BUNDLE_MAGIC_SIZE     8
+#define THEME_BUNDLE_VERSION        2
+#define THEME_BUNDLE_FILENAME       "theme.bundle"
+
+enum class ThemeBundlePixelFormat : uint32_t
+{
+    // R, G, B, 0xff
+    Rgbx8888 = 1,
+    // R, G, B, A
+    Rgba8888 = 2,
+};
+
+struct ThemeBundleHeader
+{
+    char magic[THEME_BUNDLE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t entries_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint32_t reserved;
+};
+
+struct ThemeBundleEntry
+{
+    uint32_t name_offset;
+    uint32_t data_offset;
+    // Size of the compressed data
+    uint32_t data_size;
+    // Rows are always width * 4 bytes once inflated
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+};
+
+static_assert(sizeof(ThemeBundleHeader) == 32, "Bad ThemeBundleHeader size");
+static_assert(sizeof(ThemeBundleEntry) == 24, "Bad ThemeBundleEntry size");
+
+struct ThemeBundleImage
+{
+    // zlib stream
+    const unsigned char *data;
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+    ThemeBundlePixelFormat format;
+};
+
+class ThemeBundle
+{
+public:
+    ThemeBundle();
+    ~ThemeBundle();
+
+    ThemeBundle(const ThemeBundle &) = delete;
+    ThemeBundle & operator=(const ThemeBundle &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    bool is_open() const;
+    uint32_t entry_count() const;
+
+    // Returned pointers stay valid until the bundle is closed
+    bool find_image(const std::string &name, ThemeBundleImage *image_out) const;
+
+private:
+    bool validate() const;
+    const ThemeBundleEntry * find_entry(const std::string &name) const;
+
+    void *m_data;
+    size_t m_size;
+    const ThemeBundleHeader *m_header;
+    const ThemeBundleEntry *m_entries;
+    const char *m_strings;
+};
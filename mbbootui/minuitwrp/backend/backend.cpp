@@ -39,6 +39,9 @@ static struct backend backends[] = {
 #endif
 #ifdef ENABLE_FBDEV_BACKEND
     BACKEND(fbdev),
+#endif
+#ifdef ENABLE_MEMORY_BACKEND
+    BACKEND(memory),
 #endif
     { nullptr, nullptr }
 };
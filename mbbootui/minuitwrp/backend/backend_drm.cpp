@@ -504,6 +504,12 @@ static GRSurface* drm_flip(minui_backend* backend __unused)
     return &(drm_surfaces[current_buffer]->base);
 }
 
+static int drm_buffer_age(minui_backend* backend __unused)
+{
+    // The two scanout buffers are swapped on every flip
+    return 2;
+}
+
 static void drm_exit(minui_backend* backend __unused)
 {
     drm_disable_crtc(drm_fd, main_monitor_crtc);
@@ -518,6 +524,7 @@ static void drm_exit(minui_backend* backend __unused)
 static minui_backend drm_backend = {
     .init = drm_init,
     .flip = drm_flip,
+    .buffer_age = drm_buffer_age,
     .blank = drm_blank,
     .exit = drm_exit,
 };
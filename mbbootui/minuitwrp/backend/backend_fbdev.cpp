@@ -35,10 +35,13 @@
 #include "config/config.hpp"
 #include "minui.h"
 #include "graphics.h"
+#include "pixels.h"
 #include <pixelflinger/pixelflinger.h>
 
 static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
+static GRSurface* fbdev_flip_region(minui_backend*, int, int, int, int);
+static int fbdev_buffer_age(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
 
@@ -46,6 +49,9 @@ static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = nullptr;
 static int displayed_buffer;
+// Rows copied into the displayed framebuffer by the previous flip
+static int last_flip_y0;
+static int last_flip_y1;
 
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
@@ -54,6 +60,8 @@ static __u32 smem_len;
 static minui_backend my_backend = {
     .init = fbdev_init,
     .flip = fbdev_flip,
+    .flip_region = fbdev_flip_region,
+    .buffer_age = fbdev_buffer_age,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
 };
@@ -275,64 +283,85 @@ static GRSurface* fbdev_init(minui_backend* backend)
     return gr_draw;
 }
 
-static GRSurface* fbdev_flip(minui_backend* backend __unused)
+static unsigned int get_present_flags()
 {
+    unsigned int flags = 0;
+
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
-        // In case of BGRA, do some byte swapping
-        unsigned int idx;
-        unsigned char tmp;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-                idx += 4) {
-            tmp = ucfb_vaddr[idx];
-            ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-            ucfb_vaddr[idx + 2] = tmp;
-        }
+        flags |= PX_SWAP_RB;
+    }
+    if (tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen) {
+        // flip buffer 180 degrees for devices with physically inverted screens
+        flags |= PX_ROTATE_180;
     }
-    if (!(tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)) {
-        if (double_buffered) {
-            // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[1-displayed_buffer].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
-            set_displayed_framebuffer(1-displayed_buffer);
-        } else {
-            // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[0].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
-        }
-    } else {
-        int gr_active_fb = 0;
-        if (double_buffered) {
-            gr_active_fb = 1-displayed_buffer;
-        }
 
-        /* flip buffer 180 degrees for devices with physically inverted screens */
-        unsigned int row_pixels = gr_draw->row_bytes / gr_framebuffer[0].pixel_bytes;
-        if (gr_framebuffer[0].pixel_bytes == 4) {
-            for (unsigned int y = 0; y < gr_draw->height; ++y) {
-                uint32_t* dst = reinterpret_cast<uint32_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
-                uint32_t* src = reinterpret_cast<uint32_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
-                for (unsigned int x = 0; x < gr_draw->width; ++x) {
-                    *(dst++) = *(--src);
-                }
-            }
-        } else {
-            for (unsigned int y = 0; y < gr_draw->height; ++y) {
-                uint16_t* dst = reinterpret_cast<uint16_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
-                uint16_t* src = reinterpret_cast<uint16_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
-                for (unsigned int x = 0; x < gr_draw->width; ++x) {
-                    *(dst++) = *(--src);
-                }
-            }
-        }
+    return flags;
+}
+
+// Copy rows [y0, y1) of the in-memory surface to the framebuffer that is not
+// being displayed and display it. Byte swapping and rotation happen during the
+// copy, so gr_draw itself is never modified.
+static void present_rows(int y0, int y1)
+{
+    int target = double_buffered ? 1 - displayed_buffer : 0;
+
+    px_present(&gr_framebuffer[target], gr_draw, y0, y1, get_present_flags());
+
+    if (double_buffered) {
+        set_displayed_framebuffer(1 - displayed_buffer);
+    }
+}
 
-        if (double_buffered) {
-            set_displayed_framebuffer(1-displayed_buffer);
+static GRSurface* fbdev_flip(minui_backend* backend __unused)
+{
+    present_rows(0, gr_draw->height);
+
+    last_flip_y0 = 0;
+    last_flip_y1 = gr_draw->height;
+
+    return gr_draw;
+}
+
+static GRSurface* fbdev_flip_region(minui_backend* backend __unused,
+                                    int x __unused, int y, int w __unused, int h)
+{
+    int y0 = y < 0 ? 0 : y;
+    int y1 = y + h > gr_draw->height ? gr_draw->height : y + h;
+    if (y1 < y0) {
+        y1 = y0;
+    }
+
+    // Whole rows are contiguous in memory, so copying full rows is cheaper
+    // than copying a column range row by row
+    int copy_y0 = y0;
+    int copy_y1 = y1;
+
+    if (double_buffered) {
+        // The back buffer was last written two flips ago, so it is also
+        // missing whatever the previous flip copied into the front buffer
+        if (last_flip_y0 < copy_y0) {
+            copy_y0 = last_flip_y0;
+        }
+        if (last_flip_y1 > copy_y1) {
+            copy_y1 = last_flip_y1;
         }
     }
+
+    present_rows(copy_y0, copy_y1);
+
+    last_flip_y0 = y0;
+    last_flip_y1 = y1;
+
     return gr_draw;
 }
 
+static int fbdev_buffer_age(minui_backend* backend __unused)
+{
+    // gr_draw is an in-memory shadow surface that always holds the previous
+    // frame
+    return 1;
+}
+
 static void fbdev_exit(minui_backend* backend __unused)
 {
     close(fb_fd);
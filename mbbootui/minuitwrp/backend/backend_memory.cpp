@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Headless backend that renders into a plain heap buffer. Nothing is ever
+// displayed. It exists so the rendering pipeline can be run and timed on a
+// host without a framebuffer or DRM device. Like the fbdev backend, flipping
+// copies the drawing surface into a separate "display" buffer so that the
+// cost of presenting a frame is included in measurements.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/cdefs.h>
+
+#include "backend/backend.h"
+#include "backend/backend.gen.h"
+#include "minui.h"
+#include "graphics.h"
+#include <pixelflinger/pixelflinger.h>
+
+// Surface size can be overridden with MBBOOTUI_MEMORY_BACKEND_SIZE=<w>x<h>
+#define MEMORY_BACKEND_SIZE_ENV     "MBBOOTUI_MEMORY_BACKEND_SIZE"
+#define MEMORY_BACKEND_WIDTH        1080
+#define MEMORY_BACKEND_HEIGHT       1920
+
+static GRSurface* memory_init(minui_backend*);
+static GRSurface* memory_flip(minui_backend*);
+static GRSurface* memory_flip_region(minui_backend*, int, int, int, int);
+static int memory_buffer_age(minui_backend*);
+static void memory_blank(minui_backend*, bool);
+static void memory_exit(minui_backend*);
+
+static GRSurface gr_memory;
+static unsigned char *display_data;
+static unsigned long flip_count;
+static unsigned long long bytes_copied;
+
+static minui_backend my_backend = {
+    .init = memory_init,
+    .flip = memory_flip,
+    .flip_region = memory_flip_region,
+    .buffer_age = memory_buffer_age,
+    .blank = memory_blank,
+    .exit = memory_exit,
+};
+
+extern "C" struct minui_backend * BACKEND_FUNCTION(memory)()
+{
+    return &my_backend;
+}
+
+static GRSurface* memory_init(minui_backend* backend __unused)
+{
+    int width = MEMORY_BACKEND_WIDTH;
+    int height = MEMORY_BACKEND_HEIGHT;
+
+    const char *size = getenv(MEMORY_BACKEND_SIZE_ENV);
+    if (size) {
+        int w, h;
+        if (sscanf(size, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+            width = w;
+            height = h;
+        } else {
+            fprintf(stderr, "Ignoring invalid %s: %s\n",
+                    MEMORY_BACKEND_SIZE_ENV, size);
+        }
+    }
+
+    gr_memory.width = width;
+    gr_memory.height = height;
+    gr_memory.pixel_bytes = 4;
+    gr_memory.row_bytes = width * gr_memory.pixel_bytes;
+    gr_memory.format = GGL_PIXEL_FORMAT_RGBX_8888;
+    gr_memory.data = static_cast<unsigned char *>(
+            calloc(static_cast<size_t>(gr_memory.row_bytes) * height, 1));
+    display_data = static_cast<unsigned char *>(
+            calloc(static_cast<size_t>(gr_memory.row_bytes) * height, 1));
+    if (!gr_memory.data || !display_data) {
+        perror("failed to allocate in-memory surface");
+        free(gr_memory.data);
+        free(display_data);
+        gr_memory.data = nullptr;
+        display_data = nullptr;
+        return nullptr;
+    }
+
+    flip_count = 0;
+    bytes_copied = 0;
+
+    printf("memory: %d x %d\n", width, height);
+
+    return &gr_memory;
+}
+
+static void copy_rows(int y0, int y1)
+{
+    if (y0 < 0) {
+        y0 = 0;
+    }
+    if (y1 > gr_memory.height) {
+        y1 = gr_memory.height;
+    }
+    if (y1 <= y0) {
+        return;
+    }
+
+    size_t offset = static_cast<size_t>(y0) * gr_memory.row_bytes;
+    size_t size = static_cast<size_t>(y1 - y0) * gr_memory.row_bytes;
+
+    memcpy(display_data + offset, gr_memory.data + offset, size);
+    bytes_copied += size;
+}
+
+static GRSurface* memory_flip(minui_backend* backend __unused)
+{
+    copy_rows(0, gr_memory.height);
+    ++flip_count;
+    return &gr_memory;
+}
+
+static GRSurface* memory_flip_region(minui_backend* backend __unused,
+                                     int x __unused, int y,
+                                     int w __unused, int h)
+{
+    copy_rows(y, y + h);
+    ++flip_count;
+    return &gr_memory;
+}
+
+static int memory_buffer_age(minui_backend* backend __unused)
+{
+    return 1;
+}
+
+static void memory_blank(minui_backend* backend __unused, bool blank __unused)
+{
+}
+
+static void memory_exit(minui_backend* backend __unused)
+{
+    printf("memory: %lu frames flipped, %llu bytes copied\n",
+           flip_count, bytes_copied);
+
+    free(gr_memory.data);
+    free(display_data);
+    gr_memory.data = nullptr;
+    display_data = nullptr;
+}
@@ -34,6 +34,7 @@
 //#define _EVENT_LOGGING
 
 #define MAX_DEVICES         32
+#define MAX_EXTRA_FDS       8
 
 #define VIBRATOR_TIMEOUT_FILE "/sys/class/timed_output/vibrator/enable"
 #define VIBRATOR_TIME_MS    50
@@ -761,10 +762,8 @@ static int vk_modify(struct ev *e, struct input_event *ev)
     return 0;
 }
 
-int ev_get(struct input_event *ev, int timeout_ms)
+static void ev_check_reload(void)
 {
-    int r;
-    unsigned n;
     struct timespec curr;
 
     clock_gettime(CLOCK_MONOTONIC, &curr);
@@ -779,6 +778,14 @@ int ev_get(struct input_event *ev, int timeout_ms)
         }
         lastInputStat = curr;
     }
+}
+
+int ev_get(struct input_event *ev, int timeout_ms)
+{
+    int r;
+    unsigned n;
+
+    ev_check_reload();
 
     r = poll(ev_fds, ev_count, timeout_ms);
 
@@ -799,6 +806,38 @@ int ev_get(struct input_event *ev, int timeout_ms)
     return -2;
 }
 
+// Wait until an input device or one of the caller's extra fds is ready, or
+// until the timeout expires. This lets the caller block in a single poll()
+// instead of alternating between ev_get() and its own fds. Returns the number
+// of ready fds, 0 on timeout, or -1 on error. The revents of the extra fds are
+// filled in. Pending input events are then read with ev_get(ev, 0).
+int ev_poll(struct pollfd *extra_fds, unsigned int extra_count, int timeout_ms)
+{
+    struct pollfd fds[MAX_DEVICES + MAX_EXTRA_FDS];
+    unsigned int n;
+    int r;
+
+    if (extra_count > MAX_EXTRA_FDS) {
+        extra_count = MAX_EXTRA_FDS;
+    }
+
+    ev_check_reload();
+
+    memcpy(fds, ev_fds, ev_count * sizeof(struct pollfd));
+    memcpy(fds + ev_count, extra_fds, extra_count * sizeof(struct pollfd));
+
+    r = poll(fds, ev_count + extra_count, timeout_ms);
+    if (r < 0) {
+        return -1;
+    }
+
+    for (n = 0; n < extra_count; ++n) {
+        extra_fds[n].revents = fds[ev_count + n].revents;
+    }
+
+    return r;
+}
+
 int ev_wait(int timeout)
 {
     (void) timeout;
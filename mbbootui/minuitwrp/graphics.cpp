@@ -37,6 +37,7 @@
 #include "backend/backend.h"
 #include "minui.h"
 #include "graphics.h"
+#include "pixels.h"
 #include "gui/placement.h"
 
 struct GRFont
@@ -71,6 +72,14 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// Clip rectangle that gr_clip() and gr_noclip() are constrained to. It is set
+// while only the damaged parts of a frame are being redrawn.
+static bool gr_base_clip_enabled = false;
+static int gr_base_clip_x0 = 0;
+static int gr_base_clip_y0 = 0;
+static int gr_base_clip_x1 = 0;
+static int gr_base_clip_y1 = 0;
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -136,6 +145,19 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
 void gr_clip(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+
+    if (gr_base_clip_enabled) {
+        int x0 = x > gr_base_clip_x0 ? x : gr_base_clip_x0;
+        int y0 = y > gr_base_clip_y0 ? y : gr_base_clip_y0;
+        int x1 = x + w < gr_base_clip_x1 ? x + w : gr_base_clip_x1;
+        int y1 = y + h < gr_base_clip_y1 ? y + h : gr_base_clip_y1;
+
+        x = x0;
+        y = y0;
+        w = x1 > x0 ? x1 - x0 : 0;
+        h = y1 > y0 ? y1 - y0 : 0;
+    }
+
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
 }
@@ -143,10 +165,36 @@ void gr_clip(int x, int y, int w, int h)
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
+
+    if (gr_base_clip_enabled) {
+        gl->scissor(gl, gr_base_clip_x0, gr_base_clip_y0,
+                    gr_base_clip_x1 - gr_base_clip_x0,
+                    gr_base_clip_y1 - gr_base_clip_y0);
+        gl->enable(gl, GGL_SCISSOR_TEST);
+        return;
+    }
+
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
 }
 
+// Restrict all drawing, including nested gr_clip() calls, to (x, y, w, h)
+void gr_clip_base(int x, int y, int w, int h)
+{
+    gr_base_clip_enabled = true;
+    gr_base_clip_x0 = x;
+    gr_base_clip_y0 = y;
+    gr_base_clip_x1 = x + w;
+    gr_base_clip_y1 = y + h;
+    gr_noclip();
+}
+
+void gr_noclip_base(void)
+{
+    gr_base_clip_enabled = false;
+    gr_noclip();
+}
+
 void gr_line(int x0, int y0, int x1, int y1, int width)
 {
     GGLContext *gl = gr_context;
@@ -229,15 +277,13 @@ void gr_clear()
     if (gr_current_r == gr_current_g && gr_current_r == gr_current_b) {
         memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
     } else {
-        unsigned char* px = gr_draw->data;
+        unsigned char bytes[4] = { gr_current_r, gr_current_g, gr_current_b, 0xff };
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+
         for (int y = 0; y < gr_draw->height; ++y) {
-            for (int x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
+            px_fill32(reinterpret_cast<uint32_t*>(gr_draw->data + y * gr_draw->row_bytes),
+                      value, gr_draw->width);
         }
     }
 }
@@ -300,15 +346,36 @@ unsigned int gr_get_height(gr_surface surface)
     return ((GGLSurface*) surface)->height;
 }
 
-void gr_flip()
+static void gr_bind_draw_surface()
 {
-    gr_draw = gr_backend->flip(gr_backend);
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
     gr_context->colorBuffer(gr_context, &gr_mem_surface);
 }
 
+void gr_flip()
+{
+    gr_draw = gr_backend->flip(gr_backend);
+    gr_bind_draw_surface();
+}
+
+void gr_flip_region(int x, int y, int w, int h)
+{
+    if (!gr_backend->flip_region) {
+        gr_flip();
+        return;
+    }
+
+    gr_draw = gr_backend->flip_region(gr_backend, x, y, w, h);
+    gr_bind_draw_surface();
+}
+
+int gr_buffer_age(void)
+{
+    return gr_backend->buffer_age ? gr_backend->buffer_age(gr_backend) : 0;
+}
+
 static void get_memory_surface(GGLSurface* ms)
 {
     ms->version = sizeof(*ms);
@@ -30,6 +30,16 @@ struct minui_backend
     // drawing surface.
     GRSurface* (*flip)(minui_backend*);
 
+    // Optional. Like flip(), but only the region (x, y, w, h) of the current
+    // drawing surface changed since the previous flip. Backends that must copy
+    // the surface to the display can limit the copy to that region.
+    GRSurface* (*flip_region)(minui_backend*, int x, int y, int w, int h);
+
+    // Optional. Returns how many flips ago the drawing surface was last
+    // displayed (1 if it still holds the previous frame, 2 for a classic
+    // double-buffered swap chain), or 0 if its contents are undefined.
+    int (*buffer_age)(minui_backend*);
+
     // Blank (or unblank) the screen.
     void (*blank)(minui_backend*, bool);
 
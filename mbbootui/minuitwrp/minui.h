@@ -49,11 +49,15 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+void gr_flip_region(int x, int y, int w, int h);
+int gr_buffer_age(void);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
+void gr_clip_base(int x, int y, int w, int h);
+void gr_noclip_base(void);
 void gr_fill(int x, int y, int w, int h);
 void gr_line(int x0, int y0, int x1, int y1, int width);
 gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -83,16 +87,23 @@ int gr_save_screenshot(const char *dest);
 // input event structure, include <linux/input.h> for the definition.
 // see http://www.mjmwired.net/kernel/Documentation/input/ for info.
 struct input_event;
+struct pollfd;
 
 int ev_init(void);
 void ev_exit(void);
 int ev_get(struct input_event *ev, int timeout_ms);
+int ev_poll(struct pollfd *extra_fds, unsigned int extra_count, int timeout_ms);
 int ev_has_mouse(void);
 
 // Resources
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+// Creates a surface from a zlib stream containing width * height 32-bit
+// RGBX/RGBA pixels.
+int res_create_surface_zlib(const void* data, size_t size, unsigned int width,
+                            unsigned int height, int has_alpha,
+                            gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
 
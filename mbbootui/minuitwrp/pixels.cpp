@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pixels.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define PX_USE_SSE2
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) \
+        && !defined(__ARM_BIG_ENDIAN)
+// The byte shuffle in swap_rb_neon() assumes little-endian lane order
+#  include <arm_neon.h>
+#  define PX_USE_NEON
+#endif
+
+static inline uint32_t swap_rb(uint32_t px)
+{
+    return (px & 0xff00ff00u) | ((px & 0x000000ffu) << 16)
+            | ((px >> 16) & 0x000000ffu);
+}
+
+#if defined(PX_USE_SSE2)
+
+static inline __m128i swap_rb_sse2(__m128i v)
+{
+    const __m128i ga_mask = _mm_set1_epi32(0xff00ff00);
+    const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+
+    __m128i rb = _mm_and_si128(v, rb_mask);
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    return _mm_or_si128(_mm_and_si128(v, ga_mask), rb);
+}
+
+static inline __m128i reverse32_sse2(__m128i v)
+{
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static inline __m128i reverse16_sse2(__m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+#elif defined(PX_USE_NEON)
+
+static inline uint32x4_t swap_rb_neon(uint32x4_t v)
+{
+    uint8x16_t bytes = vreinterpretq_u8_u32(v);
+    // Byte 0 and byte 2 of each pixel trade places
+    static const uint8_t idx[16] = {
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+    };
+#if defined(__aarch64__)
+    return vreinterpretq_u32_u8(vqtbl1q_u8(bytes, vld1q_u8(idx)));
+#else
+    uint8x8x2_t table = { { vget_low_u8(bytes), vget_high_u8(bytes) } };
+    uint8x8_t lo = vtbl2_u8(table, vld1_u8(idx));
+    uint8x8_t hi = vtbl2_u8(table, vld1_u8(idx + 8));
+    return vreinterpretq_u32_u8(vcombine_u8(lo, hi));
+#endif
+}
+
+static inline uint32x4_t reverse32_neon(uint32x4_t v)
+{
+    v = vrev64q_u32(v);
+    return vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+}
+
+static inline uint16x8_t reverse16_neon(uint16x8_t v)
+{
+    v = vrev64q_u16(v);
+    return vcombine_u16(vget_high_u16(v), vget_low_u16(v));
+}
+
+#endif
+
+void px_copy32_swap_rb(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if defined(PX_USE_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), swap_rb_sse2(v));
+    }
+#elif defined(PX_USE_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, swap_rb_neon(vld1q_u32(src + i)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = swap_rb(src[i]);
+    }
+}
+
+void px_copy32_reverse(uint32_t *dst, const uint32_t *src, size_t n,
+                       bool swap)
+{
+    size_t i = 0;
+
+#if defined(PX_USE_SSE2)
+    if (swap) {
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(src + n - i - 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                             swap_rb_sse2(reverse32_sse2(v)));
+        }
+    } else {
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(src + n - i - 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                             reverse32_sse2(v));
+        }
+    }
+#elif defined(PX_USE_NEON)
+    if (swap) {
+        for (; i + 4 <= n; i += 4) {
+            uint32x4_t v = vld1q_u32(src + n - i - 4);
+            vst1q_u32(dst + i, swap_rb_neon(reverse32_neon(v)));
+        }
+    } else {
+        for (; i + 4 <= n; i += 4) {
+            vst1q_u32(dst + i, reverse32_neon(vld1q_u32(src + n - i - 4)));
+        }
+    }
+#endif
+
+    const uint32_t *s = src + n - i;
+    if (swap) {
+        for (; i < n; ++i) {
+            dst[i] = swap_rb(*--s);
+        }
+    } else {
+        for (; i < n; ++i) {
+            dst[i] = *--s;
+        }
+    }
+}
+
+void px_copy16_reverse(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if defined(PX_USE_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(src + n - i - 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         reverse16_sse2(v));
+    }
+#elif defined(PX_USE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        vst1q_u16(dst + i, reverse16_neon(vld1q_u16(src + n - i - 8)));
+    }
+#endif
+
+    const uint16_t *s = src + n - i;
+    for (; i < n; ++i) {
+        dst[i] = *--s;
+    }
+}
+
+void px_fill32(uint32_t *dst, uint32_t value, size_t n)
+{
+    size_t i = 0;
+
+#if defined(PX_USE_SSE2)
+    __m128i v = _mm_set1_epi32(static_cast<int>(value));
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+#elif defined(PX_USE_NEON)
+    uint32x4_t v = vdupq_n_u32(value);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, v);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = value;
+    }
+}
+
+void px_present(GRSurface *dst, const GRSurface *src, int y0, int y1,
+                unsigned int flags)
+{
+    if (y0 < 0) {
+        y0 = 0;
+    }
+    if (y1 > src->height) {
+        y1 = src->height;
+    }
+    if (y1 <= y0) {
+        return;
+    }
+
+    // Channel swapping only makes sense for 32-bit pixels
+    bool swap = (flags & PX_SWAP_RB) && src->pixel_bytes == 4;
+
+    if (!(flags & PX_ROTATE_180)) {
+        if (!swap && dst->row_bytes == src->row_bytes) {
+            // Rows are contiguous, so copy them all at once
+            memcpy(dst->data + y0 * dst->row_bytes,
+                   src->data + y0 * src->row_bytes,
+                   (y1 - y0) * src->row_bytes);
+            return;
+        }
+
+        for (int y = y0; y < y1; ++y) {
+            unsigned char *d = dst->data + y * dst->row_bytes;
+            const unsigned char *s = src->data + y * src->row_bytes;
+
+            if (swap) {
+                px_copy32_swap_rb(reinterpret_cast<uint32_t *>(d),
+                                  reinterpret_cast<const uint32_t *>(s),
+                                  src->width);
+            } else {
+                memcpy(d, s, src->width * src->pixel_bytes);
+            }
+        }
+        return;
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        unsigned char *d = dst->data + (src->height - y - 1) * dst->row_bytes;
+        const unsigned char *s = src->data + y * src->row_bytes;
+
+        if (src->pixel_bytes == 4) {
+            px_copy32_reverse(reinterpret_cast<uint32_t *>(d),
+                              reinterpret_cast<const uint32_t *>(s),
+                              src->width, swap);
+        } else {
+            px_copy16_reverse(reinterpret_cast<uint16_t *>(d),
+                              reinterpret_cast<const uint16_t *>(s),
+                              src->width);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "minui.h"
+
+// Pixel kernels used when presenting frames. They use SSE2 or NEON when the
+// target supports it and fall back to plain C otherwise. None of them require
+// any particular alignment.
+//
+// NEON is only used when the compiler targets it. That is always the case for
+// arm64-v8a, but armeabi-v7a is built for vfpv3-d16 (not every ARMv7 device
+// has NEON) and uses the plain C path unless ANDROID_ARM_NEON is enabled.
+
+// Swap the first and third byte of each 32-bit pixel (RGBA <-> BGRA)
+#define PX_SWAP_RB          0x1
+// Rotate by 180 degrees (for devices with physically inverted screens)
+#define PX_ROTATE_180       0x2
+
+// Copy n 32-bit pixels, swapping the R and B channels. dst may be the same as
+// src.
+void px_copy32_swap_rb(uint32_t *dst, const uint32_t *src, size_t n);
+
+// Copy n 32-bit pixels in reverse order (dst[i] = src[n - 1 - i]), optionally
+// swapping the R and B channels
+void px_copy32_reverse(uint32_t *dst, const uint32_t *src, size_t n,
+                       bool swap);
+
+// Copy n 16-bit pixels in reverse order
+void px_copy16_reverse(uint16_t *dst, const uint16_t *src, size_t n);
+
+// Set n 32-bit pixels to value
+void px_fill32(uint32_t *dst, uint32_t value, size_t n);
+
+// Copy rows [y0, y1) of src into dst, applying the PX_* transformations in
+// flags in the same pass. With PX_ROTATE_180, source row y ends up in
+// destination row (height - 1 - y). Both surfaces must have the same
+// dimensions and pixel size.
+void px_present(GRSurface *dst, const GRSurface *src, int y0, int y1,
+                unsigned int flags);
@@ -29,6 +29,7 @@
 #include <linux/kd.h>
 
 #include <png.h>
+#include <zlib.h>
 
 #include <pixelflinger/pixelflinger.h>
 #ifdef TW_INCLUDE_JPEG
@@ -38,6 +39,7 @@ extern "C" {
 #endif
 #include "config/config.hpp"
 #include "minui.h"
+#include "pixels.h"
 
 #define SURFACE_DATA_ALIGNMENT 8
 
@@ -165,6 +167,14 @@ static GGLSurface* init_display_surface(png_uint_32 width, png_uint_32 height)
     return surface;
 }
 
+// Whether images need their R and B channels swapped to match the
+// framebuffer
+static bool fb_wants_bgr()
+{
+    return tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
+            || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888;
+}
+
 // Copy 'input_row' to 'output_row', transforming it to the
 // framebuffer pixel format.  The input format depends on the value of
 // 'channels':
@@ -236,8 +246,7 @@ int res_create_surface_png(const char* name, gr_surface* pSurface)
         goto exit;
     }
 
-    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
-            || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+    if (fb_wants_bgr()) {
         png_set_bgr(png_ptr);
     }
 
@@ -369,6 +378,47 @@ exit:
 }
 #endif
 
+int res_create_surface_zlib(const void* data, size_t size, unsigned int width,
+                            unsigned int height, int has_alpha,
+                            gr_surface* pSurface)
+{
+    GGLSurface* surface;
+    uLongf out_size = static_cast<uLongf>(width) * height * 4;
+
+    *pSurface = nullptr;
+
+    surface = init_display_surface(width, height);
+    if (surface == nullptr) {
+        return -8;
+    }
+
+    // The pixels are stored in their final layout, so they can be inflated
+    // straight into the surface
+    if (uncompress(surface->data, &out_size,
+                   reinterpret_cast<const Bytef*>(data), size) != Z_OK
+            || out_size != static_cast<uLongf>(width) * height * 4) {
+        free(surface);
+        return -6;
+    }
+
+    if (fb_wants_bgr()) {
+        for (unsigned int y = 0; y < height; ++y) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(
+                    surface->data + y * width * 4);
+            px_copy32_swap_rb(row, row, width);
+        }
+    }
+
+    if (has_alpha) {
+        surface->format = GGL_PIXEL_FORMAT_RGBA_8888;
+    } else {
+        surface->format = GGL_PIXEL_FORMAT_RGBX_8888;
+    }
+
+    *pSurface = (gr_surface) surface;
+    return 0;
+}
+
 int res_create_surface(const char* name, gr_surface* pSurface)
 {
     int ret;
@@ -3,7 +3,9 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "minui.h"
 
@@ -15,8 +17,16 @@
 #include <pixelflinger/pixelflinger.h>
 #include <pthread.h>
 
-#define STRING_CACHE_MAX_ENTRIES 400
-#define STRING_CACHE_TRUNCATE_ENTRIES 150
+// Glyph bitmaps are stored in one A_8 atlas texture per font. The atlas is a
+// grid of equally sized slots and the least recently used slot is recycled
+// when the atlas is full.
+#define GLYPH_ATLAS_MAX_SLOTS 256
+#define GLYPH_ATLAS_MIN_SLOTS 16
+#define GLYPH_ATLAS_MAX_BYTES (1024 * 1024)
+#define GLYPH_ATLAS_MAX_WIDTH 1024
+
+// Glyphs for ASCII characters are also looked up through a direct table
+#define ASCII_CACHE_SIZE 128
 
 typedef struct
 {
@@ -25,6 +35,31 @@ typedef struct
     char *path;
 } TrueTypeFontKey;
 
+typedef struct TrueTypeCacheEntry TrueTypeCacheEntry;
+
+typedef struct
+{
+    TrueTypeCacheEntry *glyph;
+    int prev;
+    int next;
+} GlyphAtlasSlot;
+
+typedef struct
+{
+    GGLSurface surface;
+    int slot_width;
+    int slot_height;
+    int columns;
+    int slot_count;
+    int slots_used;
+    GlyphAtlasSlot *slots;
+    int lru_head; // least recently used
+    int lru_tail; // most recently used
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} GlyphAtlas;
+
 typedef struct
 {
     int type;
@@ -35,36 +70,29 @@ typedef struct
     int base;
     FT_Face face;
     Hashmap *glyph_cache;
-    Hashmap *string_cache;
-    struct StringCacheEntry *string_cache_head;
-    struct StringCacheEntry *string_cache_tail;
+    TrueTypeCacheEntry *ascii_glyphs[ASCII_CACHE_SIZE];
+    // Glyph index currently rendered in face->glyph or -1
+    int loaded_index;
+    GlyphAtlas *atlas;
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
 
-typedef struct
+struct TrueTypeCacheEntry
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
-} TrueTypeCacheEntry;
-
-typedef struct
-{
-    char *text;
-    int max_width;
-} StringCacheKey;
-
-struct StringCacheEntry
-{
-    GGLSurface surface;
-    int rendered_bytes; // number of bytes from C string rendered, not number of UTF8 characters!
-    StringCacheKey *key;
-    struct StringCacheEntry *prev;
-    struct StringCacheEntry *next;
+    int char_index;
+    int advance;
+    int left;
+    int top;
+    int width;
+    int rows;
+    // Atlas slot holding the bitmap or -1 if it is not resident
+    int slot;
+    // Bitmap of glyphs that are too large for an atlas slot
+    FT_BitmapGlyph oversized;
 };
 
-typedef struct StringCacheEntry StringCacheEntry;
-
 typedef struct
 {
     FT_Library ft_library;
@@ -148,19 +176,6 @@ int utf8_to_unicode(const char* pIn, unsigned int *pOut)
     return utf_bytes;
 }
 
-static bool gr_ttf_string_cache_equals(void *keyA, void *keyB)
-{
-    StringCacheKey *a = (StringCacheKey *)keyA;
-    StringCacheKey *b = (StringCacheKey *)keyB;
-    return a->max_width == b->max_width && strcmp(a->text, b->text) == 0;
-}
-
-static int gr_ttf_string_cache_hash(void *key)
-{
-    StringCacheKey *k = (StringCacheKey *)key;
-    return fnv_hash(k->text, strlen(k->text));
-}
-
 static bool gr_ttf_font_cache_equals(void *keyA, void *keyB)
 {
     TrueTypeFontKey *a = (TrueTypeFontKey *)keyA;
@@ -231,8 +246,8 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     res->max_height = -1;
     res->base = -1;
     res->refcount = 1;
+    res->loaded_index = -1;
     res->glyph_cache = hashmapCreate(32, hashmapIntHash, hashmapIntEquals);
-    res->string_cache = hashmapCreate(128, gr_ttf_string_cache_hash, gr_ttf_string_cache_equals);
     pthread_mutex_init(&res->mutex, 0);
 
     if (!font_data.fonts) {
@@ -274,22 +289,21 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
     TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
+    if (e->oversized) {
+        FT_Done_Glyph((FT_Glyph)e->oversized);
+    }
     free(e);
     free(key);
     return true;
 }
 
-static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unused)
+static void gr_ttf_atlas_free(GlyphAtlas *atlas)
 {
-    StringCacheKey *k = (StringCacheKey *)key;
-    free(k->text);
-    free(k);
-
-    StringCacheEntry *e = (StringCacheEntry *)value;
-    free(e->surface.data);
-    free(e);
-    return true;
+    if (atlas) {
+        free(atlas->surface.data);
+        free(atlas->slots);
+        free(atlas);
+    }
 }
 
 void gr_ttf_freeFont(void *font)
@@ -310,8 +324,7 @@ void gr_ttf_freeFont(void *font)
         free(d->key);
 
         FT_Done_Face(d->face);
-        hashmapForEach(d->string_cache, gr_ttf_freeStringCache, nullptr);
-        hashmapFree(d->string_cache);
+        gr_ttf_atlas_free(d->atlas);
         hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
         hashmapFree(d->glyph_cache);
         pthread_mutex_destroy(&d->mutex);
@@ -326,6 +339,8 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_
     return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
 }
 
+// Only the glyph metrics are kept here. The bitmap is rendered into the atlas
+// when the glyph is first drawn.
 static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
 {
     TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
@@ -333,20 +348,32 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
         int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
         if (error) {
             fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
+            font->loaded_index = -1;
             return nullptr;
         }
+        font->loaded_index = char_index;
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
-        }
+        FT_GlyphSlot slot = font->face->glyph;
 
         res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
         memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        res->char_index = char_index;
+        res->advance = slot->advance.x >> 6;
+        res->left = slot->bitmap_left;
+        res->top = slot->bitmap_top;
+        res->slot = -1;
+        res->bbox.xMin = slot->bitmap_left;
+        res->bbox.xMax = slot->bitmap_left + slot->bitmap.width;
+        res->bbox.yMin = slot->bitmap_top - slot->bitmap.rows;
+        res->bbox.yMax = slot->bitmap_top;
+
+        if (slot->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY) {
+            res->width = slot->bitmap.width;
+            res->rows = slot->bitmap.rows;
+        } else {
+            fprintf(stderr, "Unsupported pixel mode in glyph %d: %d\n",
+                    char_index, slot->bitmap.pixel_mode);
+        }
 
         int *key = (int *)malloc(sizeof(int));
         *key = char_index;
@@ -357,31 +384,238 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
     return res;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
+static TrueTypeCacheEntry *gr_ttf_glyph_lookup(TrueTypeFont *font, unsigned int unicode, int *char_index)
+{
+    TrueTypeCacheEntry *res;
+
+    if (unicode < ASCII_CACHE_SIZE && font->ascii_glyphs[unicode]) {
+        res = font->ascii_glyphs[unicode];
+        *char_index = res->char_index;
+        return res;
+    }
+
+    *char_index = FT_Get_Char_Index(font->face, unicode);
+    res = gr_ttf_glyph_cache_get(font, *char_index);
+    if (res && unicode < ASCII_CACHE_SIZE) {
+        font->ascii_glyphs[unicode] = res;
+    }
+    return res;
+}
+
+static bool gr_ttf_load_rendered_glyph(TrueTypeFont *font, int char_index)
+{
+    if (font->loaded_index == char_index) {
+        return true;
+    }
+
+    int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
+    if (error) {
+        fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
+        font->loaded_index = -1;
+        return false;
+    }
+
+    font->loaded_index = char_index;
+    return true;
+}
+
+static GlyphAtlas *gr_ttf_atlas_create(TrueTypeFont *font)
 {
-    unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
-    uint8_t *dest_itr = dest->data;
+    FT_Size_Metrics *metrics = &font->face->size->metrics;
+    int slot_w = (metrics->max_advance + 63) >> 6;
+    int slot_h = (metrics->ascender - metrics->descender + 63) >> 6;
 
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
+    slot_w = MAX(slot_w, 1);
+    slot_h = MAX(slot_h, MAX(font->max_height, 1));
+
+    int slot_count = GLYPH_ATLAS_MAX_BYTES / (slot_w * slot_h);
+    slot_count = MIN(slot_count, GLYPH_ATLAS_MAX_SLOTS);
+    slot_count = MAX(slot_count, GLYPH_ATLAS_MIN_SLOTS);
+
+    int columns = MAX(GLYPH_ATLAS_MAX_WIDTH / slot_w, 1);
+    columns = MIN(columns, slot_count);
+    int rows = (slot_count + columns - 1) / columns;
+
+    GlyphAtlas *atlas = (GlyphAtlas *)malloc(sizeof(GlyphAtlas));
+    if (!atlas) {
+        return nullptr;
+    }
+    memset(atlas, 0, sizeof(GlyphAtlas));
+
+    atlas->slot_width = slot_w;
+    atlas->slot_height = slot_h;
+    atlas->columns = columns;
+    atlas->slot_count = slot_count;
+    atlas->lru_head = -1;
+    atlas->lru_tail = -1;
+
+    atlas->surface.version = sizeof(atlas->surface);
+    atlas->surface.width = columns * slot_w;
+    atlas->surface.height = rows * slot_h;
+    atlas->surface.stride = (atlas->surface.width + 3) & ~3;
+    atlas->surface.format = GGL_PIXEL_FORMAT_A_8;
+    atlas->surface.data = (GGLubyte *)calloc(atlas->surface.stride, atlas->surface.height);
+    atlas->slots = (GlyphAtlasSlot *)calloc(slot_count, sizeof(GlyphAtlasSlot));
+
+    if (!atlas->surface.data || !atlas->slots) {
+        fprintf(stderr, "Failed to allocate %dx%d glyph atlas\n",
+                atlas->surface.width, atlas->surface.height);
+        gr_ttf_atlas_free(atlas);
+        return nullptr;
+    }
+
+    return atlas;
+}
+
+static void gr_ttf_atlas_unlink(GlyphAtlas *atlas, int i)
+{
+    GlyphAtlasSlot *slot = &atlas->slots[i];
+
+    if (slot->prev != -1) {
+        atlas->slots[slot->prev].next = slot->next;
+    } else {
+        atlas->lru_head = slot->next;
+    }
+    if (slot->next != -1) {
+        atlas->slots[slot->next].prev = slot->prev;
+    } else {
+        atlas->lru_tail = slot->prev;
+    }
+
+    slot->prev = slot->next = -1;
+}
+
+static void gr_ttf_atlas_append(GlyphAtlas *atlas, int i)
+{
+    GlyphAtlasSlot *slot = &atlas->slots[i];
+
+    slot->prev = atlas->lru_tail;
+    slot->next = -1;
+    if (atlas->lru_tail != -1) {
+        atlas->slots[atlas->lru_tail].next = i;
+    } else {
+        atlas->lru_head = i;
+    }
+    atlas->lru_tail = i;
+}
+
+static inline int gr_ttf_atlas_slot_x(GlyphAtlas *atlas, int i)
+{
+    return (i % atlas->columns) * atlas->slot_width;
+}
+
+static inline int gr_ttf_atlas_slot_y(GlyphAtlas *atlas, int i)
+{
+    return (i / atlas->columns) * atlas->slot_height;
+}
+
+// Returns the atlas slot containing the glyph's bitmap, rendering it into the
+// least recently used slot if it isn't resident
+static int gr_ttf_atlas_get(TrueTypeFont *font, TrueTypeCacheEntry *ent)
+{
+    GlyphAtlas *atlas = font->atlas;
+    int i;
+
+    if (ent->slot >= 0) {
+        ++atlas->hits;
+        if (atlas->lru_tail != ent->slot) {
+            gr_ttf_atlas_unlink(atlas, ent->slot);
+            gr_ttf_atlas_append(atlas, ent->slot);
+        }
+        return ent->slot;
+    }
+
+    ++atlas->misses;
+
+    if (!gr_ttf_load_rendered_glyph(font, ent->char_index)) {
         return -1;
     }
 
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+    if (atlas->slots_used < atlas->slot_count) {
+        i = atlas->slots_used++;
+    } else {
+        i = atlas->lru_head;
+        gr_ttf_atlas_unlink(atlas, i);
+        atlas->slots[i].glyph->slot = -1;
+        ++atlas->evictions;
+    }
+
+    FT_Bitmap *bitmap = &font->face->glyph->bitmap;
+    uint8_t *src_itr = bitmap->buffer;
+    uint8_t *dest_itr = atlas->surface.data
+            + gr_ttf_atlas_slot_y(atlas, i) * atlas->surface.stride
+            + gr_ttf_atlas_slot_x(atlas, i);
+
+    for (int y = 0; y < ent->rows; ++y) {
+        memcpy(dest_itr, src_itr, ent->width);
+        src_itr += bitmap->pitch;
+        dest_itr += atlas->surface.stride;
+    }
+
+    atlas->slots[i].glyph = ent;
+    ent->slot = i;
+    gr_ttf_atlas_append(atlas, i);
+
+    return i;
+}
+
+// Glyphs that don't fit into an atlas slot keep their own bitmap and are
+// drawn from it directly
+static void gr_ttf_draw_oversized_glyph(GGLContext *gl, TrueTypeFont *font, TrueTypeCacheEntry *ent,
+                                        int gx, int gy, int x0, int y0, int x1, int y1)
+{
+    if (!ent->oversized) {
+        if (!gr_ttf_load_rendered_glyph(font, ent->char_index)) {
+            return;
+        }
+
+        int error = FT_Get_Glyph(font->face->glyph, (FT_Glyph *)&ent->oversized);
+        if (error) {
+            fprintf(stderr, "Failed to copy glyph %d: %d\n", ent->char_index, error);
+            ent->oversized = nullptr;
+            return;
+        }
+    }
+
+    GGLSurface surface;
+    surface.version = sizeof(surface);
+    surface.width = ent->oversized->bitmap.width;
+    surface.height = ent->oversized->bitmap.rows;
+    surface.stride = ent->oversized->bitmap.pitch;
+    surface.data = (GGLubyte *)ent->oversized->bitmap.buffer;
+    surface.format = GGL_PIXEL_FORMAT_A_8;
+
+    gl->bindTexture(gl, &surface);
+    gl->texCoord2i(gl, -gx, -gy);
+    gl->recti(gl, x0, y0, x1, y1);
+    gl->bindTexture(gl, &font->atlas->surface);
+}
+
+static void gr_ttf_draw_glyph(GGLContext *gl, TrueTypeFont *font, TrueTypeCacheEntry *ent,
+                              int gx, int gy, int clip_x0, int clip_y0, int clip_x1, int clip_y1)
+{
+    GlyphAtlas *atlas = font->atlas;
+    int x0 = MAX(gx, clip_x0);
+    int y0 = MAX(gy, clip_y0);
+    int x1 = MIN(gx + ent->width, clip_x1);
+    int y1 = MIN(gy + ent->rows, clip_y1);
+
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
 
-    // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-    // the result might end up being before the buffer - I'm not sure how to properly handle this.
-    if (dest_itr < dest->data) {
-        dest_itr = dest->data;
+    if (ent->width > atlas->slot_width || ent->rows > atlas->slot_height) {
+        gr_ttf_draw_oversized_glyph(gl, font, ent, gx, gy, x0, y0, x1, y1);
+        return;
     }
 
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
-        dest_itr += dest->stride;
+    int i = gr_ttf_atlas_get(font, ent);
+    if (i < 0) {
+        return;
     }
-    return 0;
+
+    gl->texCoord2i(gl, gr_ttf_atlas_slot_x(atlas, i) - gx, gr_ttf_atlas_slot_y(atlas, i) - gy);
+    gl->recti(gl, x0, y0, x1, y1);
 }
 
 static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
@@ -405,6 +639,7 @@ static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
             bbox.yMax = MAX(bbox.yMax, ent->bbox.yMax);
         } else {
             error = FT_Load_Glyph(f->face, char_idx, 0);
+            f->loaded_index = -1;
             if (error) {
                 continue;
             }
@@ -435,188 +670,37 @@ static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
     f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const char *text, int max_width)
+int gr_ttf_measureEx(const char *s, void *font)
 {
-    TrueTypeFont *f = font;
+    TrueTypeFont *f = (TrueTypeFont *)font;
     TrueTypeCacheEntry *ent;
-    int bytes_rendered = 0, total_w = 0;
-    int utf_bytes = 0;
+    int total_w = 0;
+    int utf_bytes;
     unsigned int unicode = 0;
-    int i, x, diff, char_idx, prev_idx = 0;
-    int height;
+    int char_idx, prev_idx = 0;
     FT_Vector delta;
-    uint8_t *data = nullptr;
-    const char *text_itr = text;
-    int *char_idxs;
-    int char_idxs_len = 0;
-
-    char_idxs = (int *) malloc(strlen(text) * sizeof(int));
 
-    while (*text_itr) {
-        utf_bytes = utf8_to_unicode(text_itr, &unicode);
-        text_itr += utf_bytes;
-        bytes_rendered += utf_bytes;
+    pthread_mutex_lock(&f->mutex);
 
-        char_idx = FT_Get_Char_Index(f->face, unicode);
-        char_idxs[char_idxs_len] = char_idx;
+    while (*s) {
+        utf_bytes = utf8_to_unicode(s, &unicode);
+        s += utf_bytes;
 
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
+        ent = gr_ttf_glyph_lookup(f, unicode, &char_idx);
         if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
+            total_w += ent->advance;
 
             if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
                 FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-                diff += delta.x >> 6;
+                total_w += delta.x >> 6;
             }
-
-            if (max_width != -1 && total_w + diff > max_width) {
-                break;
-            }
-
-            total_w += diff;
         }
         prev_idx = char_idx;
-        ++char_idxs_len;
-    }
-
-    if (font->max_height == -1) {
-        gr_ttf_calcMaxFontHeight(font);
     }
 
-    if (font->max_height == -1) {
-        free(char_idxs);
-        return -1;
-    }
-
-    height = font->max_height;
-
-    data = (uint8_t *) malloc(total_w*height);
-    memset(data, 0, total_w*height);
-    x = 0;
-    prev_idx = 0;
-
-    surface->version = sizeof(*surface);
-    surface->width = total_w;
-    surface->height = height;
-    surface->stride = total_w;
-    surface->data = (GGLubyte*)data;
-    surface->format = GGL_PIXEL_FORMAT_A_8;
-
-    for (i = 0; i < char_idxs_len; ++i) {
-        char_idx = char_idxs[i];
-        if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
-            FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-            x += delta.x >> 6;
-        }
-
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
-        if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
-        }
-
-        prev_idx = char_idx;
-    }
-
-    free(char_idxs);
-    return bytes_rendered;
-}
-
-static StringCacheEntry *gr_ttf_string_cache_peek(TrueTypeFont *font, const char *text, int max_width)
-{
-    StringCacheKey k = {
-        .text = (char*)text,
-        .max_width = max_width
-    };
-
-    return (StringCacheEntry *)hashmapGet(font->string_cache, &k);
-}
-
-static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width)
-{
-    StringCacheEntry *res;
-    StringCacheKey k = {
-        .text = (char*)text,
-        .max_width = max_width
-    };
-
-    res = (StringCacheEntry *)hashmapGet(font->string_cache, &k);
-    if (!res) {
-        res = (StringCacheEntry *)malloc(sizeof(StringCacheEntry));
-        memset(res, 0, sizeof(StringCacheEntry));
-        res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
-        if (res->rendered_bytes < 0) {
-            free(res);
-            return nullptr;
-        }
-
-        StringCacheKey *new_key = (StringCacheKey *)malloc(sizeof(StringCacheKey));
-        memset(new_key, 0, sizeof(StringCacheKey));
-        new_key->max_width = max_width;
-        new_key->text = strdup(text);
-
-        res->key = new_key;
-
-        if (font->string_cache_tail) {
-            res->prev = font->string_cache_tail;
-            res->prev->next = res;
-        } else {
-            font->string_cache_head = res;
-        }
-        font->string_cache_tail = res;
-
-        hashmapPut(font->string_cache, new_key, res);
-    } else if (res->next) {
-        // move this entry to the tail of the linked list
-        // if it isn't already there
-        if (res->prev) {
-            res->prev->next = res->next;
-        }
-
-        res->next->prev = res->prev;
-
-        if (!res->prev) {
-            font->string_cache_head = res->next;
-        }
-
-        res->next = nullptr;
-        res->prev = font->string_cache_tail;
-        res->prev->next = res;
-        font->string_cache_tail = res;
-
-        // truncate old entries
-        if (hashmapSize(font->string_cache) >= STRING_CACHE_MAX_ENTRIES) {
-            printf("Truncating string cache entries.\n");
-            int i;
-            StringCacheEntry *ent;
-            for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
-                ent = font->string_cache_head;
-                font->string_cache_head = ent->next;
-                font->string_cache_head->prev = nullptr;
-
-                hashmapRemove(font->string_cache, ent->key);
-
-                gr_ttf_freeStringCache(ent->key, ent, nullptr);
-            }
-        }
-    }
-    return res;
-}
-
-int gr_ttf_measureEx(const char *s, void *font)
-{
-    TrueTypeFont *f = (TrueTypeFont *)font;
-    int res = -1;
-
-    pthread_mutex_lock(&f->mutex);
-    StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
-    if (e) {
-        res = e->surface.width;
-    }
     pthread_mutex_unlock(&f->mutex);
 
-    return res;
+    return total_w;
 }
 
 int gr_ttf_maxExW(const char *s, void *font, int max_width)
@@ -628,22 +712,14 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
     unsigned int unicode = 0;
     int char_idx, prev_idx = 0;
     FT_Vector delta;
-    StringCacheEntry *e;
 
     pthread_mutex_lock(&f->mutex);
 
-    e = gr_ttf_string_cache_peek(f, s, max_width);
-    if (e) {
-        max_bytes = e->rendered_bytes;
-        pthread_mutex_unlock(&f->mutex);
-        return max_bytes;
-    }
-
     while (*s) {
         utf_bytes = utf8_to_unicode(s, &unicode);
         s += utf_bytes;
 
-        char_idx = FT_Get_Char_Index(f->face, unicode);
+        ent = gr_ttf_glyph_lookup(f, unicode, &char_idx);
         if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
             FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
             total_w += delta.x >> 6;
@@ -656,22 +732,29 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
         }
         prev_utf_bytes = utf_bytes;
 
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (!ent) {
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
     return max_bytes;
 }
 
+// Returns number of bytes from const char *s rendered to fit max_width, not
+// number of UTF8 characters! Glyphs are drawn one by one from the font's atlas.
 int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int max_width, int max_height)
 {
     GGLContext *gl = (GGLContext *)context;
     TrueTypeFont *font = (TrueTypeFont *)pFont;
+    TrueTypeCacheEntry *ent;
+    int bytes_rendered = 0, total_w = 0;
+    int utf_bytes, kerning;
+    unsigned int unicode = 0;
+    int char_idx, prev_idx = 0;
+    FT_Vector delta;
 
     // not actualy max width, but max_width + x
     if (max_width != -1) {
@@ -683,14 +766,20 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
 
     pthread_mutex_lock(&font->mutex);
 
-    StringCacheEntry *e = gr_ttf_string_cache_get(font, s, max_width);
-    if (!e) {
-        pthread_mutex_unlock(&font->mutex);
-        return -1;
+    if (font->max_height == -1) {
+        gr_ttf_calcMaxFontHeight(font);
     }
 
-    int y_bottom = y + e->surface.height;
-    int res = e->rendered_bytes;
+    if (!font->atlas) {
+        font->atlas = gr_ttf_atlas_create(font);
+        if (!font->atlas) {
+            pthread_mutex_unlock(&font->mutex);
+            return -1;
+        }
+    }
+
+    int y_bottom = y + font->max_height;
+    int x_right = max_width != -1 ? x + max_width : INT_MAX;
 
     if (max_height != -1 && max_height < y_bottom) {
         y_bottom = max_height;
@@ -700,18 +789,43 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
-    gl->bindTexture(gl, &e->surface);
+    gl->bindTexture(gl, &font->atlas->surface);
     gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
     gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
     gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-
     gl->enable(gl, GGL_TEXTURE_2D);
-    gl->texCoord2i(gl, -x, -y);
-    gl->recti(gl, x, y, x + e->surface.width, y_bottom);
+
+    while (*s) {
+        utf_bytes = utf8_to_unicode(s, &unicode);
+        s += utf_bytes;
+        bytes_rendered += utf_bytes;
+
+        ent = gr_ttf_glyph_lookup(font, unicode, &char_idx);
+        if (ent) {
+            kerning = 0;
+            if (FT_HAS_KERNING(font->face) && prev_idx && char_idx) {
+                FT_Get_Kerning(font->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
+                kerning = delta.x >> 6;
+            }
+
+            if (max_width != -1 && total_w + kerning + ent->advance > max_width) {
+                break;
+            }
+
+            gr_ttf_draw_glyph(gl, font, ent,
+                              x + total_w + kerning + ent->left,
+                              y + font->base - ent->top,
+                              x, y, x_right, y_bottom);
+
+            total_w += kerning + ent->advance;
+        }
+        prev_idx = char_idx;
+    }
+
     gl->disable(gl, GGL_TEXTURE_2D);
 
     pthread_mutex_unlock(&font->mutex);
-    return res;
+    return bytes_rendered;
 }
 
 int gr_ttf_getMaxFontHeight(void *font)
@@ -730,39 +844,76 @@ int gr_ttf_getMaxFontHeight(void *font)
     return res;
 }
 
-static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value, void *context)
+typedef struct
+{
+    size_t glyph_cache_size;
+    size_t atlas_size;
+    unsigned long hits;
+    unsigned long misses;
+} TrueTypeStats;
+
+static bool gr_ttf_dump_stats_count_glyph_cache(void *key __unused, void *value, void *context)
 {
-    int *string_cache_size = (int *) context;
-    StringCacheEntry *e = (StringCacheEntry *) value;
-    *string_cache_size += e->surface.height*e->surface.width + sizeof(StringCacheEntry);
+    size_t *glyph_cache_size = (size_t *) context;
+    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *) value;
+    *glyph_cache_size += sizeof(TrueTypeCacheEntry) + sizeof(int);
+    if (e->oversized) {
+        *glyph_cache_size += e->oversized->bitmap.rows * e->oversized->bitmap.pitch;
+    }
     return true;
 }
 
+static double gr_ttf_hit_rate(unsigned long hits, unsigned long misses)
+{
+    unsigned long lookups = hits + misses;
+    return lookups ? 100.0 * hits / lookups : 0.0;
+}
+
 static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
 {
     TrueTypeFontKey *k = (TrueTypeFontKey *)key;
     TrueTypeFont *f = (TrueTypeFont *)value;
-    int *total_string_cache_size = (int *)context;
-    int string_cache_size = 0;
+    TrueTypeStats *total = (TrueTypeStats *)context;
+    GlyphAtlas *a;
+    size_t glyph_cache_size = 0;
+    size_t atlas_size = 0;
 
     pthread_mutex_lock(&f->mutex);
 
-    hashmapForEach(f->string_cache, gr_ttf_dump_stats_count_string_cache, &string_cache_size);
+    hashmapForEach(f->glyph_cache, gr_ttf_dump_stats_count_glyph_cache, &glyph_cache_size);
 
     printf("  Font %s (size %d, dpi %d):\n"
            "    refcount: %d\n"
            "    max_height: %d\n"
            "    base: %d\n"
-           "    glyph_cache: %zu entries\n"
-           "    string_cache: %zu entries (%.2f kB)\n",
+           "    glyph_cache: %zu entries (%.2f kB)\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
-           hashmapSize(f->glyph_cache),
-           hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
+           hashmapSize(f->glyph_cache), ((double)glyph_cache_size)/1024);
+
+    a = f->atlas;
+    if (a) {
+        atlas_size = a->surface.stride * a->surface.height
+                + a->slot_count * sizeof(GlyphAtlasSlot) + sizeof(GlyphAtlas);
+
+        printf("    atlas: %dx%d, %d/%d slots of %dx%d (%.2f kB)\n"
+               "    atlas lookups: %lu hits, %lu misses, %lu evictions (%.1f%% hit rate)\n",
+               a->surface.width, a->surface.height,
+               a->slots_used, a->slot_count, a->slot_width, a->slot_height,
+               ((double)atlas_size)/1024,
+               a->hits, a->misses, a->evictions,
+               gr_ttf_hit_rate(a->hits, a->misses));
+
+        total->hits += a->hits;
+        total->misses += a->misses;
+    } else {
+        printf("    atlas: not allocated\n");
+    }
 
     pthread_mutex_unlock(&f->mutex);
 
-    *total_string_cache_size += string_cache_size;
+    total->glyph_cache_size += glyph_cache_size;
+    total->atlas_size += atlas_size;
     return true;
 }
 
@@ -774,10 +925,13 @@ void gr_ttf_dump_stats(void)
     if (!font_data.fonts) {
         printf("no truetype fonts loaded.\n");
     } else {
-        int total_string_cache_size = 0;
+        TrueTypeStats total;
+        memset(&total, 0, sizeof(total));
         printf("%zu fonts loaded.\n", hashmapSize(font_data.fonts));
-        hashmapForEach(font_data.fonts, gr_ttf_dump_stats_font, &total_string_cache_size);
-        printf("  Total string cache size: %.2f kB\n", ((double)total_string_cache_size)/1024);
+        hashmapForEach(font_data.fonts, gr_ttf_dump_stats_font, &total);
+        printf("  Total glyph cache size: %.2f kB\n", ((double)total.glyph_cache_size)/1024);
+        printf("  Total atlas size: %.2f kB\n", ((double)total.atlas_size)/1024);
+        printf("  Total atlas hit rate: %.1f%%\n", gr_ttf_hit_rate(total.hits, total.misses));
     }
 
     pthread_mutex_unlock(&font_data.mutex);
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compiles the images of mbbootui theme directories into a theme bundle (see
+// gui/theme_bundle.hpp). PNG images are decoded into the same 32-bit layout
+// that res_create_surface_png() produces at runtime and compressed with zlib.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <png.h>
+#include <zlib.h>
+
+#include "gui/theme_bundle.hpp"
+
+struct BundleEntry
+{
+    // zlib stream
+    std::vector<unsigned char> data;
+    uint32_t width;
+    uint32_t height;
+    ThemeBundlePixelFormat format;
+};
+
+static bool ends_with(const std::string &str, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+static bool starts_with(const std::string &str, const char *prefix)
+{
+    return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// Files in later directories replace files with the same relative path in
+// earlier directories, just like when the theme is extracted on the device
+static bool collect_files(const std::string &dir, const std::string &prefix,
+                          std::map<std::string, std::string> &files)
+{
+    std::string path = prefix.empty() ? dir : dir + "/" + prefix;
+
+    DIR *d = opendir(path.c_str());
+    if (!d) {
+        fprintf(stderr, "%s: Failed to open directory: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ret = true;
+    struct dirent *ent;
+
+    while ((ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        std::string name = prefix.empty()
+                ? ent->d_name : prefix + "/" + ent->d_name;
+        std::string full_path = dir + "/" + name;
+
+        struct stat sb;
+        if (stat(full_path.c_str(), &sb) < 0) {
+            fprintf(stderr, "%s: Failed to stat: %s\n",
+                    full_path.c_str(), strerror(errno));
+            ret = false;
+            break;
+        }
+
+        if (S_ISDIR(sb.st_mode)) {
+            if (!collect_files(dir, name, files)) {
+                ret = false;
+                break;
+            }
+        } else if (starts_with(name, "images/") && ends_with(name, ".png")) {
+            files[name] = full_path;
+        }
+        // Anything else (eg. XML files and fonts) is still loaded from the
+        // theme directory
+    }
+
+    closedir(d);
+    return ret;
+}
+
+static bool decode_png(const std::string &path, BundleEntry &entry)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    png_structp png_ptr = png_create_read_struct(
+            PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_ptr ? png_create_info_struct(png_ptr) : nullptr;
+    if (!info_ptr) {
+        fprintf(stderr, "%s: Failed to initialize libpng\n", path.c_str());
+        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<unsigned char> row;
+    std::vector<unsigned char> pixels;
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        fprintf(stderr, "%s: Failed to decode PNG image\n", path.c_str());
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        fclose(fp);
+        return false;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_read_info(png_ptr, info_ptr);
+
+    png_uint_32 width;
+    png_uint_32 height;
+    int bit_depth;
+    int color_type;
+
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+                 nullptr, nullptr, nullptr);
+
+    // Same conversions as open_png(). As on the device, the tRNS chunk of
+    // paletted images is ignored.
+    if (bit_depth == 16) {
+        png_set_strip_16(png_ptr);
+    }
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    } else if (color_type == PNG_COLOR_TYPE_GRAY
+            || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+        png_set_gray_to_rgb(png_ptr);
+    }
+
+    png_read_update_info(png_ptr, info_ptr);
+
+    png_byte channels = png_get_channels(png_ptr, info_ptr);
+    if (channels != 3 && channels != 4) {
+        fprintf(stderr, "%s: Unsupported PNG format\n", path.c_str());
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        fclose(fp);
+        return false;
+    }
+
+    // Grayscale images are RGBA (with an opaque alpha channel) at runtime
+    bool opaque = color_type == PNG_COLOR_TYPE_RGB
+            || color_type == PNG_COLOR_TYPE_PALETTE;
+
+    entry.width = width;
+    entry.height = height;
+    entry.format = opaque
+            ? ThemeBundlePixelFormat::Rgbx8888
+            : ThemeBundlePixelFormat::Rgba8888;
+
+    pixels.resize(static_cast<size_t>(width) * height * 4);
+    row.resize(static_cast<size_t>(width) * channels);
+
+    for (png_uint_32 y = 0; y < height; ++y) {
+        png_read_row(png_ptr, row.data(), nullptr);
+
+        unsigned char *out = pixels.data()
+                + static_cast<size_t>(y) * width * 4;
+
+        if (channels == 4) {
+            memcpy(out, row.data(), row.size());
+        } else {
+            const unsigned char *in = row.data();
+            for (png_uint_32 x = 0; x < width; ++x) {
+                *out++ = *in++;
+                *out++ = *in++;
+                *out++ = *in++;
+                *out++ = 0xff;
+            }
+        }
+    }
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    fclose(fp);
+
+    uLongf size = compressBound(pixels.size());
+    entry.data.resize(size);
+
+    if (compress2(entry.data.data(), &size, pixels.data(), pixels.size(),
+                  Z_BEST_COMPRESSION) != Z_OK) {
+        fprintf(stderr, "%s: Failed to compress image\n", path.c_str());
+        return false;
+    }
+
+    entry.data.resize(size);
+    return true;
+}
+
+static void put_le32(std::vector<unsigned char> &buf, size_t offset,
+                     uint32_t value)
+{
+    buf[offset] = value & 0xff;
+    buf[offset + 1] = (value >> 8) & 0xff;
+    buf[offset + 2] = (value >> 16) & 0xff;
+    buf[offset + 3] = (value >> 24) & 0xff;
+}
+
+static bool build_bundle(const std::map<std::string, BundleEntry> &entries,
+                         std::vector<unsigned char> &out)
+{
+    size_t entries_offset = sizeof(ThemeBundleHeader);
+    size_t strings_offset = entries_offset
+            + entries.size() * sizeof(ThemeBundleEntry);
+
+    std::string strings;
+    std::vector<size_t> name_offsets;
+    for (auto const &item : entries) {
+        name_offsets.push_back(strings.size());
+        strings += item.first;
+        strings += '\0';
+    }
+
+    size_t data_offset = strings_offset + strings.size();
+    size_t total_size = data_offset;
+    for (auto const &item : entries) {
+        total_size += item.second.data.size();
+    }
+
+    if (total_size > UINT32_MAX) {
+        fprintf(stderr, "Theme bundle is too large\n");
+        return false;
+    }
+
+    out.assign(total_size, 0);
+
+    memcpy(out.data(), THEME_BUNDLE_MAGIC, THEME_BUNDLE_MAGIC_SIZE);
+    put_le32(out, offsetof(ThemeBundleHeader, version), THEME_BUNDLE_VERSION);
+    put_le32(out, offsetof(ThemeBundleHeader, entry_count), entries.size());
+    put_le32(out, offsetof(ThemeBundleHeader, entries_offset), entries_offset);
+    put_le32(out, offsetof(ThemeBundleHeader, strings_offset), strings_offset);
+    put_le32(out, offsetof(ThemeBundleHeader, strings_size), strings.size());
+
+    memcpy(out.data() + strings_offset, strings.data(), strings.size());
+
+    size_t i = 0;
+    for (auto const &item : entries) {
+        const BundleEntry &entry = item.second;
+        size_t base = entries_offset + i * sizeof(ThemeBundleEntry);
+
+        put_le32(out, base + offsetof(ThemeBundleEntry, name_offset),
+                 name_offsets[i]);
+        put_le32(out, base + offsetof(ThemeBundleEntry, data_offset),
+                 data_offset);
+        put_le32(out, base + offsetof(ThemeBundleEntry, data_size),
+                 entry.data.size());
+        put_le32(out, base + offsetof(ThemeBundleEntry, width),
+                 entry.width);
+        put_le32(out, base + offsetof(ThemeBundleEntry, height),
+                 entry.height);
+        put_le32(out, base + offsetof(ThemeBundleEntry, format),
+                 static_cast<uint32_t>(entry.format));
+
+        memcpy(out.data() + data_offset, entry.data.data(),
+               entry.data.size());
+        data_offset += entry.data.size();
+        ++i;
+    }
+
+    return true;
+}
+
+static bool write_file(const char *path, const std::vector<unsigned char> &data)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    bool ret = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to write file: %s\n",
+                path, strerror(errno));
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                path, strerror(errno));
+        ret = false;
+    }
+
+    return ret;
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: themec [OPTION]... <theme dir>...\n"
+            "\n"
+            "Compile the images of one or more mbbootui theme directories\n"
+            "into a theme bundle. If an image exists in multiple directories,\n"
+            "the one from the last directory is used.\n"
+            "\n"
+            "Options:\n"
+            "  -o, --output <file>\n"
+            "                   Output file\n"
+            "  -h, --help       Display this help message\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    static const char short_options[] = "o:h";
+
+    static struct option long_options[] = {
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    const char *output_file = nullptr;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'o':
+            output_file = optarg;
+            break;
+
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!output_file || optind == argc) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    std::map<std::string, std::string> files;
+
+    for (int i = optind; i < argc; ++i) {
+        if (!collect_files(argv[i], "", files)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::map<std::string, BundleEntry> entries;
+
+    for (auto const &item : files) {
+        BundleEntry entry{};
+
+        if (!decode_png(item.second, entry)) {
+            return EXIT_FAILURE;
+        }
+
+        entries[item.first] = std::move(entry);
+    }
+
+    std::vector<unsigned char> bundle;
+    if (!build_bundle(entries, bundle) || !write_file(output_file, bundle)) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %zu images, %zu bytes\n",
+           output_file, entries.size(), bundle.size());
+
+    return EXIT_SUCCESS;
+}
@@ -20,16 +20,16 @@
 #include "appsync.h"
 
 #include <algorithm>
+#include <memory>
 
-#include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -40,6 +40,7 @@
 #include "mbcommon/common.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mblog/async_logger.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
 #include "mbutil/autoclose/file.h"
@@ -78,6 +79,8 @@
 #define INSTALLD_SOCKET_CONTEXT         "u:object_r:installd_socket:s0"
 
 #define COMMAND_BUF_SIZE                1024
+#define REQUEST_BUF_SIZE                (4 * COMMAND_BUF_SIZE)
+#define SPLICE_CHUNK_SIZE               65536
 
 #define PACKAGES_XML_PATH_FMT           "%s/system/packages.xml"
 
@@ -295,77 +298,6 @@ static int create_new_socket()
     return fd;
 }
 
-/*
- * Socket messages are prefixed with 16-bit unsigned value (little-endian)
- * indicating the number of bytes that follow. The data should be treated as
- * a string and a null terminator must be added to the end.
- */
-
-/*!
- * \brief Receive a message from a socket
- */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int *async_id)
-{
-    unsigned short count;
-
-    if (is_async) {
-        assert(async_id != nullptr);
-
-        if (!util::socket_read_int32(fd, async_id)) {
-            LOGE("Failed to receive async command ID: %s", strerror(errno));
-            return false;
-        }
-    }
-
-    if (!util::socket_read_uint16(fd, &count)) {
-        LOGE("Failed to read command size: %s", strerror(errno));
-        return false;
-    }
-
-    if (count < 1 || count >= size) {
-        LOGE("Invalid size %u", count);
-        return false;
-    }
-
-    if (util::socket_read(fd, buf, count) != count) {
-        LOGE("Failed to read command: %s", strerror(errno));
-        return false;
-    }
-
-    buf[count] = 0;
-
-    return true;
-}
-
-/*!
- * \brief Send a message to a socket
- */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
-{
-    unsigned short count = strlen(command);
-
-    if (is_async) {
-        if (!util::socket_write_int32(fd, async_id)) {
-            LOGE("Failed to write async command ID: %s", strerror(errno));
-            return false;
-        }
-    }
-
-    if (!util::socket_write_uint16(fd, count)) {
-        LOGE("Failed to write command size: %s", strerror(errno));
-        return false;
-    }
-
-    if (util::socket_write(fd, command, count) != count) {
-        LOGE("Failed to write command: %s", strerror(errno));
-        return false;
-    }
-
-    return true;
-}
-
 /*!
  * \brief Connect to the installd socket at INSTALLD_SOCKET_PATH
  *
@@ -532,173 +464,286 @@ static void handle_command(const std::vector<std::string> &args)
     }
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+/*
+ * Socket messages are prefixed with 16-bit unsigned value (little-endian)
+ * indicating the number of bytes that follow. The data should be treated as
+ * a string and a null terminator must be added to the end. The CyanogenMod
+ * async installd additionally prefixes each message with a 32-bit transaction
+ * ID.
+ *
+ * Only requests need to be split into messages, since appsync has to see the
+ * commands it hooks before installd does. Replies are forwarded as an opaque
+ * byte stream.
+ */
+
+struct ProxyState
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    int client_fd;
+    int installd_fd;
+    bool can_appsync;
+    bool is_async;
+
+    // Requests from the client that have not been forwarded yet. This is
+    // large enough to always hold one complete message.
+    char req_buf[REQUEST_BUF_SIZE];
+    size_t req_used;
+
+    // Pipe for splicing replies from installd to the client
+    int pipe_fds[2];
+    bool use_splice;
+};
 
-    uint64_t time_start, time_stop;
-    uint64_t time_start_installd, time_stop_installd;
-    uint64_t time_start_send, time_stop_send;
+static const CommandInfo * find_hooked_command(const char *msg, size_t size)
+{
+    const char *space = static_cast<const char *>(memchr(msg, ' ', size));
+    size_t cmd_size = space ? static_cast<size_t>(space - msg) : size;
 
-    int async_id;
+    for (std::size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
+        if (strlen(cmds[i].name) == cmd_size
+                && memcmp(cmds[i].name, msg, cmd_size) == 0) {
+            return &cmds[i];
+        }
+    }
 
-    time_start = util::current_time_ms();
+    return nullptr;
+}
 
-    time_start_installd = util::current_time_ms();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, &async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
-    }
-    time_stop_installd = util::current_time_ms();
+static void hook_request(const char *msg, size_t size)
+{
+    uint64_t time_start = util::current_time_ms();
+
+    // Arguments are only split for the commands that we hook
+    std::string cmdline(msg, size);
+    std::vector<std::string> args = parse_args(cmdline.c_str());
+
+    LOGD("Received command: %s", args_to_string(args).c_str());
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+    handle_command(args);
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
+    LOGD("- Time to hook installd command:       %" PRIu64 "ms",
+         util::current_time_ms() - time_start);
+}
+
+/*!
+ * \brief Forward buffered requests from the client to installd
+ *
+ * All complete messages in the buffer are sent with a single write, except
+ * that messages preceding a hooked command are sent before the hook runs.
+ */
+static bool forward_requests(ProxyState &state)
+{
+    ssize_t n = read(state.client_fd, state.req_buf + state.req_used,
+                     sizeof(state.req_buf) - state.req_used);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+        LOGE("Failed to receive request from client: %s", strerror(errno));
+        return false;
+    } else if (n == 0) {
+        LOGD("Client closed connection");
         return false;
     }
-    time_stop_send = util::current_time_ms();
 
-    time_stop = util::current_time_ms();
+    state.req_used += n;
 
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         time_stop_send - time_start_send);
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         time_stop_installd - time_start_installd);
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-         time_stop - time_start);
-    LOGD("---");
+    const size_t header_size = state.is_async
+            ? sizeof(int32_t) + sizeof(uint16_t) : sizeof(uint16_t);
+    size_t pos = 0;
+    size_t flushed = 0;
 
-    return true;
-}
+    while (state.req_used - pos >= header_size) {
+        uint16_t count;
+        memcpy(&count, state.req_buf + pos + header_size - sizeof(count),
+               sizeof(count));
 
-static bool handle_android_event(int client_fd, int installd_fd,
-                                 bool can_appsync, bool is_async)
-{
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+        if (count < 1 || count >= COMMAND_BUF_SIZE) {
+            LOGE("Invalid size %u", count);
+            return false;
+        }
 
-    uint64_t time_start, time_stop;
-    uint64_t time_start_installd, time_stop_installd;
-    uint64_t time_start_hook = 0, time_stop_hook = 0;
-    uint64_t time_start_send, time_stop_send;
+        size_t msg_size = header_size + count;
+        if (state.req_used - pos < msg_size) {
+            break;
+        }
 
-    int async_id;
+        const char *msg = state.req_buf + pos + header_size;
 
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, &async_id)) {
-        LOGE("Failed to receive request from client");
-        return false;
+        if (state.can_appsync && find_hooked_command(msg, count)) {
+            if (util::socket_write(state.installd_fd,
+                                   state.req_buf + flushed, pos - flushed)
+                    != static_cast<ssize_t>(pos - flushed)) {
+                LOGE("Failed to send request to installd: %s",
+                     strerror(errno));
+                return false;
+            }
+            flushed = pos;
+
+            hook_request(msg, count);
+        } else {
+            LOGV("Received command: %.*s",
+                 static_cast<int>(strnlen(msg, count)), msg);
+        }
+
+        pos += msg_size;
     }
 
-    time_start = util::current_time_ms();
+    if (util::socket_write(state.installd_fd,
+                           state.req_buf + flushed, pos - flushed)
+            != static_cast<ssize_t>(pos - flushed)) {
+        LOGE("Failed to send request to installd: %s", strerror(errno));
+        return false;
+    }
 
-    std::vector<std::string> args = parse_args(buf);
+    // Keep the incomplete message, if any
+    memmove(state.req_buf, state.req_buf + pos, state.req_used - pos);
+    state.req_used -= pos;
 
-    bool log_result = true;
+    return true;
+}
 
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                time_start_hook = util::current_time_ms();
-                handle_command(args);
-                time_stop_hook = util::current_time_ms();
+/*!
+ * \brief Forward replies from installd to the client
+ *
+ * The data is spliced through a pipe so that it's never copied to userspace.
+ * If the kernel can't splice from a unix socket, it falls back to a buffered
+ * copy.
+ */
+static bool forward_replies(ProxyState &state)
+{
+    if (state.use_splice) {
+        ssize_t n = splice(state.installd_fd, nullptr, state.pipe_fds[1],
+                           nullptr, SPLICE_CHUNK_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINVAL) {
+            LOGW("splice() not supported for sockets; copying replies");
+            state.use_splice = false;
+        } else if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                return true;
             }
+            LOGE("Failed to receive reply from installd: %s",
+                 strerror(errno));
+            return false;
+        } else if (n == 0) {
+            LOGD("installd closed connection");
+            return false;
         } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
+            while (n > 0) {
+                ssize_t m = splice(state.pipe_fds[0], nullptr, state.client_fd,
+                                   nullptr, n, SPLICE_F_MOVE);
+                if (m < 0 && errno == EINTR) {
+                    continue;
+                } else if (m <= 0) {
+                    LOGE("Failed to send reply to client: %s",
+                         strerror(errno));
+                    return false;
+                }
+                n -= m;
+            }
+            return true;
         }
     }
 
-    time_start_installd = util::current_time_ms();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send request to installd");
+    char buf[COMMAND_BUF_SIZE];
+
+    ssize_t n = read(state.installd_fd, buf, sizeof(buf));
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+        LOGE("Failed to receive reply from installd: %s", strerror(errno));
+        return false;
+    } else if (n == 0) {
+        LOGD("installd closed connection");
         return false;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, &async_id)) {
-        LOGE("Failed to receive reply from installd");
+
+    if (util::socket_write(state.client_fd, buf, n) != n) {
+        LOGE("Failed to send reply to client: %s", strerror(errno));
         return false;
     }
-    time_stop_installd = util::current_time_ms();
 
-    args = parse_args(buf);
+    return true;
+}
+
+/*!
+ * \brief Proxy messages between a client and installd until either side
+ *        disconnects
+ *
+ * Writes are blocking. This is fine because installd's clients only have a
+ * small number of outstanding commands and installd itself handles one
+ * command at a time.
+ */
+static void proxy_connection(int client_fd, int installd_fd,
+                             bool can_appsync, bool is_async)
+{
+    std::unique_ptr<ProxyState> state(new ProxyState());
+    state->client_fd = client_fd;
+    state->installd_fd = installd_fd;
+    state->can_appsync = can_appsync;
+    state->is_async = is_async;
+    state->req_used = 0;
+    state->use_splice = pipe2(state->pipe_fds, O_CLOEXEC) == 0;
+    if (!state->use_splice) {
+        LOGW("Failed to create pipe: %s", strerror(errno));
+        state->pipe_fds[0] = -1;
+        state->pipe_fds[1] = -1;
+    }
+
+    auto close_pipe = util::finally([&]{
+        if (state->pipe_fds[0] >= 0) {
+            close(state->pipe_fds[0]);
+            close(state->pipe_fds[1]);
+        }
+    });
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOGE("Failed to create epoll fd: %s", strerror(errno));
+        return;
     }
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
-    }
-    time_stop_send = util::current_time_ms();
+    auto close_epoll_fd = util::finally([&]{
+        close(epoll_fd);
+    });
 
-    time_stop = util::current_time_ms();
+    for (int fd : { client_fd, installd_fd }) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
 
-    if (log_result) {
-        LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             time_stop_send - time_start_send);
-        LOGD("- Time to complete installd command:   %" PRIu64 "ms",
-             time_stop_installd - time_start_installd);
-        if (can_appsync) {
-            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
-                 time_stop_hook - time_start_hook);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            LOGE("Failed to add fd %d to epoll: %s", fd, strerror(errno));
+            return;
         }
-        LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-             time_stop - time_start);
-        LOGD("---");
     }
 
-    return true;
+    struct epoll_event events[2];
+
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for events: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                continue;
+            }
+
+            bool ret = events[i].data.fd == client_fd
+                    ? forward_requests(*state)
+                    : forward_replies(*state);
+            if (!ret) {
+                return;
+            }
+        }
+    }
 }
 
 /**
@@ -747,8 +792,6 @@ static bool proxy_process(int fd, bool can_appsync)
         });
 
         // Check if we're using some variant of the CyanogenMood async installd
-        // NOTE: We'll effectively make the connection sychronous because we
-        //       always wait for a reply before receiving the next command.
         // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
         bool is_async = util::file_find_one_of(
                 INSTALLD_PATH, { "failed to read transaction id" });
@@ -756,32 +799,7 @@ static bool proxy_process(int fd, bool can_appsync)
 
         LOGD("---");
 
-        struct pollfd fds[2];
-        memset(fds, 0, sizeof(fds));
-
-        fds[0].fd = client_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = installd_fd;
-        fds[1].events = POLLIN;
-
-        while (true) {
-            fds[0].revents = 0;
-            fds[1].revents = 1;
-
-            if (poll(fds, 2, -1) < 0) {
-                LOGE("Failed to poll() fds: %s", strerror(errno));
-                break;
-            }
-
-            if (fds[0].revents & POLLIN && !handle_android_event(
-                    client_fd, installd_fd, can_appsync, is_async)) {
-                break;
-            }
-            if (fds[1].revents & POLLIN && !handle_installd_event(
-                    client_fd, installd_fd, is_async)) {
-                break;
-            }
-        }
+        proxy_connection(client_fd, installd_fd, can_appsync, is_async);
     }
 
     // Not reached
@@ -934,8 +952,16 @@ int appsync_main(int argc, char *argv[])
 
     fix_multiboot_permissions();
 
-    // mbtool logging
-    log::log_set_logger(std::make_shared<log::StdioLogger>(fp.get(), true));
+    // mbtool logging. installd events are logged from the proxy loop, so keep
+    // file I/O off of that thread.
+    log::log_set_logger(std::make_shared<log::AsyncLogger>(
+            std::make_shared<log::StdioLogger>(fp.get(), true)));
+    log::AsyncLogger::install_crash_handler();
+
+    // Drain the logger before the log file is closed
+    auto reset_logger = util::finally([]{
+        log::log_set_logger(nullptr);
+    });
 
     LOGI("=== APPSYNC VERSION %s ===", version());
 
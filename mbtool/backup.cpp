@@ -35,6 +35,7 @@
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/autoclose/archive.h"
 #include "mbutil/autoclose/dir.h"
 #include "mbutil/archive.h"
@@ -171,6 +172,8 @@ static bool backup_directory(const std::string &output_file,
                              const std::vector<std::string> &exclusions,
                              util::compression_type compression)
 {
+    MB_TRACE_SPAN(span, "backup_directory");
+
     autoclose::dir dp(autoclose::opendir(directory.c_str()));
     if (!dp) {
         LOGE("%s: Failed to open directory: %s",
@@ -198,8 +201,17 @@ static bool backup_directory(const std::string &output_file,
         return false;
     }
 
-    return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression);
+    bool ret = util::libarchive_tar_create(output_file, directory, contents,
+                                           compression);
+
+#if MB_TRACE_ENABLED
+    struct stat sb;
+    if (ret && stat(output_file.c_str(), &sb) == 0) {
+        MB_TRACE_COUNTER(span, "bytes", sb.st_size);
+    }
+#endif
+
+    return ret;
 }
 
 static bool restore_directory(const std::string &input_file,
@@ -207,6 +219,15 @@ static bool restore_directory(const std::string &input_file,
                               const std::vector<std::string> &exclusions,
                               util::compression_type compression)
 {
+    MB_TRACE_SPAN(span, "restore_directory");
+
+#if MB_TRACE_ENABLED
+    struct stat sb;
+    if (stat(input_file.c_str(), &sb) == 0) {
+        MB_TRACE_COUNTER(span, "bytes", sb.st_size);
+    }
+#endif
+
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
@@ -559,6 +580,8 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
                        const std::string &output_dir, int targets,
                        util::compression_type compression)
 {
+    MB_TRACE_SCOPE("backup_rom");
+
     if (!targets) {
         LOGE("No backup targets specified");
         return false;
@@ -647,6 +670,8 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
 static bool restore_rom(const std::shared_ptr<Rom> &rom,
                         const std::string &input_dir, int targets)
 {
+    MB_TRACE_SCOPE("restore_rom");
+
     if (!targets) {
         LOGE("No restore targets specified");
         return false;
@@ -995,6 +1020,7 @@ int backup_main(int argc, char *argv[])
     }
 
     bool ret = backup_rom(rom, output_dir, targets, compression);
+    write_trace("backup");
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1105,6 +1131,7 @@ int restore_main(int argc, char *argv[])
     }
 
     bool ret = restore_rom(rom, input_dir, targets);
+    write_trace("restore");
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -70,6 +70,10 @@ static bool no_unshare = false;
 
 static autoclose::file log_fp(nullptr, std::fclose);
 
+// Kept up to date by the listening process so that connection processes
+// inherit an already parsed copy of packages.xml
+static Packages packages;
+
 static bool verify_credentials(uid_t uid)
 {
     // Rely on the OS for signature checking and simply compare strings in
@@ -78,36 +82,36 @@ static bool verify_credentials(uid_t uid)
     // the connection will terminate. Or, the client already has root access, in
     // which case, there's not much we can do to prevent damage.
 
-    Packages pkgs;
-    if (!pkgs.load_xml(PACKAGES_XML)) {
+    if (!packages.reload_xml(PACKAGES_XML)) {
         LOGE("Failed to load " PACKAGES_XML);
         return false;
     }
 
-    std::shared_ptr<Package> pkg = pkgs.find_by_uid(uid);
+    const Package *pkg = packages.find_by_uid(uid);
     if (!pkg) {
         LOGE("Failed to find package for UID %u", uid);
         return false;
     }
 
     pkg->dump();
-    LOGD("%s has %zu signatures", pkg->name.c_str(), pkg->sig_indexes.size());
+    LOGD("%s has %zu signatures", pkg->name, pkg->sig_indexes.size());
 
-    for (const std::string &index : pkg->sig_indexes) {
-        if (pkgs.sigs.find(index) == pkgs.sigs.end()) {
-            LOGW("Signature index %s has no key", index.c_str());
+    for (const char *index : pkg->sig_indexes) {
+        auto it = packages.sigs.find(index);
+        if (it == packages.sigs.end()) {
+            LOGW("Signature index %s has no key", index);
             continue;
         }
 
-        const std::string &key = pkgs.sigs[index];
+        const std::string &key = it->second;
         if (std::find(valid_certs.begin(), valid_certs.end(), key)
                 != valid_certs.end()) {
-            LOGV("%s matches whitelisted signatures", pkg->name.c_str());
+            LOGV("%s matches whitelisted signatures", pkg->name);
             return true;
         }
     }
 
-    LOGE("%s does not match whitelisted signatures", pkg->name.c_str());
+    LOGE("%s does not match whitelisted signatures", pkg->name);
     return false;
 }
 
@@ -243,6 +247,10 @@ static bool run_daemon()
 
     int client_fd;
     while ((client_fd = accept(fd, nullptr, nullptr)) >= 0) {
+        // This only parses the file if it changed. Failures are reported again
+        // by verify_credentials() in the child.
+        packages.reload_xml(PACKAGES_XML);
+
         pid_t child_pid = fork();
         if (child_pid < 0) {
             LOGE("Failed to fork: %s", strerror(errno));
@@ -284,6 +292,7 @@ static bool run_daemon()
 
             bool ret = client_connection(client_fd);
             close(client_fd);
+            write_trace("daemon");
             _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
         }
         close(client_fd);
@@ -31,6 +31,7 @@
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
@@ -44,7 +45,7 @@
 #include "mbutil/string.h"
 
 #include "init.h"
-#include "packages.h"
+#include "metadata_cache.h"
 #include "reboot.h"
 #include "roms.h"
 #include "signature.h"
@@ -1027,6 +1028,9 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
     Roms roms;
     roms.add_installed();
 
+    MetadataCache cache;
+    cache.load();
+
     std::vector<fb::Offset<v3::MbRom>> fb_roms;
 
     for (auto r : roms.roms) {
@@ -1050,16 +1054,14 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         }
         build_prop += "/build.prop";
 
-        std::unordered_map<std::string, std::string> properties;
-        util::property_file_get_all(build_prop, properties);
-
-        if (properties.find("ro.build.version.release") != properties.end()) {
-            const std::string &version = properties["ro.build.version.release"];
-            fb_version = builder.CreateString(version);
-        }
-        if (properties.find("ro.build.display.id") != properties.end()) {
-            const std::string &build = properties["ro.build.display.id"];
-            fb_build = builder.CreateString(build);
+        RomBuildInfo info;
+        if (cache.get_build_info(build_prop, info)) {
+            if (!info.version.empty()) {
+                fb_version = builder.CreateString(info.version);
+            }
+            if (!info.build.empty()) {
+                fb_build = builder.CreateString(info.build);
+            }
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1074,6 +1076,8 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         fb_roms.push_back(fb_rom);
     }
 
+    cache.save();
+
     // Create response
     auto response = v3::CreateMbGetInstalledRomsResponseDirect(
             builder, &fb_roms);
@@ -1283,34 +1287,21 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
 
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::MbGetPackagesCountError> error;
-    unsigned int system_pkgs = 0;
-    unsigned int update_pkgs = 0;
-    unsigned int other_pkgs = 0;
+    PackageCounts counts{};
 
-    Packages pkgs;
-    bool ret = pkgs.load_xml(packages_xml);
+    MetadataCache cache;
+    cache.load();
 
+    bool ret = cache.get_package_counts(packages_xml, counts);
     if (ret) {
-        for (std::shared_ptr<Package> pkg : pkgs.pkgs) {
-            bool is_system = (pkg->pkg_flags & Package::FLAG_SYSTEM)
-                    || (pkg->pkg_public_flags & Package::PUBLIC_FLAG_SYSTEM);
-            bool is_update = (pkg->pkg_flags & Package::FLAG_UPDATED_SYSTEM_APP)
-                    || (pkg->pkg_public_flags & Package::PUBLIC_FLAG_UPDATED_SYSTEM_APP);
-
-            if (is_update) {
-                ++update_pkgs;
-            } else if (is_system) {
-                ++system_pkgs;
-            } else {
-                ++other_pkgs;
-            }
-        }
+        cache.save();
     } else {
         error = v3::CreateMbGetPackagesCountError(builder);
     }
 
     auto response = v3::CreateMbGetPackagesCountResponse(
-            builder, ret, system_pkgs, update_pkgs, other_pkgs, error);
+            builder, ret, counts.system_pkgs, counts.update_pkgs,
+            counts.other_pkgs, error);
 
     // Wrap response
     builder.Finish(v3::CreateResponse(
@@ -1479,6 +1470,7 @@ bool connection_version_3(int fd)
         bool ret = true;
 
         if (fn) {
+            MB_TRACE_SCOPE(v3::EnumNameRequestType(type));
             ret = fn(fd, request);
         } else {
             // Invalid command; allow further commands
@@ -259,6 +259,7 @@ bool emergency_reboot()
         LOGI("Dumping kernel log to %s", log_path.c_str());
 
         rename(log_path.c_str(), log_path_old.c_str());
+        log::log_flush();
         dump_kernel_log(log_path.c_str());
         sync();
 
@@ -267,6 +268,8 @@ bool emergency_reboot()
 
     fix_multiboot_permissions();
 
+    log::log_flush();
+
     // Does not return if successful
     reboot_directly("recovery");
 
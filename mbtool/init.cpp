@@ -20,8 +20,8 @@
 #include "init.h"
 
 #include <algorithm>
+#include <map>
 #include <memory>
-#include <unordered_set>
 
 #include <cerrno>
 #include <cstdlib>
@@ -55,6 +55,7 @@
 #include "mbutil/file.h"
 #include "mbutil/finally.h"
 #include "mbutil/fstab.h"
+#include "mbutil/line_patcher.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -310,61 +311,42 @@ static bool replace_file(const char *replace, const char *with)
     return true;
 }
 
-static bool fix_file_contexts(const char *path)
+// Edits to be applied to the ramdisk files, keyed by path. Each file is read
+// and written at most once no matter how many stages modify it.
+typedef std::map<std::string, util::LinePatcher> RamdiskEdits;
+
+static bool apply_ramdisk_edits(const RamdiskEdits &edits)
 {
-    std::string new_path(path);
-    new_path += ".new";
+    bool ret = true;
 
-    autoclose::file fp_old(autoclose::fopen(path, "rb"));
-    if (!fp_old) {
-        if (errno == ENOENT) {
-            return true;
-        } else {
-            LOGE("%s: Failed to open for reading: %s",
-                 path, strerror(errno));
-            return false;
+    for (auto const &item : edits) {
+        if (!item.second.apply(item.first) && errno != ENOENT) {
+            LOGE("%s: Failed to patch file: %s",
+                 item.first.c_str(), strerror(errno));
+            ret = false;
         }
     }
 
-    autoclose::file fp_new(autoclose::fopen(new_path.c_str(), "wb"));
-    if (!fp_new) {
-        LOGE("%s: Failed to open for writing: %s",
-             new_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read = 0;
-
-    auto free_line = util::finally([&]{
-        free(line);
-    });
-
-    while ((read = getline(&line, &len, fp_old.get())) >= 0) {
-        if (mb::starts_with(line, "/data/media(")
-                && !strstr(line, "<<none>>")) {
-            fputc('#', fp_new.get());
-        }
+    return ret;
+}
 
-        if (fwrite(line, 1, read, fp_new.get()) != (std::size_t) read) {
-            LOGE("%s: Failed to write file: %s",
-                 new_path.c_str(), strerror(errno));
-            return false;
+static void fix_file_contexts(util::LinePatcher &patcher)
+{
+    patcher.add_edit([](util::LinePatcher::Line &line) {
+        if (line.starts_with("/data/media(")
+                && !line.contains("<<none>>")) {
+            line.comment_out = true;
         }
-    }
+    });
 
-    static const char *new_contexts =
+    patcher.add_trailer(
             "\n"
             "/data/media              <<none>>\n"
             "/data/media/[0-9]+(/.*)? <<none>>\n"
             "/raw(/.*)?               <<none>>\n"
             "/data/multiboot(/.*)?    <<none>>\n"
             "/cache/multiboot(/.*)?   <<none>>\n"
-            "/system/multiboot(/.*)?  <<none>>\n";
-    fputs(new_contexts, fp_new.get());
-
-    return replace_file(path, new_path.c_str());
+            "/system/multiboot(/.*)?  <<none>>\n");
 }
 
 static bool fix_binary_file_contexts(const char *path)
@@ -401,7 +383,11 @@ static bool fix_binary_file_contexts(const char *path)
     }
 
     // Patch temporary file
-    if (!fix_file_contexts(tmp_path.c_str())) {
+    util::LinePatcher patcher;
+    fix_file_contexts(patcher);
+
+    if (!patcher.apply(tmp_path)) {
+        LOGE("%s: Failed to patch file: %s", tmp_path.c_str(), strerror(errno));
         unlink(tmp_path.c_str());
         return false;
     }
@@ -420,92 +406,61 @@ static bool fix_binary_file_contexts(const char *path)
     return replace_file(path, new_path.c_str());
 }
 
-static bool is_completely_whitespace(const char *str)
+static bool add_mbtool_services(RamdiskEdits &edits, bool enable_appsync)
 {
-    while (*str) {
-        if (!isspace(*str)) {
-            return false;
-        }
-        ++str;
-    }
-    return true;
-}
+    struct State {
+        bool has_init_multiboot_rc = false;
+        bool has_disabled_installd = false;
+        bool inside_service = false;
+    };
 
-static bool add_mbtool_services(bool enable_appsync)
-{
-    autoclose::file fp_old(autoclose::fopen("/init.rc", "rb"));
-    if (!fp_old) {
+    if (access("/init.rc", F_OK) < 0) {
         if (errno == ENOENT) {
             return true;
         } else {
-            LOGE("Failed to open /init.rc: %s", strerror(errno));
+            LOGE("Failed to access /init.rc: %s", strerror(errno));
             return false;
         }
     }
 
-    autoclose::file fp_new(autoclose::fopen("/init.rc.new", "wb"));
-    if (!fp_new) {
-        LOGE("Failed to open /init.rc.new for writing: %s",
-             strerror(errno));
-        return false;
-    }
-
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read = 0;
-
-    auto free_line = util::finally([&]{
-        free(line);
-    });
-
-    bool has_init_multiboot_rc = false;
-    bool has_disabled_installd = false;
-    bool inside_service = false;
+    auto state = std::make_shared<State>();
+    util::LinePatcher &patcher = edits["/init.rc"];
 
-    while ((read = getline(&line, &len, fp_old.get())) >= 0) {
-        if (strstr(line, "import /init.multiboot.rc")) {
-            has_init_multiboot_rc = true;
+    patcher.add_scan([state, enable_appsync](
+            const util::LinePatcher::Line &line) {
+        if (line.contains("import /init.multiboot.rc")) {
+            state->has_init_multiboot_rc = true;
         }
 
         if (enable_appsync) {
-            if (mb::starts_with(line, "service")) {
-                inside_service = strstr(line, "installd") != nullptr;
-            } else if (inside_service && is_completely_whitespace(line)) {
-                inside_service = false;
+            if (line.starts_with("service")) {
+                state->inside_service = line.contains("installd");
+            } else if (state->inside_service && line.is_whitespace()) {
+                state->inside_service = false;
             }
 
-            if (inside_service && strstr(line, "disabled")) {
-                has_disabled_installd = true;
+            if (state->inside_service && line.contains("disabled")) {
+                state->has_disabled_installd = true;
             }
         }
-    }
-
-    rewind(fp_old.get());
+    });
 
-    while ((read = getline(&line, &len, fp_old.get())) >= 0) {
+    patcher.add_edit([state, enable_appsync](util::LinePatcher::Line &line) {
         // Load /init.multiboot.rc
-        if (!has_init_multiboot_rc && line[0] != '#') {
-            has_init_multiboot_rc = true;
-            fputs("import /init.multiboot.rc\n", fp_new.get());
-        }
-
-        if (fwrite(line, 1, read, fp_new.get()) != (std::size_t) read) {
-            LOGE("Failed to write to /init.rc.new: %s", strerror(errno));
-            return false;
+        if (!state->has_init_multiboot_rc
+                && (line.size == 0 || line.data[0] != '#')) {
+            state->has_init_multiboot_rc = true;
+            line.prepend += "import /init.multiboot.rc\n";
         }
 
         // Disable installd. mbtool's appsync will spawn it on demand
         if (enable_appsync
-                && !has_disabled_installd
-                && mb::starts_with(line, "service")
-                && strstr(line, "installd")) {
-            fputs("    disabled\n", fp_new.get());
+                && !state->has_disabled_installd
+                && line.starts_with("service")
+                && line.contains("installd")) {
+            line.append += "    disabled\n";
         }
-    }
-
-    if (!replace_file("/init.rc", "/init.rc.new")) {
-        return false;
-    }
+    });
 
     // Create /init.multiboot.rc
     autoclose::file fp_multiboot(autoclose::fopen("/init.multiboot.rc", "wb"));
@@ -560,7 +515,7 @@ static bool write_fstab_hack(const char *fstab)
     return true;
 }
 
-static bool strip_manual_mounts()
+static bool strip_manual_mounts(RamdiskEdits &edits)
 {
     autoclose::dir dir(autoclose::opendir("/"));
     if (!dir) {
@@ -578,71 +533,21 @@ static bool strip_manual_mounts()
         std::string path("/");
         path += ent->d_name;
 
-        autoclose::file fp(autoclose::fopen(path.c_str(), "r"));
-        if (!fp) {
-            LOGE("Failed to open %s for reading: %s",
-                 path.c_str(), strerror(errno));
-            continue;
-        }
-
-        char *line = nullptr;
-        size_t len = 0;
-        ssize_t read = 0;
-
-        auto free_line = util::finally([&]{
-            free(line);
-        });
-
-        std::size_t count = 0;
-        std::unordered_set<std::size_t> comment_out;
-
-        // Find out which lines need to be commented out
-        while ((read = getline(&line, &len, fp.get())) >= 0) {
-            if (strstr(line, "mount")
-                    && (strstr(line, "/system")
-                    || strstr(line, "/cache")
-                    || strstr(line, "/data"))) {
-                std::vector<std::string> tokens = util::tokenize(line, " \t\n");
+        edits[path].add_edit([](util::LinePatcher::Line &line) {
+            if (line.contains("mount")
+                    && (line.contains("/system")
+                    || line.contains("/cache")
+                    || line.contains("/data"))) {
+                std::vector<std::string> tokens =
+                        util::tokenize(line.str(), " \t\n");
                 if (tokens.size() >= 4 && tokens[0] == "mount"
                         && (tokens[3] == "/system"
                         || tokens[3] == "/cache"
                         || tokens[3] == "/data")) {
-                    comment_out.insert(count);
+                    line.comment_out = true;
                 }
             }
-
-            ++count;
-        }
-
-        if (comment_out.empty()) {
-            continue;
-        }
-
-        // Go back to beginning of file for reread
-        rewind(fp.get());
-        count = 0;
-
-        std::string new_path(path);
-        new_path += ".new";
-
-        autoclose::file fp_new(autoclose::fopen(new_path.c_str(), "w"));
-        if (!fp_new) {
-            LOGE("Failed to open %s for writing: %s",
-                 new_path.c_str(), strerror(errno));
-            continue;
-        }
-
-        // Actually comment out the lines
-        while ((read = getline(&line, &len, fp.get())) >= 0) {
-            if (comment_out.find(count) != comment_out.end()) {
-                fputs("#", fp_new.get());
-            }
-            fputs(line, fp_new.get());
-
-            ++count;
-        }
-
-        replace_file(path.c_str(), new_path.c_str());
+        });
     }
 
     return true;
@@ -895,11 +800,13 @@ static bool disable_spota()
 {
     static const char *spota_dir = "/data/security/spota";
 
-    std::unordered_map<std::string, std::string> props;
-    util::property_file_get_all("/system/build.prop", props);
+    util::PropertyFile build_prop;
+    build_prop.open("/system/build.prop");
 
-    if (strcasecmp(props["ro.product.manufacturer"].c_str(), "samsung") != 0
-            && strcasecmp(props["ro.product.brand"].c_str(), "samsung") != 0) {
+    if (strcasecmp(build_prop.get_string(
+                    "ro.product.manufacturer", {}).c_str(), "samsung") != 0
+            && strcasecmp(build_prop.get_string(
+                    "ro.product.brand", {}).c_str(), "samsung") != 0) {
         // Not a Samsung device
         LOGV("Not mounting empty tmpfs over: %s", spota_dir);
         return true;
@@ -1267,15 +1174,18 @@ int init_main(int argc, char *argv[])
     LOGD("Enable appsync: %d", config.indiv_app_sharing);
 
     // Make runtime ramdisk modifications
+    RamdiskEdits ramdisk_edits;
+
     if (access(FILE_CONTEXTS, R_OK) == 0) {
-        fix_file_contexts(FILE_CONTEXTS);
+        fix_file_contexts(ramdisk_edits[FILE_CONTEXTS]);
     }
     if (access(FILE_CONTEXTS_BIN, R_OK) == 0) {
         fix_binary_file_contexts(FILE_CONTEXTS_BIN);
     }
     write_fstab_hack(fstab.c_str());
-    add_mbtool_services(config.indiv_app_sharing);
-    strip_manual_mounts();
+    add_mbtool_services(ramdisk_edits, config.indiv_app_sharing);
+    strip_manual_mounts(ramdisk_edits);
+    apply_ramdisk_edits(ramdisk_edits);
 
     // Data modifications
     create_layout_version();
@@ -1309,6 +1219,8 @@ int init_main(int argc, char *argv[])
     run_adb();
 #endif
 
+    write_trace("init");
+
     // Unmount partitions
     selinux_unmount();
     umount("/dev/pts");
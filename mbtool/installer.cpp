@@ -46,6 +46,7 @@
 
 // libmblog
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 
 // libmbdevice
 #include "mbdevice/json.h"
@@ -405,15 +406,17 @@ bool Installer::destroy_chroot() const
     std::string dev_block_path(in_chroot("/dev/block"));
     autoclose::dir dp = autoclose::opendir(dev_block_path.c_str());
     if (dp) {
-        std::string path;
+        std::vector<std::string> paths;
         struct dirent *ent;
         while ((ent = readdir(dp.get()))) {
-            path = dev_block_path;
+            std::string path(dev_block_path);
             path += '/';
             path += ent->d_name;
-            util::loopdev_remove_device(path.c_str());
+            paths.push_back(std::move(path));
         }
         dp.reset();
+
+        util::loopdev_remove_devices(paths);
     }
 
     log_umount(in_chroot("/system").c_str());
@@ -1252,6 +1255,8 @@ void Installer::on_cleanup(Installer::ProceedState ret)
 
 Installer::ProceedState Installer::install_stage_initialize()
 {
+    MB_TRACE_SCOPE("install_stage_initialize");
+
     LOGD("Installer version: %s (%s)", mb::version(), mb::git_version());
 
     LOGD("[Installer] Initialization stage");
@@ -1286,6 +1291,8 @@ Installer::ProceedState Installer::install_stage_initialize()
 
 Installer::ProceedState Installer::install_stage_create_chroot()
 {
+    MB_TRACE_SCOPE("install_stage_create_chroot");
+
     LOGD("[Installer] Chroot creation stage");
 
     display_msg("Creating chroot environment");
@@ -1302,6 +1309,8 @@ Installer::ProceedState Installer::install_stage_create_chroot()
 
 Installer::ProceedState Installer::install_stage_set_up_environment()
 {
+    MB_TRACE_SCOPE("install_stage_set_up_environment");
+
     LOGD("[Installer] Environment set up stage");
 
     if (!log_delete_recursive(_temp)) {
@@ -1327,6 +1336,8 @@ Installer::ProceedState Installer::install_stage_set_up_environment()
 
 Installer::ProceedState Installer::install_stage_check_device()
 {
+    MB_TRACE_SCOPE("install_stage_check_device");
+
     LOGD("[Installer] Device verification stage");
 
     std::vector<unsigned char> contents;
@@ -1480,6 +1491,8 @@ Installer::ProceedState Installer::install_stage_check_device()
 
 Installer::ProceedState Installer::install_stage_get_install_type()
 {
+    MB_TRACE_SCOPE("install_stage_get_install_type");
+
     LOGD("[Installer] Retrieve install type stage");
 
     std::string install_type = get_install_type();
@@ -1532,6 +1545,8 @@ Installer::ProceedState Installer::install_stage_get_install_type()
 
 Installer::ProceedState Installer::install_stage_set_up_chroot()
 {
+    MB_TRACE_SCOPE("install_stage_set_up_chroot");
+
     LOGD("[Installer] Chroot set up stage");
 
     // Calculate SHA512 hash of the boot partition
@@ -1590,6 +1605,8 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
 
 Installer::ProceedState Installer::install_stage_mount_filesystems()
 {
+    MB_TRACE_SCOPE("install_stage_mount_filesystems");
+
     LOGD("[Installer] Filesystem mounting stage");
 
     if (_flags & InstallerFlags::INSTALLER_SKIP_MOUNTING_VOLUMES) {
@@ -1696,6 +1713,8 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 
 Installer::ProceedState Installer::install_stage_installation()
 {
+    MB_TRACE_SCOPE("install_stage_installation");
+
     LOGD("[Installer] Installation stage");
 
     ProceedState hook_ret = on_pre_install();
@@ -1770,6 +1789,8 @@ Installer::ProceedState Installer::install_stage_installation()
 
 Installer::ProceedState Installer::install_stage_unmount_filesystems()
 {
+    MB_TRACE_SCOPE("install_stage_unmount_filesystems");
+
     LOGD("[Installer] Filesystem unmounting stage");
 
     // Umount filesystems from inside the chroot
@@ -1781,11 +1802,10 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     run_command_chroot(_chroot.c_str(), argv_unmount_data);
 
     // Disassociate loop devices
-    for (const std::string &loop_dev : _associated_loop_devs) {
-        if (!util::loopdev_remove_device(loop_dev)) {
-            LOGE("%s: Failed to disassociate loop device: %s",
-                 loop_dev.c_str(), strerror(errno));
-        }
+    size_t removed = util::loopdev_remove_devices(_associated_loop_devs);
+    if (removed < _associated_loop_devs.size()) {
+        LOGE("Failed to disassociate %zu loop devices: %s",
+             _associated_loop_devs.size() - removed, strerror(errno));
     }
 
     if (_rom->cache_is_image && !util::umount(in_chroot("/cache").c_str())) {
@@ -1796,6 +1816,13 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
         display_msg("Failed to unmount %s", in_chroot("/data").c_str());
     }
 
+    // Detach any loop devices that we attached, but that are no longer mounted,
+    // so the images are not in use while they are checked
+    size_t reclaimed = util::loopdev_reclaim_leaked();
+    if (reclaimed > 0) {
+        LOGW("Reclaimed %zu leaked loop devices", reclaimed);
+    }
+
     if (_rom->system_is_image) {
         // Run file system checks
         if (!fsck_ext4_image(_system_path)) {
@@ -1827,6 +1854,8 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
 
 Installer::ProceedState Installer::install_stage_finish()
 {
+    MB_TRACE_SCOPE("install_stage_finish");
+
     LOGD("[Installer] Finalization stage");
 
     // Calculate SHA512 hash of the boot partition after installation
@@ -1916,6 +1945,8 @@ Installer::ProceedState Installer::install_stage_finish()
 
 void Installer::install_stage_cleanup(Installer::ProceedState ret)
 {
+    MB_TRACE_SCOPE("install_stage_cleanup");
+
     LOGD("[Installer] Cleanup stage");
 
     if (ret == ProceedState::Fail) {
@@ -1955,6 +1986,7 @@ bool Installer::start_installation()
 
     auto when_finished = util::finally([&] {
         install_stage_cleanup(ret);
+        write_trace("installer");
     });
 
 
@@ -45,6 +45,7 @@
 
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/process.h"
 #include "mbutil/string.h"
 
@@ -189,6 +190,10 @@ int main(int argc, char *argv[])
 
     umask(0);
 
+#if MB_TRACE_ENABLED
+    mb::log::trace_set_enabled(true);
+#endif
+
     if (!setlocale(LC_ALL, "C")) {
         fprintf(stderr, "Failed to set default locale\n");
     }
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata_cache.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+#include "mbutil/autoclose/file.h"
+#include "mbutil/directory.h"
+#include "mbutil/finally.h"
+#include "mbutil/integer.h"
+#include "mbutil/properties.h"
+#include "mbutil/string.h"
+
+#include "roms.h"
+
+#define METADATA_CACHE_PATH     "/data/multiboot/_metadata_cache"
+#define METADATA_CACHE_HEADER   "mbtool metadata cache 1"
+
+#define KEY_BUILD_INFO          "build_info:"
+#define KEY_PACKAGE_COUNTS      "package_counts:"
+
+#define PROP_VERSION            "ro.build.version.release"
+#define PROP_BUILD              "ro.build.display.id"
+
+namespace mb
+{
+
+MetadataCache::MetadataCache()
+    : _path(get_raw_path(METADATA_CACHE_PATH))
+    , _dirty(false)
+{
+}
+
+/*!
+ * \brief Load the cache file
+ *
+ * A missing or unreadable cache is not an error. The cache just starts out
+ * empty.
+ *
+ * \return Whether the cache file was loaded
+ */
+bool MetadataCache::load()
+{
+    _entries.clear();
+    _dirty = false;
+
+    autoclose::file fp(autoclose::fopen(_path.c_str(), "rbe"));
+    if (!fp) {
+        if (errno != ENOENT) {
+            LOGW("%s: Failed to open cache: %s", _path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+    bool first = true;
+
+    auto free_line = util::finally([&]{
+        free(line);
+    });
+
+    while ((read = getline(&line, &len, fp.get())) >= 0) {
+        if (read > 0 && line[read - 1] == '\n') {
+            line[--read] = '\0';
+        }
+
+        if (first) {
+            first = false;
+            if (strcmp(line, METADATA_CACHE_HEADER) != 0) {
+                LOGW("%s: Ignoring cache with unknown format", _path.c_str());
+                return false;
+            }
+            continue;
+        }
+
+        auto fields = util::split(line, "\t");
+        if (fields.size() < 5) {
+            continue;
+        }
+
+        Entry entry;
+        uint64_t ino;
+        uint64_t size;
+
+        if (!util::str_to_unum(fields[1].c_str(), 10, &ino)
+                || !util::str_to_unum(fields[2].c_str(), 10, &size)
+                || !util::str_to_snum(fields[3].c_str(), 10, &entry.mtime_sec)
+                || !util::str_to_snum(fields[4].c_str(), 10, &entry.mtime_nsec)) {
+            continue;
+        }
+
+        entry.ino = static_cast<ino_t>(ino);
+        entry.size = static_cast<off_t>(size);
+        entry.values.assign(fields.begin() + 5, fields.end());
+
+        _entries[std::move(fields[0])] = std::move(entry);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the cache file if any entries changed
+ *
+ * Entries for files that no longer exist are dropped.
+ *
+ * \return Whether the cache file was written (or did not need to be)
+ */
+bool MetadataCache::save()
+{
+    if (!_dirty) {
+        return true;
+    }
+
+    if (!util::mkdir_parent(_path, 0700) && errno != EEXIST) {
+        LOGW("%s: Failed to create parent directory: %s",
+             _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Each connection to the daemon is handled in a forked process, so
+    // multiple processes may be saving the cache at the same time. Every one
+    // of them needs its own temporary file so that only complete files are
+    // renamed into place.
+    std::string tmp_path(_path);
+    tmp_path += ".XXXXXX";
+
+    int tmp_fd = mkstemp(&tmp_path[0]);
+    if (tmp_fd < 0) {
+        LOGW("%s: Failed to create temporary file: %s",
+             _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    autoclose::file fp(fdopen(tmp_fd, "wb"), fclose);
+    if (!fp) {
+        LOGW("%s: Failed to open for writing: %s",
+             tmp_path.c_str(), strerror(errno));
+        close(tmp_fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    fputs(METADATA_CACHE_HEADER "\n", fp.get());
+
+    for (auto const &pair : _entries) {
+        const char *path = strchr(pair.first.c_str(), ':');
+        struct stat sb;
+
+        if (!path || stat(path + 1, &sb) < 0) {
+            continue;
+        }
+
+        auto const &entry = pair.second;
+        fprintf(fp.get(), "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRId64 "\t%" PRId64,
+                pair.first.c_str(), static_cast<uint64_t>(entry.ino),
+                static_cast<uint64_t>(entry.size), entry.mtime_sec,
+                entry.mtime_nsec);
+        for (auto const &value : entry.values) {
+            fputc('\t', fp.get());
+            fputs(value.c_str(), fp.get());
+        }
+        fputc('\n', fp.get());
+    }
+
+    if (ferror(fp.get()) || fflush(fp.get()) != 0
+            || fsync(fileno(fp.get())) < 0 || fclose(fp.release()) != 0) {
+        LOGW("%s: Failed to write cache: %s", tmp_path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (rename(tmp_path.c_str(), _path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s",
+             tmp_path.c_str(), _path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    _dirty = false;
+    return true;
+}
+
+bool MetadataCache::lookup(const std::string &key, const struct stat &sb,
+                           size_t n_values,
+                           std::vector<std::string> &values_out)
+{
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+        return false;
+    }
+
+    auto const &entry = it->second;
+    if (entry.ino != sb.st_ino
+            || entry.size != sb.st_size
+            || entry.mtime_sec != static_cast<int64_t>(sb.st_mtim.tv_sec)
+            || entry.mtime_nsec != static_cast<int64_t>(sb.st_mtim.tv_nsec)
+            || entry.values.size() != n_values) {
+        return false;
+    }
+
+    values_out = entry.values;
+    return true;
+}
+
+void MetadataCache::store(const std::string &key, const struct stat &sb,
+                          std::vector<std::string> values)
+{
+    // The file format can't represent these
+    for (auto const &value : values) {
+        if (value.find_first_of("\t\n") != std::string::npos) {
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.ino = sb.st_ino;
+    entry.size = sb.st_size;
+    entry.mtime_sec = sb.st_mtim.tv_sec;
+    entry.mtime_nsec = sb.st_mtim.tv_nsec;
+    entry.values = std::move(values);
+
+    _entries[key] = std::move(entry);
+    _dirty = true;
+}
+
+/*!
+ * \brief Get the Android version and build ID from a ROM's build.prop
+ *
+ * \param build_prop Path to build.prop
+ * \param info Output build info. Missing properties are left empty.
+ *
+ * \return Whether the build info was read from the cache or from the file
+ */
+bool MetadataCache::get_build_info(const std::string &build_prop,
+                                   RomBuildInfo &info)
+{
+    struct stat sb;
+    if (stat(build_prop.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    std::string key(KEY_BUILD_INFO);
+    key += build_prop;
+
+    std::vector<std::string> values;
+    if (lookup(key, sb, 2, values)) {
+        info.version = std::move(values[0]);
+        info.build = std::move(values[1]);
+        return true;
+    }
+
+    std::unordered_map<std::string, std::string> props;
+    if (!util::property_file_get_keys(
+            build_prop, { PROP_VERSION, PROP_BUILD }, props)) {
+        return false;
+    }
+
+    info.version = props[PROP_VERSION];
+    info.build = props[PROP_BUILD];
+
+    store(key, sb, { info.version, info.build });
+    return true;
+}
+
+/*!
+ * \brief Get the number of system, updated system, and other packages
+ *
+ * \param packages_xml Path to packages.xml
+ * \param counts Output package counts
+ *
+ * \return Whether the counts were read from the cache or from the file
+ */
+bool MetadataCache::get_package_counts(const std::string &packages_xml,
+                                       PackageCounts &counts)
+{
+    struct stat sb;
+    if (stat(packages_xml.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", packages_xml.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string key(KEY_PACKAGE_COUNTS);
+    key += packages_xml;
+
+    std::vector<std::string> values;
+    if (lookup(key, sb, 3, values)
+            && util::str_to_unum(values[0].c_str(), 10, &counts.system_pkgs)
+            && util::str_to_unum(values[1].c_str(), 10, &counts.update_pkgs)
+            && util::str_to_unum(values[2].c_str(), 10, &counts.other_pkgs)) {
+        return true;
+    }
+
+    if (!count_packages_xml(packages_xml, counts)) {
+        return false;
+    }
+
+    store(key, sb, {
+        std::to_string(counts.system_pkgs),
+        std::to_string(counts.update_pkgs),
+        std::to_string(counts.other_pkgs),
+    });
+    return true;
+}
+
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "packages.h"
+
+namespace mb
+{
+
+struct RomBuildInfo
+{
+    std::string version;
+    std::string build;
+};
+
+/*!
+ * On-disk cache of data that the daemon extracts from a ROM's files
+ *
+ * Every daemon connection is a separate process, so the cache is persisted to
+ * a file. Entries are keyed by path and are invalidated when the file's inode,
+ * size, or mtime changes.
+ */
+class MetadataCache
+{
+public:
+    MetadataCache();
+
+    bool load();
+    bool save();
+
+    bool get_build_info(const std::string &build_prop, RomBuildInfo &info);
+    bool get_package_counts(const std::string &packages_xml,
+                            PackageCounts &counts);
+
+private:
+    struct Entry
+    {
+        ino_t ino;
+        off_t size;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        std::vector<std::string> values;
+    };
+
+    bool lookup(const std::string &key, const struct stat &sb,
+                size_t n_values, std::vector<std::string> &values_out);
+    void store(const std::string &key, const struct stat &sb,
+               std::vector<std::string> values);
+
+    std::string _path;
+    std::unordered_map<std::string, Entry> _entries;
+    bool _dirty;
+};
+
+}
@@ -40,6 +40,7 @@
 #include "mbcommon/string.h"
 #include "mbdevice/device.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/autoclose/file.h"
 #include "mbutil/blkid.h"
 #include "mbutil/command.h"
@@ -54,6 +55,7 @@
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "mount_scheduler.h"
 #include "multiboot.h"
 #include "reboot.h"
 #include "roms.h"
@@ -383,8 +385,10 @@ static bool mount_ext4(const char *source, const char *target)
 static bool try_extsd_mount(const char *block_dev, const char *mount_point)
 {
     // Vold ignores the fstab fstype field and uses blkid to determine the
-    // filesystem. We don't link in blkid, so we'll use a trial and error
-    // approach.
+    // filesystem. We do the same with our own minimal blkid implementation and
+    // only attempt the mount that matches the detected type. Probe results are
+    // cached, so retrying the same devices while waiting for the SD card does
+    // not reread them.
 
     bool use_fuse_exfat =
             util::file_find_one_of("/init.orig", { "EXFAT   ", "exfat" });
@@ -573,30 +577,32 @@ static bool mount_target(const char *source, const char *target, bool bind)
 }
 
 /*!
- * \brief Mount all system image files to /raw/images/[ROM ID]
+ * \brief Add tasks for mounting all system image files to /raw/images/[ROM ID]
  */
-static bool mount_all_system_images()
+static void add_system_image_tasks(MountScheduler &scheduler)
 {
     Roms roms;
     roms.add_installed();
 
-    bool failed = false;
-
     for (const std::shared_ptr<Rom> &rom : roms.roms) {
         if (rom->system_is_image) {
             std::string mount_point(IMAGES_MOUNT_POINT);
             mount_point += "/";
             mount_point += rom->id;
             std::string system_path(rom->full_system_path());
-
-            if (!mount_target(system_path.c_str(), mount_point.c_str(), false)) {
-                LOGW("Failed to mount image for %s", rom->id.c_str());
-                failed = true;
-            }
+            std::string id(rom->id);
+
+            scheduler.add(mount_point, system_path,
+                          [mount_point, system_path, id] {
+                if (!mount_target(system_path.c_str(), mount_point.c_str(),
+                                  false)) {
+                    LOGW("Failed to mount image for %s", id.c_str());
+                    return false;
+                }
+                return true;
+            });
         }
     }
-
-    return !failed;
 }
 
 static bool disable_fsck(const char *fsck_binary)
@@ -872,38 +878,6 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         return false;
     }
 
-    bool ret = true;
-
-    // Mount system
-    if (ret && !recs.system.empty()) {
-        if (create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755)) {
-            successful.push_back(SYSTEM_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " SYSTEM_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount cache
-    if (ret && !recs.cache.empty()) {
-        if (create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755)) {
-            successful.push_back(CACHE_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " CACHE_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount data
-    if (ret && !recs.data.empty()) {
-        if (create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755)) {
-            successful.push_back(DATA_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " DATA_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
     // Mount external SD only if ROM is installed on the external SD. This is
     // necessary because mount_extsd_fstab_entries() blocks until an SD card is
     // found or a timeout occurs.
@@ -914,12 +888,44 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         LOGV("Skipping extsd mount because ROM is not an extsd-slot");
     }
 
-    if (ret && !recs.extsd.empty() && require_extsd) {
-        if (mount_extsd_fstab_entries(recs.extsd, EXTSD_MOUNT_POINT, 0755)) {
-            successful.push_back(EXTSD_MOUNT_POINT);
+    // The partitions do not depend on each other, so they are mounted
+    // concurrently. This keeps a slow device (eg. an SD card that takes a
+    // while to show up) from delaying the others.
+    MountScheduler scheduler("mount_fstab");
+    std::vector<std::pair<size_t, const char *>> tasks;
+
+    if (!recs.system.empty()) {
+        tasks.emplace_back(scheduler.add(SYSTEM_MOUNT_POINT, "", [&] {
+            return create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755);
+        }), SYSTEM_MOUNT_POINT);
+    }
+
+    if (!recs.cache.empty()) {
+        tasks.emplace_back(scheduler.add(CACHE_MOUNT_POINT, "", [&] {
+            return create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755);
+        }), CACHE_MOUNT_POINT);
+    }
+
+    if (!recs.data.empty()) {
+        tasks.emplace_back(scheduler.add(DATA_MOUNT_POINT, "", [&] {
+            return create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755);
+        }), DATA_MOUNT_POINT);
+    }
+
+    if (!recs.extsd.empty() && require_extsd) {
+        tasks.emplace_back(scheduler.add(EXTSD_MOUNT_POINT, "", [&] {
+            return mount_extsd_fstab_entries(
+                    recs.extsd, EXTSD_MOUNT_POINT, 0755);
+        }), EXTSD_MOUNT_POINT);
+    }
+
+    bool ret = scheduler.run();
+
+    for (auto const &task : tasks) {
+        if (scheduler.succeeded(task.first)) {
+            successful.push_back(task.second);
         } else {
-            LOGE("Failed to mount " EXTSD_MOUNT_POINT);
-            ret = false;
+            LOGE("Failed to mount %s", task.second);
         }
     }
 
@@ -951,6 +957,8 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
 
 bool mount_rom(const std::shared_ptr<Rom> &rom)
 {
+    MB_TRACE_SCOPE("mount_rom");
+
     std::string target_system = rom->full_system_path();
     std::string target_cache = rom->full_cache_path();
     std::string target_data = rom->full_data_path();
@@ -963,28 +971,43 @@ bool mount_rom(const std::shared_ptr<Rom> &rom)
         return false;
     }
 
-    if (!mount_target(target_system.c_str(), "/system", !rom->system_is_image)) {
-        return false;
-    }
-
-    if (!mount_target(target_cache.c_str(), "/cache", !rom->cache_is_image)) {
-        return false;
-    }
+    // The sources are all located in the /raw mount points, so only the
+    // internal SD bind mount has to wait for another task (/data)
+    MountScheduler scheduler("mount_rom");
 
-    if (!mount_target(target_data.c_str(), "/data", !rom->data_is_image)) {
-        return false;
-    }
+    size_t system_task = scheduler.add("/system", target_system, [&] {
+        return mount_target(target_system.c_str(), "/system",
+                            !rom->system_is_image);
+    });
+    size_t cache_task = scheduler.add("/cache", target_cache, [&] {
+        return mount_target(target_cache.c_str(), "/cache",
+                            !rom->cache_is_image);
+    });
+    size_t data_task = scheduler.add("/data", target_data, [&] {
+        return mount_target(target_data.c_str(), "/data",
+                            !rom->data_is_image);
+    });
 
     // Bind mount internal SD directory
-    util::mkdir_recursive("/raw/data/media", 0771);
-    util::mkdir_recursive("/data/media", 0771);
+    size_t media_task = scheduler.add("/data/media", "/raw/data/media", [] {
+        util::mkdir_recursive("/raw/data/media", 0771);
+        util::mkdir_recursive("/data/media", 0771);
+
+        return util::mount("/raw/data/media", "/data/media", "", MS_BIND, "");
+    });
+
+    // Failing to mount other ROMs' images is not fatal
+    add_system_image_tasks(scheduler);
 
-    if (!util::mount("/raw/data/media", "/data/media", "", MS_BIND, "")) {
+    scheduler.run();
+
+    if (!scheduler.succeeded(system_task)
+            || !scheduler.succeeded(cache_task)
+            || !scheduler.succeeded(data_task)
+            || !scheduler.succeeded(media_task)) {
         return false;
     }
 
-    mount_all_system_images();
-
     bool require_extsd = rom->system_source == Rom::Source::EXTERNAL_SD
             || rom->cache_source == Rom::Source::EXTERNAL_SD
             || rom->data_source == Rom::Source::EXTERNAL_SD;
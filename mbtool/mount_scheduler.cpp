@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mount_scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <cinttypes>
+
+#include "mblog/logging.h"
+#include "mblog/trace.h"
+#include "mbutil/time.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Check if \a path is \a dir or is located under \a dir
+ */
+static bool path_is_under(const std::string &path, const std::string &dir)
+{
+    if (dir.empty() || path.compare(0, dir.size(), dir) != 0) {
+        return false;
+    }
+
+    return path.size() == dir.size() || dir.back() == '/'
+            || path[dir.size()] == '/';
+}
+
+MountScheduler::MountScheduler(std::string name, unsigned int max_threads)
+    : _name(std::move(name))
+    , _max_threads(std::max(max_threads, 1u))
+{
+}
+
+/*!
+ * \brief Add a mount task
+ *
+ * \param mount_point Mount point of the task
+ * \param source Source path of the task or an empty string if the source is
+ *               not located in another task's mount point
+ * \param fn Function that performs the mount and returns whether it succeeded
+ *
+ * \return Index of the task
+ */
+size_t MountScheduler::add(std::string mount_point, std::string source,
+                           TaskFn fn)
+{
+    Task task;
+    task.mount_point = std::move(mount_point);
+    task.source = std::move(source);
+    task.fn = std::move(fn);
+    task.state = State::PENDING;
+    task.duration_ms = 0;
+
+    for (size_t i = 0; i < _tasks.size(); ++i) {
+        const std::string &dir = _tasks[i].mount_point;
+
+        if (path_is_under(task.mount_point, dir)
+                || path_is_under(task.source, dir)) {
+            LOGV("[%s] %s depends on %s", _name.c_str(),
+                 task.mount_point.c_str(), dir.c_str());
+            task.deps.push_back(i);
+        }
+    }
+
+    _tasks.push_back(std::move(task));
+    return _tasks.size() - 1;
+}
+
+/*!
+ * \brief Run all tasks and wait for them to complete
+ *
+ * \return Whether all tasks succeeded
+ */
+bool MountScheduler::run()
+{
+    uint64_t start = util::current_time_ms();
+
+    unsigned int n_threads = std::min<size_t>(_max_threads, _tasks.size());
+    std::vector<std::thread> threads;
+
+    // The calling thread acts as one of the workers
+    for (unsigned int i = 1; i < n_threads; ++i) {
+        threads.emplace_back(&MountScheduler::worker, this);
+    }
+
+    worker();
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    uint64_t total_ms = 0;
+    bool ret = true;
+
+    for (const Task &task : _tasks) {
+        total_ms += task.duration_ms;
+        if (task.state != State::SUCCEEDED) {
+            ret = false;
+        }
+    }
+
+    LOGI("[%s] Completed %zu tasks in %" PRIu64 "ms"
+         " (%" PRIu64 "ms if run sequentially)",
+         _name.c_str(), _tasks.size(), util::current_time_ms() - start,
+         total_ms);
+
+    return ret;
+}
+
+/*!
+ * \brief Check if a task succeeded
+ *
+ * \note This is only meaningful after run() returns
+ */
+bool MountScheduler::succeeded(size_t task) const
+{
+    return _tasks[task].state == State::SUCCEEDED;
+}
+
+void MountScheduler::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        Task *ready = nullptr;
+        bool waiting = false;
+
+        for (Task &task : _tasks) {
+            if (task.state != State::PENDING) {
+                continue;
+            }
+
+            bool blocked = false;
+            bool dep_failed = false;
+
+            for (size_t dep : task.deps) {
+                switch (_tasks[dep].state) {
+                case State::SUCCEEDED:
+                    break;
+                case State::FAILED:
+                case State::SKIPPED:
+                    dep_failed = true;
+                    break;
+                default:
+                    blocked = true;
+                    break;
+                }
+            }
+
+            if (dep_failed) {
+                LOGW("[%s] %s: Skipped because a dependency failed",
+                     _name.c_str(), task.mount_point.c_str());
+                task.state = State::SKIPPED;
+            } else if (blocked) {
+                waiting = true;
+            } else {
+                ready = &task;
+                break;
+            }
+        }
+
+        if (!ready) {
+            if (!waiting) {
+                break;
+            }
+
+            _cond.wait(lock);
+            continue;
+        }
+
+        ready->state = State::RUNNING;
+        lock.unlock();
+
+        bool ret;
+        uint64_t start = util::current_time_ms();
+        {
+            MB_TRACE_SCOPE("mount_task");
+            ret = ready->fn();
+        }
+        uint64_t duration = util::current_time_ms() - start;
+
+        lock.lock();
+
+        LOGD("[%s] %s: %s in %" PRIu64 "ms", _name.c_str(),
+             ready->mount_point.c_str(), ret ? "Succeeded" : "Failed",
+             duration);
+
+        ready->state = ret ? State::SUCCEEDED : State::FAILED;
+        ready->duration_ms = duration;
+
+        _cond.notify_all();
+    }
+
+    // Wake up other workers so they can exit if nothing is left to do
+    _cond.notify_all();
+}
+
+}
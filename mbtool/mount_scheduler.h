@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+/*!
+ * Runs a set of mount operations concurrently
+ *
+ * A task depends on every previously added task whose mount point contains
+ * the task's mount point or source path. Independent tasks run in parallel on
+ * a small thread pool and tasks whose dependencies failed are skipped.
+ */
+class MountScheduler
+{
+public:
+    typedef std::function<bool()> TaskFn;
+
+    explicit MountScheduler(std::string name, unsigned int max_threads = 4);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MountScheduler)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MountScheduler)
+
+    size_t add(std::string mount_point, std::string source, TaskFn fn);
+
+    bool run();
+
+    bool succeeded(size_t task) const;
+
+private:
+    enum class State
+    {
+        PENDING,
+        RUNNING,
+        SUCCEEDED,
+        FAILED,
+        SKIPPED,
+    };
+
+    struct Task
+    {
+        std::string mount_point;
+        std::string source;
+        TaskFn fn;
+        std::vector<size_t> deps;
+        State state;
+        uint64_t duration_ms;
+    };
+
+    void worker();
+
+    std::string _name;
+    unsigned int _max_threads;
+    std::vector<Task> _tasks;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+};
+
+}
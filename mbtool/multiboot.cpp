@@ -22,17 +22,22 @@
 #include <cerrno>
 #include <cstring>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/chmod.h"
 #include "mbutil/chown.h"
 #include "mbutil/copy.h"
+#include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "roms.h"
+
 
 namespace mb
 {
@@ -223,4 +228,35 @@ bool switch_context(const std::string &context)
     return true;
 }
 
+/*!
+ * \brief Write recorded trace spans to MULTIBOOT_TRACE_DIR
+ *
+ * This does nothing unless mbtool was built with MBP_ENABLE_TRACING. The file
+ * is named \<name\>-\<pid\>.json so that traces from multiple processes can
+ * be loaded together.
+ *
+ * \param name Prefix for the trace file name
+ */
+void write_trace(const char *name)
+{
+#if MB_TRACE_ENABLED
+    std::string dir = get_raw_path(MULTIBOOT_TRACE_DIR);
+    if (!util::mkdir_recursive(dir, 0775) && errno != EEXIST) {
+        LOGW("%s: Failed to create directory: %s",
+             dir.c_str(), strerror(errno));
+        return;
+    }
+
+    std::string path = mb::format("%s/%s-%d.json", dir.c_str(), name, getpid());
+    if (!log::trace_write_json(path.c_str())) {
+        LOGW("%s: Failed to write trace: %s", path.c_str(), strerror(errno));
+        return;
+    }
+
+    log::trace_clear();
+#else
+    (void) name;
+#endif
+}
+
 }
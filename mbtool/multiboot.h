@@ -27,6 +27,7 @@
 #define MULTIBOOT_LOG_INSTALLER         INTERNAL_STORAGE "/MultiBoot.log"
 #define MULTIBOOT_LOG_APPSYNC           MULTIBOOT_DIR "/appsync.log"
 #define MULTIBOOT_LOG_DAEMON            MULTIBOOT_DIR "/daemon.log"
+#define MULTIBOOT_TRACE_DIR             MULTIBOOT_DIR "/traces"
 
 #define ABOOT_PARTITION                 "/dev/block/platform/msm_sdcc.1/by-name/aboot"
 
@@ -79,4 +80,6 @@ bool fix_multiboot_permissions();
 
 bool switch_context(const std::string &context);
 
+void write_trace(const char *name);
+
 }
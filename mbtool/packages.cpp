@@ -19,17 +19,16 @@
 
 #include "packages.h"
 
-#include <algorithm>
+#include <unordered_set>
 
-#include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 
-#include <pugixml.hpp>
-
 #include "mblog/logging.h"
 
+#include "xml_reader.h"
 
 namespace mb
 {
@@ -89,23 +88,135 @@ static const char *ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA
 static const char *ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR
                                              = "secondaryNativeLibraryDir";
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs);
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs);
+static const size_t STRING_POOL_CHUNK_SIZE = 16384;
+
+/*!
+ * Arena of interned, NULL-terminated strings
+ *
+ * Strings are bump-allocated from fixed-size chunks and are never freed
+ * individually. Interning the same string twice returns the same pointer,
+ * which deduplicates the many repeated values (ABIs, installers, signature
+ * indexes, etc.) in packages.xml.
+ */
+class StringPool
+{
+public:
+    StringPool();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StringPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StringPool)
+
+    const char * intern(const std::string &str);
+
+private:
+    struct Hash
+    {
+        size_t operator()(const char *str) const;
+    };
+
+    struct Equal
+    {
+        bool operator()(const char *a, const char *b) const;
+    };
+
+    char * allocate(size_t size);
+
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    char *_cur;
+    size_t _remaining;
+    std::unordered_set<const char *, Hash, Equal> _strings;
+};
+
+// FNV-1a
+static size_t hash_cstring(const char *str)
+{
+    uint32_t hash = 2166136261u;
+    for (; *str; ++str) {
+        hash ^= static_cast<unsigned char>(*str);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+size_t StringPool::Hash::operator()(const char *str) const
+{
+    return hash_cstring(str);
+}
+
+bool StringPool::Equal::operator()(const char *a, const char *b) const
+{
+    return strcmp(a, b) == 0;
+}
+
+StringPool::StringPool()
+    : _cur(nullptr)
+    , _remaining(0)
+{
+}
+
+char * StringPool::allocate(size_t size)
+{
+    if (size > STRING_POOL_CHUNK_SIZE / 4) {
+        // Give large strings their own allocation so that they don't waste
+        // the rest of the current chunk
+        _chunks.emplace_back(new char[size]);
+        return _chunks.back().get();
+    }
+
+    if (size > _remaining) {
+        _chunks.emplace_back(new char[STRING_POOL_CHUNK_SIZE]);
+        _cur = _chunks.back().get();
+        _remaining = STRING_POOL_CHUNK_SIZE;
+    }
+
+    char *ptr = _cur;
+    _cur += size;
+    _remaining -= size;
+    return ptr;
+}
+
+const char * StringPool::intern(const std::string &str)
+{
+    if (str.empty()) {
+        return "";
+    }
+
+    auto it = _strings.find(str.c_str());
+    if (it != _strings.end()) {
+        return *it;
+    }
+
+    char *ptr = allocate(str.size() + 1);
+    memcpy(ptr, str.c_str(), str.size() + 1);
+    _strings.insert(ptr);
+    return ptr;
+}
+
+struct ParseContext
+{
+    XmlReader reader;
+    Packages *pkgs;
+    StringPool *strings;
+    // Scratch buffer for decoding attribute values
+    std::string buf;
+};
+
+static bool parse_tag_cert(ParseContext &ctx, Package &pkg);
+static bool parse_tag_sigs(ParseContext &ctx, Package &pkg);
+static bool parse_tag_package(ParseContext &ctx);
+static bool parse_tag_packages(ParseContext &ctx);
+static bool skip_element(ParseContext &ctx);
 
 
 Package::Package() :
-        name(),
-        real_name(),
-        code_path(),
-        resource_path(),
-        native_library_path(),
-        primary_cpu_abi(),
-        secondary_cpu_abi(),
-        cpu_abi_override(),
+        name(""),
+        real_name(""),
+        code_path(""),
+        resource_path(""),
+        native_library_path(""),
+        primary_cpu_abi(""),
+        secondary_cpu_abi(""),
+        cpu_abi_override(""),
         pkg_flags(static_cast<Flags>(0)),
         pkg_public_flags(static_cast<PublicFlags>(0)),
         pkg_private_flags(static_cast<PrivateFlags>(0)),
@@ -116,13 +227,13 @@ Package::Package() :
         is_shared_user(0),
         user_id(0),
         shared_user_id(0),
-        uid_error(),
-        install_status(),
-        installer()
+        uid_error(""),
+        install_status(""),
+        installer("")
 {
 }
 
-uid_t Package::get_uid()
+uid_t Package::get_uid() const
 {
     return is_shared_user ? shared_user_id : user_id;
 }
@@ -140,7 +251,7 @@ static char * time_to_string(uint64_t time)
 #define DUMP_FLAG(flag) LOGD(fmt_flag, "", #flag, \
                              static_cast<uint64_t>(Package::flag))
 
-void Package::dump()
+void Package::dump() const
 {
     static const char *fmt_string = "- %-22s %s";
     static const char *fmt_int    = "- %-22s %d";
@@ -148,22 +259,22 @@ void Package::dump()
     static const char *fmt_flag   = "- %-22s %s (0x%x)";
 
     LOGD("Package:");
-    if (!name.empty())
-        LOGD(fmt_string, "Name:", name.c_str());
-    if (!real_name.empty())
-        LOGD(fmt_string, "Real name:", real_name.c_str());
-    if (!code_path.empty())
-        LOGD(fmt_string, "Code path:", code_path.c_str());
-    if (!resource_path.empty())
-        LOGD(fmt_string, "Resource path:", resource_path.c_str());
-    if (!native_library_path.empty())
-        LOGD(fmt_string, "Native library path:", native_library_path.c_str());
-    if (!primary_cpu_abi.empty())
-        LOGD(fmt_string, "Primary CPU ABI:", primary_cpu_abi.c_str());
-    if (!secondary_cpu_abi.empty())
-        LOGD(fmt_string, "Secondary CPU ABI:", secondary_cpu_abi.c_str());
-    if (!cpu_abi_override.empty())
-        LOGD(fmt_string, "CPU ABI override:", cpu_abi_override.c_str());
+    if (*name)
+        LOGD(fmt_string, "Name:", name);
+    if (*real_name)
+        LOGD(fmt_string, "Real name:", real_name);
+    if (*code_path)
+        LOGD(fmt_string, "Code path:", code_path);
+    if (*resource_path)
+        LOGD(fmt_string, "Resource path:", resource_path);
+    if (*native_library_path)
+        LOGD(fmt_string, "Native library path:", native_library_path);
+    if (*primary_cpu_abi)
+        LOGD(fmt_string, "Primary CPU ABI:", primary_cpu_abi);
+    if (*secondary_cpu_abi)
+        LOGD(fmt_string, "Secondary CPU ABI:", secondary_cpu_abi);
+    if (*cpu_abi_override)
+        LOGD(fmt_string, "CPU ABI override:", cpu_abi_override);
 
     LOGD(fmt_hex, "Flags:", static_cast<uint64_t>(pkg_flags));
     if (pkg_flags & Package::FLAG_SYSTEM)
@@ -322,258 +433,470 @@ void Package::dump()
         LOGD(fmt_int, "User ID:", user_id);
     }
 
-    if (!uid_error.empty())
-        LOGD(fmt_string, "UID error:", uid_error.c_str());
-    if (!install_status.empty())
-        LOGD(fmt_string, "Install status:", install_status.c_str());
-    if (!installer.empty())
-        LOGD(fmt_string, "Installer:", installer.c_str());
+    if (*uid_error)
+        LOGD(fmt_string, "UID error:", uid_error);
+    if (*install_status)
+        LOGD(fmt_string, "Install status:", install_status);
+    if (*installer)
+        LOGD(fmt_string, "Installer:", installer);
 }
 
-bool Packages::load_xml(const std::string &path)
+Packages::Packages()
+    : _loaded(false)
+    , _dev(0)
+    , _ino(0)
+    , _size(0)
+    , _mtime()
+{
+}
+
+size_t Packages::CStringHash::operator()(const char *str) const
+{
+    return hash_cstring(str);
+}
+
+bool Packages::CStringEqual::operator()(const char *a, const char *b) const
+{
+    return strcmp(a, b) == 0;
+}
+
+void Packages::clear()
 {
     pkgs.clear();
     sigs.clear();
+    _strings.reset();
+    _uid_index.clear();
+    _name_index.clear();
+    _loaded = false;
+    _path.clear();
+}
+
+void Packages::build_indexes()
+{
+    _uid_index.clear();
+    _name_index.clear();
+    _uid_index.reserve(pkgs.size());
+    _name_index.reserve(pkgs.size());
 
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
-    if (!result) {
-        LOGE("Failed to parse XML file: %s: %s",
-             path.c_str(), result.description());
+    // emplace() doesn't replace existing entries, so the first match wins
+    for (size_t i = 0; i < pkgs.size(); ++i) {
+        const Package &pkg = pkgs[i];
+
+        if (!pkg.is_shared_user) {
+            _uid_index.emplace(static_cast<uid_t>(pkg.user_id), i);
+        }
+        _name_index.emplace(pkg.name, i);
+    }
+}
+
+/*!
+ * \brief Load packages from packages.xml
+ *
+ * The file is parsed in a single streaming pass. All strings are interned in
+ * an arena that is shared by copies of this instance.
+ *
+ * \param path Path to packages.xml
+ *
+ * \return Whether the file was successfully loaded. If false, the instance
+ *         will be empty.
+ */
+bool Packages::load_xml(const std::string &path)
+{
+    clear();
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
         return false;
     }
 
-    pugi::xml_node root = doc.root();
+    ParseContext ctx;
+    std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();
+    ctx.pkgs = this;
+    ctx.strings = strings.get();
 
-    for (pugi::xml_node cur_node : root.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    if (!ctx.reader.open(path)) {
+        LOGE("%s: Failed to open file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            if (!parse_tag_packages(cur_node, this)) {
-                return false;
-            }
+    XmlReader::Token token;
+
+    while ((token = ctx.reader.next()) == XmlReader::Token::StartElement) {
+        bool ret;
+
+        if (ctx.reader.name_is(TAG_PACKAGES)) {
+            ret = parse_tag_packages(ctx);
         } else {
-            LOGW("Unrecognized root tag: %s", cur_node.name());
+            LOGW("Unrecognized root tag: %s", ctx.reader.name_str().c_str());
+            ret = skip_element(ctx);
+        }
+
+        if (!ret) {
+            token = XmlReader::Token::Error;
+            break;
         }
     }
 
+    if (token != XmlReader::Token::EndDocument) {
+        if (ctx.reader.error()) {
+            LOGE("Failed to parse XML file: %s: %s",
+                 path.c_str(), ctx.reader.error());
+        }
+        clear();
+        return false;
+    }
+
+    _strings = std::move(strings);
+    build_indexes();
+
+    _loaded = true;
+    _path = path;
+    _dev = sb.st_dev;
+    _ino = sb.st_ino;
+    _size = sb.st_size;
+    _mtime = sb.st_mtim;
+
     return true;
 }
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+/*!
+ * \brief Reload packages.xml if it changed since it was last loaded
+ *
+ * Android replaces packages.xml atomically, so a change in the file's device,
+ * inode, size, or modification time means that it needs to be parsed again.
+ *
+ * \param path Path to packages.xml
+ *
+ * \return Whether the loaded packages are up to date
+ */
+bool Packages::reload_xml(const std::string &path)
 {
-    assert(strcmp(node.name(), TAG_CERT) == 0);
+    if (_loaded && path == _path) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0
+                && sb.st_dev == _dev
+                && sb.st_ino == _ino
+                && sb.st_size == _size
+                && sb.st_mtim.tv_sec == _mtime.tv_sec
+                && sb.st_mtim.tv_nsec == _mtime.tv_nsec) {
+            return true;
+        }
+    }
 
-    std::string index;
-    std::string key;
+    return load_xml(path);
+}
 
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
+/*!
+ * \brief Skip the current element and all of its children
+ */
+static bool skip_element(ParseContext &ctx)
+{
+    size_t depth = ctx.reader.depth();
+
+    while (true) {
+        switch (ctx.reader.next()) {
+        case XmlReader::Token::StartElement:
+            break;
+        case XmlReader::Token::EndElement:
+            if (ctx.reader.depth() < depth) {
+                return true;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+}
+
+static bool parse_tag_cert(ParseContext &ctx, Package &pkg)
+{
+    const char *index = "";
+    std::string key;
 
-        if (strcmp(name, ATTR_INDEX) == 0) {
-            index = value;
-        } else if (strcmp(name, ATTR_KEY) == 0) {
-            key = value;
+    for (auto const &attr : ctx.reader.attributes()) {
+        if (attr.name_is(ATTR_INDEX)) {
+            XmlReader::decode(attr.value, attr.value_size, ctx.buf);
+            index = ctx.strings->intern(ctx.buf);
+        } else if (attr.name_is(ATTR_KEY)) {
+            XmlReader::decode(attr.value, attr.value_size, key);
         } else {
-            LOGW("Unrecognized attribute '%s' in <%s>", name, TAG_CERT);
+            LOGW("Unrecognized attribute '%s' in <%s>",
+                 std::string(attr.name, attr.name_size).c_str(), TAG_CERT);
         }
     }
 
-    if (index.empty()) {
+    if (!*index) {
         LOGW("Missing or empty index in <%s>", TAG_CERT);
     } else {
-        pkg->sig_indexes.push_back(index);
+        pkg.sig_indexes.push_back(index);
     }
-    if (!index.empty() && !key.empty()) {
+    if (*index && !key.empty()) {
+        Packages *pkgs = ctx.pkgs;
         auto it = pkgs->sigs.find(index);
         if (it != pkgs->sigs.end()) {
             // Make sure key matches if it's already in the map
             if (it->second != key) {
-                LOGE("Error: Index \"%s\" assigned to multiple keys",
-                     index.c_str());
+                LOGE("Error: Index \"%s\" assigned to multiple keys", index);
                 return false;
             }
         } else {
             // Otherwise, add it to the map
-            pkgs->sigs.insert(std::make_pair(std::move(index), std::move(key)));
+            pkgs->sigs.insert(std::make_pair(index, std::move(key)));
         }
     }
 
-    return true;
+    return skip_element(ctx);
 }
 
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+static bool parse_tag_sigs(ParseContext &ctx, Package &pkg)
 {
-    assert(strcmp(node.name(), TAG_SIGS) == 0);
+    XmlReader::Token token;
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    while ((token = ctx.reader.next()) == XmlReader::Token::StartElement) {
+        bool ret = true;
 
-        if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
+        if (ctx.reader.name_is(TAG_SIGS)) {
             LOGW("Nested <%s> is not allowed", TAG_SIGS);
-        } else if (strcmp(cur_node.name(), TAG_CERT) == 0) {
-            if (!parse_tag_cert(cur_node, pkgs, pkg)) {
-                return false;
-            }
+            ret = skip_element(ctx);
+        } else if (ctx.reader.name_is(TAG_CERT)) {
+            ret = parse_tag_cert(ctx, pkg);
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_SIGS);
+            LOGW("Unrecognized <%s> within <%s>",
+                 ctx.reader.name_str().c_str(), TAG_SIGS);
+            ret = skip_element(ctx);
+        }
+
+        if (!ret) {
+            return false;
         }
     }
 
-    return true;
+    return token == XmlReader::Token::EndElement;
 }
 
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_package(ParseContext &ctx)
 {
-    assert(strcmp(node.name(), TAG_PACKAGE) == 0);
-
-    std::shared_ptr<Package> pkg(new Package());
-
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
-
-        if (strcmp(name, ATTR_CODE_PATH) == 0) {
-            pkg->code_path = value;
-        } else if (strcmp(name, ATTR_CPU_ABI_OVERRIDE) == 0) {
-            pkg->cpu_abi_override = value;
-        } else if (strcmp(name, ATTR_FLAGS) == 0) {
-            pkg->pkg_flags = static_cast<Package::Flags>(
-                    strtoll(value, nullptr, 10));
-        } else if (strcmp(name, ATTR_PUBLIC_FLAGS) == 0) {
-            pkg->pkg_public_flags = static_cast<Package::PublicFlags>(
-                    strtoll(value, nullptr, 10));
-        } else if (strcmp(name, ATTR_PRIVATE_FLAGS) == 0) {
-            pkg->pkg_private_flags = static_cast<Package::PrivateFlags>(
-                    strtoll(value, nullptr, 10));
-        } else if (strcmp(name, ATTR_FT) == 0) {
-            pkg->timestamp = strtoull(value, nullptr, 16);
-        } else if (strcmp(name, ATTR_INSTALL_STATUS) == 0) {
-            pkg->install_status = value;
-        } else if (strcmp(name, ATTR_INSTALLER) == 0) {
-            pkg->installer = value;
-        } else if (strcmp(name, ATTR_IT) == 0) {
-            pkg->first_install_time = strtoull(value, nullptr, 16);
-        } else if (strcmp(name, ATTR_NAME) == 0) {
-            pkg->name = value;
-        } else if (strcmp(name, ATTR_NATIVE_LIBRARY_PATH) == 0) {
-            pkg->native_library_path = value;
-        } else if (strcmp(name, ATTR_PRIMARY_CPU_ABI) == 0) {
-            pkg->primary_cpu_abi = value;
-        } else if (strcmp(name, ATTR_REAL_NAME) == 0) {
-            pkg->real_name = value;
-        } else if (strcmp(name, ATTR_RESOURCE_PATH) == 0) {
-            pkg->resource_path = value;
-        } else if (strcmp(name, ATTR_SECONDARY_CPU_ABI) == 0) {
-            pkg->secondary_cpu_abi = value;
-        } else if (strcmp(name, ATTR_SHARED_USER_ID) == 0) {
-            pkg->shared_user_id = strtol(value, nullptr, 10);
-            pkg->is_shared_user = 1;
-        } else if (strcmp(name, ATTR_UID_ERROR) == 0) {
-            pkg->uid_error = value;
-        } else if (strcmp(name, ATTR_USER_ID) == 0) {
-            pkg->user_id = strtol(value, nullptr, 10);
-            pkg->is_shared_user = 0;
-        } else if (strcmp(name, ATTR_UT) == 0) {
-            pkg->last_update_time = strtoull(value, nullptr, 16);
-        } else if (strcmp(name, ATTR_VERSION) == 0) {
-            pkg->version = strtol(value, nullptr, 10);
-        } else if (strcmp(name, ATTR_SAMSUNG_DM) == 0
-                || strcmp(name, ATTR_SAMSUNG_DT) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_DIR) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_DIR) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA) == 0
-                || strcmp(name, ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR) == 0) {
+    Package pkg;
+    std::string &value = ctx.buf;
+
+    for (auto const &attr : ctx.reader.attributes()) {
+        XmlReader::decode(attr.value, attr.value_size, value);
+
+        if (attr.name_is(ATTR_CODE_PATH)) {
+            pkg.code_path = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_CPU_ABI_OVERRIDE)) {
+            pkg.cpu_abi_override = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_FLAGS)) {
+            pkg.pkg_flags = static_cast<Package::Flags>(
+                    strtoll(value.c_str(), nullptr, 10));
+        } else if (attr.name_is(ATTR_PUBLIC_FLAGS)) {
+            pkg.pkg_public_flags = static_cast<Package::PublicFlags>(
+                    strtoll(value.c_str(), nullptr, 10));
+        } else if (attr.name_is(ATTR_PRIVATE_FLAGS)) {
+            pkg.pkg_private_flags = static_cast<Package::PrivateFlags>(
+                    strtoll(value.c_str(), nullptr, 10));
+        } else if (attr.name_is(ATTR_FT)) {
+            pkg.timestamp = strtoull(value.c_str(), nullptr, 16);
+        } else if (attr.name_is(ATTR_INSTALL_STATUS)) {
+            pkg.install_status = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_INSTALLER)) {
+            pkg.installer = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_IT)) {
+            pkg.first_install_time = strtoull(value.c_str(), nullptr, 16);
+        } else if (attr.name_is(ATTR_NAME)) {
+            pkg.name = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_NATIVE_LIBRARY_PATH)) {
+            pkg.native_library_path = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_PRIMARY_CPU_ABI)) {
+            pkg.primary_cpu_abi = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_REAL_NAME)) {
+            pkg.real_name = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_RESOURCE_PATH)) {
+            pkg.resource_path = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_SECONDARY_CPU_ABI)) {
+            pkg.secondary_cpu_abi = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_SHARED_USER_ID)) {
+            pkg.shared_user_id = strtol(value.c_str(), nullptr, 10);
+            pkg.is_shared_user = 1;
+        } else if (attr.name_is(ATTR_UID_ERROR)) {
+            pkg.uid_error = ctx.strings->intern(value);
+        } else if (attr.name_is(ATTR_USER_ID)) {
+            pkg.user_id = strtol(value.c_str(), nullptr, 10);
+            pkg.is_shared_user = 0;
+        } else if (attr.name_is(ATTR_UT)) {
+            pkg.last_update_time = strtoull(value.c_str(), nullptr, 16);
+        } else if (attr.name_is(ATTR_VERSION)) {
+            pkg.version = strtol(value.c_str(), nullptr, 10);
+        } else if (attr.name_is(ATTR_SAMSUNG_DM)
+                || attr.name_is(ATTR_SAMSUNG_DT)
+                || attr.name_is(ATTR_SAMSUNG_NATIVE_LIBRARY_DIR)
+                || attr.name_is(ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_DIR)
+                || attr.name_is(ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA)
+                || attr.name_is(ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR)) {
             // Ignore Samsung-specific attributes
         } else {
-            LOGW("Unrecognized attribute '%s' in <%s>", name, TAG_PACKAGE);
+            LOGW("Unrecognized attribute '%s' in <%s>",
+                 std::string(attr.name, attr.name_size).c_str(), TAG_PACKAGE);
         }
     }
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    XmlReader::Token token;
+
+    while ((token = ctx.reader.next()) == XmlReader::Token::StartElement) {
+        bool ret = true;
 
-        if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
+        if (ctx.reader.name_is(TAG_PACKAGE)) {
             LOGW("Nested <%s> is not allowed", TAG_PACKAGE);
-        } else if (strcmp(cur_node.name(), TAG_DEFINED_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_DOMAIN_VERIFICATION) == 0
-                || strcmp(cur_node.name(), TAG_PERMS) == 0
-                || strcmp(cur_node.name(), TAG_PROPER_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_UPGRADE_KEYSET) == 0) {
+            ret = skip_element(ctx);
+        } else if (ctx.reader.name_is(TAG_DEFINED_KEYSET)
+                || ctx.reader.name_is(TAG_DOMAIN_VERIFICATION)
+                || ctx.reader.name_is(TAG_PERMS)
+                || ctx.reader.name_is(TAG_PROPER_SIGNING_KEYSET)
+                || ctx.reader.name_is(TAG_SIGNING_KEYSET)
+                || ctx.reader.name_is(TAG_UPGRADE_KEYSET)) {
             // Ignore
-        } else if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
-            if (!parse_tag_sigs(cur_node, pkgs, pkg)) {
-                return false;
-            }
+            ret = skip_element(ctx);
+        } else if (ctx.reader.name_is(TAG_SIGS)) {
+            ret = parse_tag_sigs(ctx, pkg);
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_PACKAGE);
+            LOGW("Unrecognized <%s> within <%s>",
+                 ctx.reader.name_str().c_str(), TAG_PACKAGE);
+            ret = skip_element(ctx);
         }
+
+        if (!ret) {
+            return false;
+        }
+    }
+
+    if (token != XmlReader::Token::EndElement) {
+        return false;
     }
 
-    pkgs->pkgs.push_back(std::move(pkg));
+    ctx.pkgs->pkgs.push_back(std::move(pkg));
 
     return true;
 }
 
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_packages(ParseContext &ctx)
 {
-    assert(strcmp(node.name(), TAG_PACKAGES) == 0);
+    XmlReader::Token token;
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    while ((token = ctx.reader.next()) == XmlReader::Token::StartElement) {
+        bool ret = true;
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
+        if (ctx.reader.name_is(TAG_PACKAGES)) {
             LOGW("Nested <%s> is not allowed", TAG_PACKAGES);
-        } else if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
-            if (!parse_tag_package(cur_node, pkgs)) {
-                return false;
-            }
-        } else if (strcmp(cur_node.name(), TAG_DATABASE_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_KEYSET_SETTINGS) == 0
-                || strcmp(cur_node.name(), TAG_LAST_PLATFORM_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSION_TREES) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSIONS) == 0
-                || strcmp(cur_node.name(), TAG_RENAMED_PACKAGE) == 0
-                || strcmp(cur_node.name(), TAG_SHARED_USER) == 0
-                || strcmp(cur_node.name(), TAG_UPDATED_PACKAGE) == 0
-                || strcmp(cur_node.name(), TAG_VERSION) == 0) {
+            ret = skip_element(ctx);
+        } else if (ctx.reader.name_is(TAG_PACKAGE)) {
+            ret = parse_tag_package(ctx);
+        } else if (ctx.reader.name_is(TAG_DATABASE_VERSION)
+                || ctx.reader.name_is(TAG_KEYSET_SETTINGS)
+                || ctx.reader.name_is(TAG_LAST_PLATFORM_VERSION)
+                || ctx.reader.name_is(TAG_PERMISSION_TREES)
+                || ctx.reader.name_is(TAG_PERMISSIONS)
+                || ctx.reader.name_is(TAG_RENAMED_PACKAGE)
+                || ctx.reader.name_is(TAG_SHARED_USER)
+                || ctx.reader.name_is(TAG_UPDATED_PACKAGE)
+                || ctx.reader.name_is(TAG_VERSION)) {
             // Ignore
+            ret = skip_element(ctx);
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_PACKAGES);
+            LOGW("Unrecognized <%s> within <%s>",
+                 ctx.reader.name_str().c_str(), TAG_PACKAGES);
+            ret = skip_element(ctx);
+        }
+
+        if (!ret) {
+            return false;
+        }
+    }
+
+    return token == XmlReader::Token::EndElement;
+}
+
+/*!
+ * \brief Count system, updated system, and other packages in packages.xml
+ *
+ * This is equivalent to loading the file with Packages::load_xml() and
+ * checking the flags of each package, but it streams through the file and
+ * only looks at the flags attributes of top-level \<package\> elements.
+ *
+ * \param path Path to packages.xml
+ * \param counts Output package counts
+ *
+ * \return Whether the file was successfully parsed
+ */
+bool count_packages_xml(const std::string &path, PackageCounts &counts)
+{
+    counts = {};
+
+    XmlReader reader;
+    if (!reader.open(path)) {
+        LOGE("%s: Failed to open file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool in_packages = false;
+    XmlReader::Token token;
+
+    while ((token = reader.next()) != XmlReader::Token::EndDocument) {
+        if (token == XmlReader::Token::Error) {
+            LOGE("Failed to parse XML file: %s: %s",
+                 path.c_str(), reader.error());
+            return false;
+        } else if (token == XmlReader::Token::EndElement) {
+            if (reader.depth() == 0) {
+                in_packages = false;
+            }
+            continue;
+        }
+
+        if (reader.depth() == 1) {
+            in_packages = reader.name_is(TAG_PACKAGES);
+        } else if (in_packages && reader.depth() == 2
+                && reader.name_is(TAG_PACKAGE)) {
+            uint64_t flags = 0;
+            uint64_t public_flags = 0;
+
+            for (auto const &attr : reader.attributes()) {
+                if (attr.name_is(ATTR_FLAGS)) {
+                    flags = strtoll(attr.value_str().c_str(), nullptr, 10);
+                } else if (attr.name_is(ATTR_PUBLIC_FLAGS)) {
+                    public_flags = strtoll(
+                            attr.value_str().c_str(), nullptr, 10);
+                }
+            }
+
+            bool is_system = (flags & Package::FLAG_SYSTEM)
+                    || (public_flags & Package::PUBLIC_FLAG_SYSTEM);
+            bool is_update = (flags & Package::FLAG_UPDATED_SYSTEM_APP)
+                    || (public_flags & Package::PUBLIC_FLAG_UPDATED_SYSTEM_APP);
+
+            if (is_update) {
+                ++counts.update_pkgs;
+            } else if (is_system) {
+                ++counts.system_pkgs;
+            } else {
+                ++counts.other_pkgs;
+            }
         }
     }
 
     return true;
 }
 
-std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
+const Package * Packages::find_by_uid(uid_t uid) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _uid_index.find(uid);
+    return it == _uid_index.end() ? nullptr : &pkgs[it->second];
 }
 
-std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id) const
+const Package * Packages::find_by_pkg(const std::string &pkg_id) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return pkg->name == pkg_id;
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _name_index.find(pkg_id.c_str());
+    return it == _name_index.end() ? nullptr : &pkgs[it->second];
 }
 
 }
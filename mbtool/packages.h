@@ -24,6 +24,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include <sys/stat.h>
 
 namespace mb
 {
@@ -111,14 +112,15 @@ public:
         PRIVATE_FLAG_HAS_DOMAIN_URLS = 1ULL << 4
     };
 
-    std::string name;                   // PackageSetting.name
-    std::string real_name;              // PackageSetting.realName
-    std::string code_path;              // PackageSetting.codePathString
-    std::string resource_path;          // PackageSetting.resourcePathString
-    std::string native_library_path;    // PackageSetting.legacyNativeLibraryPathString
-    std::string primary_cpu_abi;        // PackageSetting.primaryCpuAbiString
-    std::string secondary_cpu_abi;      // PackageSetting.secondaryCpuAbiString
-    std::string cpu_abi_override;       // PackageSetting.cpuAbiOverride
+    // Strings are interned by the owning Packages instance and are never null
+    const char *name;                   // PackageSetting.name
+    const char *real_name;              // PackageSetting.realName
+    const char *code_path;              // PackageSetting.codePathString
+    const char *resource_path;          // PackageSetting.resourcePathString
+    const char *native_library_path;    // PackageSetting.legacyNativeLibraryPathString
+    const char *primary_cpu_abi;        // PackageSetting.primaryCpuAbiString
+    const char *secondary_cpu_abi;      // PackageSetting.secondaryCpuAbiString
+    const char *cpu_abi_override;       // PackageSetting.cpuAbiOverride
     // Android <6.0
     Flags pkg_flags;                    // PackageSetting.pkgFlags
     // Android >=6.0
@@ -132,30 +134,73 @@ public:
     int is_shared_user;                 // PackageSetting.sharedUser != null
     int user_id;                        // PackageSetting.appId
     int shared_user_id;                 // PackageSetting.appId
-    std::string uid_error;              // (not in PackageSetting)
-    std::string install_status;         // (not in PackageSetting)
-    std::string installer;              // PackageSetting.installerPackageName
+    const char *uid_error;              // (not in PackageSetting)
+    const char *install_status;         // (not in PackageSetting)
+    const char *installer;              // PackageSetting.installerPackageName
 
-    std::vector<std::string> sig_indexes;
+    std::vector<const char *> sig_indexes;
 
     // Functions
     Package();
 
-    uid_t get_uid();
+    uid_t get_uid() const;
 
-    void dump();
+    void dump() const;
 };
 
+struct PackageCounts
+{
+    unsigned int system_pkgs;
+    unsigned int update_pkgs;
+    unsigned int other_pkgs;
+};
+
+bool count_packages_xml(const std::string &path, PackageCounts &counts);
+
+class StringPool;
+
 class Packages
 {
 public:
-    std::vector<std::shared_ptr<Package>> pkgs;
+    std::vector<Package> pkgs;
     std::unordered_map<std::string, std::string> sigs;
 
+    Packages();
+
     bool load_xml(const std::string &path);
+    bool reload_xml(const std::string &path);
+
+    const Package * find_by_uid(uid_t uid) const;
+    const Package * find_by_pkg(const std::string &pkg_id) const;
+
+private:
+    struct CStringHash
+    {
+        size_t operator()(const char *str) const;
+    };
+
+    struct CStringEqual
+    {
+        bool operator()(const char *a, const char *b) const;
+    };
+
+    void clear();
+    void build_indexes();
+
+    // Shared so that copies of this instance can reference the same strings
+    std::shared_ptr<StringPool> _strings;
+
+    std::unordered_map<uid_t, size_t> _uid_index;
+    std::unordered_map<const char *, size_t, CStringHash, CStringEqual>
+            _name_index;
 
-    std::shared_ptr<Package> find_by_uid(uid_t uid) const;
-    std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
+    // Identity of the file that was last loaded
+    bool _loaded;
+    std::string _path;
+    dev_t _dev;
+    ino_t _ino;
+    off_t _size;
+    struct timespec _mtime;
 };
 
 }
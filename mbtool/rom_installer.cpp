@@ -141,19 +141,26 @@ std::unordered_map<std::string, std::string> RomInstaller::get_properties()
 
     // Copy required properties from system if they don't exist in the
     // properties file
+    std::vector<std::string> missing;
     for (auto const &prop : needed_props) {
-        if (props.find(prop) != props.end() && !props[prop].empty()) {
-            continue;
+        auto it = props.find(prop);
+        if (it == props.end() || it->second.empty()) {
+            missing.push_back(prop);
         }
+    }
+
+    std::unordered_map<std::string, std::string> system_props;
+    util::property_get_keys(missing, system_props);
 
-        std::string value = util::property_get_string(prop, {});
-        if (!value.empty()) {
-            props[prop] = value;
+    for (auto const &prop : missing) {
+        auto it = system_props.find(prop);
+        if (it != system_props.end() && !it->second.empty()) {
+            props[prop] = it->second;
 
             LOGD("Property '%s' does not exist in recovery's default.prop",
                  prop.c_str());
             LOGD("- '%s'='%s' will be set in chroot environment",
-                 prop.c_str(), value.c_str());
+                 prop.c_str(), it->second.c_str());
         }
     }
 
@@ -195,9 +202,9 @@ Installer::ProceedState RomInstaller::on_checked_device()
     if (access(etc_fstab.c_str(), R_OK) < 0 && errno == ENOENT) {
         autoclose::file fp(autoclose::fopen(etc_fstab.c_str(), "w"));
         if (fp) {
-            auto system_devs = _device.system_block_devs();
-            auto cache_devs = _device.cache_block_devs();
-            auto data_devs = _device.data_block_devs();
+            auto const &system_devs = _device.system_block_devs();
+            auto const &cache_devs = _device.cache_block_devs();
+            auto const &data_devs = _device.data_block_devs();
 
             // Set block device if it's provided and non-empty
             std::string system_dev =
@@ -337,8 +337,10 @@ std::shared_ptr<Rom> Roms::get_current_rom()
     Roms roms;
     roms.add_installed();
 
-    // This is set if mbtool is handling the boot process
-    std::string prop_id = util::property_get_string(PROP_MULTIBOOT_ROM_ID, {});
+    // This is set if mbtool is handling the boot process. The handle is kept
+    // around since long-running processes (eg. appsync) call this repeatedly.
+    static util::CachedProperty prop_rom_id(PROP_MULTIBOOT_ROM_ID);
+    std::string prop_id = prop_rom_id.get_string({});
     // This is necessary for the daemon to get a correct result before Android
     // boots (eg. for the boot UI)
     if (prop_id.empty()) {
@@ -19,16 +19,22 @@
 
 #include "sepolpatch.h"
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <tuple>
+#include <vector>
 
 #include <climits>
 #include <cstdio>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 // libsepol is not very C++ friendly. 'bool' is a struct field in conditional.h
@@ -39,42 +45,64 @@
 #undef bool
 
 #include "mbcommon/common.h"
+#include "mbcommon/string.h"
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
 #include "mbutil/autoclose/file.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
 #include "mbutil/finally.h"
+#include "mbutil/hash.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
+#include "mbutil/time.h"
 
 #include "multiboot.h"
+#include "roms.h"
 
 
+// Patched policies are cached here, keyed by the input policy and patch type
+#define SEPOLICY_CACHE_DIR              "/data/multiboot/_sepolicy_cache"
+#define SEPOLICY_CACHE_MAX_ENTRIES      4
+// Must be incremented whenever the patches in this file change. The mbtool
+// version is also part of the cache key, so this only matters for builds that
+// report the same version.
+#define SEPOLICY_CACHE_VERSION          1
+
 extern "C" int policydb_index_decls(policydb_t *p);
 
 namespace mb
 {
 
 /*!
- * Add or remove rule.
+ * Add or remove a set of permissions in a single allow rule.
+ *
+ * Only one avtab lookup is done regardless of how many permission bits are
+ * set in \p perm_mask.
  *
  * \param pdb Policy DB object
  * \param source_type_val Source type for rule
  * \param target_type_val Target type for rule
  * \param class_val Class for rule
- * \param perm_val Permission for rule
- * \param remove Whether to remove the rule
+ * \param perm_mask Bitmask of permissions (bit `perm_val - 1` for each perm)
+ * \param remove Whether to remove the permissions
  *
  * \return Whether a change was made
  */
-SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
+SELinuxResult selinux_raw_set_allow_mask(policydb_t *pdb,
                                          uint16_t source_type_val,
                                          uint16_t target_type_val,
                                          uint16_t class_val,
-                                         uint32_t perm_val,
+                                         uint32_t perm_mask,
                                          bool remove)
 {
     avtab_datum_t *av;
     avtab_key_t key;
 
+    if (perm_mask == 0) {
+        return SELinuxResult::UNCHANGED;
+    }
+
     key.source_type = source_type_val;
     key.target_type = target_type_val;
     key.target_class = class_val;
@@ -86,7 +114,7 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
             return SELinuxResult::UNCHANGED;
         } else {
             avtab_datum_t av_new;
-            av_new.data = (1U << (perm_val - 1));
+            av_new.data = perm_mask;
             if (avtab_insert(&pdb->te_avtab, &key, &av_new) != 0) {
                 return SELinuxResult::ERROR;
             }
@@ -96,9 +124,9 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
         auto old_data = av->data;
 
         if (remove) {
-            av->data &= ~(1U << (perm_val - 1));
+            av->data &= ~perm_mask;
         } else {
-            av->data |= (1U << (perm_val - 1));
+            av->data |= perm_mask;
         }
 
         return (av->data == old_data)
@@ -107,6 +135,29 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
     }
 }
 
+/*!
+ * Add or remove rule.
+ *
+ * \param pdb Policy DB object
+ * \param source_type_val Source type for rule
+ * \param target_type_val Target type for rule
+ * \param class_val Class for rule
+ * \param perm_val Permission for rule
+ * \param remove Whether to remove the rule
+ *
+ * \return Whether a change was made
+ */
+SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
+                                         uint16_t source_type_val,
+                                         uint16_t target_type_val,
+                                         uint16_t class_val,
+                                         uint32_t perm_val,
+                                         bool remove)
+{
+    return selinux_raw_set_allow_mask(pdb, source_type_val, target_type_val,
+                                      class_val, 1U << (perm_val - 1), remove);
+}
+
 SELinuxResult selinux_raw_set_type_trans(policydb_t *pdb,
                                          uint16_t source_type_val,
                                          uint16_t target_type_val,
@@ -145,8 +196,6 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
                                           uint16_t target_type_val,
                                           uint16_t class_val)
 {
-    SELinuxResult result(SELinuxResult::UNCHANGED);
-
     auto clazz = pdb->class_val_to_struct[class_val - 1];
     if (!clazz) {
         return SELinuxResult::ERROR;
@@ -158,31 +207,22 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
         tables[1] = clazz->comdatum->permissions.table;
     }
 
+    // Collect all permissions into one mask so that the avtab entry is only
+    // looked up once
+    uint32_t perm_mask = 0;
+
     for (auto table = tables; *table; ++table) {
         for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
             for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
                     cur = cur->next) {
                 perm_datum_t *perm_datum = (perm_datum_t *) cur->datum;
-
-                SELinuxResult ret = selinux_raw_set_avtab_rule(
-                        pdb, source_type_val, target_type_val, class_val,
-                        perm_datum->s.value, false);
-
-                switch (ret) {
-                case SELinuxResult::ERROR:
-                    return ret;
-                case SELinuxResult::CHANGED:
-                    result = ret;
-                    break;
-                case SELinuxResult::UNCHANGED:
-                    // Ignore
-                    break;
-                }
+                perm_mask |= 1U << (perm_datum->s.value - 1);
             }
         }
     }
 
-    return result;
+    return selinux_raw_set_allow_mask(pdb, source_type_val, target_type_val,
+                                      class_val, perm_mask, false);
 }
 
 SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
@@ -789,14 +829,15 @@ void selinux_strip_no_audit(policydb_t *pdb)
         if (!(expr)) return false; \
     } while (0)
 
-static inline bool add_rules(policydb_t *pdb,
-                             const char *source,
-                             const char *target,
-                             const char *clazz,
-                             const std::vector<std::string> &perms)
+MB_UNUSED
+static inline bool remove_rules(policydb_t *pdb,
+                                const char *source,
+                                const char *target,
+                                const char *clazz,
+                                const std::vector<std::string> &perms)
 {
     for (auto const &perm : perms) {
-        if (!selinux_add_rule(pdb, source, target, clazz, perm.c_str())) {
+        if (!selinux_remove_rule(pdb, source, target, clazz, perm.c_str())) {
             return false;
         }
     }
@@ -804,15 +845,89 @@ static inline bool add_rules(policydb_t *pdb,
     return true;
 }
 
-MB_UNUSED
-static inline bool remove_rules(policydb_t *pdb,
-                                const char *source,
-                                const char *target,
-                                const char *clazz,
-                                const std::vector<std::string> &perms)
+#define MAX_RULE_PERMS 8
+
+/*!
+ * \brief Uncompiled allow rule
+ *
+ * Unused entries in \a perms are left as nullptr.
+ */
+struct AllowRule
 {
-    for (auto const &perm : perms) {
-        if (!selinux_remove_rule(pdb, source, target, clazz, perm.c_str())) {
+    const char *source;
+    const char *target;
+    const char *clazz;
+    const char *perms[MAX_RULE_PERMS];
+};
+
+/*!
+ * \brief Add a batch of allow rules
+ *
+ * All type, class, and permission names are resolved up front and the
+ * permissions are merged into one mask per (source, target, class) key. Each
+ * key is then applied with a single avtab lookup, regardless of how many rules
+ * or permissions refer to it.
+ *
+ * \param pdb Policy DB object
+ * \param rules Array of rules
+ * \param count Number of rules in \p rules
+ *
+ * \return Whether all of the rules were successfully added
+ */
+static bool add_rule_set(policydb_t *pdb, const AllowRule *rules, size_t count)
+{
+    // Ordered so that the avtab is always modified in the same order
+    std::map<std::tuple<uint16_t, uint16_t, uint16_t>, uint32_t> compiled;
+
+    for (size_t i = 0; i < count; ++i) {
+        const AllowRule &rule = rules[i];
+
+        type_datum_t *source = find_type(pdb, rule.source);
+        if (!source) {
+            LOGE("Source type %s does not exist", rule.source);
+            return false;
+        }
+
+        type_datum_t *target = find_type(pdb, rule.target);
+        if (!target) {
+            LOGE("Target type %s does not exist", rule.target);
+            return false;
+        }
+
+        class_datum_t *clazz = find_class(pdb, rule.clazz);
+        if (!clazz) {
+            LOGE("Class %s does not exist", rule.clazz);
+            return false;
+        }
+
+        uint32_t &mask = compiled[std::make_tuple(
+                source->s.value, target->s.value, clazz->s.value)];
+
+        for (size_t j = 0; j < MAX_RULE_PERMS && rule.perms[j]; ++j) {
+            perm_datum_t *perm = find_perm(clazz, rule.perms[j]);
+            if (!perm) {
+                LOGE("Perm %s does not exist in class %s",
+                     rule.perms[j], rule.clazz);
+                return false;
+            }
+
+            mask |= 1U << (perm->s.value - 1);
+        }
+    }
+
+    for (auto const &item : compiled) {
+        uint16_t source_val = std::get<0>(item.first);
+        uint16_t target_val = std::get<1>(item.first);
+        uint16_t class_val = std::get<2>(item.first);
+
+        SELinuxResult result = selinux_raw_set_allow_mask(
+                pdb, source_val, target_val, class_val, item.second, false);
+        if (result == SELinuxResult::ERROR) {
+            LOGE("Failed to add rule: allow %s %s:%s 0x%08x;",
+                 pdb->p_type_val_to_name[source_val - 1],
+                 pdb->p_type_val_to_name[target_val - 1],
+                 pdb->p_class_val_to_name[class_val - 1],
+                 item.second);
             return false;
         }
     }
@@ -820,6 +935,12 @@ static inline bool remove_rules(policydb_t *pdb,
     return true;
 }
 
+static inline bool add_rule_set(policydb_t *pdb,
+                                const std::vector<AllowRule> &rules)
+{
+    return add_rule_set(pdb, rules.data(), rules.size());
+}
+
 static bool apply_pre_boot_patches(policydb_t *pdb)
 {
     // We are going to allow everything. The stage 1 policy is not a security
@@ -980,58 +1101,61 @@ static bool create_mbtool_types(policydb_t *pdb)
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedobject"));
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
 
+    std::vector<AllowRule> rules;
+
     // Allow setting the current process context from init to mb_exec
-    ff(add_rules(pdb, "init", "mb_exec", "process", {
+    rules.push_back({ "init", "mb_exec", "process", {
         "noatsecure", "rlimitinh", "setcurrent", "siginh", "transition",
         //"dyntransition",
-    }));
+    } });
 
     // Allow installd to connect to appsync's socket
-    ff(add_rules(pdb, "installd", "mb_exec", "unix_stream_socket", {
+    rules.push_back({ "installd", "mb_exec", "unix_stream_socket", {
         "accept", "listen", "read", "write",
-    }));
+    } });
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "unix_stream_socket", {
+        rules.push_back({ "system_server", "mb_exec", "unix_stream_socket", {
             "connectto",
-        }));
+        } });
     } else {
-        ff(add_rules(pdb, "system", "mb_exec", "unix_stream_socket", {
+        rules.push_back({ "system", "mb_exec", "unix_stream_socket", {
             "connectto",
-        }));
+        } });
     }
 
     // Allow apps to connect to the daemon
-    ff(add_rules(pdb, "untrusted_app", "mb_exec", "unix_stream_socket", {
+    rules.push_back({ "untrusted_app", "mb_exec", "unix_stream_socket", {
         "connectto",
-    }));
+    } });
 
     // Allow zygote to write to our stdout pipe when rebooting
-    ff(add_rules(pdb, "zygote", "init", "fifo_file", { "write" }));
+    rules.push_back({ "zygote", "init", "fifo_file", { "write" } });
 
     // Allow rebooting via the android.intent.action.REBOOT intent
     if (find_type(pdb, "activity_service")) {
-        ff(add_rules(pdb, "zygote", "activity_service", "service_manager", { "find" }));
+        rules.push_back({ "zygote", "activity_service", "service_manager", { "find" } });
     }
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "zygote", "system_server", "binder", { "call" }));
+        rules.push_back({ "zygote", "system_server", "binder", { "call" } });
     }
 
-    ff(add_rules(pdb, "zygote", "init", "unix_stream_socket", { "read", "write" }));
-    ff(add_rules(pdb, "zygote", "servicemanager", "binder", { "call" }));
+    rules.push_back({ "zygote", "init", "unix_stream_socket", { "read", "write" } });
+    rules.push_back({ "zygote", "servicemanager", "binder", { "call" } });
 
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "binder", { "transfer" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "file", { "open", "read" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "process", { "getattr" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "open" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "read" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "process", { "getattr" }));
+    rules.push_back({ "servicemanager", "mb_exec", "binder", { "transfer" } });
+    rules.push_back({ "servicemanager", "mb_exec", "dir", { "search" } });
+    rules.push_back({ "servicemanager", "mb_exec", "file", { "open", "read" } });
+    rules.push_back({ "servicemanager", "mb_exec", "process", { "getattr" } });
+    rules.push_back({ "servicemanager", "zygote", "dir", { "search" } });
+    rules.push_back({ "servicemanager", "zygote", "file", { "open", "read" } });
+    rules.push_back({ "servicemanager", "zygote", "process", { "getattr" } });
 
     // For in-app flashing
-    ff(add_rules(pdb, "rootfs", "tmpfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "kernel", "mb_exec", "fd", { "use" }));
+    rules.push_back({ "rootfs", "tmpfs", "filesystem", { "associate" } });
+    rules.push_back({ "tmpfs",  "rootfs", "filesystem", { "associate" } });
+    rules.push_back({ "kernel", "mb_exec", "fd", { "use" } });
+
+    ff(add_rule_set(pdb, rules));
 
     // Give mb_exec <insert diety here> permissions
     type_datum_t *mb_exec = find_type(pdb, "mb_exec");
@@ -1074,22 +1198,24 @@ static bool apply_main_patches(policydb_t *pdb)
 
 static bool apply_cwm_recovery_patches(policydb_t *pdb)
 {
-    // Debugging rules (for CWM and Philz)
-    ff(add_rules(pdb, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "system_file",     "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "tmpfs",           "file",       { "relabelto" }));
-
-    ff(add_rules(pdb, "rootfs", "tmpfs",          "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+    static const AllowRule rules[] = {
+        // Debugging rules (for CWM and Philz)
+        { "adbd",   "block_device",    "blk_file",   { "relabelto" } },
+        { "adbd",   "graphics_device", "chr_file",   { "relabelto" } },
+        { "adbd",   "graphics_device", "dir",        { "relabelto" } },
+        { "adbd",   "input_device",    "chr_file",   { "relabelto" } },
+        { "adbd",   "input_device",    "dir",        { "relabelto" } },
+        { "adbd",   "rootfs",          "dir",        { "relabelto" } },
+        { "adbd",   "rootfs",          "file",       { "relabelto" } },
+        { "adbd",   "rootfs",          "lnk_file",   { "relabelto" } },
+        { "adbd",   "system_file",     "file",       { "relabelto" } },
+        { "adbd",   "tmpfs",           "file",       { "relabelto" } },
+
+        { "rootfs", "tmpfs",           "filesystem", { "associate" } },
+        { "tmpfs",  "rootfs",          "filesystem", { "associate" } },
+    };
 
-    return true;
+    return add_rule_set(pdb, rules, sizeof(rules) / sizeof(rules[0]));
 }
 
 bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
@@ -1139,11 +1265,16 @@ bool patch_sepolicy(const std::string &source,
 
     LOGD("Policy version: %u", pdb.policyvers);
 
+    uint64_t start = util::current_time_ms();
+
     if (!selinux_apply_patch(&pdb, patch)) {
         LOGE("%s: Failed to apply policy patch", source.c_str());
         return false;
     }
 
+    uint64_t stop = util::current_time_ms();
+    LOGD("Applying policy patch took %" PRIu64 "ms", stop - start);
+
     if (!util::selinux_write_policy(target, &pdb)) {
         LOGE("%s: Failed to write SELinux policy", target.c_str());
         return false;
@@ -1152,6 +1283,224 @@ bool patch_sepolicy(const std::string &source,
     return true;
 }
 
+static const char * patch_name(SELinuxPatch patch)
+{
+    switch (patch) {
+    case SELinuxPatch::PRE_BOOT:
+        return "pre_boot";
+    case SELinuxPatch::MAIN:
+        return "main";
+    case SELinuxPatch::CWM_RECOVERY:
+        return "cwm_recovery";
+    case SELinuxPatch::STRIP_NO_AUDIT:
+        return "strip_no_audit";
+    case SELinuxPatch::NONE:
+    default:
+        return nullptr;
+    }
+}
+
+/*!
+ * \brief Get cache file path for the patched version of a policy
+ *
+ * The cache key covers everything that the result of selinux_apply_patch()
+ * depends on: the input policy, the patch type, the version of the patches in
+ * this file, and (for SELinuxPatch::MAIN) the label of the internal storage
+ * directory. The mbtool version and git version are included as well, so that
+ * updating mbtool never reuses a policy patched by an older version, even if
+ * SEPOLICY_CACHE_VERSION was not incremented.
+ */
+static bool sepolicy_cache_path(const std::vector<unsigned char> &policy,
+                                SELinuxPatch patch,
+                                std::string *path_out)
+{
+    const char *name = patch_name(patch);
+    if (!name) {
+        return false;
+    }
+
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    if (!util::sha512_hash(policy.data(), policy.size(), digest)) {
+        return false;
+    }
+
+    std::string key = util::hex_string(digest, sizeof(digest));
+    key += '\0';
+    key += std::to_string(SEPOLICY_CACHE_VERSION);
+    key += '\0';
+    key += version();
+    key += '\0';
+    key += git_version();
+    key += '\0';
+    key += name;
+
+    if (patch == SELinuxPatch::MAIN) {
+        std::string context;
+        if (util::selinux_lget_context(INTERNAL_STORAGE, &context)
+                || util::selinux_lget_context("/data/media", &context)) {
+            key += '\0';
+            key += context;
+        }
+    }
+
+    if (!util::sha512_hash(key.data(), key.size(), digest)) {
+        return false;
+    }
+
+    *path_out = get_raw_path(SEPOLICY_CACHE_DIR);
+    *path_out += '/';
+    *path_out += name;
+    *path_out += '-';
+    *path_out += util::hex_string(digest, sizeof(digest));
+
+    return true;
+}
+
+/*!
+ * \brief Remove the oldest cache entries for a patch type
+ *
+ * Several entries are kept per patch type because the loaded policy may
+ * already be patched (eg. if the daemon is restarted), which produces a
+ * different key than the stock policy.
+ */
+static void sepolicy_cache_prune(SELinuxPatch patch, size_t keep)
+{
+    std::string cache_dir = get_raw_path(SEPOLICY_CACHE_DIR);
+    std::string prefix(patch_name(patch));
+    prefix += '-';
+
+    DIR *dp = opendir(cache_dir.c_str());
+    if (!dp) {
+        return;
+    }
+
+    auto close_dp = util::finally([&]{
+        closedir(dp);
+    });
+
+    std::vector<std::pair<time_t, std::string>> entries;
+    struct stat sb;
+
+    while (struct dirent *ent = readdir(dp)) {
+        if (!starts_with(ent->d_name, prefix)) {
+            continue;
+        }
+
+        std::string path(cache_dir);
+        path += '/';
+        path += ent->d_name;
+
+        if (stat(path.c_str(), &sb) == 0) {
+            entries.push_back(std::make_pair(sb.st_mtime, std::move(path)));
+        }
+    }
+
+    if (entries.size() <= keep) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size() - keep; ++i) {
+        LOGV("%s: Removing stale cached policy", entries[i].second.c_str());
+        unlink(entries[i].second.c_str());
+    }
+}
+
+static bool load_policy_data(const std::vector<unsigned char> &data)
+{
+    int fd = open(SELINUX_LOAD_FILE, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", SELINUX_LOAD_FILE, strerror(errno));
+        return false;
+    }
+
+    auto close_fd = util::finally([&]{
+        close(fd);
+    });
+
+    // The kernel requires the entire policy to be written in a single call
+    ssize_t n = write(fd, data.data(), data.size());
+    if (n < 0 || static_cast<size_t>(n) != data.size()) {
+        LOGE("%s: Failed to load policy: %s",
+             SELINUX_LOAD_FILE, n < 0 ? strerror(errno) : "Short write");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load patched policy from the cache, refreshing the cache on a miss
+ *
+ * \return Whether the patched policy was loaded. If false, the caller should
+ *         fall back to patching the policy directly.
+ */
+static bool patch_loaded_sepolicy_cached(SELinuxPatch patch)
+{
+    std::vector<unsigned char> policy;
+    std::string cache_path;
+
+    if (!util::file_read_all(SELINUX_POLICY_FILE, &policy)) {
+        LOGE("%s: Failed to read policy: %s",
+             SELINUX_POLICY_FILE, strerror(errno));
+        return false;
+    }
+
+    if (!sepolicy_cache_path(policy, patch, &cache_path)) {
+        return false;
+    }
+
+    std::vector<unsigned char> patched;
+
+    if (util::file_read_all(cache_path, &patched)) {
+        if (load_policy_data(patched)) {
+            LOGD("%s: Loaded cached patched policy", cache_path.c_str());
+            // Mark as recently used
+            utimes(cache_path.c_str(), nullptr);
+            return true;
+        }
+
+        LOGW("%s: Removing cached policy that failed to load",
+             cache_path.c_str());
+        unlink(cache_path.c_str());
+        return false;
+    }
+
+    LOGV("No cached policy found. Patching %s", SELINUX_POLICY_FILE);
+
+    if (!util::mkdir_parent(cache_path, 0700)) {
+        LOGW("%s: Failed to create parent directory: %s",
+             cache_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    sepolicy_cache_prune(patch, SEPOLICY_CACHE_MAX_ENTRIES - 1);
+
+    std::string temp_path(cache_path);
+    temp_path += ".tmp";
+
+    if (!patch_sepolicy(SELINUX_POLICY_FILE, temp_path, patch)) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), cache_path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             cache_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (!util::file_read_all(cache_path, &patched)
+            || !load_policy_data(patched)) {
+        unlink(cache_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 bool patch_loaded_sepolicy(SELinuxPatch patch)
 {
     autoclose::file fp(autoclose::fopen(SELINUX_ENFORCE_FILE, "rbe"));
@@ -1168,6 +1517,12 @@ bool patch_loaded_sepolicy(SELinuxPatch patch)
         }
     }
 
+    // Only the booted system has a usable /data. In recovery, /data may not be
+    // mounted yet.
+    if (patch == SELinuxPatch::MAIN && patch_loaded_sepolicy_cached(patch)) {
+        return true;
+    }
+
     return patch_sepolicy(SELINUX_POLICY_FILE, SELINUX_LOAD_FILE, patch);
 }
 
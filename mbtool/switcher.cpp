@@ -31,6 +31,7 @@
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mblog/trace.h"
 #include "mbutil/chmod.h"
 #include "mbutil/chown.h"
 #include "mbutil/copy.h"
@@ -305,6 +306,8 @@ SwitchRomResult switch_rom(const std::string &id,
                            const std::vector<std::string> &blockdev_base_dirs,
                            bool force_update_checksums)
 {
+    MB_TRACE_SCOPE("switch_rom");
+
     LOGD("Attempting to switch to %s", id.c_str());
     LOGD("Force update checksums: %d", force_update_checksums);
 
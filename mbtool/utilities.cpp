@@ -33,6 +33,7 @@
 
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/database.h"
 #include "mbdevice/device.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
@@ -73,6 +74,20 @@ static bool get_device(const char *path, Device &device)
         LOGE("%s: Failed to read file: %s", path, strerror(errno));
         return false;
     }
+
+    // Prebuilt databases only need the matching device to be deserialized.
+    // The lookup returns the same device as the loop below.
+    if (device_database_is_valid(contents.data(), contents.size())) {
+        if (device_from_database_any(
+                contents.data(), contents.size(),
+                { prop_product_device, prop_build_product }, device)) {
+            return true;
+        }
+
+        LOGE("Unknown device: %s", prop_product_device.c_str());
+        return false;
+    }
+
     contents.push_back('\0');
 
     std::vector<Device> devices;
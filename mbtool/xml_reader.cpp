@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xml_reader.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mb
+{
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_name_char(char c)
+{
+    return !is_space(c) && c != '=' && c != '>' && c != '/' && c != '<'
+            && c != '"' && c != '\'';
+}
+
+static bool span_equals(const char *data, size_t size, const char *str)
+{
+    size_t len = strlen(str);
+    return len == size && memcmp(data, str, size) == 0;
+}
+
+bool XmlReader::Attribute::name_is(const char *str) const
+{
+    return span_equals(name, name_size, str);
+}
+
+std::string XmlReader::Attribute::value_str() const
+{
+    return decode(value, value_size);
+}
+
+XmlReader::XmlReader()
+    : _map(nullptr)
+    , _map_size(0)
+    , _cur(nullptr)
+    , _end(nullptr)
+    , _name(nullptr)
+    , _name_size(0)
+    , _depth(0)
+    , _pending_end(false)
+    , _error(nullptr)
+{
+}
+
+XmlReader::~XmlReader()
+{
+    if (_map) {
+        munmap(_map, _map_size);
+    }
+}
+
+/*!
+ * \brief Memory map a file for reading
+ *
+ * \return Whether the file was successfully mapped. errno is set on failure.
+ */
+bool XmlReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    void *map = nullptr;
+    size_t size = static_cast<size_t>(sb.st_size);
+
+    if (size > 0) {
+        map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return false;
+        }
+    }
+
+    close(fd);
+
+    if (_map) {
+        munmap(_map, _map_size);
+    }
+    _map = map;
+    _map_size = size;
+
+    set_data(static_cast<const char *>(map), size);
+    return true;
+}
+
+/*!
+ * \brief Read from a buffer
+ *
+ * The buffer must outlive the reader.
+ */
+void XmlReader::set_data(const char *data, size_t size)
+{
+    _cur = data;
+    _end = data + size;
+    _name = nullptr;
+    _name_size = 0;
+    _attrs.clear();
+    _depth = 0;
+    _pending_end = false;
+    _error = nullptr;
+}
+
+XmlReader::Token XmlReader::fail(const char *msg)
+{
+    _error = msg;
+    _cur = _end;
+    return Token::Error;
+}
+
+bool XmlReader::skip_past(const char *terminator)
+{
+    size_t len = strlen(terminator);
+
+    while (static_cast<size_t>(_end - _cur) >= len) {
+        const char *p = static_cast<const char *>(
+                memchr(_cur, terminator[0], _end - _cur));
+        if (!p || static_cast<size_t>(_end - p) < len) {
+            break;
+        }
+        if (memcmp(p, terminator, len) == 0) {
+            _cur = p + len;
+            return true;
+        }
+        _cur = p + 1;
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Advance to the next element boundary
+ *
+ * Self-closing elements produce a StartElement token followed by an
+ * EndElement token.
+ */
+XmlReader::Token XmlReader::next()
+{
+    if (_error) {
+        return Token::Error;
+    }
+
+    if (_pending_end) {
+        _pending_end = false;
+        _attrs.clear();
+        --_depth;
+        return Token::EndElement;
+    }
+
+    while (true) {
+        const char *lt = static_cast<const char *>(
+                memchr(_cur, '<', _end - _cur));
+        if (!lt) {
+            _cur = _end;
+            if (_depth != 0) {
+                return fail("Unexpected end of document");
+            }
+            return Token::EndDocument;
+        }
+        _cur = lt + 1;
+
+        if (_cur == _end) {
+            return fail("Unexpected end of document");
+        }
+
+        if (*_cur == '?') {
+            if (!skip_past("?>")) {
+                return fail("Unterminated processing instruction");
+            }
+        } else if (*_cur == '!') {
+            if (_end - _cur >= 3 && memcmp(_cur, "!--", 3) == 0) {
+                if (!skip_past("-->")) {
+                    return fail("Unterminated comment");
+                }
+            } else if (_end - _cur >= 8 && memcmp(_cur, "![CDATA[", 8) == 0) {
+                if (!skip_past("]]>")) {
+                    return fail("Unterminated CDATA section");
+                }
+            } else if (!skip_past(">")) {
+                return fail("Unterminated declaration");
+            }
+        } else if (*_cur == '/') {
+            ++_cur;
+            return parse_end_element();
+        } else {
+            return parse_start_element();
+        }
+    }
+}
+
+XmlReader::Token XmlReader::parse_start_element()
+{
+    _attrs.clear();
+
+    _name = _cur;
+    while (_cur < _end && is_name_char(*_cur)) {
+        ++_cur;
+    }
+    _name_size = _cur - _name;
+    if (_name_size == 0) {
+        return fail("Missing element name");
+    }
+
+    while (true) {
+        while (_cur < _end && is_space(*_cur)) {
+            ++_cur;
+        }
+        if (_cur == _end) {
+            return fail("Unterminated start tag");
+        }
+
+        if (*_cur == '>') {
+            ++_cur;
+            ++_depth;
+            return Token::StartElement;
+        } else if (*_cur == '/') {
+            if (_end - _cur < 2 || _cur[1] != '>') {
+                return fail("Invalid self-closing tag");
+            }
+            _cur += 2;
+            ++_depth;
+            _pending_end = true;
+            return Token::StartElement;
+        }
+
+        Attribute attr;
+        attr.name = _cur;
+        while (_cur < _end && is_name_char(*_cur)) {
+            ++_cur;
+        }
+        attr.name_size = _cur - attr.name;
+        if (attr.name_size == 0) {
+            return fail("Invalid attribute name");
+        }
+
+        while (_cur < _end && is_space(*_cur)) {
+            ++_cur;
+        }
+        if (_cur == _end || *_cur != '=') {
+            return fail("Missing '=' after attribute name");
+        }
+        ++_cur;
+        while (_cur < _end && is_space(*_cur)) {
+            ++_cur;
+        }
+        if (_cur == _end || (*_cur != '"' && *_cur != '\'')) {
+            return fail("Attribute value is not quoted");
+        }
+
+        char quote = *_cur++;
+        const char *close = static_cast<const char *>(
+                memchr(_cur, quote, _end - _cur));
+        if (!close) {
+            return fail("Unterminated attribute value");
+        }
+        attr.value = _cur;
+        attr.value_size = close - _cur;
+        _cur = close + 1;
+
+        _attrs.push_back(attr);
+    }
+}
+
+XmlReader::Token XmlReader::parse_end_element()
+{
+    _attrs.clear();
+
+    _name = _cur;
+    while (_cur < _end && is_name_char(*_cur)) {
+        ++_cur;
+    }
+    _name_size = _cur - _name;
+
+    while (_cur < _end && is_space(*_cur)) {
+        ++_cur;
+    }
+    if (_cur == _end || *_cur != '>') {
+        return fail("Unterminated end tag");
+    }
+    ++_cur;
+
+    if (_depth == 0) {
+        return fail("Unexpected end tag");
+    }
+    --_depth;
+
+    return Token::EndElement;
+}
+
+bool XmlReader::name_is(const char *str) const
+{
+    return span_equals(_name, _name_size, str);
+}
+
+std::string XmlReader::name_str() const
+{
+    return std::string(_name, _name_size);
+}
+
+const std::vector<XmlReader::Attribute> & XmlReader::attributes() const
+{
+    return _attrs;
+}
+
+const XmlReader::Attribute * XmlReader::find_attribute(const char *name) const
+{
+    for (auto const &attr : _attrs) {
+        if (attr.name_is(name)) {
+            return &attr;
+        }
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief Depth of the current element
+ *
+ * The root element has a depth of 1. After an EndElement token, this is the
+ * depth of the parent element.
+ */
+size_t XmlReader::depth() const
+{
+    return _depth;
+}
+
+const char * XmlReader::error() const
+{
+    return _error;
+}
+
+static void append_utf8(std::string &out, unsigned long cp)
+{
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x110000) {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+/*!
+ * \brief Decode the predefined and numeric character entities in a string
+ *
+ * Unknown or malformed entities are kept as-is.
+ */
+std::string XmlReader::decode(const char *data, size_t size)
+{
+    std::string out;
+    decode(data, size, out);
+    return out;
+}
+
+/*!
+ * \brief Decode a string into an existing buffer
+ *
+ * This is the same as decode(const char *, size_t), but \p out is overwritten
+ * in place so that its capacity can be reused across calls.
+ */
+void XmlReader::decode(const char *data, size_t size, std::string &out)
+{
+    const char *end = data + size;
+
+    const char *amp = static_cast<const char *>(memchr(data, '&', size));
+    if (!amp) {
+        out.assign(data, size);
+        return;
+    }
+
+    out.clear();
+    out.reserve(size);
+
+    while (data < end) {
+        amp = static_cast<const char *>(memchr(data, '&', end - data));
+        if (!amp) {
+            out.append(data, end);
+            break;
+        }
+        out.append(data, amp);
+
+        const char *semi = static_cast<const char *>(
+                memchr(amp, ';', end - amp));
+        if (!semi) {
+            out.append(amp, end);
+            break;
+        }
+
+        const char *ent = amp + 1;
+        size_t ent_size = semi - ent;
+
+        if (span_equals(ent, ent_size, "amp")) {
+            out += '&';
+        } else if (span_equals(ent, ent_size, "lt")) {
+            out += '<';
+        } else if (span_equals(ent, ent_size, "gt")) {
+            out += '>';
+        } else if (span_equals(ent, ent_size, "quot")) {
+            out += '"';
+        } else if (span_equals(ent, ent_size, "apos")) {
+            out += '\'';
+        } else if (ent_size >= 2 && ent[0] == '#') {
+            std::string num(ent + 1, ent_size - 1);
+            bool hex = num[0] == 'x' || num[0] == 'X';
+            const char *num_begin = num.c_str() + (hex ? 1 : 0);
+            char *num_end;
+            unsigned long cp = strtoul(num_begin, &num_end, hex ? 16 : 10);
+            if (num_end != num_begin && *num_end == '\0') {
+                append_utf8(out, cp);
+            } else {
+                out.append(amp, semi + 1);
+            }
+        } else {
+            out.append(amp, semi + 1);
+        }
+
+        data = semi + 1;
+    }
+}
+
+}
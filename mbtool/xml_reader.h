@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+/*!
+ * Minimal pull parser for Android's XML files (eg. packages.xml)
+ *
+ * The file is memory mapped and tokenized in place, so no DOM is built and
+ * names and attribute values are spans into the file. Comments, processing
+ * instructions, doctypes, CDATA and text content are skipped. Attribute
+ * values are not entity-decoded; use decode() for values that may contain
+ * entities.
+ */
+class XmlReader
+{
+public:
+    enum class Token
+    {
+        StartElement,
+        EndElement,
+        EndDocument,
+        Error,
+    };
+
+    struct Attribute
+    {
+        const char *name;
+        size_t name_size;
+        const char *value;
+        size_t value_size;
+
+        bool name_is(const char *str) const;
+        std::string value_str() const;
+    };
+
+    XmlReader();
+    ~XmlReader();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(XmlReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(XmlReader)
+
+    bool open(const std::string &path);
+    void set_data(const char *data, size_t size);
+
+    Token next();
+
+    bool name_is(const char *str) const;
+    std::string name_str() const;
+    const std::vector<Attribute> & attributes() const;
+    const Attribute * find_attribute(const char *name) const;
+    size_t depth() const;
+    const char * error() const;
+
+    static std::string decode(const char *data, size_t size);
+    static void decode(const char *data, size_t size, std::string &out);
+
+private:
+    bool skip_past(const char *terminator);
+    Token parse_start_element();
+    Token parse_end_element();
+    Token fail(const char *msg);
+
+    void *_map;
+    size_t _map_size;
+
+    const char *_cur;
+    const char *_end;
+
+    const char *_name;
+    size_t _name_size;
+    std::vector<Attribute> _attrs;
+    size_t _depth;
+    bool _pending_end;
+    const char *_error;
+};
+
+}
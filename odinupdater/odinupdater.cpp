@@ -314,7 +314,7 @@ static bool load_block_devs()
 
 #if !DEBUG_SKIP_FLASH_SYSTEM
     {
-        auto devs = device.system_block_devs();
+        auto const &devs = device.system_block_devs();
         auto it = std::find_if(devs.begin(), devs.end(), is_blk_device);
         if (it == devs.end()) {
             error("%s: No system block device specified", DEVICE_JSON_FILE);
@@ -326,7 +326,7 @@ static bool load_block_devs()
 
 #if !DEBUG_SKIP_FLASH_BOOT
     {
-        auto devs = device.boot_block_devs();
+        auto const &devs = device.boot_block_devs();
         auto it = std::find_if(devs.begin(), devs.end(), is_blk_device);
         if (it == devs.end()) {
             error("%s: No boot block device specified", DEVICE_JSON_FILE);